@@ -125,6 +125,10 @@ extern USBD_Class_cb_TypeDef  USBD_CDC_cb;
 /** @defgroup USB_CORE_Exported_Functions
   * @{
   */
+uint8_t  usbd_cdc_RxLend (uint8_t *buf, uint32_t size);
+uint8_t *usbd_cdc_RxGet  (uint32_t *len);
+uint8_t  usbd_cdc_RxPending (void);
+void     usbd_cdc_RxRestart (void);
 /**
   * @}
   */ 
@@ -67,6 +67,7 @@
 #include "usbd_cdc_core.h"
 #include "usbd_desc.h"
 #include "usbd_req.h"
+#include <string.h>
 
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
@@ -82,6 +83,16 @@
 /** @defgroup usbd_cdc_Private_TypesDefinitions
   * @{
   */ 
+/* Ring of application-owned OUT buffers. The free ring is filled by the
+   application and drained by the OUT endpoint, the full ring the other way
+   round: each has one producer and one consumer, no lock needed. */
+typedef struct
+{
+  uint8_t  *buf[CDC_RX_POOL_SIZE];
+  uint32_t  len[CDC_RX_POOL_SIZE];
+  __IO uint32_t wr;
+  __IO uint32_t rd;
+} CDC_RxRing_TypeDef;
 /**
   * @}
   */ 
@@ -97,6 +108,10 @@
 #define USB_CDC_BUSY         1
 #define USB_CDC_ZLP          2
 
+#if (CDC_RX_POOL_SIZE & (CDC_RX_POOL_SIZE - 1))
+  #error "CDC_RX_POOL_SIZE must be a power of two"
+#endif
+
 /**
   * @}
   */ 
@@ -123,12 +138,15 @@ uint8_t  usbd_cdc_Setup       (void  *pdev, USB_SETUP_REQ *req);
 uint8_t  usbd_cdc_EP0_RxReady  (void *pdev);
 uint8_t  usbd_cdc_DataIn      (void *pdev, uint8_t epnum);
 uint8_t  usbd_cdc_DataOut     (void *pdev, uint8_t epnum);
-//uint8_t  usbd_cdc_SOF         (void *pdev);
-uint8_t  usbd_cdc_SOF         (void *pdev) { return USBD_OK; }
+uint8_t  usbd_cdc_SOF         (void *pdev);
 /*********************************************
    CDC specific management functions
  *********************************************/
-//static void Handle_USBAsynchXfer  (void *pdev);
+static void Handle_USBAsynchXfer  (void *pdev);
+static uint32_t CDC_TxFill        (uint8_t *buf);
+static void CDC_RxArm             (void *pdev);
+static uint8_t CDC_RxPut          (CDC_RxRing_TypeDef *r, uint8_t *buf, uint32_t len);
+static uint8_t *CDC_RxTake        (CDC_RxRing_TypeDef *r, uint32_t *len);
 
 static uint8_t  *USBD_cdc_GetCfgDesc (uint8_t speed, uint16_t *length);
 #ifdef USE_USB_OTG_HS  
@@ -170,26 +188,40 @@ __ALIGN_BEGIN static __IO uint32_t  usbd_cdc_AltSet  __ALIGN_END = 0;
     #pragma data_alignment=4   
   #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN uint8_t USB_Rx_Buffer   [CDC_DATA_MAX_PACKET_SIZE] __ALIGN_END ;
+__ALIGN_BEGIN uint8_t APP_Rx_Buffer   [APP_RX_DATA_SIZE] __ALIGN_END ; 
+
 
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
   #if defined ( __ICCARM__ ) /*!< IAR Compiler */
     #pragma data_alignment=4   
   #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN uint8_t APP_Rx_Buffer   [APP_RX_DATA_SIZE] __ALIGN_END ; 
-
+__ALIGN_BEGIN uint8_t CmdBuff[CDC_CMD_PACKET_SZE] __ALIGN_END ;
 
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
   #if defined ( __ICCARM__ ) /*!< IAR Compiler */
     #pragma data_alignment=4   
   #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN uint8_t CmdBuff[CDC_CMD_PACKET_SZE] __ALIGN_END ;
-
-uint32_t APP_Rx_ptr_in  = 0;
+/* IN ping-pong buffer: one half on the bus, the other staged behind it */
+__ALIGN_BEGIN static uint8_t USB_Tx_Buffer[2][CDC_IN_XFER_SIZE] __ALIGN_END ;
+static uint32_t USB_Tx_Len[2];
+static uint8_t  USB_Tx_Cur = 0;
+
+static CDC_RxRing_TypeDef CDC_RxFree;
+static CDC_RxRing_TypeDef CDC_RxFull;
+static uint8_t  *USB_Rx_Cur = NULL;  /* buffer the OUT endpoint is armed with */
+static uint32_t  USB_Rx_Size;
+/* Set by usbd_cdc_Init, cleared by usbd_cdc_RxRestart: the OUT endpoint is
+   not armed while set, so the main loop may empty both rings */
+static __IO uint8_t CDC_RxStopped = 1;
+
+__IO uint32_t APP_Rx_ptr_in  = 0;
 uint32_t APP_Rx_ptr_out = 0;
 uint32_t APP_Rx_length  = 0;
+/* Set by the UART side when its writer passed APP_Rx_ptr_out: what lies
+   between the two indices is no longer in order, the CDC side drops it */
+__IO uint8_t APP_Rx_overrun = 0;
 
 uint8_t  USB_Tx_State = USB_CDC_IDLE;
 
@@ -464,14 +496,19 @@ uint8_t  usbd_cdc_Init (void  *pdev,
   pbuf[4] = DEVICE_CLASS_CDC;
   pbuf[5] = DEVICE_SUBCLASS_CDC;
   
-  /* Initialize the Interface physical components */
-  APP_VCP_FOPS.pIf_Init();
-
-  /* Prepare Out endpoint to receive next packet */
-  DCD_EP_PrepareRx(pdev,
-                   CDC_OUT_EP,
-                   (uint8_t*)(USB_Rx_Buffer),
-                   CDC_DATA_OUT_PACKET_SIZE);
+  USB_Tx_State = USB_CDC_IDLE;
+  USB_Tx_Len[0] = USB_Tx_Len[1] = 0;
+  USB_Tx_Cur = 0;
+  /* APP_Rx_ptr_in belongs to the running UART DMA: only catch up with it */
+  APP_Rx_ptr_out = APP_Rx_ptr_in;
+  APP_Rx_overrun = 0;
+
+  /* All lent buffers come back. The rings are emptied by their main loop
+     side in usbd_cdc_RxRestart, the OUT endpoint waits for it un-armed.
+     The interface hardware was set up once by the application, from
+     thread context; it is not touched from here. */
+  CDC_RxStopped = 1;
+  USB_Rx_Cur = NULL;
   
   return USBD_OK;
 }
@@ -498,6 +535,8 @@ uint8_t  usbd_cdc_DeInit (void  *pdev,
   DCD_EP_Close(pdev,
               CDC_CMD_EP);
 
+  USB_Rx_Cur = NULL;
+
   /* Restore default state of the Interface physical components */
   APP_VCP_FOPS.pIf_DeInit();
   
@@ -615,7 +654,6 @@ uint8_t  usbd_cdc_EP0_RxReady (void  *pdev)
   return USBD_OK;
 }
 
-#include "stdio.h"
 /**
   * @brief  usbd_audio_DataIn
   *         Data sent on non-control IN endpoint
@@ -625,57 +663,27 @@ uint8_t  usbd_cdc_EP0_RxReady (void  *pdev)
   */
 uint8_t  usbd_cdc_DataIn (void *pdev, uint8_t epnum)
 {
-  uint16_t USB_Tx_ptr;
-  uint16_t USB_Tx_length;
-  printf("usbd_cdc_DataIn 0000000000 \n");
+  uint32_t sent = 0;
+
   if (USB_Tx_State == USB_CDC_BUSY)
   {
-    if (APP_Rx_length == 0) 
-    {
-      USB_Tx_State = USB_CDC_IDLE;
-    }
-    else 
-    {
-      if (APP_Rx_length > CDC_DATA_IN_PACKET_SIZE){
-        USB_Tx_ptr = APP_Rx_ptr_out;
-        USB_Tx_length = CDC_DATA_IN_PACKET_SIZE;
-        
-        APP_Rx_ptr_out += CDC_DATA_IN_PACKET_SIZE;
-        APP_Rx_length -= CDC_DATA_IN_PACKET_SIZE;    
-      }
-      else 
-      {
-        USB_Tx_ptr = APP_Rx_ptr_out;
-        USB_Tx_length = APP_Rx_length;
-        
-        APP_Rx_ptr_out += APP_Rx_length;
-        APP_Rx_length = 0;
-        if(USB_Tx_length == CDC_DATA_IN_PACKET_SIZE)
-        {
-          USB_Tx_State = USB_CDC_ZLP;
-        }
-      }
-      if(APP_Rx_ptr_out >= APP_RX_DATA_SIZE) APP_Rx_ptr_out -= APP_RX_DATA_SIZE;
-      /* Prepare the available data buffer to be sent on IN endpoint */
-      DCD_EP_Tx (pdev,
-                 CDC_IN_EP,
-                 (uint8_t*)&APP_Rx_Buffer[USB_Tx_ptr],
-                 USB_Tx_length);
-
-      APP_VCP_FOPS.pIf_DataTx();
-      return USBD_OK;
-    }
-  }  
-  
-  /* Avoid any asynchronous transfer during ZLP */
-  if (USB_Tx_State == USB_CDC_ZLP)
+    /* Retire the half that just went out, the other one is already staged */
+    sent = USB_Tx_Len[USB_Tx_Cur];
+    USB_Tx_Len[USB_Tx_Cur] = 0;
+    USB_Tx_Cur ^= 1;
+    APP_VCP_FOPS.pIf_DataTx();
+  }
+
+  Handle_USBAsynchXfer(pdev);
+
+  /* Nothing follows a transfer ending on a full packet: terminate it */
+  if ((USB_Tx_State == USB_CDC_IDLE) && sent && ((sent % CDC_DATA_IN_PACKET_SIZE) == 0))
   {
-    /*Send ZLP to indicate the end of the current transfer */
     DCD_EP_Tx (pdev,
                CDC_IN_EP,
                NULL,
                0);
-    USB_Tx_State = USB_CDC_IDLE;
+    USB_Tx_State = USB_CDC_ZLP;
   }
   return USBD_OK;
 }
@@ -689,120 +697,128 @@ uint8_t  usbd_cdc_DataIn (void *pdev, uint8_t epnum)
   */
 uint8_t  usbd_cdc_DataOut (void *pdev, uint8_t epnum)
 {      
-  uint16_t USB_Rx_Cnt;
-  printf("usbd_cdc_DataOut 111111111 \n");
+  uint8_t  *buf = USB_Rx_Cur;
+  uint32_t USB_Rx_Cnt;
+
   /* Get the received data buffer and update the counter */
   USB_Rx_Cnt = ((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].xfer_count;
-  
-  /* USB data will be immediately processed, this allow next USB traffic being 
-  NAKed till the end of the application Xfer */
-  APP_VCP_FOPS.pIf_DataRx(USB_Rx_Buffer, USB_Rx_Cnt);
-  
-  /* Prepare Out endpoint to receive next packet */
-  DCD_EP_PrepareRx(pdev,
-                   CDC_OUT_EP,
-                   (uint8_t*)(USB_Rx_Buffer),
-                   CDC_DATA_OUT_PACKET_SIZE);
+
+  /* Re-arm into the next lent buffer before anything else; with none left
+     the endpoint stays un-armed and NAKs until the application lends one */
+  USB_Rx_Cur = NULL;
+  CDC_RxArm(pdev);
+
+  /* Hand the filled buffer over by reference */
+  CDC_RxPut(&CDC_RxFull, buf, USB_Rx_Cnt);
+  APP_VCP_FOPS.pIf_DataRx(buf, USB_Rx_Cnt);
   
   return USBD_OK;
 }
 
-#if 0
 /**
-  * @brief  usbd_audio_SOF
-  *         Start Of Frame event management
+  * @brief  usbd_cdc_SOF
+  *         Start Of Frame event management: restart the IN pipe when it went
+  *         idle and the UART has put new data in the ring since, and the OUT
+  *         pipe when it ran out of buffers.
   * @param  pdev: instance
-  * @param  epnum: endpoint number
   * @retval status
   */
 uint8_t  usbd_cdc_SOF (void *pdev)
-{      
-  static uint32_t FrameCount = 0;
-  
-  if (FrameCount++ == CDC_IN_FRAME_INTERVAL)
+{
+  if (((USB_OTG_CORE_HANDLE*)pdev)->dev.device_status != USB_OTG_CONFIGURED)
+  {
+    return USBD_OK;
+  }
+  if (USB_Tx_State == USB_CDC_IDLE)
   {
-    /* Reset the frame counter */
-    FrameCount = 0;
-    
-    /* Check the data to be sent through IN pipe */
     Handle_USBAsynchXfer(pdev);
   }
-  
+  /* OUT endpoint NAKing for lack of buffers: retry once one was lent back */
+  if (USB_Rx_Cur == NULL)
+  {
+    CDC_RxArm(pdev);
+  }
   return USBD_OK;
 }
 
+/**
+  * @brief  CDC_TxFill
+  *         Copy up to CDC_IN_XFER_SIZE pending bytes out of the APP_Rx ring.
+  *         APP_Rx_ptr_in is moved by the UART side only, APP_Rx_ptr_out only
+  *         here, so one snapshot of ptr_in is all the locking needed.
+  *         After an overrun the pending bytes are dropped, not sent.
+  * @param  buf: ping-pong half to fill
+  * @retval number of bytes copied
+  */
+static uint32_t CDC_TxFill (uint8_t *buf)
+{
+  uint32_t in = APP_Rx_ptr_in;
+  uint32_t out = APP_Rx_ptr_out;
+  uint32_t len, run;
+
+  if (APP_Rx_overrun)
+  {
+    APP_Rx_overrun = 0;
+    APP_Rx_ptr_out = in;
+    return 0;
+  }
+  len = (in >= out) ? (in - out) : (APP_RX_DATA_SIZE - out + in);
+  if (len > CDC_IN_XFER_SIZE)
+  {
+    len = CDC_IN_XFER_SIZE;
+  }
+  run = APP_RX_DATA_SIZE - out;
+  if (run > len)
+  {
+    run = len;
+  }
+  memcpy(buf, &APP_Rx_Buffer[out], run);
+  memcpy(buf + run, &APP_Rx_Buffer[0], len - run);
+
+  out += len;
+  if (out >= APP_RX_DATA_SIZE)
+  {
+    out -= APP_RX_DATA_SIZE;
+  }
+  APP_Rx_ptr_out = out;
+  return len;
+}
+
 /**
   * @brief  Handle_USBAsynchXfer
-  *         Send data to USB
+  *         Arm the IN endpoint with the staged half of the ping-pong buffer
+  *         and stage the other half behind it, so DataIn can re-arm at once.
+  *         Each transfer carries up to CDC_IN_XFER_SIZE bytes (several
+  *         packets); the buffers are aligned, so no length rounding is
+  *         needed for the HS DMA.
   * @param  pdev: instance
   * @retval None
   */
 static void Handle_USBAsynchXfer (void *pdev)
 {
-  uint16_t USB_Tx_ptr;
-  uint16_t USB_Tx_length;
-  
-  if(USB_Tx_State == USB_CDC_IDLE)
+  uint8_t cur = USB_Tx_Cur;
+
+  if (USB_Tx_Len[cur] == 0)
   {
-    if (APP_Rx_ptr_out == APP_RX_DATA_SIZE)
-    {
-      APP_Rx_ptr_out = 0;
-    }
-    
-    if(APP_Rx_ptr_out == APP_Rx_ptr_in) 
-    {
-      USB_Tx_State = USB_CDC_IDLE; 
-      return;
-    }
-    
-    if(APP_Rx_ptr_out > APP_Rx_ptr_in) /* rollback */
-    { 
-      APP_Rx_length = APP_RX_DATA_SIZE - APP_Rx_ptr_out;
-      
-    }
-    else 
-    {
-      APP_Rx_length = APP_Rx_ptr_in - APP_Rx_ptr_out;
-      
-    }
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-    APP_Rx_length &= ~0x03;
-#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-    
-    if (APP_Rx_length > CDC_DATA_IN_PACKET_SIZE)
-    {
-      USB_Tx_ptr = APP_Rx_ptr_out;
-      USB_Tx_length = CDC_DATA_IN_PACKET_SIZE;
-      
-      APP_Rx_ptr_out += CDC_DATA_IN_PACKET_SIZE;	
-      APP_Rx_length -= CDC_DATA_IN_PACKET_SIZE;
-      USB_Tx_State = USB_CDC_BUSY;
-    }
-    else
-    {
-      USB_Tx_ptr = APP_Rx_ptr_out;
-      USB_Tx_length = APP_Rx_length;
-      
-      APP_Rx_ptr_out += APP_Rx_length;
-      APP_Rx_length = 0;
-      if(USB_Tx_length == CDC_DATA_IN_PACKET_SIZE)
-      {
-        USB_Tx_State = USB_CDC_ZLP;
-      }
-      else
-      {
-        USB_Tx_State = USB_CDC_BUSY;
-      }
-    }
-    
-    DCD_EP_Tx (pdev,
-               CDC_IN_EP,
-               (uint8_t*)&APP_Rx_Buffer[USB_Tx_ptr],
-               USB_Tx_length);
-  }  
-}
+    USB_Tx_Len[cur] = CDC_TxFill(USB_Tx_Buffer[cur]);
+  }
+  if (USB_Tx_Len[cur] == 0)
+  {
+    USB_Tx_State = USB_CDC_IDLE;
+    return;
+  }
 
-#endif
+  USB_Tx_State = USB_CDC_BUSY;
+  DCD_EP_Tx (pdev,
+             CDC_IN_EP,
+             USB_Tx_Buffer[cur],
+             USB_Tx_Len[cur]);
+
+  if (USB_Tx_Len[cur ^ 1] == 0)
+  {
+    USB_Tx_Len[cur ^ 1] = CDC_TxFill(USB_Tx_Buffer[cur ^ 1]);
+  }
+}
 
 /**
   * @brief  USBD_cdc_GetCfgDesc 
@@ -837,53 +853,148 @@ static uint8_t  *USBD_cdc_GetOtherCfgDesc (uint8_t speed, uint16_t *length)
   * @}
   */ 
 //#include <stdio.h>
-int usbd_cdc_trigger(void *pdev,uint32_t len)
+/**
+  * @brief  CDC_RxPut
+  *         Queue a buffer on one of the OUT buffer rings
+  * @param  r: ring
+  * @param  buf: buffer
+  * @param  len: buffer size (free ring) or received length (full ring)
+  * @retval USBD_OK, or USBD_FAIL if the ring is full
+  */
+static uint8_t CDC_RxPut (CDC_RxRing_TypeDef *r, uint8_t *buf, uint32_t len)
 {
-    uint16_t USB_Tx_ptr;
-    uint16_t USB_Tx_length;
+  uint32_t i = r->wr;
 
-    if(USB_Tx_State == USB_CDC_IDLE)
-    {
-      APP_Rx_ptr_out = 0;
-      APP_Rx_ptr_in = len;
-      APP_Rx_length = len;
+  if (i - r->rd >= CDC_RX_POOL_SIZE)
+  {
+    return USBD_FAIL;
+  }
+  r->buf[i & (CDC_RX_POOL_SIZE - 1)] = buf;
+  r->len[i & (CDC_RX_POOL_SIZE - 1)] = len;
+  __DMB();                        /* publish the slot before the index */
+  r->wr = i + 1;
+  return USBD_OK;
+}
 
-  #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-      APP_Rx_length &= ~0x03;
-  #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+/**
+  * @brief  CDC_RxTake
+  *         Dequeue the oldest buffer of one of the OUT buffer rings
+  * @param  r: ring
+  * @param  len: buffer size (free ring) or received length (full ring)
+  * @retval buffer, or NULL if the ring is empty
+  */
+static uint8_t *CDC_RxTake (CDC_RxRing_TypeDef *r, uint32_t *len)
+{
+  uint32_t i = r->rd;
+  uint8_t *buf;
 
-     // printf("trigger cdc %d\n",APP_Rx_length);
+  if (r->wr == i)
+  {
+    return NULL;
+  }
+  __DMB();                        /* index read before the slot */
+  buf  = r->buf[i & (CDC_RX_POOL_SIZE - 1)];
+  *len = r->len[i & (CDC_RX_POOL_SIZE - 1)];
+  __DMB();
+  r->rd = i + 1;
+  return buf;
+}
 
-      if (APP_Rx_length > CDC_DATA_IN_PACKET_SIZE)
-      {
-        USB_Tx_ptr = APP_Rx_ptr_out;
-        USB_Tx_length = CDC_DATA_IN_PACKET_SIZE;
+/**
+  * @brief  CDC_RxArm
+  *         Arm the OUT endpoint with the next lent buffer, if there is one.
+  *         A buffer larger than one packet takes a multi-packet transfer that
+  *         completes on a short packet or when the buffer is full.
+  * @param  pdev: instance
+  * @retval None
+  */
+static void CDC_RxArm (void *pdev)
+{
+  if (USB_Rx_Cur != NULL || CDC_RxStopped)
+  {
+    return;
+  }
+  USB_Rx_Cur = CDC_RxTake(&CDC_RxFree, &USB_Rx_Size);
+  if (USB_Rx_Cur != NULL)
+  {
+    DCD_EP_PrepareRx(pdev,
+                     CDC_OUT_EP,
+                     USB_Rx_Cur,
+                     USB_Rx_Size);
+  }
+}
 
-        APP_Rx_ptr_out += CDC_DATA_IN_PACKET_SIZE;
-        APP_Rx_length -= CDC_DATA_IN_PACKET_SIZE;
-        USB_Tx_State = USB_CDC_BUSY;
-      }
-      else
-      {
-        USB_Tx_ptr = APP_Rx_ptr_out;
-        USB_Tx_length = APP_Rx_length;
+/**
+  * @brief  usbd_cdc_RxLend
+  *         Lend a receive buffer to the OUT endpoint. It comes back through
+  *         usbd_cdc_RxGet once filled. Called by the application only,
+  *         the whole pool right after usbd_cdc_RxRestart.
+  * @param  buf: buffer, 4-byte aligned for the HS DMA
+  * @param  size: buffer size, a multiple of CDC_DATA_OUT_PACKET_SIZE
+  * @retval USBD_OK, or USBD_FAIL if CDC_RX_POOL_SIZE buffers are already lent
+  */
+uint8_t usbd_cdc_RxLend (uint8_t *buf, uint32_t size)
+{
+  return CDC_RxPut(&CDC_RxFree, buf, size);
+}
 
-        APP_Rx_ptr_out += APP_Rx_length;
-        APP_Rx_length = 0;
-        if(USB_Tx_length == CDC_DATA_IN_PACKET_SIZE)
-        {
-          USB_Tx_State = USB_CDC_ZLP;
-        }
-        else
-        {
-          USB_Tx_State = USB_CDC_BUSY;
-        }
-      }
+/**
+  * @brief  usbd_cdc_RxGet
+  *         Take the oldest filled OUT buffer. The application owns it until
+  *         it lends it back with usbd_cdc_RxLend.
+  * @param  len: number of bytes received in it
+  * @retval buffer, or NULL if nothing was received
+  */
+uint8_t *usbd_cdc_RxGet (uint32_t *len)
+{
+  return CDC_RxTake(&CDC_RxFull, len);
+}
 
-      DCD_EP_Tx (pdev,
-                 CDC_IN_EP,
-                 (uint8_t*)&APP_Rx_Buffer[USB_Tx_ptr],
-                 USB_Tx_length);
+/**
+  * @brief  usbd_cdc_RxPending
+  *         Check whether the interface was (re)configured since the last
+  *         usbd_cdc_RxRestart, i.e. all lent buffers were dropped.
+  * @param  None
+  * @retval 1 if usbd_cdc_RxRestart has to be called
+  */
+uint8_t usbd_cdc_RxPending (void)
+{
+  return CDC_RxStopped;
+}
+
+/**
+  * @brief  usbd_cdc_RxRestart
+  *         Empty both OUT buffer rings and let the OUT endpoint run again.
+  *         Called by the application only, from the side that lends and
+  *         gets the buffers, then the pool is lent again with
+  *         usbd_cdc_RxLend. The endpoint is left alone while CDC_RxStopped
+  *         is set, so both indices of each ring can be written here.
+  * @param  None
+  * @retval None
+  */
+void usbd_cdc_RxRestart (void)
+{
+  CDC_RxFree.rd = CDC_RxFree.wr = 0;
+  CDC_RxFull.rd = CDC_RxFull.wr = 0;
+  __DMB();                        /* rings empty before the endpoint sees them */
+  CDC_RxStopped = 0;
+}
+
+/**
+  * @brief  usbd_cdc_trigger
+  *         Send len bytes the application wrote at the start of APP_Rx_Buffer
+  * @param  pdev: instance
+  * @param  len: number of bytes
+  * @retval 1 if the transfer was started, 0 if the IN pipe is busy
+  */
+int usbd_cdc_trigger(void *pdev,uint32_t len)
+{
+    if(USB_Tx_State == USB_CDC_IDLE)
+    {
+      USB_Tx_Len[0] = USB_Tx_Len[1] = 0;
+      APP_Rx_ptr_out = 0;
+      APP_Rx_ptr_in = len;
+      Handle_USBAsynchXfer(pdev);
       return 1;
     }
     return 0;
@@ -892,6 +1003,7 @@ int usbd_cdc_trigger(void *pdev,uint32_t len)
 int usbd_cdc_trigger_reset(void)
 {
     USB_Tx_State = USB_CDC_IDLE;
+    USB_Tx_Len[0] = USB_Tx_Len[1] = 0;
     APP_Rx_ptr_out = 0;
     APP_Rx_ptr_in  = 0;
     APP_Rx_length  = 0;
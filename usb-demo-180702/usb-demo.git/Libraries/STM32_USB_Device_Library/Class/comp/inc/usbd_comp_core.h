@@ -0,0 +1,91 @@
+/**
+  ******************************************************************************
+  * @file    usbd_comp_core.h
+  * @brief   header file for the usbd_comp_core.c file.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+
+#ifndef __USB_COMP_CORE_H_
+#define __USB_COMP_CORE_H_
+
+#include  "usbd_ioreq.h"
+
+/** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
+  * @{
+  */
+
+/** @defgroup usbd_comp
+  * @brief This file is the Header file for usbd_comp_core.c
+  * @{
+  */
+
+
+/** @defgroup usbd_comp_Exported_Defines
+  * @{
+  */
+/* Classes one composite device can carry */
+#ifndef USBD_COMP_MAX_CLASS
+ #define USBD_COMP_MAX_CLASS                   2
+#endif
+
+/* Room for the generated configuration descriptor */
+#ifndef USBD_COMP_CONFIG_DESC_SIZ
+ #define USBD_COMP_CONFIG_DESC_SIZ             256
+#endif
+
+#define USBD_COMP_MAX_ITF                      16
+
+/* USBD_COMP_Add flags */
+#define USBD_COMP_IAD                          0x01  /* group the class interfaces under an IAD */
+
+#define USB_DESC_TYPE_IAD                      0x0B
+#define USB_DESC_TYPE_CS_INTERFACE             0x24
+/**
+  * @}
+  */
+
+
+/** @defgroup USBD_COMP_Exported_TypesDefinitions
+  * @{
+  */
+/**
+  * @}
+  */
+
+
+
+/** @defgroup USBD_COMP_Exported_Macros
+  * @{
+  */
+
+/**
+  * @}
+  */
+
+/** @defgroup USBD_COMP_Exported_Variables
+  * @{
+  */
+
+extern USBD_Class_cb_TypeDef  USBD_COMP_cb;
+/**
+  * @}
+  */
+
+/** @defgroup USB_COMP_Exported_Functions
+  * @{
+  */
+uint8_t USBD_COMP_Add (USBD_Class_cb_TypeDef *class_cb, uint8_t flags);
+/**
+  * @}
+  */
+
+#endif  // __USB_COMP_CORE_H_
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
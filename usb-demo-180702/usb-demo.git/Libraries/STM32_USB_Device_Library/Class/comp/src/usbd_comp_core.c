@@ -0,0 +1,705 @@
+/**
+  ******************************************************************************
+  * @file    usbd_comp_core.c
+  * @brief   Composite device layer: carries several classes on one core.
+  *
+  *          Each class keeps its own descriptor, numbering its interfaces
+  *          from 0. USBD_COMP_Add gives it the next block of interface
+  *          numbers, and the configuration descriptor sent to the host is
+  *          the classes' ones back to back, renumbered and, where asked
+  *          for, grouped under an Interface Association Descriptor.
+  *
+  *          Requests and transfers are routed back through lookup tables:
+  *           - interface requests by interface number, with wIndex
+  *             translated back to the class numbering
+  *           - endpoint requests, DataIn and DataOut by endpoint number
+  *           - EP0 data stages to the class that took the setup stage
+  *           - Init, DeInit, SOF and device requests to every class
+  *
+  *          Endpoint addresses are not renumbered: the classes must use
+  *          disjoint endpoints (see CDC_xxx_EP in usbd_conf.h).
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_comp_core.h"
+#include "usbd_desc.h"
+#include "usbd_req.h"
+
+
+/** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
+  * @{
+  */
+
+
+/** @defgroup usbd_comp
+  * @brief usbd core module
+  * @{
+  */
+
+/** @defgroup usbd_comp_Private_TypesDefinitions
+  * @{
+  */
+typedef struct
+{
+  USBD_Class_cb_TypeDef *cb;
+  uint8_t   ItfBase;            /* first interface number in the composite */
+  uint8_t   ItfNum;
+  uint8_t   Flags;              /* USBD_COMP_IAD */
+  uint16_t  DescLen;            /* bytes it adds to the full speed configuration */
+} USBD_COMP_Class_TypeDef;
+/**
+  * @}
+  */
+
+
+/** @defgroup usbd_comp_Private_Defines
+  * @{
+  */
+#define USBD_COMP_NONE          0xFF
+/**
+  * @}
+  */
+
+
+/** @defgroup usbd_comp_Private_Macros
+  * @{
+  */
+/**
+  * @}
+  */
+
+
+/** @defgroup usbd_comp_Private_FunctionPrototypes
+  * @{
+  */
+static uint8_t  USBD_COMP_Init        (void  *pdev, uint8_t cfgidx);
+static uint8_t  USBD_COMP_DeInit      (void  *pdev, uint8_t cfgidx);
+static uint8_t  USBD_COMP_Setup       (void  *pdev, USB_SETUP_REQ *req);
+static uint8_t  USBD_COMP_EP0_TxSent  (void  *pdev);
+static uint8_t  USBD_COMP_EP0_RxReady (void  *pdev);
+static uint8_t  USBD_COMP_DataIn      (void  *pdev, uint8_t epnum);
+static uint8_t  USBD_COMP_DataOut     (void  *pdev, uint8_t epnum);
+static uint8_t  USBD_COMP_SOF         (void  *pdev);
+static uint8_t  USBD_COMP_IsoINIncomplete  (void  *pdev);
+static uint8_t  USBD_COMP_IsoOUTIncomplete (void  *pdev);
+static uint8_t  *USBD_COMP_GetCfgDesc (uint8_t speed, uint16_t *length);
+#ifdef USB_OTG_HS_CORE
+static uint8_t  *USBD_COMP_GetOtherCfgDesc (uint8_t speed, uint16_t *length);
+#endif
+static uint8_t  *USBD_COMP_GetCoreCfgDesc (void *pdev, uint8_t speed, uint16_t *length);
+static uint8_t  *USBD_COMP_GetItfDesc (void *pdev, uint8_t itf, uint8_t idx,
+                                       uint16_t *wValue, uint16_t *length);
+static uint8_t  *USBD_COMP_Build      (uint8_t *buf, void *pdev, uint8_t speed,
+                                       uint8_t other, uint16_t *length);
+/**
+  * @}
+  */
+
+
+/** @defgroup usbd_comp_Private_Variables
+  * @{
+  */
+USBD_Class_cb_TypeDef  USBD_COMP_cb =
+{
+  USBD_COMP_Init,
+  USBD_COMP_DeInit,
+  USBD_COMP_Setup,
+  USBD_COMP_EP0_TxSent,
+  USBD_COMP_EP0_RxReady,
+  USBD_COMP_DataIn,
+  USBD_COMP_DataOut,
+  USBD_COMP_SOF,
+  USBD_COMP_IsoINIncomplete,
+  USBD_COMP_IsoOUTIncomplete,
+  USBD_COMP_GetCfgDesc,
+#ifdef USB_OTG_HS_CORE
+  USBD_COMP_GetOtherCfgDesc,
+#endif
+#ifdef USB_SUPPORT_USER_STRING_DESC
+  NULL,
+#endif
+  USBD_COMP_GetCoreCfgDesc,
+  USBD_COMP_GetItfDesc,
+};
+
+static USBD_COMP_Class_TypeDef USBD_COMP_Class[USBD_COMP_MAX_CLASS];
+static uint8_t USBD_COMP_ClassNum = 0;
+
+/* interface / endpoint number -> class index, USBD_COMP_NONE if unused */
+static uint8_t USBD_COMP_ItfMap  [USBD_COMP_MAX_ITF];
+static uint8_t USBD_COMP_InEpMap [USB_OTG_MAX_TX_FIFOS];
+static uint8_t USBD_COMP_OutEpMap[USB_OTG_MAX_TX_FIFOS];
+static uint8_t USBD_COMP_ItfTotal = 0;
+
+/* class that took the last setup stage, owns the EP0 data stage */
+static uint8_t USBD_COMP_Ep0 = USBD_COMP_NONE;
+
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN static uint8_t USBD_COMP_CfgDesc[USBD_COMP_CONFIG_DESC_SIZ] __ALIGN_END ;
+
+#ifdef USB_OTG_HS_CORE
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN static uint8_t USBD_COMP_OtherCfgDesc[USBD_COMP_CONFIG_DESC_SIZ] __ALIGN_END ;
+#endif
+/**
+  * @}
+  */
+
+
+/** @defgroup usbd_comp_Private_Functions
+  * @{
+  */
+
+/**
+  * @brief  USBD_COMP_Add
+  *         Append a class to the composite device, before USBD_Init
+  * @param  class_cb: class callbacks
+  * @param  flags: USBD_COMP_IAD to group its interfaces under an IAD
+  * @retval USBD_OK, or USBD_FAIL if the class does not fit or shares an
+  *         endpoint with one added before
+  */
+uint8_t USBD_COMP_Add (USBD_Class_cb_TypeDef *class_cb, uint8_t flags)
+{
+  USBD_COMP_Class_TypeDef *c;
+  uint8_t *pdesc;
+  uint16_t len, size, total, i;
+  uint8_t idx, itf = 0, ep;
+
+  if (USBD_COMP_ClassNum == 0)
+  {
+    for (i = 0; i < USBD_COMP_MAX_ITF; i++)
+    {
+      USBD_COMP_ItfMap[i] = USBD_COMP_NONE;
+    }
+    for (i = 0; i < USB_OTG_MAX_TX_FIFOS; i++)
+    {
+      USBD_COMP_InEpMap[i] = USBD_COMP_NONE;
+      USBD_COMP_OutEpMap[i] = USBD_COMP_NONE;
+    }
+    USBD_COMP_ItfTotal = 0;
+  }
+  if (USBD_COMP_ClassNum >= USBD_COMP_MAX_CLASS)
+  {
+    return USBD_FAIL;
+  }
+  idx = USBD_COMP_ClassNum;
+
+  /* endpoint addresses and the interface count do not depend on speed */
+  pdesc = class_cb->GetConfigDescriptor(USB_OTG_SPEED_FULL, &len);
+  for (i = 9; (i + 1 < len) && (pdesc[i] >= 2); i += pdesc[i])
+  {
+    if (pdesc[i + 1] == USB_INTERFACE_DESCRIPTOR_TYPE)
+    {
+      if (pdesc[i + 2] + 1 > itf)
+      {
+        itf = pdesc[i + 2] + 1;
+      }
+    }
+    else if (pdesc[i + 1] == USB_ENDPOINT_DESCRIPTOR_TYPE)
+    {
+      ep = pdesc[i + 2] & 0x7F;
+      if ((ep == 0) || (ep >= USB_OTG_MAX_TX_FIFOS))
+      {
+        return USBD_FAIL;
+      }
+      if (((pdesc[i + 2] & 0x80) ? USBD_COMP_InEpMap[ep] : USBD_COMP_OutEpMap[ep])
+          < idx)
+      {
+        return USBD_FAIL;
+      }
+    }
+  }
+
+  total = 9;
+  for (i = 0; i < idx; i++)
+  {
+    total += USBD_COMP_Class[i].DescLen;
+  }
+  size = len - 9 + ((flags & USBD_COMP_IAD) ? 8 : 0);
+  if ((total + size > USBD_COMP_CONFIG_DESC_SIZ) ||
+      (USBD_COMP_ItfTotal + itf > USBD_COMP_MAX_ITF))
+  {
+    return USBD_FAIL;
+  }
+
+  /* everything checked: commit the class and its routes */
+  for (i = 9; (i + 1 < len) && (pdesc[i] >= 2); i += pdesc[i])
+  {
+    if (pdesc[i + 1] == USB_ENDPOINT_DESCRIPTOR_TYPE)
+    {
+      ep = pdesc[i + 2] & 0x7F;
+      if (pdesc[i + 2] & 0x80)
+      {
+        USBD_COMP_InEpMap[ep] = idx;
+      }
+      else
+      {
+        USBD_COMP_OutEpMap[ep] = idx;
+      }
+    }
+  }
+  c = &USBD_COMP_Class[idx];
+  c->cb = class_cb;
+  c->ItfBase = USBD_COMP_ItfTotal;
+  c->ItfNum = itf;
+  c->Flags = flags;
+  c->DescLen = size;
+  for (i = 0; i < itf; i++)
+  {
+    USBD_COMP_ItfMap[c->ItfBase + i] = idx;
+  }
+  USBD_COMP_ItfTotal += itf;
+  USBD_COMP_ClassNum++;
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_Init
+  *         Initialize every class
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t  USBD_COMP_Init (void  *pdev,
+                                uint8_t cfgidx)
+{
+  uint8_t i;
+
+  USBD_COMP_Ep0 = USBD_COMP_NONE;
+  for (i = 0; i < USBD_COMP_ClassNum; i++)
+  {
+    USBD_COMP_Class[i].cb->Init(pdev, cfgidx);
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_DeInit
+  *         DeInitialize every class
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t  USBD_COMP_DeInit (void  *pdev,
+                                  uint8_t cfgidx)
+{
+  uint8_t i;
+
+  for (i = 0; i < USBD_COMP_ClassNum; i++)
+  {
+    USBD_COMP_Class[i].cb->DeInit(pdev, cfgidx);
+  }
+  USBD_COMP_Ep0 = USBD_COMP_NONE;
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_Setup
+  *         Route a setup request to the class owning its recipient
+  * @param  pdev: device instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t  USBD_COMP_Setup (void  *pdev,
+                                 USB_SETUP_REQ *req)
+{
+  USB_SETUP_REQ  local;
+  uint8_t idx, i;
+
+  switch (req->bmRequest & USB_REQ_RECIPIENT_MASK)
+  {
+  case USB_REQ_RECIPIENT_INTERFACE:
+    i = LOBYTE(req->wIndex);
+    idx = (i < USBD_COMP_MAX_ITF) ? USBD_COMP_ItfMap[i] : USBD_COMP_NONE;
+    if (idx == USBD_COMP_NONE)
+    {
+      break;
+    }
+    /* the class sees its own interface numbering */
+    local = *req;
+    local.wIndex = (req->wIndex & 0xFF00) | (i - USBD_COMP_Class[idx].ItfBase);
+    USBD_COMP_Ep0 = idx;
+    return USBD_COMP_Class[idx].cb->Setup(pdev, &local);
+
+  case USB_REQ_RECIPIENT_ENDPOINT:
+    i = LOBYTE(req->wIndex) & 0x7F;
+    if (i >= USB_OTG_MAX_TX_FIFOS)
+    {
+      break;
+    }
+    idx = (req->wIndex & 0x80) ? USBD_COMP_InEpMap[i] : USBD_COMP_OutEpMap[i];
+    if (idx == USBD_COMP_NONE)
+    {
+      break;
+    }
+    USBD_COMP_Ep0 = idx;
+    return USBD_COMP_Class[idx].cb->Setup(pdev, req);
+
+  default:
+    /* device requests (remote wakeup) concern every class */
+    for (i = 0; i < USBD_COMP_ClassNum; i++)
+    {
+      USBD_COMP_Class[i].cb->Setup(pdev, req);
+    }
+    return USBD_OK;
+  }
+
+  USBD_CtlError (pdev, req);
+  return USBD_FAIL;
+}
+
+/**
+  * @brief  USBD_COMP_EP0_TxSent
+  *         Handle EP0 Tx status for the class of the last setup stage
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_COMP_EP0_TxSent (void  *pdev)
+{
+  USBD_Class_cb_TypeDef *cb;
+
+  if (USBD_COMP_Ep0 != USBD_COMP_NONE)
+  {
+    cb = USBD_COMP_Class[USBD_COMP_Ep0].cb;
+    if (cb->EP0_TxSent != NULL)
+    {
+      return cb->EP0_TxSent(pdev);
+    }
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_EP0_RxReady
+  *         Handle EP0 Rx data for the class of the last setup stage
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_COMP_EP0_RxReady (void  *pdev)
+{
+  USBD_Class_cb_TypeDef *cb;
+
+  if (USBD_COMP_Ep0 != USBD_COMP_NONE)
+  {
+    cb = USBD_COMP_Class[USBD_COMP_Ep0].cb;
+    if (cb->EP0_RxReady != NULL)
+    {
+      return cb->EP0_RxReady(pdev);
+    }
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_DataIn
+  *         Handle data IN Stage. Classes that registered the EP with
+  *         DCD_EP_SetHandler are called by the ISR directly instead.
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t  USBD_COMP_DataIn (void  *pdev,
+                                  uint8_t epnum)
+{
+  uint8_t idx;
+
+  epnum &= 0x7F;
+  idx = (epnum < USB_OTG_MAX_TX_FIFOS) ? USBD_COMP_InEpMap[epnum] : USBD_COMP_NONE;
+  if ((idx != USBD_COMP_NONE) && (USBD_COMP_Class[idx].cb->DataIn != NULL))
+  {
+    return USBD_COMP_Class[idx].cb->DataIn(pdev, epnum);
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_DataOut
+  *         Handle data OUT Stage
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t  USBD_COMP_DataOut (void  *pdev,
+                                   uint8_t epnum)
+{
+  uint8_t idx;
+
+  idx = (epnum < USB_OTG_MAX_TX_FIFOS) ? USBD_COMP_OutEpMap[epnum] : USBD_COMP_NONE;
+  if ((idx != USBD_COMP_NONE) && (USBD_COMP_Class[idx].cb->DataOut != NULL))
+  {
+    return USBD_COMP_Class[idx].cb->DataOut(pdev, epnum);
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_SOF
+  *         Start Of Frame event, for every class
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_COMP_SOF (void  *pdev)
+{
+  uint8_t i;
+
+  for (i = 0; i < USBD_COMP_ClassNum; i++)
+  {
+    if (USBD_COMP_Class[i].cb->SOF != NULL)
+    {
+      USBD_COMP_Class[i].cb->SOF(pdev);
+    }
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_IsoINIncomplete
+  *         Incomplete isochronous IN transfer, for every class
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_COMP_IsoINIncomplete (void  *pdev)
+{
+  uint8_t i;
+
+  for (i = 0; i < USBD_COMP_ClassNum; i++)
+  {
+    if (USBD_COMP_Class[i].cb->IsoINIncomplete != NULL)
+    {
+      USBD_COMP_Class[i].cb->IsoINIncomplete(pdev);
+    }
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_IsoOUTIncomplete
+  *         Incomplete isochronous OUT transfer, for every class
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_COMP_IsoOUTIncomplete (void  *pdev)
+{
+  uint8_t i;
+
+  for (i = 0; i < USBD_COMP_ClassNum; i++)
+  {
+    if (USBD_COMP_Class[i].cb->IsoOUTIncomplete != NULL)
+    {
+      USBD_COMP_Class[i].cb->IsoOUTIncomplete(pdev);
+    }
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_COMP_Build
+  *         Concatenate the class configuration descriptors: interfaces
+  *         renumbered, an IAD in front of the classes added with
+  *         USBD_COMP_IAD, one configuration header for the lot
+  * @param  buf: destination, USBD_COMP_CONFIG_DESC_SIZ bytes
+  * @param  pdev: device instance for GetCoreConfigDescriptor, or NULL
+  * @param  speed : current device speed
+  * @param  other : build the other speed configuration
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t  *USBD_COMP_Build (uint8_t *buf, void *pdev, uint8_t speed,
+                                  uint8_t other, uint16_t *length)
+{
+  USBD_COMP_Class_TypeDef *c;
+  uint8_t *pdesc, *p;
+  uint16_t len, pos = 9, i, j;
+  uint8_t n;
+
+  for (n = 0; n < USBD_COMP_ClassNum; n++)
+  {
+    c = &USBD_COMP_Class[n];
+#ifdef USB_OTG_HS_CORE
+    if (other && (c->cb->GetOtherConfigDescriptor != NULL))
+    {
+      pdesc = c->cb->GetOtherConfigDescriptor(speed, &len);
+    }
+    else
+#endif
+    if ((pdev != NULL) && (c->cb->GetCoreConfigDescriptor != NULL))
+    {
+      pdesc = c->cb->GetCoreConfigDescriptor(pdev, speed, &len);
+    }
+    else
+    {
+      pdesc = c->cb->GetConfigDescriptor(speed, &len);
+    }
+    if (n == 0)
+    {
+      for (i = 0; i < 9; i++)
+      {
+        buf[i] = pdesc[i];
+      }
+    }
+    else if (pdesc[8] > buf[8])
+    {
+      buf[8] = pdesc[8];                          /* bMaxPower */
+    }
+
+    if ((c->Flags & USBD_COMP_IAD) && (pos + 8 <= USBD_COMP_CONFIG_DESC_SIZ))
+    {
+      /* function class from the first interface of the class */
+      for (i = 9; (i + 8 < len) && (pdesc[i] >= 2); i += pdesc[i])
+      {
+        if (pdesc[i + 1] == USB_INTERFACE_DESCRIPTOR_TYPE)
+        {
+          break;
+        }
+      }
+      p = (i + 8 < len) ? &pdesc[i] : NULL;
+      buf[pos++] = 8;
+      buf[pos++] = USB_DESC_TYPE_IAD;
+      buf[pos++] = c->ItfBase;                    /* bFirstInterface */
+      buf[pos++] = c->ItfNum;                     /* bInterfaceCount */
+      buf[pos++] = p ? p[5] : 0;                  /* bFunctionClass */
+      buf[pos++] = p ? p[6] : 0;                  /* bFunctionSubClass */
+      buf[pos++] = p ? p[7] : 0;                  /* bFunctionProtocol */
+      buf[pos++] = 0;                             /* iFunction */
+    }
+
+    for (i = 9; (i + 1 < len) && (pdesc[i] >= 2); i += pdesc[i])
+    {
+      if (pos + pdesc[i] > USBD_COMP_CONFIG_DESC_SIZ)
+      {
+        break;
+      }
+      p = &buf[pos];
+      for (j = 0; (j < pdesc[i]) && (i + j < len); j++)
+      {
+        p[j] = pdesc[i + j];
+      }
+      pos += j;
+      if (j < 3)
+      {
+        continue;
+      }
+      switch (p[1])
+      {
+      case USB_INTERFACE_DESCRIPTOR_TYPE:
+      case USB_DESC_TYPE_IAD:
+        p[2] += c->ItfBase;
+        break;
+
+      case USB_DESC_TYPE_CS_INTERFACE:
+        if ((p[2] == 0x01) && (j > 4))            /* CDC call management */
+        {
+          p[4] += c->ItfBase;                     /* bDataInterface */
+        }
+        else if (p[2] == 0x06)                    /* CDC union */
+        {
+          for (j = 3; j < p[0]; j++)
+          {
+            p[j] += c->ItfBase;
+          }
+        }
+        break;
+
+      default:
+        break;
+      }
+    }
+  }
+
+  buf[2] = LOBYTE(pos);                           /* wTotalLength */
+  buf[3] = HIBYTE(pos);
+  buf[4] = USBD_COMP_ItfTotal;                    /* bNumInterfaces */
+  *length = pos;
+  return buf;
+}
+
+/**
+  * @brief  USBD_COMP_GetCfgDesc
+  *         return configuration descriptor
+  * @param  speed : current device speed
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t  *USBD_COMP_GetCfgDesc (uint8_t speed, uint16_t *length)
+{
+  return USBD_COMP_Build(USBD_COMP_CfgDesc, NULL, speed, 0, length);
+}
+
+/**
+  * @brief  USBD_COMP_GetCoreCfgDesc
+  *         return configuration descriptor for one core
+  * @param  pdev: device instance
+  * @param  speed : current device speed
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t  *USBD_COMP_GetCoreCfgDesc (void *pdev, uint8_t speed, uint16_t *length)
+{
+  return USBD_COMP_Build(USBD_COMP_CfgDesc, pdev, speed, 0, length);
+}
+
+/**
+  * @brief  USBD_COMP_GetItfDesc
+  *         return a class descriptor of an interface from the class owning it
+  * @param  pdev: device instance
+  * @param  itf : interface number in the composite device
+  * @param  idx : 0 for the first descriptor
+  * @param  wValue : descriptor type << 8 | index
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer, NULL past the last one
+  */
+static uint8_t  *USBD_COMP_GetItfDesc (void *pdev, uint8_t itf, uint8_t idx,
+                                       uint16_t *wValue, uint16_t *length)
+{
+  USBD_COMP_Class_TypeDef *c;
+  uint8_t i;
+
+  i = (itf < USBD_COMP_MAX_ITF) ? USBD_COMP_ItfMap[itf] : USBD_COMP_NONE;
+  if (i == USBD_COMP_NONE)
+  {
+    return NULL;
+  }
+  c = &USBD_COMP_Class[i];
+  if (c->cb->GetItfDescriptor == NULL)
+  {
+    return NULL;
+  }
+  /* the class sees its own interface numbering */
+  return c->cb->GetItfDescriptor(pdev, itf - c->ItfBase, idx, wValue, length);
+}
+
+#ifdef USB_OTG_HS_CORE
+/**
+  * @brief  USBD_COMP_GetOtherCfgDesc
+  *         return other speed configuration descriptor
+  * @param  speed : current device speed
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t  *USBD_COMP_GetOtherCfgDesc (uint8_t speed, uint16_t *length)
+{
+  return USBD_COMP_Build(USBD_COMP_OtherCfgDesc, NULL, speed, 1, length);
+}
+#endif
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
@@ -31,6 +31,8 @@
 #define __USB_HID_CORE_H_
 
 #include  "usbd_ioreq.h"
+#include  "usbd_fifo.h"
+#include  "usbd_stats.h"
 //#include "irt10_config.h"
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
@@ -59,44 +61,41 @@
 #define USB_HID_CONFIG_DESC_SIZ_MAC         (41)
 
 //------------------------------------------ HIDС -----------------------------------
-#define SIZE_DESC_USER_050607     35
-#define SIZE_DESC_USER_0506       38
-#define SIZE_DESC_USER_A1         29
-#define SIZE_DESC_USER_A2         29
-#define SIZE_DESC_USER_A3         29
-#define SIZE_DESC_USER_FB         29
-#define SIZE_DESC_USER_FC         29
-#define SIZE_DESC_USER_FB_SW         27
+/* Lengths are counted from the DESCRIPTOR_* bytes in usbd_hid_core.c at compile
+   time, so they are only valid in that file, after the DESCRIPTOR_* macros */
+#define HID_DESC_LEN(...)         sizeof((const uint8_t[]){ __VA_ARGS__ })
+
+#define SIZE_DESC_USER_050607     HID_DESC_LEN(DESCRIPTOR_USER050607)
+#define SIZE_DESC_USER_0506       HID_DESC_LEN(DESCRIPTOR_USER0506)
+#define SIZE_DESC_USER_A1         HID_DESC_LEN(DESCRIPTOR_USERA1)
+#define SIZE_DESC_USER_A2         HID_DESC_LEN(DESCRIPTOR_USERA2)
+#define SIZE_DESC_USER_A3         HID_DESC_LEN(DESCRIPTOR_USERA3)
+#define SIZE_DESC_USER_FB         HID_DESC_LEN(DESCRIPTOR_USERFB)
+#define SIZE_DESC_USER_FC         HID_DESC_LEN(DESCRIPTOR_USERFC)
+#define SIZE_DESC_USER_FB_SW         27     /* SEEWO_HID: no descriptor bytes in this tree */
 #define SIZE_DESC_USER_FC_SW         27
 #define SIZE_DESC_USER_FDFE_SW         60
-#define SIZE_DESC_USER_CH         38
-#define SIZE_DESC_USER_HH         35
-#define SIZE_DESC_USER_PM         53
-#define SIZE_DESC_KEY             65
+#define SIZE_DESC_USER_CH         HID_DESC_LEN(DESCRIPTOR_USER_CH)
+#define SIZE_DESC_USER_HH         HID_DESC_LEN(DESCRIPTOR_USER_HH)
+#define SIZE_DESC_USER_PM         HID_DESC_LEN(DESCRIPTOR_USER_PM)
+#define SIZE_DESC_KEY             HID_DESC_LEN(DESCRIPTOR_KEY)
 #define SIZE_DESC_KEY_SW          67
-#define SIZE_DESC_MOUSE           60
+#define SIZE_DESC_MOUSE           HID_DESC_LEN(DESCRIPTOR_MOUSE)
+#define SIZE_DESC_MOUSE_HH        HID_DESC_LEN(DESCRIPTOR_MOUSE_HH)
 #define SIZE_DESC_MOUSE_SW        94
-#define SIZE_DESC_TOUCH_TIME      20
-#define SIZE_DESC_TOUCH           480
-#define SIZE_DESC_TOUCH_EREA_IST1 442
-#define SIZE_DESC_TOUCH_EREA_IST2 (442+11*6)
-#ifndef TOUCH_SIZE
-  #define SIZE_DESC_TOUCH_EREA    SIZE_DESC_TOUCH_EREA_IST1
-#else
-  #define SIZE_DESC_TOUCH_EREA    SIZE_DESC_TOUCH_EREA_IST2
-#endif
-#ifndef POINT_OS_EREA
-  #define SIZE_DESC_MULTITOUCH    SIZE_DESC_TOUCH
-#else
-  #define SIZE_DESC_MULTITOUCH    SIZE_DESC_TOUCH_EREA
-#endif
-#define SIZE_DESC_TOUCH_EREA_HH2  (SIZE_DESC_TOUCH_EREA_IST2+SIZE_DESC_TOUCH_TIME)
+#define SIZE_DESC_TOUCH_TIME      HID_DESC_LEN(DESCRIPTOR_TOUCH_TIME)
+#define SIZE_DESC_TOUCH           HID_DESC_LEN(DESCRIPTOR_TOUCH)
+#define SIZE_DESC_TOUCH_EREA_IST1 HID_DESC_LEN(DESCRIPTOR_TOUCH_EREA_IST1)
+#define SIZE_DESC_TOUCH_EREA_IST2 HID_DESC_LEN(DESCRIPTOR_TOUCH_EREA_IST2)
+#define SIZE_DESC_TOUCH_EREA      HID_DESC_LEN(DESCRIPTOR_TOUCH_EREA)
+#define SIZE_DESC_MULTITOUCH      HID_DESC_LEN(DESCRIPTOR_MULTITOUCH)
+#define SIZE_DESC_TOUCH_EREA_HH2  HID_DESC_LEN(DESCRIPTOR_TOUCH_EREA_HH2)
 #define SIZE_DESC_TOUCH_EREA_SW   516
-#define SIZE_DESC_TOUCH_EREA_TST  533
-#define SIZE_DESC_TOUCH_EREA_CK   690
-#define SIZE_DESC_PEN             86
-#define SIZE_DESC_PEN_NEW         133
-#define SIZE_DESC_PEN_PM          70
+#define SIZE_DESC_TOUCH_EREA_TST  HID_DESC_LEN(DESCRIPTOR_TOUCH_EREA_TST)
+#define SIZE_DESC_TOUCH_EREA_CK   HID_DESC_LEN(DESCRIPTOR_TOUCH_EREA_CK)
+#define SIZE_DESC_PEN             HID_DESC_LEN(DESCRIPTOR_PEN)
+#define SIZE_DESC_PEN_NEW         HID_DESC_LEN(DESCRIPTOR_PEN_NEW)
+#define SIZE_DESC_PEN_PM          HID_DESC_LEN(DESCRIPTOR_PEN_PM)
 
 
 #define TOUCH_SIZE_W        1920
@@ -111,6 +110,9 @@
     #define HID_MAC_REPORT_DESC_SIZE          (SIZE_DESC_USER_FDFE_SW+SIZE_DESC_MOUSE_SW)	
   #elif defined(SEEWO)
     #define HID_MAC_REPORT_DESC_SIZE          (SIZE_DESC_USER_050607+SIZE_DESC_USER_FB+SIZE_DESC_USER_FC+SIZE_DESC_USER_A3+SIZE_DESC_USER_CH+SIZE_DESC_KEY+SIZE_DESC_MOUSE)	
+  #elif defined(TST) || defined(PM) || defined(VESTEL)
+    /* no Mac set of their own: interface 0 as for any other host */
+    #define HID_MAC_REPORT_DESC_SIZE          (HID_MOUSE_REPORT_DESC_SIZE)
   #elif defined(HONGHE)
     #define HID_MAC_REPORT_DESC_SIZE          (SIZE_DESC_USER_050607+SIZE_DESC_USER_A1+SIZE_DESC_USER_A2+SIZE_DESC_USER_A3+SIZE_DESC_KEY+SIZE_DESC_MOUSE)	  
   #else
@@ -125,7 +127,7 @@
 
 #elif defined(TST)
     #define HID_MOUSE_REPORT_DESC_SIZE      (SIZE_DESC_TOUCH_EREA_TST)
-    #define HID_WIN7_REPORT_DESC_SIZE       (SIZE_DESC_USER_0506+SIZE_DESC_MOUSE+SIZE_DESC_USER_A1+SIZE_DESC_USER_A2+SIZE_DESC_USER_A3+SIZE_DESC_KEY)
+    #define HID_WIN7_REPORT_DESC_SIZE       (SIZE_DESC_USER_0506+SIZE_DESC_MOUSE_HH)
     #define HID_INTF3_REPORT_DESC_SIZE      (0)
 
 #elif defined(CK)
@@ -144,7 +146,7 @@
     #define HID_INTF3_REPORT_DESC_SIZE      (SIZE_DESC_MOUSE)
 
 #elif defined(HONGHE)
-    #define HID_MOUSE_REPORT_DESC_SIZE      (SIZE_DESC_USER_050607+SIZE_DESC_USER_A1+SIZE_DESC_USER_A2+SIZE_DESC_USER_A3+SIZE_DESC_KEY+SIZE_DESC_MOUSE)
+    #define HID_MOUSE_REPORT_DESC_SIZE      (SIZE_DESC_USER_050607+SIZE_DESC_USER_A1+SIZE_DESC_USER_A2+SIZE_DESC_USER_A3+SIZE_DESC_KEY+SIZE_DESC_MOUSE_HH)
   #ifndef POINT_OS_EREA
     #define HID_WIN7_REPORT_DESC_SIZE       (SIZE_DESC_USER_HH+SIZE_DESC_MULTITOUCH)	
   #else	
@@ -201,6 +203,11 @@
 
 #define HID_REQ_SET_REPORT            0x09
 #define HID_REQ_GET_REPORT            0x01
+
+/* vendor request to a HID interface: USBD_STATS_ep of each IN EP,
+   wValue bit 0 clears them once read */
+#define USBD_HID_REQ_GET_STATS        0x01
+#define USBD_HID_STATS_CLEAR          0x01
 /**
   * @}
   */
@@ -209,7 +216,79 @@
 /** @defgroup USBD_CORE_Exported_TypesDefinitions
   * @{
   */
+#define USBD_HID_MAX_CORE             2     /* USB_OTG_HS_CORE_ID, USB_OTG_FS_CORE_ID */
+#define USBD_HID_NUM_EP               3     /* EP1..EP3, IN and OUT */
+
+/* multitouch input report of DESCRIPTOR_TOUCH: ID, 10 x (flags, contact ID, X, Y), count */
+#define USBD_HID_TOUCH_REPORT_ID      0x02
+#define USBD_HID_TOUCH_MAX_CONTACT    10
+#define USBD_HID_TOUCH_CONTACT_SIZE   6
+#define USBD_HID_TOUCH_REPORT_SIZE    (2 + USBD_HID_TOUCH_MAX_CONTACT * USBD_HID_TOUCH_CONTACT_SIZE)
+#define USBD_HID_TOUCH_TIP            0x01  /* tip switch bit of the contact flags */
+
+/* field layout of the touch report, so reports are filled by member, not by offset */
+typedef __packed struct _USBD_HID_TouchContact
+{
+  uint8_t         Flags;                       /* tip switch, in range, confidence */
+  uint8_t         ID;
+  uint16_t        X;
+  uint16_t        Y;
+} USBD_HID_TouchContact_TypeDef;
+
+typedef __packed struct _USBD_HID_TouchReport
+{
+  uint8_t         ReportID;                    /* USBD_HID_TOUCH_REPORT_ID */
+  USBD_HID_TouchContact_TypeDef Contact[USBD_HID_TOUCH_MAX_CONTACT];
+  uint8_t         Count;
+} USBD_HID_TouchReport_TypeDef;
+
+/* the scheduler only knows the 6 byte contacts of DESCRIPTOR_TOUCH */
+#if !defined(POINT_OS_EREA) && !defined(TST) && !defined(CK) && !defined(SEEWO_HID)
+  #define USBD_HID_TOUCH_COALESCE
+#endif
+
+/* contacts merged by contact ID, emitted from USBD_HID_SOF */
+typedef struct _USBD_HID_Touch
+{
+  USBD_HID_TouchContact_TypeDef Contact[USBD_HID_TOUCH_MAX_CONTACT];
+  uint16_t        Active;                      /* slot holds a known finger */
+  uint16_t        Dirty;                       /* slot changed since last report */
+  uint8_t         EP;                          /* IN endpoint of the touch interface */
+  uint32_t        Merged;                      /* updates folded into a pending one */
+  uint32_t        Drop;                        /* updates lost, table or ring full */
+} USBD_HID_Touch_TypeDef;
+
+/* GET_DESCRIPTOR answers of one interface, served in place */
+typedef struct _USBD_HID_ItfDesc
+{
+  uint8_t  *pHid;               /* HID class descriptor, NULL if none */
+  uint8_t  *pReport;
+  uint16_t  ReportLen;          /* 0 if the interface has no report descriptor */
+} USBD_HID_ItfDesc_TypeDef;
+
+/* HID class state of one OTG core, so FS and HS can run concurrently */
+typedef struct _USBD_HID_Core
+{
+  USBD_FIFO_type  TxFIFO[USBD_HID_NUM_EP];
+  uint8_t         RcvBuf[USBD_HID_NUM_EP][HID_OUT_PACKET];
+  uint8_t         CtrlBuf[64];                 /* SET_REPORT data stage */
+  uint8_t         OutReport[HID_OUT_PACKET];   /* last EP1 OUT report */
+  __IO uint8_t    OutReady;
+  __IO uint8_t    TxValid[USBD_HID_NUM_EP];    /* 1: IN EP idle */
+  uint8_t         TxCount[USBD_HID_NUM_EP];    /* queued reports in the transfer in flight */
+  uint32_t        Protocol;
+  uint32_t        IdleState;
+  uint32_t        AltSet;
+  __IO uint8_t    Busy;                        /* main loop is producing, SOF must wait */
+  uint32_t        TxDrop[USBD_HID_NUM_EP];     /* reports lost on a full TX queue */
+#ifdef USBD_HID_STATS
+  USBD_STATS_type Stats[USBD_HID_NUM_EP];
+#endif
+  USBD_HID_Touch_TypeDef Touch;
+  USBD_HID_ItfDesc_TypeDef ItfDesc[USBD_HID_NUM_EP];  /* by interface, for the host of this core */
+} USBD_HID_Core_TypeDef;
 
+#define USBD_HID_CORE(pdev)  (&USBD_HID_Core[((USB_OTG_CORE_HANDLE *)(pdev))->cfg.coreID])
 
 /**
   * @}
@@ -232,13 +311,8 @@
 extern USBD_Class_cb_TypeDef  USBD_HID_cb;
 extern USBD_Class_cb_TypeDef  USBD_HID_cb1;
 
-extern __IO u8 USBD_HID_TxValid_EP1;
-extern __IO u8 USBD_HID_TxValid_EP2;
-extern __IO u8 USBD_HID_TxValid_EP3;
-extern u8 USBD_HID_RcvBuf[64];
+extern USBD_HID_Core_TypeDef USBD_HID_Core[USBD_HID_MAX_CORE];
 
-
-extern u8 USB_Buffer_PM[64];
 extern u8 Host_OS;
 
 
@@ -259,8 +333,20 @@ uint8_t USBD_HID_SendReport_EP2 (USB_OTG_CORE_HANDLE  *pdev,
 uint8_t USBD_HID_SendReport_EP3 (USB_OTG_CORE_HANDLE  *pdev,
                                  uint8_t *report,
                                  uint16_t len);
+uint8_t *USBD_HID_ReserveReport (USB_OTG_CORE_HANDLE  *pdev,
+                                 uint8_t epnum);
+uint8_t USBD_HID_CommitReport (USB_OTG_CORE_HANDLE  *pdev,
+                               uint8_t epnum,
+                               uint16_t len);
+uint8_t USBD_HID_ReadOutReport (USB_OTG_CORE_HANDLE  *pdev,
+                                uint8_t *buf);
 void WaitForUSBDFIFO(void);
 void USBD_FIFO_FlushAll(void);
+#ifdef USBD_HID_STATS
+void USBD_HID_GetStats (USB_OTG_CORE_HANDLE  *pdev,
+                        uint8_t epnum,
+                        USBD_STATS_ep *stats);
+#endif
 
 /**
   * @}
@@ -50,9 +50,12 @@
 #include "usbd_hid_core.h"
 #include "usbd_desc.h"
 #include "usbd_req.h"
+#include "usbd_hostos.h"
 //#include "includes.h"
 //#include "irt10_config.h"
 #include "usbd_fifo.h"
+#include "usbd_trace.h"
+#include <string.h>
 
 #define INT_BULK 3
 //#define INT_BULK 2
@@ -1364,6 +1367,31 @@
 /** @defgroup USBD_HID_Private_Defines
   * @{
   */
+#ifdef USBD_HID_HS_BATCH
+  #ifndef USB_OTG_HS_INTERNAL_DMA_ENABLED
+    #error "USBD_HID_HS_BATCH needs USB_OTG_HS_INTERNAL_DMA_ENABLED"
+  #endif
+  #if (USBD_HID_HS_BATCH_EP == HID_IN_EP3) && (INT_BULK != 3)
+    #error "USBD_HID_HS_BATCH needs an interrupt EP3 (INT_BULK 3)"
+  #endif
+  #define USBD_HID_HS_BATCH_SIZE    (USBD_HID_HS_MPS * USBD_HID_HS_MULT)
+  #define USBD_HID_HS_EP_MPS        (USBD_HID_HS_MPS | ((USBD_HID_HS_MULT - 1) << 11))
+  /* only the HS core can enumerate at high speed */
+  #define USBD_HID_IS_BATCH(pdev, ep) ((((ep) | 0x80) == USBD_HID_HS_BATCH_EP) && \
+                                       (((USB_OTG_CORE_HANDLE *)(pdev))->cfg.speed == USB_OTG_SPEED_HIGH))
+  #define USBD_HID_IN_MPS(pdev, ep) (USBD_HID_IS_BATCH(pdev, ep) ? USBD_HID_HS_EP_MPS : HID_IN_PACKET)
+#else
+  #define USBD_HID_IS_BATCH(pdev, ep) 0
+  #define USBD_HID_IN_MPS(pdev, ep) HID_IN_PACKET
+#endif
+
+#if defined(USBD_HID_HS_BATCH) && defined(USB_OTG_HS_CORE)
+/* Rx, EP0 and one Tx FIFO per IN EP (EP3 batched) must fit the HS FIFO RAM */
+typedef char USBD_HID_HS_FifoCheck[(RX_FIFO_HS_SIZE + TX0_FIFO_HS_SIZE +
+                                    (USBD_HID_HS_BATCH_SIZE + 3) / 4 +
+                                    (USBD_HID_NUM_EP - 1) * (HID_IN_PACKET / 4) <=
+                                    USB_OTG_HS_TOTAL_FIFO_SIZE - USB_OTG_DMA_FIFO_RESERVED) ? 1 : -1];
+#endif
 
 /**
   * @}
@@ -1395,27 +1423,18 @@ static uint8_t  USBD_HID_Setup (void  *pdev,
                                 USB_SETUP_REQ *req);
 
 static uint8_t  *USBD_HID_GetCfgDesc (uint8_t speed, uint16_t *length);
+static uint8_t  *USBD_HID_GetCoreCfgDesc (void *pdev, uint8_t speed, uint16_t *length);
+static uint8_t  *USBD_HID_GetItfDesc (void *pdev, uint8_t itf, uint8_t idx,
+                                      uint16_t *wValue, uint16_t *length);
+static uint8_t  *USBD_HID_CfgDescFor (uint8_t speed, uint8_t os, uint16_t *length);
 
 static uint8_t  USBD_HID_DataIn (void  *pdev, uint8_t epnum);
 static uint8_t  USBD_HID_DataOut (void  *pdev, uint8_t epnum);
-static uint8_t  USBD_HID_DataOut_HS (void  *pdev, uint8_t epnum);
 
 static uint8_t  USBD_HID_SOF (void  *pdev);
 
 extern void EP1_OUT_Callback(u8 *);
 
-int usb_check = 0;
-#if 0
-typedef enum
-{
-    USB_CHECK_FS = 0x00,
-    USB_CHECK_HS = 0x01,
-    USB_CHECK_NUM,
-}USB_CHECK;
-
-USB_CHECK usb_check;
-#endif
-
 /**
   * @}
   */
@@ -1423,20 +1442,18 @@ USB_CHECK usb_check;
 /** @defgroup USBD_HID_Private_Variables
   * @{
   */
-__ALIGN_BEGIN u8 USBD_HID_SndBuf[64] __ALIGN_END;
-__ALIGN_BEGIN u8 USBD_HID_SndBuf2[64] __ALIGN_END;
+#if INT_BULK==2
 __ALIGN_BEGIN u8 USBD_HID_SndBuf3[64] __ALIGN_END;
-__ALIGN_BEGIN u8 USBD_HID_RcvBuf[64] __ALIGN_END;
-__ALIGN_BEGIN u8 USBD_HID_RcvBuf2[64] __ALIGN_END;
-__ALIGN_BEGIN u8 USBD_HID_RcvBuf3[64] __ALIGN_END;
-__ALIGN_BEGIN u8 USB_Buffer_PM[64] __ALIGN_END;
+#endif
 
-// USB HID ͳͻ
-__IO u8 USBD_HID_TxValid_EP1 = 1;
-__IO u8 USBD_HID_TxValid_EP2 = 1;
-__IO u8 USBD_HID_TxValid_EP3 = 1;
-__IO u8 USBD_HID_TxCnt = 0;    
+#ifdef USBD_HID_HS_BATCH
+/* HS transfers of the batched EP: queued reports packed back to back */
+__ALIGN_BEGIN static uint8_t USBD_HID_BatchBuf[USBD_HID_HS_BATCH_SIZE] __ALIGN_END;
+__ALIGN_BEGIN static uint8_t USBD_HID_CfgDescHS[USB_HID_CONFIG_DESC_SIZ] __ALIGN_END;
+#endif
 
+/* one HID context per OTG core, indexed by cfg.coreID */
+__ALIGN_BEGIN USBD_HID_Core_TypeDef USBD_HID_Core[USBD_HID_MAX_CORE] __ALIGN_END;
 
 USBD_Class_cb_TypeDef  USBD_HID_cb =
 {
@@ -1454,6 +1471,11 @@ USBD_Class_cb_TypeDef  USBD_HID_cb =
 #ifdef USB_OTG_HS_CORE
   USBD_HID_GetCfgDesc, /* use same config as per FS */
 #endif
+#ifdef USB_SUPPORT_USER_STRING_DESC
+  NULL,
+#endif
+  USBD_HID_GetCoreCfgDesc,
+  USBD_HID_GetItfDesc,
 };
 
 USBD_Class_cb_TypeDef  USBD_HID_cb1 =
@@ -1464,7 +1486,7 @@ USBD_Class_cb_TypeDef  USBD_HID_cb1 =
   NULL, /*EP0_TxSent*/
   NULL, /*EP0_RxReady*/
   USBD_HID_DataIn, /*DataIn*/
-  USBD_HID_DataOut_HS,
+  USBD_HID_DataOut,
   USBD_HID_SOF, /*SOF */
   NULL,
   NULL,
@@ -1472,29 +1494,13 @@ USBD_Class_cb_TypeDef  USBD_HID_cb1 =
 #ifdef USB_OTG_HS_CORE
   USBD_HID_GetCfgDesc, /* use same config as per FS */
 #endif
+#ifdef USB_SUPPORT_USER_STRING_DESC
+  NULL,
+#endif
+  USBD_HID_GetCoreCfgDesc,
+  USBD_HID_GetItfDesc,
 };
 
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
-    #pragma data_alignment=4
-  #endif
-#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN static uint32_t  USBD_HID_AltSet  __ALIGN_END = 0;
-
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
-    #pragma data_alignment=4
-  #endif
-#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN static uint32_t  USBD_HID_Protocol  __ALIGN_END = 0;
-
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
-    #pragma data_alignment=4
-  #endif
-#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN static uint32_t  USBD_HID_IdleState __ALIGN_END = 0;
-
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
   #if defined ( __ICCARM__ ) /*!< IAR Compiler */
     #pragma data_alignment=4
@@ -1665,7 +1671,7 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgDesc_MAC[USB_HID_CONFIG_DESC_SIZ_MAC] _
 {
   0x09, /* bLength: Configuration Descriptor size */
   USB_CONFIGURATION_DESCRIPTOR_TYPE, /* bDescriptorType: Configuration */
-  USB_HID_CONFIG_DESC_SIZ,
+  USB_HID_CONFIG_DESC_SIZ_MAC,
   /* wTotalLength: Bytes returned */
   0x00,
   0x01,      /*bNumInterfaces: 2 interface*/
@@ -1754,6 +1760,21 @@ __ALIGN_BEGIN static uint8_t USBD_HID_Desc_WIN7[USB_HID_DESC_SIZ] __ALIGN_END=
   HID_WIN7_REPORT_DESC_SIZE/256,
 };
 
+/* USB HID device Configuration Descriptor */
+__ALIGN_BEGIN static uint8_t USBD_HID_Desc_INTF3[USB_HID_DESC_SIZ] __ALIGN_END=
+{
+  /* 18 */
+  0x09,         /*bLength: HID Descriptor size*/
+  HID_DESCRIPTOR_TYPE, /*bDescriptorType: HID*/
+  0x11,         /*bcdHID: HID Class Spec release number*/
+  0x01,
+  0x00,         /*bCountryCode: Hardware target country*/
+  0x01,         /*bNumDescriptors: Number of HID class descriptors to follow*/
+  0x22,         /*bDescriptorType*/
+  (u8)HID_INTF3_REPORT_DESC_SIZE,/*wItemLength: Total length of Report descriptor*/
+  HID_INTF3_REPORT_DESC_SIZE/256,
+};
+
 /* USB HID device Configuration Descriptor */
 __ALIGN_BEGIN static uint8_t USBD_HID_Desc_MAC[USB_HID_DESC_SIZ] __ALIGN_END=
 {
@@ -1781,7 +1802,7 @@ __ALIGN_BEGIN static uint8_t USBD_HID_Desc_MAC[USB_HID_DESC_SIZ] __ALIGN_END=
 
 //----------------------------------- CW -------------------------------------
 #if defined(CHUANGWEI)
-__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __ALIGN_END =
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
 {
     // interface 1
     DESCRIPTOR_USER0506
@@ -1790,7 +1811,7 @@ __ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __
 };
 //----------------------------------- TST -------------------------------------
 #elif defined(TST)
-__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __ALIGN_END =
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
 {
     // interface 1
     DESCRIPTOR_TOUCH_EREA_TST
@@ -1800,7 +1821,7 @@ __ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __
 };
 //----------------------------------- CK -------------------------------------
 #elif defined(CK)
-__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __ALIGN_END =
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
 {
     // interface 1
     DESCRIPTOR_USER050607
@@ -1809,7 +1830,7 @@ __ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __
 };
 //----------------------------------- CH -------------------------------------
 #elif defined(CHANGHONG)
-__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __ALIGN_END =
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
 {
     // interface 1
     DESCRIPTOR_USER050607
@@ -1824,7 +1845,7 @@ __ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __
 };
 //----------------------------------- PM -------------------------------------
 #elif defined(PM)
-__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __ALIGN_END =
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
 {
     // interface 1
     DESCRIPTOR_USER_PM
@@ -1836,7 +1857,7 @@ __ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __
 };
 //----------------------------------- HH -------------------------------------
 #elif defined(HONGHE)
-__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __ALIGN_END =
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
 {
     // interface 1
     DESCRIPTOR_USER050607
@@ -1859,7 +1880,7 @@ __ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __
 };
 //----------------------------------- SEEWO -------------------------------------
 #elif defined(SEEWO)
-__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __ALIGN_END =
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
 {
     // interface 1
     DESCRIPTOR_USER050607
@@ -1874,10 +1895,25 @@ __ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __
     DESCRIPTOR_MULTITOUCH
     DESCRIPTOR_PEN_NEW
 };
+//----------------------------------- VESTEL -------------------------------------
+#elif defined(VESTEL)
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
+{
+    // interface 1
+    DESCRIPTOR_USER050607
+    DESCRIPTOR_USERA1
+    DESCRIPTOR_USERA2
+    DESCRIPTOR_USERA3
+    DESCRIPTOR_USER_CH
+    DESCRIPTOR_MOUSE
+
+    // interface 2
+    DESCRIPTOR_MULTITOUCH
+};
 
 //----------------------------------- IST -------------------------------------
 #else
-__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __ALIGN_END =
+__ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[] __ALIGN_END =
 {
     // interface 1
     DESCRIPTOR_USER050607
@@ -1896,10 +1932,50 @@ __ALIGN_BEGIN static uint8_t HID_Mouse_Touch_ReportDesc[HID_REPORT_DESC_SIZE] __
 };
 #endif
 
+/* the per-interface sizes in usbd_hid_core.h must add up to the bytes above */
+typedef char HID_ReportDesc_SizeCheck[(sizeof(HID_Mouse_Touch_ReportDesc) == HID_REPORT_DESC_SIZE) ? 1 : -1];
+
 u8* HID_MOUSE_ReportDesc = HID_Mouse_Touch_ReportDesc;
 u8* HID_Intf3_ReportDesc = HID_Mouse_Touch_ReportDesc +HID_MOUSE_REPORT_DESC_SIZE;
 u8* HID_WIN7_ReportDesc  = HID_Mouse_Touch_ReportDesc +HID_MOUSE_REPORT_DESC_SIZE+HID_INTF3_REPORT_DESC_SIZE;
 
+/* GET_DESCRIPTOR answers per interface, copied to each core at Init;
+   interfaces left out of the configuration stay zero: both requests stall */
+static const USBD_HID_ItfDesc_TypeDef USBD_HID_ItfDescDefault[USBD_HID_NUM_EP] =
+{
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  { USBD_HID_Desc,
+    HID_Mouse_Touch_ReportDesc, HID_MOUSE_REPORT_DESC_SIZE },
+#ifndef USB_ONE_INTERFACE
+  { USBD_HID_Desc_WIN7,
+    HID_Mouse_Touch_ReportDesc + HID_MOUSE_REPORT_DESC_SIZE + HID_INTF3_REPORT_DESC_SIZE,
+    HID_WIN7_REPORT_DESC_SIZE },
+#endif
+#else
+  /* HID descriptors inside USBD_HID_CfgDesc: 9 + 9, 9 + 32 + 9 and 9 + 64 + 9 */
+  { USBD_HID_CfgDesc + 0x12,
+    HID_Mouse_Touch_ReportDesc, HID_MOUSE_REPORT_DESC_SIZE },
+#ifndef USB_ONE_INTERFACE
+  { USBD_HID_CfgDesc + 0x32,
+    HID_Mouse_Touch_ReportDesc + HID_MOUSE_REPORT_DESC_SIZE + HID_INTF3_REPORT_DESC_SIZE,
+    HID_WIN7_REPORT_DESC_SIZE },
+#endif
+#endif
+#if !defined(USB_ONE_INTERFACE) && !defined(USB_TWO_INTERFACE)
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  { USBD_HID_Desc_INTF3,
+#else
+  { USBD_HID_CfgDesc + 0x52,
+#endif
+    HID_Mouse_Touch_ReportDesc + HID_MOUSE_REPORT_DESC_SIZE,
+    HID_INTF3_REPORT_DESC_SIZE },
+#endif
+};
+
+#ifdef USBD_HID_STATS
+/* snapshot sent by USBD_HID_REQ_GET_STATS */
+__ALIGN_BEGIN static USBD_STATS_ep USBD_HID_StatsBuf[USBD_HID_MAX_CORE][USBD_HID_NUM_EP] __ALIGN_END;
+#endif
 
 __ALIGN_BEGIN static uint8_t HID_MOUSE_ReportValue[HID_MOUSE_REPORT_VALUE_SIZE] __ALIGN_END =
 {
@@ -1929,11 +2005,16 @@ __ALIGN_BEGIN static uint8_t HID_MOUSE_ReportValue[HID_MOUSE_REPORT_VALUE_SIZE]
 static uint8_t  USBD_HID_Init (void  *pdev,
                                uint8_t cfgidx)
 {
+  USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
+  int i;
+#ifdef USBD_HID_HOST_OS_DESC
+  uint8_t mac;
+#endif
 
   /* Open EP IN */
   DCD_EP_Open(pdev,
               HID_IN_EP,
-              HID_IN_PACKET,
+              USBD_HID_IN_MPS(pdev, HID_IN_EP),
               USB_OTG_EP_INT);
 
   /* Open EP OUT */
@@ -1945,7 +2026,7 @@ static uint8_t  USBD_HID_Init (void  *pdev,
     /* Open EP IN */
   DCD_EP_Open(pdev,
               HID_IN_EP2,
-              HID_IN_PACKET,
+              USBD_HID_IN_MPS(pdev, HID_IN_EP2),
               USB_OTG_EP_INT);
 
   /* Open EP OUT */
@@ -1957,7 +2038,7 @@ static uint8_t  USBD_HID_Init (void  *pdev,
   	/* Open EP IN */
   DCD_EP_Open(pdev,
               HID_IN_EP3,
-              HID_IN_PACKET,
+              USBD_HID_IN_MPS(pdev, HID_IN_EP3),
               USB_OTG_EP_INT);
 
   /* Open EP OUT */
@@ -1966,9 +2047,41 @@ static uint8_t  USBD_HID_Init (void  *pdev,
               HID_OUT_PACKET,
               USB_OTG_EP_INT);
 
-  DCD_EP_PrepareRx(pdev, HID_OUT_EP, USBD_HID_RcvBuf, 64);
-  DCD_EP_PrepareRx(pdev, HID_OUT_EP2, USBD_HID_RcvBuf2, 64);
-  DCD_EP_PrepareRx(pdev, HID_OUT_EP3, USBD_HID_RcvBuf3, 64);
+  /* transfer complete on the HID EPs skips the core's DataIn/OutStage */
+  DCD_EP_SetHandler(pdev, HID_IN_EP, USBD_HID_DataIn);
+  DCD_EP_SetHandler(pdev, HID_IN_EP2, USBD_HID_DataIn);
+  DCD_EP_SetHandler(pdev, HID_IN_EP3, USBD_HID_DataIn);
+  DCD_EP_SetHandler(pdev, HID_OUT_EP, USBD_HID_DataOut);
+  DCD_EP_SetHandler(pdev, HID_OUT_EP2, USBD_HID_DataOut);
+  DCD_EP_SetHandler(pdev, HID_OUT_EP3, USBD_HID_DataOut);
+
+  DCD_EP_PrepareRx(pdev, HID_OUT_EP, hid->RcvBuf[0], HID_OUT_PACKET);
+  DCD_EP_PrepareRx(pdev, HID_OUT_EP2, hid->RcvBuf[1], HID_OUT_PACKET);
+  DCD_EP_PrepareRx(pdev, HID_OUT_EP3, hid->RcvBuf[2], HID_OUT_PACKET);
+
+  /* reports queued before (re)configuration are stale */
+  for (i = 0; i < USBD_HID_NUM_EP; i++)
+  {
+    USBD_FIFO_Flush(&hid->TxFIFO[i]);
+    hid->TxValid[i] = 1;
+  }
+  hid->OutReady = 0;
+  hid->Touch.Active = 0;
+  hid->Touch.Dirty = 0;
+
+  memcpy(hid->ItfDesc, USBD_HID_ItfDescDefault, sizeof (hid->ItfDesc));
+#ifdef USBD_HID_HOST_OS_DESC
+  /* interface 0 answers follow the descriptor set picked for this host */
+  mac = (USBD_HostOS_Get(pdev) == USBD_HOST_OS_MACOS);
+  hid->ItfDesc[0].ReportLen = mac ? HID_MAC_REPORT_DESC_SIZE :
+                                    HID_MOUSE_REPORT_DESC_SIZE;
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  hid->ItfDesc[0].pHid = mac ? USBD_HID_Desc_MAC : USBD_HID_Desc;
+#else
+  hid->ItfDesc[0].pHid = mac ? USBD_HID_CfgDesc_MAC + 0x12 :
+                               USBD_HID_CfgDesc + 0x12;
+#endif
+#endif
 
   return USBD_OK;
 }
@@ -2006,32 +2119,59 @@ static uint8_t  USBD_HID_DeInit (void  *pdev,
 static uint8_t  USBD_HID_Setup (void  *pdev,
                                 USB_SETUP_REQ *req)
 {
+  USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
   uint16_t len = 0;
   uint8_t  *pbuf = NULL;
+#ifdef USBD_HID_STATS
+  USBD_STATS_ep *snap;
+  int i;
+#endif
 
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
+#ifdef USBD_HID_STATS
+  case USB_REQ_TYPE_VENDOR :
+    if (req->bRequest != USBD_HID_REQ_GET_STATS)
+    {
+      USBD_CtlError (pdev, req);
+      return USBD_FAIL;
+    }
+    /* producer counters may lose an increment racing with the clear */
+    snap = USBD_HID_StatsBuf[((USB_OTG_CORE_HANDLE *)pdev)->cfg.coreID];
+    for (i = 0; i < USBD_HID_NUM_EP; i++)
+    {
+      snap[i] = hid->Stats[i].ep;
+      if (req->wValue & USBD_HID_STATS_CLEAR)
+        memset(&hid->Stats[i].ep, 0, sizeof (USBD_STATS_ep));
+    }
+    USBD_CtlSendData (pdev,
+                      (uint8_t *)snap,
+                      MIN(sizeof (USBD_STATS_ep) * USBD_HID_NUM_EP, req->wLength));
+    break;
+#endif
+
+
   case USB_REQ_TYPE_CLASS :
     switch (req->bRequest)
     {
 
     case HID_REQ_SET_PROTOCOL:
-      USBD_HID_Protocol = (uint8_t)(req->wValue);
+      hid->Protocol = (uint8_t)(req->wValue);
       break;
 
     case HID_REQ_GET_PROTOCOL:
       USBD_CtlSendData (pdev,
-                        (uint8_t *)&USBD_HID_Protocol,
+                        (uint8_t *)&hid->Protocol,
                         1);
       break;
 
     case HID_REQ_SET_IDLE:
-      USBD_HID_IdleState = (uint8_t)(req->wValue >> 8);
+      hid->IdleState = (uint8_t)(req->wValue >> 8);
       break;
 
     case HID_REQ_GET_IDLE:
       USBD_CtlSendData (pdev,
-                        (uint8_t *)&USBD_HID_IdleState,
+                        (uint8_t *)&hid->IdleState,
                         1);
       break;
 
@@ -2054,9 +2194,10 @@ static uint8_t  USBD_HID_Setup (void  *pdev,
 #else
       if ((req->wValue & 0xff) == 0x04) {
 #endif
-      //  Host_OS = Host_OS_Win7;
+        /* the Win7 touch feature report */
+        USBD_HostOS_Hint(pdev, USBD_HOST_OS_WINDOWS);
       }
-      USBD_CtlPrepareRx (pdev, USB_Buffer_PM, 64);
+      USBD_CtlPrepareRx (pdev, hid->CtrlBuf, 64);
     }
       break;
     default:
@@ -2069,80 +2210,311 @@ static uint8_t  USBD_HID_Setup (void  *pdev,
     switch (req->bRequest)
     {
       case USB_REQ_GET_DESCRIPTOR:
-      if( req->wValue >> 8 == HID_REPORT_DESC)
       {
-          if((req->wIndex & 0xFF) == 0) {
-#ifdef MAC_RECONNECT						
-            if(macUsbReconnectFlag)
-              len = MIN(HID_MAC_REPORT_DESC_SIZE , req->wLength);
-            else
-#endif							
-              len = MIN(HID_MOUSE_REPORT_DESC_SIZE , req->wLength);
-            pbuf = HID_MOUSE_ReportDesc;
-          }
-#ifndef USB_ONE_INTERFACE
-          else if((req->wIndex & 0xFF) == 1) {
-            len = MIN(HID_WIN7_REPORT_DESC_SIZE , req->wLength);
-            pbuf = HID_WIN7_ReportDesc;
-          }
-#ifndef USB_TWO_INTERFACE          
-          else if((req->wIndex & 0xFF) == 2) {					
-            len = MIN(HID_INTF3_REPORT_DESC_SIZE , req->wLength);
-            pbuf = HID_Intf3_ReportDesc;
-          }
-#endif          
-#endif
+        USBD_HID_ItfDesc_TypeDef *d;
+
+        d = ((req->wIndex & 0xFF) < USBD_HID_NUM_EP) ?
+            &USBD_HID_CORE(pdev)->ItfDesc[req->wIndex & 0xFF] : NULL;
+        if ((d != NULL) && (req->wValue >> 8 == HID_REPORT_DESC) && d->ReportLen)
+        {
+          USBD_CtlSendData (pdev, d->pReport, MIN(d->ReportLen , req->wLength));
         }
-      else if( req->wValue >> 8 == HID_DESCRIPTOR_TYPE)
-      {
-        if((req->wIndex & 0xFF) == 0) {
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-    #ifdef MAC_RECONNECT					
-            if(macUsbReconnectFlag)
-                pbuf = USBD_HID_Desc_MAC;	
-            else
-    #endif							
-                pbuf = USBD_HID_Desc;
-#else
-    #ifdef MAC_RECONNECT
-            if(macUsbReconnectFlag)
-                pbuf = USBD_HID_CfgDesc_MAC + 0x12;	
-            else
-    #endif							
-                pbuf = USBD_HID_CfgDesc + 0x12;						            
-#endif
-            len = MIN(USB_HID_DESC_SIZ , req->wLength);
+        else if ((d != NULL) && (req->wValue >> 8 == HID_DESCRIPTOR_TYPE) && d->pHid)
+        {
+          USBD_CtlSendData (pdev, d->pHid, MIN(USB_HID_DESC_SIZ , req->wLength));
         }
-        else if((req->wIndex & 0xFF) == 1) {
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-            pbuf = USBD_HID_Desc_WIN7;
-#else
-            pbuf = USBD_HID_CfgDesc + 0x12;
-#endif
-            len = MIN(USB_HID_DESC_SIZ , req->wLength);
+        else
+        {
+          USBD_CtlError (pdev, req);
+          return USBD_FAIL;
         }
       }
-
-      USBD_CtlSendData (pdev,
-                        pbuf,
-                        len);
-
       break;
 
     case USB_REQ_GET_INTERFACE :
       USBD_CtlSendData (pdev,
-                        (uint8_t *)&USBD_HID_AltSet,
+                        (uint8_t *)&hid->AltSet,
                         1);
       break;
 
     case USB_REQ_SET_INTERFACE :
-      USBD_HID_AltSet = (uint8_t)(req->wValue);
+      hid->AltSet = (uint8_t)(req->wValue);
       break;
     }
   }
   return USBD_OK;
 }
 
+#ifdef USBD_HID_HS_BATCH
+/**
+  * @brief  USBD_HID_TxBatch
+  *         Pack the queued reports of an IN endpoint back to back, so one
+  *         DMA transfer carries up to USBD_HID_HS_MULT packets per microframe.
+  *         The slots stay queued until DataIn releases hid->TxCount of them.
+  * @param  hid: HID state of the HS core
+  * @param  idx: IN endpoint index (0..USBD_HID_NUM_EP-1)
+  * @param  dst: USBD_HID_HS_BATCH_SIZE bytes DMA buffer
+  * @retval number of bytes packed
+  */
+static uint16_t USBD_HID_TxBatch (USBD_HID_Core_TypeDef *hid,
+                                  uint8_t idx,
+                                  uint8_t *dst)
+{
+    u8 *src;
+    u16 len, last = 0, total = 0;
+    u8 n = 0;
+
+    while ((src = USBD_FIFO_At(&hid->TxFIFO[idx], n, &len)) != NULL)
+    {
+        if (total + len > USBD_HID_HS_BATCH_SIZE)
+            break;
+        memcpy(dst + total, src, len);
+        total += len;
+        last = len;
+        n++;
+    }
+    /* a transfer ending on a full packet would make the host wait for more */
+    if (n > 1 && (total % USBD_HID_HS_MPS) == 0)
+    {
+        total -= last;
+        n--;
+    }
+    hid->TxCount[idx] = n;
+    return total;
+}
+#endif
+
+/**
+  * @brief  USBD_HID_TxNext
+  *         Start the IN transfer of the report at the head of the queue.
+  *         The slot is transmitted in place and released in DataIn.
+  * @param  pdev: device instance
+  * @param  epnum: IN endpoint address
+  * @retval None
+  */
+static void USBD_HID_TxNext (void *pdev, uint8_t epnum)
+{
+    USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
+    uint8_t idx = (epnum & 0x7F) - 1;
+    u8 *buf;
+    u16 len;
+
+    buf = USBD_FIFO_Front(&hid->TxFIFO[idx], &len);
+    if (buf == NULL) {
+        hid->TxValid[idx] = 1;
+        return;
+    }
+    hid->TxCount[idx] = 1;
+#ifdef USBD_HID_HS_BATCH
+    if (USBD_HID_IS_BATCH(pdev, epnum) && USBD_FIFO_Used(&hid->TxFIFO[idx]) > 1)
+    {
+        buf = USBD_HID_BatchBuf;
+        len = USBD_HID_TxBatch(hid, idx, buf);
+    }
+#endif
+    DCD_EP_Tx (pdev, epnum, buf, len);
+}
+
+/**
+  * @brief  USBD_HID_ReserveReport
+  *         Reserve a TX slot so the caller can build a report in place.
+  *         Main loop only; USBD_HID_SOF also produces touch reports,
+  *         so hold hid->Busy around Reserve/Commit on the touch endpoint.
+  * @param  pdev: device instance
+  * @param  epnum: IN endpoint address (HID_IN_EP, HID_IN_EP2, HID_IN_EP3)
+  * @retval pointer to a USBD_FIFO_SLOT_SIZE buffer, NULL if not available
+  */
+uint8_t *USBD_HID_ReserveReport (USB_OTG_CORE_HANDLE  *pdev,
+                                 uint8_t epnum)
+{
+    if (pdev->dev.device_status != USB_OTG_CONFIGURED)
+        return NULL;
+    return USBD_FIFO_Reserve(&USBD_HID_CORE(pdev)->TxFIFO[(epnum & 0x7F) - 1]);
+}
+
+/**
+  * @brief  USBD_HID_CommitReport
+  *         Queue the slot returned by USBD_HID_ReserveReport and start
+  *         the transfer if the endpoint is idle
+  * @param  pdev: device instance
+  * @param  epnum: IN endpoint address
+  * @param  len: report length
+  * @retval status
+  */
+uint8_t USBD_HID_CommitReport (USB_OTG_CORE_HANDLE  *pdev,
+                               uint8_t epnum,
+                               uint16_t len)
+{
+    USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
+    uint8_t idx = (epnum & 0x7F) - 1;
+
+    USBD_STATS_COMMIT(&hid->Stats[idx], &hid->TxFIFO[idx]);
+    USBD_FIFO_Commit(&hid->TxFIFO[idx], len);
+    /* no transfer in flight -> no DataIn can race with this */
+    if (hid->TxValid[idx])
+    {
+        hid->TxValid[idx] = 0;
+        USBD_HID_TxNext(pdev, epnum);
+    }
+    return USBD_OK;
+}
+
+#ifdef USBD_HID_TOUCH_COALESCE
+/**
+  * @brief  USBD_HID_TouchEmit
+  *         Build one touch report from the contact table in the TX queue.
+  *         Every active finger is reported so the host always gets a
+  *         complete frame; a reported lift frees its slot.
+  * @param  pdev: device instance
+  * @retval 1 if the report was queued, 0 if the TX queue is full
+  */
+static uint8_t USBD_HID_TouchEmit (USB_OTG_CORE_HANDLE  *pdev)
+{
+    USBD_HID_Touch_TypeDef *t = &USBD_HID_CORE(pdev)->Touch;
+    USBD_HID_TouchReport_TypeDef *r;
+    u8 i, n = 0;
+
+    r = (USBD_HID_TouchReport_TypeDef *)USBD_HID_ReserveReport(pdev, t->EP);
+    if (r == NULL)
+        return 0;
+
+    r->ReportID = USBD_HID_TOUCH_REPORT_ID;
+    for (i = 0; i < USBD_HID_TOUCH_MAX_CONTACT; i++)
+    {
+        if (!(t->Active & (1 << i)))
+            continue;
+        r->Contact[n++] = t->Contact[i];
+        if (!(t->Contact[i].Flags & USBD_HID_TOUCH_TIP))
+            t->Active &= ~(1 << i);
+    }
+    memset(&r->Contact[n], 0, (USBD_HID_TOUCH_MAX_CONTACT - n) * USBD_HID_TOUCH_CONTACT_SIZE);
+    r->Count = n;
+    t->Dirty = 0;
+    USBD_HID_CommitReport(pdev, t->EP, USBD_HID_TOUCH_REPORT_SIZE);
+    return 1;
+}
+
+/**
+  * @brief  USBD_HID_TouchPost
+  *         Merge the contacts of a touch report into the contact table by
+  *         contact ID, only the newest state of each finger is kept.
+  *         The report is sent from USBD_HID_SOF, at most one per frame.
+  * @param  pdev: device instance
+  * @param  epnum: IN endpoint of the touch interface
+  * @param  r: touch report
+  * @retval None
+  */
+static void USBD_HID_TouchPost (USB_OTG_CORE_HANDLE  *pdev,
+                                uint8_t epnum,
+                                USBD_HID_TouchReport_TypeDef *r)
+{
+    USBD_HID_Touch_TypeDef *t = &USBD_HID_CORE(pdev)->Touch;
+    USBD_HID_TouchContact_TypeDef *c;
+    u8 i, j, k;
+
+    if (pdev->dev.device_status != USB_OTG_CONFIGURED)
+        return;
+
+    t->EP = epnum;
+    for (i = 0; i < USBD_HID_TOUCH_MAX_CONTACT; i++)
+    {
+        c = &r->Contact[i];
+        if (r->Count)
+        {
+            if (i >= r->Count)
+                break;
+        }
+        /* hybrid mode: continuation reports have a zero contact count */
+        else if (!(c->Flags | c->ID | c->X | c->Y))
+        {
+            continue;
+        }
+
+        /* slot of this contact ID, or the first free one */
+        k = USBD_HID_TOUCH_MAX_CONTACT;
+        for (j = 0; j < USBD_HID_TOUCH_MAX_CONTACT; j++)
+        {
+            if (t->Active & (1 << j))
+            {
+                if (t->Contact[j].ID == c->ID)
+                {
+                    k = j;
+                    break;
+                }
+            }
+            else if (k == USBD_HID_TOUCH_MAX_CONTACT)
+            {
+                k = j;
+            }
+        }
+        if (k == USBD_HID_TOUCH_MAX_CONTACT)
+        {
+            t->Drop++;
+            continue;
+        }
+
+#if USBD_HID_SCHED_POLICY == USBD_HID_SCHED_COMPLETE
+        /* a pending down/up would be overwritten, send it now */
+        if ((t->Dirty & (1 << k)) &&
+            ((t->Contact[k].Flags ^ c->Flags) & USBD_HID_TOUCH_TIP))
+        {
+            if (!USBD_HID_TouchEmit(pdev))
+                t->Drop++;
+        }
+#endif
+        if (t->Dirty & (1 << k))
+            t->Merged++;
+        t->Contact[k] = *c;
+        t->Active |= 1 << k;
+        t->Dirty |= 1 << k;
+    }
+}
+#endif /* USBD_HID_TOUCH_COALESCE */
+
+/**
+  * @brief  USBD_HID_QueueReport
+  *         Copy a caller report into the TX queue of an IN endpoint
+  * @param  pdev: device instance
+  * @param  epnum: IN endpoint address
+  * @param  report: pointer to report
+  * @param  len: report length, at most USBD_FIFO_SLOT_SIZE
+  * @retval status
+  */
+static uint8_t USBD_HID_QueueReport (USB_OTG_CORE_HANDLE  *pdev,
+                                     uint8_t epnum,
+                                     uint8_t *report,
+                                     uint16_t len)
+{
+    USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
+    u8 *buf;
+
+    if (len > USBD_FIFO_SLOT_SIZE)
+        return USBD_FAIL;
+    hid->Busy = 1;
+#ifdef USBD_HID_TOUCH_COALESCE
+    if (report[0] == USBD_HID_TOUCH_REPORT_ID && len == USBD_HID_TOUCH_REPORT_SIZE)
+    {
+        USBD_HID_TouchPost(pdev, epnum, (USBD_HID_TouchReport_TypeDef *)report);
+    }
+    else
+#endif
+    {
+        buf = USBD_HID_ReserveReport(pdev, epnum);
+        if (buf != NULL)
+        {
+            memcpy(buf, report, len);
+            USBD_HID_CommitReport(pdev, epnum, len);
+        }
+        else if (pdev->dev.device_status == USB_OTG_CONFIGURED)
+        {
+            hid->TxDrop[(epnum & 0x7F) - 1]++;
+            USBD_STATS_DROP(&hid->Stats[(epnum & 0x7F) - 1]);
+        }
+    }
+    hid->Busy = 0;
+    return USBD_OK;
+}
+
 /**
   * @brief  USBD_HID_SendReport
   *         Send HID Report
@@ -2171,19 +2543,7 @@ uint8_t USBD_HID_SendReport     (USB_OTG_CORE_HANDLE  *pdev,
     //if (!(Mode_Point&Mode_Point_OS) && report[0]==0x01) // block report from picasso subsystem
         //return USBD_OK;
 
-    if (pdev->dev.device_status == USB_OTG_CONFIGURED )
-    {
-        if (USBD_HID_TxValid_EP1)
-        {
-            USBD_HID_TxValid_EP1 = 0;
-            memcpy(USBD_HID_SndBuf, report, len);
-            DCD_EP_Tx (pdev, HID_IN_EP, USBD_HID_SndBuf, len);
-        }
-        else {
-            USBD_FIFO_Push(&USBD_HID_TxFIFO_EP1, report, &len);
-        }
-    }
-    return USBD_OK;
+    return USBD_HID_QueueReport(pdev, HID_IN_EP, report, len);
 }
 
 /**
@@ -2203,19 +2563,7 @@ uint8_t USBD_HID_SendReport_EP2 (USB_OTG_CORE_HANDLE  *pdev,
     //if (!(Mode_Point&Mode_Point_OS) && report[0]==0x02) // block report from picasso subsystem
         //return USBD_OK;
     
-    if (pdev->dev.device_status == USB_OTG_CONFIGURED )
-    {
-        if (USBD_HID_TxValid_EP2)
-        {
-            USBD_HID_TxValid_EP2 = 0;
-            memcpy(USBD_HID_SndBuf2, report, len);
-            DCD_EP_Tx (pdev, HID_IN_EP2, USBD_HID_SndBuf2, len);
-        }
-        else {
-            USBD_FIFO_Push(&USBD_HID_TxFIFO_EP2, report, &len);
-        }
-    }
-    return USBD_OK;
+    return USBD_HID_QueueReport(pdev, HID_IN_EP2, report, len);
 }
 
 
@@ -2229,32 +2577,107 @@ uint8_t USBD_HID_SendReport_EP3 (USB_OTG_CORE_HANDLE  *pdev,
     //if ((Mode_Point&Mode_Point_OS)==0 && report[0]==0x01) // block report from picasso subsystem
         //return USBD_OK;
     
-    if (pdev->dev.device_status == USB_OTG_CONFIGURED )
+    return USBD_HID_QueueReport(pdev, HID_IN_EP3, report, len);
+}
+
+/**
+  * @brief  USBD_HID_GetCfgDesc
+  *         return configuration descriptor, the one of no particular host
+  * @param  speed : current device speed
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t  *USBD_HID_GetCfgDesc (uint8_t speed, uint16_t *length)
+{
+    return USBD_HID_CfgDescFor(speed, USBD_HOST_OS_UNKNOWN, length);
+}
+
+/**
+  * @brief  USBD_HID_GetCoreCfgDesc
+  *         return configuration descriptor for the host OS guessed on a core
+  * @param  pdev: device instance
+  * @param  speed : current device speed
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t  *USBD_HID_GetCoreCfgDesc (void *pdev, uint8_t speed, uint16_t *length)
+{
+    return USBD_HID_CfgDescFor(speed, USBD_HostOS_Get(pdev), length);
+}
+
+/**
+  * @brief  USBD_HID_GetItfDesc
+  *         return the HID then the report descriptor of an interface, as
+  *         set up by USBD_HID_Init for the host of this core
+  * @param  pdev: device instance
+  * @param  itf : interface number
+  * @param  idx : 0 for the first descriptor
+  * @param  wValue : descriptor type << 8
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer, NULL past the last one
+  */
+static uint8_t  *USBD_HID_GetItfDesc (void *pdev, uint8_t itf, uint8_t idx,
+                                      uint16_t *wValue, uint16_t *length)
+{
+    USBD_HID_ItfDesc_TypeDef *d;
+
+    if (itf >= USBD_HID_NUM_EP)
     {
-        if (USBD_HID_TxValid_EP3)
+        return NULL;
+    }
+    d = &USBD_HID_CORE(pdev)->ItfDesc[itf];
+    if (d->pHid != NULL)
+    {
+        if (idx == 0)
         {
-            USBD_HID_TxValid_EP3 = 0;
-            memcpy(USBD_HID_SndBuf3, report, len);
-            DCD_EP_Tx (pdev, HID_IN_EP3, USBD_HID_SndBuf3, len);
-        }
-        else {
-            USBD_FIFO_Push(&USBD_HID_TxFIFO_EP3, report, &len);
+            *wValue = HID_DESCRIPTOR_TYPE << 8;
+            *length = USB_HID_DESC_SIZ;
+            return d->pHid;
         }
+        idx--;
     }
-    return USBD_OK;
+    if ((idx == 0) && d->ReportLen)
+    {
+        *wValue = HID_REPORT_DESC << 8;
+        *length = d->ReportLen;
+        return d->pReport;
+    }
+    return NULL;
 }
 
 /**
-  * @brief  USBD_HID_GetCfgDesc
+  * @brief  USBD_HID_CfgDescFor
   *         return configuration descriptor
   * @param  speed : current device speed
+  * @param  os : host OS, USBD_HOST_OS_xxx
   * @param  length : pointer data length
   * @retval pointer to descriptor buffer
   */
-static uint8_t  *USBD_HID_GetCfgDesc (uint8_t speed, uint16_t *length)
+static uint8_t  *USBD_HID_CfgDescFor (uint8_t speed, uint8_t os, uint16_t *length)
 {
-#ifdef MAC_RECONNECT
-    if(macUsbReconnectFlag) {			
+#ifdef USBD_HID_HS_BATCH
+    /* high speed: same descriptor, the batched EP high-bandwidth */
+    if (speed == USB_OTG_SPEED_HIGH)
+    {
+        uint16_t i;
+
+        memcpy(USBD_HID_CfgDescHS, USBD_HID_CfgDesc, sizeof (USBD_HID_CfgDesc));
+        for (i = 0; i + 6 < sizeof (USBD_HID_CfgDescHS) && USBD_HID_CfgDescHS[i];
+             i += USBD_HID_CfgDescHS[i])
+        {
+            if (USBD_HID_CfgDescHS[i + 1] == USB_ENDPOINT_DESCRIPTOR_TYPE &&
+                USBD_HID_CfgDescHS[i + 2] == USBD_HID_HS_BATCH_EP)
+            {
+                USBD_HID_CfgDescHS[i + 4] = LOBYTE(USBD_HID_HS_EP_MPS);
+                USBD_HID_CfgDescHS[i + 5] = HIBYTE(USBD_HID_HS_EP_MPS);
+            }
+        }
+        *length = sizeof (USBD_HID_CfgDescHS);
+        return USBD_HID_CfgDescHS;
+    }
+#endif
+#ifdef USBD_HID_HOST_OS_DESC
+    if(os == USBD_HOST_OS_MACOS) {			
         *length = sizeof (USBD_HID_CfgDesc_MAC);
         return USBD_HID_CfgDesc_MAC;
     }
@@ -2278,7 +2701,8 @@ static uint8_t  *USBD_HID_GetCfgDesc (uint8_t speed, uint16_t *length)
 static uint8_t  USBD_HID_DataIn (void  *pdev,
                               uint8_t epnum)
 {
-    u16 len;
+    USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
+
     //printf(" USBD_HID_DataIn epnum=%d 000 \n",epnum);//
     /* Ensure that the FIFO is empty before a new transfer, this condition could
     be caused by  a new transfer before the end of the previous transfer */
@@ -2290,115 +2714,120 @@ static uint8_t  USBD_HID_DataIn (void  *pdev,
         return USBD_OK;
     }else
 #endif
-    if (epnum == 1) {
-        DCD_EP_Flush(pdev, HID_IN_EP);
-        if (USBD_FIFO_Peek(&USBD_HID_TxFIFO_EP1) > 0) {
-            
-            USBD_FIFO_Pop(&USBD_HID_TxFIFO_EP1, USBD_HID_SndBuf, &len);
-            DCD_EP_Tx (pdev, HID_IN_EP, USBD_HID_SndBuf, len);
-            //printf("DataIn len=%d buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",len,USBD_HID_SndBuf[0],USBD_HID_SndBuf[1],USBD_HID_SndBuf[2],USBD_HID_SndBuf[3]);
-        } else {            
-        //printf(" USBD_HID_DataIn 33333333 \n");
-            USBD_HID_TxValid_EP1 = 1;
-        }
+    if (epnum >= 1 && epnum <= USBD_HID_NUM_EP && !hid->TxValid[epnum - 1]) {
+        /* with DMA the transfer is complete, nothing is left to flush */
+        if (!USBD_HID_IS_BATCH(pdev, epnum))
+            DCD_EP_Flush(pdev, epnum | 0x80);
+        USBD_STATS_RELEASE(&hid->Stats[epnum - 1], &hid->TxFIFO[epnum - 1], hid->TxCount[epnum - 1]);
+        USBD_FIFO_ReleaseN(&hid->TxFIFO[epnum - 1], hid->TxCount[epnum - 1]);
+        /* touch interface, unless the touch engine posts elsewhere */
+        if (epnum == ((hid->Touch.EP ? hid->Touch.EP : HID_IN_EP2) & 0x7F))
+            USBD_HostOS_FirstReport(pdev);
+        USBD_HID_TxNext(pdev, epnum | 0x80);
     }
-    else if (epnum == 2) {
-        DCD_EP_Flush(pdev, HID_IN_EP2);    
-        if (USBD_FIFO_Peek(&USBD_HID_TxFIFO_EP2) > 0) {
-            USBD_FIFO_Pop(&USBD_HID_TxFIFO_EP2, USBD_HID_SndBuf2, &len);
-            DCD_EP_Tx (pdev, HID_IN_EP2, USBD_HID_SndBuf2, len);
-        } else {
-            USBD_HID_TxValid_EP2 = 1;
-        }
-    }        
-    else if (epnum == 3) {
-        DCD_EP_Flush(pdev, HID_IN_EP3);
-        if (USBD_FIFO_Peek(&USBD_HID_TxFIFO_EP3) > 0) {
-            USBD_FIFO_Pop(&USBD_HID_TxFIFO_EP3, USBD_HID_SndBuf3, &len);
-            DCD_EP_Tx (pdev, HID_IN_EP3, USBD_HID_SndBuf3, len);
-        } else {
-            USBD_HID_TxValid_EP3 = 1;
-        }
-    }        
     return USBD_OK;
 }
 
 static uint8_t  USBD_HID_DataOut (void  *pdev,
                               uint8_t epnum)
 {
-    
-    u8 buffer[64];
-    printf(" USBD_HID_DataOut_FS epnum=%d 111 \n",epnum);//
+    USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
+    u8 *rx;
+
+    TRACE2(TRACE_HID_OUT, ((USB_OTG_CORE_HANDLE *)pdev)->cfg.coreID, epnum);
+    if (epnum < 1 || epnum > USBD_HID_NUM_EP)
+        return USBD_OK;
+
+    rx = hid->RcvBuf[epnum - 1];
     if (epnum == 1) {
-        memcpy(buffer, USBD_HID_RcvBuf, 64);
-        DCD_EP_PrepareRx(pdev, HID_OUT_EP, USBD_HID_RcvBuf, 64);
-        USBD_HID_RcvBuf[3] = 0;
-        usb_check = 1;
-        printf("DataOUT  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",USBD_HID_RcvBuf[0],USBD_HID_RcvBuf[1],USBD_HID_RcvBuf[2],USBD_HID_RcvBuf[3]);
-        } else {            
-        //EP1_OUT_Callback(buffer);
+        /* latch the report for the main loop before re-arming the EP */
+        memcpy(hid->OutReport, rx, HID_OUT_PACKET);
+        hid->OutReady = 1;
+        TRACE4(TRACE_HID_OUT_DATA, rx[0], rx[1], rx[2], rx[3]);
+        EP1_OUT_Callback(hid->OutReport);
     }
-    if (epnum == 2) {
-        memcpy(buffer, USBD_HID_RcvBuf2, 64);
-        DCD_EP_PrepareRx(pdev, HID_OUT_EP2, USBD_HID_RcvBuf2, 64);
-        //EP1_OUT_Callback(buffer);
-    }        
-    if (epnum == 3) {
-        memcpy(buffer, USBD_HID_RcvBuf3, 64);
-        DCD_EP_PrepareRx(pdev, HID_OUT_EP3, USBD_HID_RcvBuf3, 64);
-        //EP1_OUT_Callback(buffer);
-    }        
+    DCD_EP_PrepareRx(pdev, epnum, rx, HID_OUT_PACKET);
     return USBD_OK;
 }
 
-static uint8_t  USBD_HID_DataOut_HS(void * pdev,uint8_t epnum)
+/**
+  * @brief  USBD_HID_SOF
+  *         Touch report scheduler, sends the merged contacts once per
+  *         (micro)frame. If the TX queue is full the contacts stay pending
+  *         and keep merging instead of being dropped.
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_HID_SOF (void  *pdev)
 {
-    
-    u8 buffer[64];
-    printf(" USBD_HID_DataOut_HS epnum=%d 222 \n",epnum);//
-    if (epnum == 1) {
-        memcpy(buffer, USBD_HID_RcvBuf2, 64);
-        DCD_EP_PrepareRx(pdev, HID_OUT_EP, USBD_HID_RcvBuf2, 64);
-        USBD_HID_RcvBuf[3] = 1;
-        usb_check = 1;
-        printf("DataOUT  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",USBD_HID_RcvBuf[0],USBD_HID_RcvBuf[1],USBD_HID_RcvBuf[2],USBD_HID_RcvBuf[3]);
-        } else {            
-        //EP1_OUT_Callback(buffer);
-    }
-    if (epnum == 2) {
-        memcpy(buffer, USBD_HID_RcvBuf2, 64);
-        DCD_EP_PrepareRx(pdev, HID_OUT_EP2, USBD_HID_RcvBuf2, 64);
-        //EP1_OUT_Callback(buffer);
-    }        
-    if (epnum == 3) {
-        memcpy(buffer, USBD_HID_RcvBuf3, 64);
-        DCD_EP_PrepareRx(pdev, HID_OUT_EP3, USBD_HID_RcvBuf3, 64);
-        //EP1_OUT_Callback(buffer);
-    }        
+#ifdef USBD_HID_TOUCH_COALESCE
+    USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
+
+    /* the ISR never runs under main, so Busy cannot change here */
+    if (!hid->Busy && hid->Touch.Dirty)
+        USBD_HID_TouchEmit(pdev);
+#endif
     return USBD_OK;
 }
 
-static uint8_t  USBD_HID_SOF (void  *pdev)
+/**
+  * @brief  USBD_HID_ReadOutReport
+  *         Fetch the last report received on HID_OUT_EP of this core
+  * @param  pdev: device instance
+  * @param  buf: destination, HID_OUT_PACKET bytes
+  * @retval 1 if a new report was copied, 0 otherwise
+  */
+uint8_t USBD_HID_ReadOutReport (USB_OTG_CORE_HANDLE  *pdev,
+                                uint8_t *buf)
 {
-//	extern __IO u32 jiffies_SOF;
-    //extern __IO u32 jiffies;
-    //jiffies_SOF = jiffies;
+    USBD_HID_Core_TypeDef *hid = USBD_HID_CORE(pdev);
+
+    if (!hid->OutReady)
+        return 0;
+    /* retry if DataOut latched a newer report while copying */
+    do {
+        hid->OutReady = 0;
+        memcpy(buf, hid->OutReport, HID_OUT_PACKET);
+    } while (hid->OutReady);
+    return 1;
 }
 
 void WaitForUSBDFIFO(void)
 {
-    while (USBD_FIFO_Used(&USBD_HID_TxFIFO_EP1) > USBD_FIFO_Unused(&USBD_HID_TxFIFO_EP1));
-    while (USBD_FIFO_Used(&USBD_HID_TxFIFO_EP2) > USBD_FIFO_Unused(&USBD_HID_TxFIFO_EP2));
-    while (USBD_FIFO_Used(&USBD_HID_TxFIFO_EP3) > USBD_FIFO_Unused(&USBD_HID_TxFIFO_EP3));
+    int c, i;
+
+    for (c = 0; c < USBD_HID_MAX_CORE; c++)
+        for (i = 0; i < USBD_HID_NUM_EP; i++)
+            while (USBD_FIFO_Used(&USBD_HID_Core[c].TxFIFO[i]) > USBD_FIFO_Unused(&USBD_HID_Core[c].TxFIFO[i]))
+                __WFI();    /* drained by DataIn, sleep until the next interrupt */
 }
 
 void USBD_FIFO_FlushAll()
 {
-    USBD_FIFO_Flush(&USBD_HID_TxFIFO_EP1);
-    USBD_FIFO_Flush(&USBD_HID_TxFIFO_EP2);
-    USBD_FIFO_Flush(&USBD_HID_TxFIFO_EP3);
+    int c, i;
+
+    for (c = 0; c < USBD_HID_MAX_CORE; c++)
+        for (i = 0; i < USBD_HID_NUM_EP; i++)
+            USBD_FIFO_Flush(&USBD_HID_Core[c].TxFIFO[i]);
 }
 
+#ifdef USBD_HID_STATS
+/**
+  * @brief  USBD_HID_GetStats
+  *         Copy the statistics of an IN endpoint, for the main loop
+  * @param  pdev: device instance
+  * @param  epnum: IN endpoint address
+  * @param  stats: filled in
+  * @retval None
+  */
+void USBD_HID_GetStats (USB_OTG_CORE_HANDLE  *pdev,
+                        uint8_t epnum,
+                        USBD_STATS_ep *stats)
+{
+    *stats = USBD_HID_CORE(pdev)->Stats[(epnum & 0x7F) - 1].ep;
+}
+#endif
+
 
 /**
   * @}
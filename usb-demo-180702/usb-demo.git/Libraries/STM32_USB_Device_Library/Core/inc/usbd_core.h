@@ -100,6 +100,11 @@ USBD_Status USBD_ClrCfg(USB_OTG_CORE_HANDLE  *pdev, uint8_t cfgidx);
 
 USBD_Status USBD_SetCfg(USB_OTG_CORE_HANDLE  *pdev, uint8_t cfgidx);
 
+uint8_t *USBD_GetCfgDesc(USB_OTG_CORE_HANDLE  *pdev, uint16_t *length);
+
+USBD_Status USBD_CalcTxFifos(const uint8_t *pcfg, uint16_t len, uint8_t speed,
+                             uint8_t fifos, uint32_t space, uint16_t *depth);
+
 /**
   * @}
   */ 
@@ -0,0 +1,87 @@
+/**
+  ******************************************************************************
+  * @file    usbd_hostos.h
+  * @brief   header file for the usbd_hostos.c file
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+
+#ifndef __USBD_HOSTOS_H_
+#define __USBD_HOSTOS_H_
+
+/* Includes ------------------------------------------------------------------*/
+#include  "usbd_def.h"
+#include  "usb_core.h"
+
+
+/** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
+  * @{
+  */
+
+/** @defgroup USBD_HOSTOS
+  * @brief Host OS fingerprint from the enumeration requests
+  * @{
+  */
+
+/** @defgroup USBD_HOSTOS_Exported_Defines
+  * @{
+  */
+/* Host operating systems told apart (Android enumerates as Linux) */
+#define USBD_HOST_OS_UNKNOWN           0
+#define USBD_HOST_OS_WINDOWS           1
+#define USBD_HOST_OS_MACOS             2
+#define USBD_HOST_OS_LINUX             3
+#define USBD_HOST_OS_NUM               4
+
+/* Millisecond time base for the enumeration timings */
+#ifndef USBD_HOSTOS_TICK
+ #define USBD_HOSTOS_TICK()            0
+#endif
+/**
+  * @}
+  */
+
+
+/** @defgroup USBD_HOSTOS_Exported_Types
+  * @{
+  */
+typedef struct
+{
+  uint8_t  Guess;               /* OS the descriptors were chosen for */
+  uint8_t  Verdict;             /* OS with everything seen so far */
+  uint16_t Enum;                /* enumerations fingerprinted */
+  uint16_t Mismatch;            /* of them, Verdict ended != Guess */
+  uint16_t Count[USBD_HOST_OS_NUM];   /* Verdicts, by OS */
+  uint32_t EnumTime;            /* first bus reset -> SET_CONFIGURATION */
+  uint32_t ReportTime;          /* first bus reset -> first touch report sent */
+} USBD_HostOS_Stats_TypeDef;
+/**
+  * @}
+  */
+
+
+/** @defgroup USBD_HOSTOS_Exported_FunctionsPrototype
+  * @{
+  */
+void    USBD_HostOS_Reset       (USB_OTG_CORE_HANDLE  *pdev);
+void    USBD_HostOS_BusReset    (USB_OTG_CORE_HANDLE  *pdev);
+void    USBD_HostOS_Setup       (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req);
+void    USBD_HostOS_Hint        (USB_OTG_CORE_HANDLE  *pdev, uint8_t os);
+void    USBD_HostOS_FirstReport (USB_OTG_CORE_HANDLE  *pdev);
+uint8_t USBD_HostOS_Get         (USB_OTG_CORE_HANDLE  *pdev);
+void    USBD_HostOS_GetStats    (USB_OTG_CORE_HANDLE  *pdev,
+                                 USBD_HostOS_Stats_TypeDef *stats);
+/**
+  * @}
+  */
+
+#endif /* __USBD_HOSTOS_H_ */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
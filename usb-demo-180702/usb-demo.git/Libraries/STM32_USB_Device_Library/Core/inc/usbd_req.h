@@ -90,6 +90,7 @@ void USBD_CtlError( USB_OTG_CORE_HANDLE  *pdev,
                             USB_SETUP_REQ *req);
 
 void USBD_GetString(uint8_t *desc, uint8_t *unicode, uint16_t *len);
+void USBD_DescCacheFlush(USB_OTG_CORE_HANDLE  *pdev);
 /**
   * @}
   */ 
@@ -28,6 +28,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_core.h"
 #include "usbd_req.h"
+#include "usbd_hostos.h"
 #include "usbd_ioreq.h"
 #include "usb_dcd_int.h"
 #include "usb_bsp.h"
@@ -150,6 +151,10 @@ void USBD_Init(USB_OTG_CORE_HANDLE *pdev,
   /* set USB OTG core params */
   DCD_Init(pdev , coreID);
   
+  /* new descriptor set: drop the answers kept for the previous one */
+  USBD_HostOS_Reset(pdev);
+  USBD_DescCacheFlush(pdev);
+  
   /* Upon Init call usr callback */
   pdev->dev.usr_cb->Init();
   
@@ -372,6 +377,8 @@ static uint8_t USBD_Reset(USB_OTG_CORE_HANDLE  *pdev)
               USB_OTG_MAX_EP0_SIZE,
               EP_TYPE_CTRL);
   
+  USBD_HostOS_BusReset(pdev);
+  
   /* Upon Reset call usr call back */
   pdev->dev.device_status = USB_OTG_DEFAULT;
   pdev->dev.usr_cb->DeviceReset(pdev->cfg.speed);
@@ -433,11 +440,26 @@ static uint8_t USBD_SOF(USB_OTG_CORE_HANDLE  *pdev)
 *        Configure device and start the interface
 * @param  pdev: device instance
 * @param  cfgidx: configuration index
-* @retval status
+* @retval status: USBD_FAIL if the IN endpoints do not get a Tx FIFO each,
+*         the interface is not started then
 */
 
 USBD_Status USBD_SetCfg(USB_OTG_CORE_HANDLE  *pdev, uint8_t cfgidx)
 {
+  uint16_t depth[USB_OTG_MAX_TX_FIFOS];
+  uint8_t *pcfg;
+  uint16_t len;
+  
+  /* Size the IN FIFOs for this configuration before its EPs are opened;
+     an endpoint must not be opened without one */
+  pcfg = USBD_GetCfgDesc(pdev, &len);
+  if ((USBD_CalcTxFifos(pcfg, len, pdev->cfg.speed, pdev->cfg.dev_endpoints,
+                        USB_OTG_GetTxFifoSpace(pdev), depth) != USBD_OK) ||
+      (USB_OTG_SetTxFifos(pdev, depth) != USB_OTG_OK))
+  {
+    return USBD_FAIL;
+  }
+  
   pdev->dev.class_cb->Init(pdev, cfgidx); 
   
   /* Upon set config call usr call back */
@@ -445,6 +467,121 @@ USBD_Status USBD_SetCfg(USB_OTG_CORE_HANDLE  *pdev, uint8_t cfgidx)
   return USBD_OK; 
 }
 
+/**
+* @brief  USBD_GetCfgDesc
+*         Configuration descriptor of the class for this device instance,
+*         through GetCoreConfigDescriptor when the class has one
+* @param  pdev: device instance
+* @param  length: descriptor length
+* @retval pointer to descriptor buffer
+*/
+uint8_t *USBD_GetCfgDesc(USB_OTG_CORE_HANDLE  *pdev, uint16_t *length)
+{
+  USBD_Class_cb_TypeDef *cb = pdev->dev.class_cb;
+  
+  if (cb->GetCoreConfigDescriptor != NULL)
+  {
+    return cb->GetCoreConfigDescriptor(pdev, pdev->cfg.speed, length);
+  }
+  return cb->GetConfigDescriptor(pdev->cfg.speed, length);
+}
+
+/**
+* @brief  USBD_CalcTxFifos
+*         Size the IN endpoint Tx FIFOs of a configuration: one max packet
+*         (times the high-bandwidth transactions) per endpoint, then a second
+*         one for the hot endpoints (bulk, isochronous, and interrupt polled
+*         every frame) from EP1 up, as long as the RAM lasts
+* @param  pcfg: configuration descriptor
+* @param  len: its wTotalLength
+* @param  speed: USB_OTG_SPEED_HIGH or USB_OTG_SPEED_FULL
+* @param  fifos: Tx FIFOs of the core (cfg.dev_endpoints), EP0's included
+* @param  space: words available, see USB_OTG_GetTxFifoSpace
+* @param  depth: USB_OTG_MAX_TX_FIFOS depths in words, [0] is left 0
+* @retval status: USBD_FAIL if an IN endpoint has no Tx FIFO on this core or
+*         one packet per endpoint does not fit
+*/
+USBD_Status USBD_CalcTxFifos(const uint8_t *pcfg, uint16_t len, uint8_t speed,
+                             uint8_t fifos, uint32_t space, uint16_t *depth)
+{
+  uint32_t i, mps, total = 0;
+  uint16_t hot = 0;
+  uint8_t ep, top = 0;
+  
+  for (i = 0; i < USB_OTG_MAX_TX_FIFOS; i++)
+  {
+    depth[i] = 0;
+  }
+  
+  for (i = 0; (i + 1 < len) && (pcfg[i] >= 2); i += pcfg[i])
+  {
+    if ((pcfg[i + 1] != USB_DESC_TYPE_ENDPOINT) || (i + 7 > len) ||
+        !(pcfg[i + 2] & 0x80))
+    {
+      continue;
+    }
+    ep = pcfg[i + 2] & 0x0F;
+    if ((ep == 0) || (ep >= fifos) || (ep >= USB_OTG_MAX_TX_FIFOS))
+    {
+      return USBD_FAIL;
+    }
+    mps = pcfg[i + 4] | (pcfg[i + 5] << 8);
+    if (speed == USB_OTG_SPEED_HIGH)
+    {
+      mps = (mps & 0x7FF) * (((mps >> 11) & 0x3) + 1);
+    }
+    else
+    {
+      mps &= 0x7FF;
+    }
+    /* the same EP may appear in several alternate settings */
+    mps = (mps + 3) / 4;
+    if (mps < 16)
+    {
+      mps = 16;
+    }
+    if (mps > depth[ep])
+    {
+      depth[ep] = mps;
+    }
+    /* bmAttributes: 3 interrupt; bInterval in frames at FS, 2^(n-1)
+       microframes at HS */
+    if (((pcfg[i + 3] & 0x3) != 3) ||
+        (pcfg[i + 6] <= ((speed == USB_OTG_SPEED_HIGH) ? 4 : 1)))
+    {
+      hot |= 1 << ep;
+    }
+    if (ep > top)
+    {
+      top = ep;
+    }
+  }
+  
+  /* a FIFO below the last one in use still takes the minimum 16 words */
+  for (ep = 1; ep <= top; ep++)
+  {
+    if (depth[ep] == 0)
+    {
+      depth[ep] = 16;
+    }
+    total += depth[ep];
+  }
+  if (total > space)
+  {
+    return USBD_FAIL;
+  }
+  
+  for (ep = 1; ep <= top; ep++)
+  {
+    if ((hot & (1 << ep)) && (total + depth[ep] <= space))
+    {
+      total += depth[ep];
+      depth[ep] *= 2;
+    }
+  }
+  return USBD_OK;
+}
+
 /**
 * @brief  USBD_ClrCfg 
 *         Clear current configuration
@@ -506,6 +643,7 @@ static uint8_t USBD_DevDisconnected(USB_OTG_CORE_HANDLE  *pdev)
 {
   pdev->dev.usr_cb->DeviceDisconnected();
   pdev->dev.class_cb->DeInit(pdev, 0);
+  USBD_HostOS_Reset(pdev);
   pdev->dev.connection_status = 0;    
   return USBD_OK;
 }
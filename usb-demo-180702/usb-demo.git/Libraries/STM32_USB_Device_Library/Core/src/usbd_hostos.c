@@ -0,0 +1,362 @@
+/**
+  ******************************************************************************
+  * @file    usbd_hostos.c
+  * @brief   Tell the host OS from the enumeration requests, so a class can
+  *          pick its descriptor set during the first enumeration instead of
+  *          forcing a disconnect / reconnect cycle.
+  *
+  *          Each host stack has its own enumeration habits:
+  *          - Windows resets after the first device descriptor request, asks
+  *            the configuration descriptor with wLength 255 and the 0xEE
+  *            (MS OS) string.
+  *          - Linux / Android also reset after the first device descriptor
+  *            request but read the configuration header (9 bytes) first.
+  *          - macOS reads the first device descriptor with wLength 8 and
+  *            string lengths (wLength 2) before the strings themselves.
+  *          A score per OS is built from these; the guess is fixed by the
+  *          first configuration descriptor request, the last moment the
+  *          class can still choose. The verdict keeps following the
+  *          requests after that and the two are compared in the statistics.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_hostos.h"
+
+
+/** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
+  * @{
+  */
+
+
+/** @defgroup USBD_HOSTOS
+  * @brief Host OS fingerprint from the enumeration requests
+  * @{
+  */
+
+/** @defgroup USBD_HOSTOS_Private_TypesDefinitions
+  * @{
+  */
+/* Features already scored, each one counts once per enumeration */
+#define HOSTOS_SEEN_DEV         0x01    /* first device descriptor request */
+#define HOSTOS_SEEN_RESET       0x02    /* bus reset after it, before SET_ADDRESS */
+#define HOSTOS_SEEN_CFG255      0x04
+#define HOSTOS_SEEN_MSOS        0x08
+#define HOSTOS_SEEN_STRLEN      0x10
+#define HOSTOS_SEEN_HINT        0x20
+
+typedef struct
+{
+  uint8_t  Active;              /* an enumeration is being fingerprinted */
+  uint8_t  Committed;           /* Guess fixed */
+  uint8_t  Addressed;
+  uint8_t  Configured;
+  uint8_t  Reported;
+  uint8_t  Seen;
+  uint8_t  Guess;
+  uint8_t  Verdict;
+  uint8_t  Score[USBD_HOST_OS_NUM];
+  uint32_t ResetTick;
+  USBD_HostOS_Stats_TypeDef Stats;
+} USBD_HostOS_State_TypeDef;
+/**
+  * @}
+  */
+
+
+/** @defgroup USBD_HOSTOS_Private_Variables
+  * @{
+  */
+static USBD_HostOS_State_TypeDef USBD_HostOS_State[2];   /* by USB_OTG_CORE_ID_TypeDef */
+/**
+  * @}
+  */
+
+
+/** @defgroup USBD_HOSTOS_Private_Functions
+  * @{
+  */
+
+/**
+  * @brief  USBD_HostOS_Best
+  *         OS with the highest score, unknown if none or on a tie
+  * @param  s: fingerprint
+  * @retval USBD_HOST_OS_xxx
+  */
+static uint8_t USBD_HostOS_Best (USBD_HostOS_State_TypeDef *s)
+{
+  uint8_t os, best = USBD_HOST_OS_UNKNOWN;
+  uint8_t max = 0;
+
+  for (os = USBD_HOST_OS_WINDOWS; os < USBD_HOST_OS_NUM; os++)
+  {
+    if (s->Score[os] > max)
+    {
+      max = s->Score[os];
+      best = os;
+    }
+    else if ((s->Score[os] == max) && max)
+    {
+      best = USBD_HOST_OS_UNKNOWN;
+    }
+  }
+  return best;
+}
+
+/**
+  * @brief  USBD_HostOS_Score
+  *         Count a feature once and follow the verdict
+  * @param  s: fingerprint
+  * @param  seen: HOSTOS_SEEN_xxx
+  * @param  os: OS the feature points to
+  * @param  weight: its weight
+  * @retval None
+  */
+static void USBD_HostOS_Score (USBD_HostOS_State_TypeDef *s,
+                               uint8_t seen, uint8_t os, uint8_t weight)
+{
+  if (s->Seen & seen)
+  {
+    return;
+  }
+  s->Seen |= seen;
+  s->Score[os] += weight;
+  s->Verdict = USBD_HostOS_Best(s);
+}
+
+/**
+  * @brief  USBD_HostOS_End
+  *         Account the enumeration being fingerprinted
+  * @param  s: fingerprint
+  * @retval None
+  */
+static void USBD_HostOS_End (USBD_HostOS_State_TypeDef *s)
+{
+  if (s->Active && s->Committed)
+  {
+    s->Stats.Enum++;
+    s->Stats.Count[s->Verdict]++;
+    if (s->Verdict != s->Guess)
+    {
+      s->Stats.Mismatch++;
+    }
+  }
+  s->Active = 0;
+}
+
+/**
+  * @brief  USBD_HostOS_Start
+  *         Start the fingerprint of a new enumeration
+  * @param  s: fingerprint
+  * @retval None
+  */
+static void USBD_HostOS_Start (USBD_HostOS_State_TypeDef *s)
+{
+  uint8_t os;
+
+  USBD_HostOS_End(s);
+  s->Active = 1;
+  s->Committed = 0;
+  s->Addressed = 0;
+  s->Configured = 0;
+  s->Reported = 0;
+  s->Seen = 0;
+  s->Guess = USBD_HOST_OS_UNKNOWN;
+  s->Verdict = USBD_HOST_OS_UNKNOWN;
+  for (os = 0; os < USBD_HOST_OS_NUM; os++)
+  {
+    s->Score[os] = 0;
+  }
+  s->ResetTick = USBD_HOSTOS_TICK();
+}
+
+/**
+  * @brief  USBD_HostOS_Reset
+  *         Forget the host, on disconnection or library (re)init
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_HostOS_Reset (USB_OTG_CORE_HANDLE  *pdev)
+{
+  USBD_HostOS_State_TypeDef *s = &USBD_HostOS_State[pdev->cfg.coreID & 1];
+
+  USBD_HostOS_End(s);
+}
+
+/**
+  * @brief  USBD_HostOS_BusReset
+  *         Bus reset: the resets of one enumeration are part of the
+  *         fingerprint, a reset after the guess starts a new one
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_HostOS_BusReset (USB_OTG_CORE_HANDLE  *pdev)
+{
+  USBD_HostOS_State_TypeDef *s = &USBD_HostOS_State[pdev->cfg.coreID & 1];
+
+  if (!s->Active || s->Committed)
+  {
+    USBD_HostOS_Start(s);
+  }
+  else if ((s->Seen & HOSTOS_SEEN_DEV) && !s->Addressed &&
+           !(s->Seen & HOSTOS_SEEN_RESET))
+  {
+    /* Windows and Linux both do this, it only sets them apart from macOS */
+    s->Seen |= HOSTOS_SEEN_RESET;
+    s->Score[USBD_HOST_OS_WINDOWS]++;
+    s->Score[USBD_HOST_OS_LINUX]++;
+    s->Verdict = USBD_HostOS_Best(s);
+  }
+}
+
+/**
+  * @brief  USBD_HostOS_Setup
+  *         Score a standard device request, before it is served
+  * @param  pdev: device instance
+  * @param  req: usb request
+  * @retval None
+  */
+void USBD_HostOS_Setup (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req)
+{
+  USBD_HostOS_State_TypeDef *s = &USBD_HostOS_State[pdev->cfg.coreID & 1];
+
+  if (!s->Active)
+  {
+    USBD_HostOS_Start(s);
+  }
+
+  switch (req->bRequest)
+  {
+  case USB_REQ_GET_DESCRIPTOR:
+    switch (req->wValue >> 8)
+    {
+    case USB_DESC_TYPE_DEVICE:
+      if (!(s->Seen & HOSTOS_SEEN_DEV) && (req->wLength == 8))
+      {
+        s->Score[USBD_HOST_OS_MACOS] += 2;
+      }
+      s->Seen |= HOSTOS_SEEN_DEV;
+      break;
+
+    case USB_DESC_TYPE_CONFIGURATION:
+      if (req->wLength == 0xFF)
+      {
+        USBD_HostOS_Score(s, HOSTOS_SEEN_CFG255, USBD_HOST_OS_WINDOWS, 3);
+      }
+      if (!s->Committed)
+      {
+        if (req->wLength == USB_LEN_CFG_DESC)
+        {
+          s->Score[USBD_HOST_OS_MACOS]++;
+          s->Score[USBD_HOST_OS_LINUX]++;
+        }
+        s->Verdict = USBD_HostOS_Best(s);
+        s->Guess = s->Verdict;
+        s->Committed = 1;
+      }
+      break;
+
+    case USB_DESC_TYPE_STRING:
+      if ((req->wValue & 0xFF) == 0xEE)
+      {
+        USBD_HostOS_Score(s, HOSTOS_SEEN_MSOS, USBD_HOST_OS_WINDOWS, 3);
+      }
+      else if (req->wLength == 2)
+      {
+        USBD_HostOS_Score(s, HOSTOS_SEEN_STRLEN, USBD_HOST_OS_MACOS, 2);
+      }
+      break;
+    }
+    break;
+
+  case USB_REQ_SET_ADDRESS:
+    s->Addressed = 1;
+    break;
+
+  case USB_REQ_SET_CONFIGURATION:
+    if ((req->wValue != 0) && !s->Configured)
+    {
+      s->Configured = 1;
+      s->Stats.EnumTime = USBD_HOSTOS_TICK() - s->ResetTick;
+    }
+    break;
+  }
+}
+
+/**
+  * @brief  USBD_HostOS_Hint
+  *         A class request only one OS sends, after enumeration
+  * @param  pdev: device instance
+  * @param  os: USBD_HOST_OS_xxx
+  * @retval None
+  */
+void USBD_HostOS_Hint (USB_OTG_CORE_HANDLE  *pdev, uint8_t os)
+{
+  USBD_HostOS_State_TypeDef *s = &USBD_HostOS_State[pdev->cfg.coreID & 1];
+
+  if (s->Active && (os < USBD_HOST_OS_NUM))
+  {
+    USBD_HostOS_Score(s, HOSTOS_SEEN_HINT, os, 3);
+  }
+}
+
+/**
+  * @brief  USBD_HostOS_FirstReport
+  *         A touch report went out: stamp the first one after configuration
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_HostOS_FirstReport (USB_OTG_CORE_HANDLE  *pdev)
+{
+  USBD_HostOS_State_TypeDef *s = &USBD_HostOS_State[pdev->cfg.coreID & 1];
+
+  if (s->Active && s->Configured && !s->Reported)
+  {
+    s->Reported = 1;
+    s->Stats.ReportTime = USBD_HOSTOS_TICK() - s->ResetTick;
+  }
+}
+
+/**
+  * @brief  USBD_HostOS_Get
+  *         OS the descriptors of the current enumeration are chosen for
+  * @param  pdev: device instance
+  * @retval USBD_HOST_OS_xxx, unknown before the configuration descriptor
+  */
+uint8_t USBD_HostOS_Get (USB_OTG_CORE_HANDLE  *pdev)
+{
+  USBD_HostOS_State_TypeDef *s = &USBD_HostOS_State[pdev->cfg.coreID & 1];
+
+  return (s->Active && s->Committed) ? s->Guess : USBD_HOST_OS_UNKNOWN;
+}
+
+/**
+  * @brief  USBD_HostOS_GetStats
+  *         Fingerprint of the current enumeration and the counters so far
+  * @param  pdev: device instance
+  * @param  stats: filled in
+  * @retval None
+  */
+void USBD_HostOS_GetStats (USB_OTG_CORE_HANDLE  *pdev,
+                           USBD_HostOS_Stats_TypeDef *stats)
+{
+  USBD_HostOS_State_TypeDef *s = &USBD_HostOS_State[pdev->cfg.coreID & 1];
+
+  *stats = s->Stats;
+  stats->Guess = USBD_HostOS_Get(pdev);
+  stats->Verdict = s->Active ? s->Verdict : USBD_HOST_OS_UNKNOWN;
+}
+
+/**
+  * @}
+  */
+
+
+/**
+  * @}
+  */
+
+
+/**
+  * @}
+  */
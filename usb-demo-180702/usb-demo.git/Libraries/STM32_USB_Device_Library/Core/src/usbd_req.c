@@ -29,6 +29,7 @@
 #include "usbd_req.h"
 #include "usbd_ioreq.h"
 #include "usbd_desc.h"
+#include "usbd_hostos.h"
 
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
@@ -44,6 +45,37 @@
 /** @defgroup USBD_REQ_Private_TypesDefinitions
   * @{
   */ 
+#ifndef USBD_DESC_CACHE_ENTRIES
+ #define USBD_DESC_CACHE_ENTRIES        24
+#endif
+
+#ifndef USBD_DESC_CACHE_POOL
+ #define USBD_DESC_CACHE_POOL           256   /* string bytes per core */
+#endif
+
+#define USBD_DESC_NO_ITF               0xFF  /* device descriptor, not an interface one */
+
+/* GET_DESCRIPTOR answers of one core, built when the descriptor set changes
+   (init, speed, host OS guess, configuration): a request is one lookup.
+   Strings are converted to UTF-16 once into the pool, the other descriptors
+   are served in place from the class / user buffers. */
+typedef struct
+{
+  uint16_t  wValue;             /* type << 8 | index */
+  uint16_t  langid;             /* strings only */
+  uint8_t   itf;                /* class descriptors of an interface, else USBD_DESC_NO_ITF */
+  uint16_t  len;
+  uint8_t  *pbuf;
+} USBD_DescEntry_TypeDef;
+
+typedef struct
+{
+  uint8_t   speed;              /* entries hold for this speed */
+  uint8_t   os;                 /* and this host OS guess only */
+  uint8_t   num;
+  uint16_t  used;               /* pool bytes */
+  USBD_DescEntry_TypeDef entry[USBD_DESC_CACHE_ENTRIES];
+} USBD_DescCache_TypeDef;
 /**
   * @}
   */ 
@@ -92,6 +124,15 @@ __ALIGN_BEGIN uint32_t  USBD_default_cfg __ALIGN_END  = 0;
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
 __ALIGN_BEGIN uint32_t  USBD_cfg_status __ALIGN_END  = 0;  
 
+static USBD_DescCache_TypeDef USBD_DescCache[2];   /* by USB_OTG_CORE_ID_TypeDef */
+
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4   
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN static uint8_t USBD_DescPool[2][USBD_DESC_CACHE_POOL] __ALIGN_END;
+
 /**
   * @}
   */ 
@@ -122,6 +163,21 @@ static void USBD_ClrFeature(USB_OTG_CORE_HANDLE  *pdev,
                             USB_SETUP_REQ *req);
 
 static uint8_t USBD_GetLen(uint8_t *buf);
+
+static uint8_t *USBD_GetDesc(USB_OTG_CORE_HANDLE  *pdev,
+                             uint16_t wValue, uint16_t *length);
+
+static void USBD_DescCacheCheck(USB_OTG_CORE_HANDLE  *pdev);
+
+static void USBD_DescCacheItf(USB_OTG_CORE_HANDLE  *pdev);
+
+static USBD_DescEntry_TypeDef *USBD_DescCacheFind(USB_OTG_CORE_HANDLE  *pdev,
+                                                  uint16_t wValue, uint16_t langid,
+                                                  uint8_t itf);
+
+static void USBD_DescCacheAdd(USB_OTG_CORE_HANDLE  *pdev,
+                              uint16_t wValue, uint16_t langid, uint8_t itf,
+                              uint8_t *pbuf, uint16_t len);
 /**
   * @}
   */ 
@@ -143,6 +199,8 @@ USBD_Status  USBD_StdDevReq (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ  *req)
 {
   USBD_Status ret = USBD_OK;  
   
+  USBD_HostOS_Setup(pdev, req);
+  
   switch (req->bRequest) 
   {
   case USB_REQ_GET_DESCRIPTOR: 
@@ -193,6 +251,7 @@ USBD_Status  USBD_StdDevReq (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ  *req)
 USBD_Status  USBD_StdItfReq (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ  *req)
 {
   USBD_Status ret = USBD_OK; 
+  USBD_DescEntry_TypeDef *entry = NULL;
   
   switch (pdev->dev.device_status) 
   {
@@ -200,7 +259,25 @@ USBD_Status  USBD_StdItfReq (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ  *req)
     
     if (LOBYTE(req->wIndex) <= USBD_ITF_MAX_NUM) 
     {
-      pdev->dev.class_cb->Setup (pdev, req); 
+      /* class descriptors of the interface (HID, report) come from the table */
+      if ((req->bRequest == USB_REQ_GET_DESCRIPTOR) &&
+          ((req->bmRequest & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_STANDARD))
+      {
+        USBD_DescCacheCheck(pdev);
+        entry = USBD_DescCacheFind(pdev, req->wValue, 0, LOBYTE(req->wIndex));
+      }
+      if (entry != NULL)
+      {
+        if (req->wLength != 0)
+        {
+          USBD_CtlSendData (pdev, entry->pbuf, MIN(entry->len , req->wLength));
+          break;
+        }
+      }
+      else
+      {
+        pdev->dev.class_cb->Setup (pdev, req); 
+      }
       
       if((req->wLength == 0)&& (ret == USBD_OK))
       {
@@ -372,11 +449,69 @@ USBD_Status  USBD_StdEPReq (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ  *req)
 static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev, 
                                USB_SETUP_REQ *req)
 {
+  USBD_DescEntry_TypeDef *entry;
+  uint16_t langid;
   uint16_t len;
   uint8_t *pbuf;
-  len = req->wLength ;
+  
+  USBD_DescCacheCheck(pdev);
+  langid = ((req->wValue >> 8) == USB_DESC_TYPE_STRING) ? req->wIndex : 0;
+  entry = USBD_DescCacheFind(pdev, req->wValue, langid, USBD_DESC_NO_ITF);
+  if (entry != NULL)
+  {
+    pbuf = entry->pbuf;
+    len  = entry->len;
+    /* classes may hand out one buffer for both speeds */
+    if ((req->wValue >> 8) == USB_DESC_TYPE_CONFIGURATION)
+    {
+      pbuf[1] = USB_DESC_TYPE_CONFIGURATION;
+      pdev->dev.pConfig_descriptor = pbuf;
+    }
+    else if ((req->wValue >> 8) == USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION)
+    {
+      pbuf[1] = USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION;
+    }
+  }
+  else
+  {
+    /* not in the table: a string in another language, a user string, or
+       one that did not fit */
+    pbuf = USBD_GetDesc(pdev, req->wValue, &len);
+    if (pbuf == NULL)
+    {
+      USBD_CtlError(pdev , req);
+      return;
+    }
+    USBD_DescCacheAdd(pdev, req->wValue, langid, USBD_DESC_NO_ITF, pbuf, len);
+  }
+  
+  if((len != 0)&& (req->wLength != 0))
+  {
     
-  switch (req->wValue >> 8)
+    len = MIN(len , req->wLength);
+    
+    USBD_CtlSendData (pdev, 
+                      pbuf,
+                      len);
+  }
+  
+}
+
+/**
+* @brief  USBD_GetDesc
+*         Build a device, configuration or string descriptor
+* @param  pdev: device instance
+* @param  wValue: descriptor type << 8 | index
+* @param  length: its length
+* @retval the descriptor, NULL if the device has no such one
+*/
+static uint8_t *USBD_GetDesc(USB_OTG_CORE_HANDLE  *pdev,
+                             uint16_t wValue, uint16_t *length)
+{
+  uint16_t len = 0;
+  uint8_t *pbuf;
+  
+  switch (wValue >> 8)
   {
 #if (USBD_LPM_ENABLED == 1)
   case USB_DESC_TYPE_BOS:
@@ -388,7 +523,7 @@ static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev,
     break;
     
   case USB_DESC_TYPE_CONFIGURATION:
-      pbuf   = (uint8_t *)pdev->dev.class_cb->GetConfigDescriptor(pdev->cfg.speed, &len);
+      pbuf   = USBD_GetCfgDesc(pdev, &len);
 #ifdef USB_OTG_HS_CORE
     if((pdev->cfg.speed == USB_OTG_SPEED_FULL )&&
        (pdev->cfg.phy_itface  == USB_OTG_ULPI_PHY))
@@ -401,7 +536,7 @@ static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev,
     break;
     
   case USB_DESC_TYPE_STRING:
-    switch ((uint8_t)(req->wValue))
+    switch ((uint8_t)wValue)
     {
     case USBD_IDX_LANGID_STR:
      pbuf = pdev->dev.usr_device->GetLangIDStrDescriptor(pdev->cfg.speed, &len);        
@@ -429,11 +564,10 @@ static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev,
       
     default:
 #ifdef USB_SUPPORT_USER_STRING_DESC
-      pbuf = pdev->dev.class_cb->GetUsrStrDescriptor(pdev->cfg.speed, (req->wValue) , &len);
+      pbuf = pdev->dev.class_cb->GetUsrStrDescriptor(pdev->cfg.speed, wValue , &len);
       break;
 #else      
-       USBD_CtlError(pdev , req);
-      return;
+      return NULL;
 #endif /* USBD_CtlError(pdev , req)*/      
     }
     break;
@@ -442,7 +576,7 @@ static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev,
     if(pdev->cfg.speed == USB_OTG_SPEED_HIGH  )   
     {
       
-      pbuf   = (uint8_t *)pdev->dev.class_cb->GetConfigDescriptor(pdev->cfg.speed, &len);
+      pbuf   = USBD_GetCfgDesc(pdev, &len);
             
       USBD_DeviceQualifierDesc[4]= pbuf[14];
       USBD_DeviceQualifierDesc[5]= pbuf[15];
@@ -454,12 +588,10 @@ static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev,
     }
     else
     {
-      USBD_CtlError(pdev , req);
-      return;
+      return NULL;
     }
 #else
-      USBD_CtlError(pdev , req);
-      return;
+      return NULL;
 #endif    
 
   case USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION:
@@ -473,28 +605,17 @@ static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev,
     }
     else
     {
-      USBD_CtlError(pdev , req);
-      return;
+      return NULL;
     }
 #else
-      USBD_CtlError(pdev , req);
-      return;
+      return NULL;
 #endif     
   default: 
-     USBD_CtlError(pdev , req);
-    return;
-  }
-  
-  if((len != 0)&& (req->wLength != 0))
-  {
-    
-    len = MIN(len , req->wLength);
-    
-    USBD_CtlSendData (pdev, 
-                      pbuf,
-                      len);
+    return NULL;
   }
   
+  *length = len;
+  return pbuf;
 }
 
 /**
@@ -567,7 +688,16 @@ static void USBD_SetConfig(USB_OTG_CORE_HANDLE  *pdev,
       {                                			   							   							   				
         pdev->dev.device_config = cfgidx;
         pdev->dev.device_status = USB_OTG_CONFIGURED;
-        USBD_SetCfg(pdev , cfgidx);
+        if (USBD_SetCfg(pdev , cfgidx) != USBD_OK)
+        {
+          /* its IN endpoints do not fit in the Tx FIFO RAM */
+          pdev->dev.device_config = 0;
+          pdev->dev.device_status = USB_OTG_ADDRESSED;
+          USBD_CtlError(pdev , req);
+          break;
+        }
+        /* the interface descriptors of the class go in the table */
+        USBD_DescCacheItf(pdev);
         USBD_CtlSendStatus(pdev);
       }
       else 
@@ -582,6 +712,7 @@ static void USBD_SetConfig(USB_OTG_CORE_HANDLE  *pdev,
         pdev->dev.device_status = USB_OTG_ADDRESSED;
         pdev->dev.device_config = cfgidx;          
         USBD_ClrCfg(pdev , cfgidx);
+        USBD_DescCacheItf(pdev);
         USBD_CtlSendStatus(pdev);
         
       } 
@@ -592,7 +723,15 @@ static void USBD_SetConfig(USB_OTG_CORE_HANDLE  *pdev,
         
         /* set new configuration */
         pdev->dev.device_config = cfgidx;
-        USBD_SetCfg(pdev , cfgidx);
+        if (USBD_SetCfg(pdev , cfgidx) != USBD_OK)
+        {
+          /* the old one is gone already: back to the addressed state */
+          pdev->dev.device_config = 0;
+          pdev->dev.device_status = USB_OTG_ADDRESSED;
+          USBD_CtlError(pdev , req);
+          break;
+        }
+        USBD_DescCacheItf(pdev);
         USBD_CtlSendStatus(pdev);
       }
       else
@@ -819,6 +958,207 @@ void USBD_CtlError( USB_OTG_CORE_HANDLE  *pdev,
 }
 
 
+/**
+  * @brief  USBD_DescCacheCheck
+  *         Rebuild the table of a core if the configuration set it was built
+  *         for changed with the speed or the host OS guess
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void USBD_DescCacheCheck(USB_OTG_CORE_HANDLE  *pdev)
+{
+  USBD_DescCache_TypeDef *cache = &USBD_DescCache[pdev->cfg.coreID & 1];
+  
+  if ((cache->speed != pdev->cfg.speed) || (cache->os != USBD_HostOS_Get(pdev)))
+  {
+    USBD_DescCacheFlush(pdev);
+  }
+}
+
+/**
+  * @brief  USBD_DescCacheFlush
+  *         Build the GET_DESCRIPTOR table of a core again: the device,
+  *         configuration and string descriptors, and once configured the
+  *         class descriptors of every interface. Called on init, on a
+  *         speed or host OS change, and by an application changing its
+  *         descriptors at run time.
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_DescCacheFlush(USB_OTG_CORE_HANDLE  *pdev)
+{
+  static const uint16_t dev_desc[] =
+  {
+    USB_DESC_TYPE_DEVICE << 8,
+    USB_DESC_TYPE_CONFIGURATION << 8,
+    USB_DESC_TYPE_DEVICE_QUALIFIER << 8,
+    USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION << 8,
+    (USB_DESC_TYPE_STRING << 8) | USBD_IDX_MFC_STR,
+    (USB_DESC_TYPE_STRING << 8) | USBD_IDX_PRODUCT_STR,
+    (USB_DESC_TYPE_STRING << 8) | USBD_IDX_SERIAL_STR,
+    (USB_DESC_TYPE_STRING << 8) | USBD_IDX_CONFIG_STR,
+    (USB_DESC_TYPE_STRING << 8) | USBD_IDX_INTERFACE_STR,
+  };
+  USBD_DescCache_TypeDef *cache = &USBD_DescCache[pdev->cfg.coreID & 1];
+  uint16_t langid = 0, len, i;
+  uint8_t *pbuf;
+  
+  cache->speed = pdev->cfg.speed;
+  cache->os = USBD_HostOS_Get(pdev);
+  cache->num = 0;
+  cache->used = 0;
+  
+  /* strings are kept for the first language the device offers, the one
+     hosts ask in */
+  pbuf = USBD_GetDesc(pdev, USB_DESC_TYPE_STRING << 8 | USBD_IDX_LANGID_STR, &len);
+  if ((pbuf != NULL) && (len >= 4))
+  {
+    USBD_DescCacheAdd(pdev, USB_DESC_TYPE_STRING << 8 | USBD_IDX_LANGID_STR, 0,
+                      USBD_DESC_NO_ITF, pbuf, len);
+    langid = pbuf[2] | (pbuf[3] << 8);
+  }
+  for (i = 0; i < sizeof(dev_desc) / sizeof(dev_desc[0]); i++)
+  {
+    if (((dev_desc[i] >> 8) == USB_DESC_TYPE_STRING) && (langid == 0))
+    {
+      break;
+    }
+    pbuf = USBD_GetDesc(pdev, dev_desc[i], &len);
+    if (pbuf != NULL)
+    {
+      USBD_DescCacheAdd(pdev, dev_desc[i],
+                        ((dev_desc[i] >> 8) == USB_DESC_TYPE_STRING) ? langid : 0,
+                        USBD_DESC_NO_ITF, pbuf, len);
+    }
+  }
+  
+  USBD_DescCacheItf(pdev);
+}
+
+/**
+  * @brief  USBD_DescCacheItf
+  *         Put the class descriptors of the interfaces of the configuration
+  *         in the table in place of those of the previous one
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void USBD_DescCacheItf(USB_OTG_CORE_HANDLE  *pdev)
+{
+  USBD_DescCache_TypeDef *cache = &USBD_DescCache[pdev->cfg.coreID & 1];
+  uint16_t wValue, len, total, i;
+  uint8_t *pbuf, *pdesc, n = 0, idx;
+  
+  /* they are no strings, the pool is left alone */
+  for (i = 0; i < cache->num; i++)
+  {
+    if (cache->entry[i].itf == USBD_DESC_NO_ITF)
+    {
+      cache->entry[n++] = cache->entry[i];
+    }
+  }
+  cache->num = n;
+  
+  /* the class sets its interface descriptors up in its Init */
+  if ((pdev->dev.device_status != USB_OTG_CONFIGURED) ||
+      (pdev->dev.class_cb->GetItfDescriptor == NULL))
+  {
+    return;
+  }
+  pbuf = USBD_GetCfgDesc(pdev, &total);
+  for (i = 9; (i + 1 < total) && (pbuf[i] >= 2); i += pbuf[i])
+  {
+    if ((pbuf[i + 1] == USB_DESC_TYPE_INTERFACE) && (pbuf[i + 3] == 0))
+    {
+      for (idx = 0; ; idx++)
+      {
+        pdesc = pdev->dev.class_cb->GetItfDescriptor(pdev, pbuf[i + 2], idx,
+                                                     &wValue, &len);
+        if (pdesc == NULL)
+        {
+          break;
+        }
+        USBD_DescCacheAdd(pdev, wValue, 0, pbuf[i + 2], pdesc, len);
+      }
+    }
+  }
+}
+
+/**
+  * @brief  USBD_DescCacheFind
+  *         Look a GET_DESCRIPTOR answer up
+  * @param  pdev: device instance
+  * @param  wValue: descriptor type << 8 | index
+  * @param  langid: LANGID of a string, else 0
+  * @param  itf: interface of a class descriptor, else USBD_DESC_NO_ITF
+  * @retval the entry, NULL if not kept
+  */
+static USBD_DescEntry_TypeDef *USBD_DescCacheFind(USB_OTG_CORE_HANDLE  *pdev,
+                                                  uint16_t wValue, uint16_t langid,
+                                                  uint8_t itf)
+{
+  USBD_DescCache_TypeDef *cache = &USBD_DescCache[pdev->cfg.coreID & 1];
+  uint8_t i;
+  
+  for (i = 0; i < cache->num; i++)
+  {
+    if ((cache->entry[i].wValue == wValue) && (cache->entry[i].langid == langid) &&
+        (cache->entry[i].itf == itf))
+    {
+      return &cache->entry[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+  * @brief  USBD_DescCacheAdd
+  *         Keep a GET_DESCRIPTOR answer. Strings come from a buffer shared by
+  *         all of them and are copied to the pool, the rest is kept in place.
+  *         When the table or the pool is full the answer is just not kept.
+  * @param  pdev: device instance
+  * @param  wValue: descriptor type << 8 | index
+  * @param  langid: LANGID of a string, else 0
+  * @param  itf: interface of a class descriptor, else USBD_DESC_NO_ITF
+  * @param  pbuf: descriptor
+  * @param  len: its full length
+  * @retval None
+  */
+static void USBD_DescCacheAdd(USB_OTG_CORE_HANDLE  *pdev,
+                              uint16_t wValue, uint16_t langid, uint8_t itf,
+                              uint8_t *pbuf, uint16_t len)
+{
+  USBD_DescCache_TypeDef *cache = &USBD_DescCache[pdev->cfg.coreID & 1];
+  USBD_DescEntry_TypeDef *entry;
+  uint8_t *pool;
+  uint16_t i;
+  
+  if ((len == 0) || (cache->num >= USBD_DESC_CACHE_ENTRIES))
+  {
+    return;
+  }
+  if ((wValue >> 8) == USB_DESC_TYPE_STRING)
+  {
+    if (cache->used + len > USBD_DESC_CACHE_POOL)
+    {
+      return;
+    }
+    pool = &USBD_DescPool[pdev->cfg.coreID & 1][cache->used];
+    for (i = 0; i < len; i++)
+    {
+      pool[i] = pbuf[i];
+    }
+    pbuf = pool;
+    cache->used = (cache->used + len + 3) & ~3;   /* keep DMA alignment */
+  }
+  entry = &cache->entry[cache->num];
+  entry->wValue = wValue;
+  entry->langid = langid;
+  entry->itf    = itf;
+  entry->pbuf   = pbuf;
+  entry->len    = len;
+  cache->num++;
+}
+
 /**
   * @brief  USBD_GetString
   *         Convert Ascii string into unicode one
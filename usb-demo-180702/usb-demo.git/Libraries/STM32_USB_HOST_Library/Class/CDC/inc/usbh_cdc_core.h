@@ -80,6 +80,21 @@
 #define CS_INTERFACE                                            0x24
 #define CDC_PAGE_SIZE_64                                        0x40
 
+/* Receive ring slots, a power of two, each filled by one IN transfer */
+#ifndef CDC_RX_SLOTS
+ #define CDC_RX_SLOTS                                           4
+#endif
+#ifndef CDC_RX_SLOT_SIZE
+ #define CDC_RX_SLOT_SIZE                                       512  /* multiple of wMaxPacketSize */
+#endif
+#define CDC_RX_MASK                                             (CDC_RX_SLOTS - 1)
+
+/* Items waiting to be sent, a power of two */
+#ifndef CDC_TX_QUEUE
+ #define CDC_TX_QUEUE                                           8
+#endif
+#define CDC_TX_MASK                                             (CDC_TX_QUEUE - 1)
+
 
 
 
@@ -106,24 +121,52 @@ typedef enum
 }
 CDC_State;
 
-/* CDC Transfer State */
-typedef struct _CDCXfer
+/* Caller buffer to send, in place: a list of them goes out back to back */
+typedef struct _CDC_TxItem
 {
-  volatile CDC_State CDCState;
-  uint8_t* pRxTxBuff;
-  uint8_t* pFillBuff;
-  uint8_t* pEmptyBuff;
-  uint32_t BufferLen;
-  uint16_t DataLength;
-} CDC_Xfer_TypeDef;
+  uint8_t              *data;
+  uint32_t             length;
+  struct _CDC_TxItem   *next;          /* next of the list, 0 ends it */
+} CDC_TxItem_TypeDef;
 
 typedef struct CDC_UserCb
 {
-  void  (*Send)       (uint8_t  *);             
-  void  (*Receive)    (uint8_t *);       
+  void  (*Send)       (CDC_TxItem_TypeDef *);  /* item sent, its buffer is free again */
+  void  (*Receive)    (void);                   /* data waiting, see CDC_RxGet */
+  void  (*RxFull)     (uint8_t full);           /* 1: ring full, the device is NAKed */
   
 } CDC_Usercb_TypeDef;
 
+/* Receive ring: the IN pipe is re-armed from the interrupt handler on the
+   next free slot, wr has the handler as single writer, rd the main loop */
+typedef struct _CDC_RxRing
+{
+  uint8_t              data[CDC_RX_SLOTS][CDC_RX_SLOT_SIZE];
+  uint16_t             len[CDC_RX_SLOTS];
+  __IO uint32_t        wr;
+  __IO uint32_t        rd;
+  uint16_t             offset;          /* bytes of slot rd already read */
+  __IO uint8_t         armed;           /* IN transfer on slot wr */
+  uint8_t              full;            /* as last told RxFull */
+  uint32_t             Bytes;
+  uint32_t             Stalls;          /* times the ring was full */
+} CDC_RxRing_TypeDef;
+
+/* Transmit queue: the handler sends item sent and moves on, the main loop
+   queues at head and hands the sent ones back up to done */
+typedef struct _CDC_TxQueue
+{
+  CDC_TxItem_TypeDef   *item[CDC_TX_QUEUE];
+  __IO uint32_t        head;
+  __IO uint32_t        sent;
+  uint32_t             done;
+  uint32_t             offset;          /* bytes of item sent already sent */
+  uint16_t             chunk;           /* bytes of the transfer on the bus */
+  __IO uint8_t         busy;
+  uint32_t             Bytes;
+  uint32_t             Naks;
+} CDC_TxQueue_TypeDef;
+
 /* Structure for CDC process */
 typedef struct _CDC_CommInterface
 {
@@ -190,6 +233,10 @@ extern USBH_Class_cb_TypeDef  CDC_cb;
 * @{
 */ 
 void  CDC_SendData(uint8_t *data, uint16_t length);
+uint8_t  CDC_Send(CDC_TxItem_TypeDef *list);
+uint32_t CDC_RxGet(uint8_t **data);
+void  CDC_RxRelease(uint32_t length);
+void  CDC_RegisterUserCb(CDC_Usercb_TypeDef *cb);
 void  CDC_StartReception( USB_OTG_CORE_HANDLE *pdev);
 void  CDC_StopReception( USB_OTG_CORE_HANDLE *pdev);
 /**
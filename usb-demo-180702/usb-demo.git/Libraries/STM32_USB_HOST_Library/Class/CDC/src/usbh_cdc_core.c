@@ -56,7 +56,6 @@
 /** @defgroup CDC_CORE_Private_Defines
 * @{
 */ 
-#define CDC_BUFFER_SIZE                 1024
 /**
 * @}
 */ 
@@ -81,24 +80,17 @@
 __ALIGN_BEGIN CDC_Machine_TypeDef   CDC_Machine __ALIGN_END ;
 
 CDC_Requests                        CDC_ReqState;
-CDC_Xfer_TypeDef                    CDC_TxParam;
-CDC_Xfer_TypeDef                    CDC_RxParam;
+CDC_TxQueue_TypeDef                 CDC_Tx;
 
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
 #if defined ( __ICCARM__ ) /*!< IAR Compiler */
 #pragma data_alignment=4   
 #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN uint8_t               TxBuf [CDC_BUFFER_SIZE] __ALIGN_END ;
+__ALIGN_BEGIN CDC_RxRing_TypeDef    CDC_Rx __ALIGN_END ;
 
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-#if defined ( __ICCARM__ ) /*!< IAR Compiler */
-#pragma data_alignment=4   
-#endif
-#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN uint8_t               RxBuf [CDC_BUFFER_SIZE] __ALIGN_END ;
-
-CDC_Usercb_TypeDef                  UserCb;
+static CDC_Usercb_TypeDef           *UserCb;
+static CDC_TxItem_TypeDef           CDC_DataItem;   /* CDC_SendData */
 uint8_t                             RX_Enabled = 0;
 /**
 * @}
@@ -108,9 +100,15 @@ uint8_t                             RX_Enabled = 0;
 /** @defgroup CDC_CORE_Private_FunctionPrototypes
 * @{
 */ 
-static void CDC_InitTxRxParam(void);
+static void CDC_InitTxRxParam(USB_OTG_CORE_HANDLE *pdev);
+
+static void CDC_TxStart(USB_OTG_CORE_HANDLE *pdev);
+
+static void CDC_TxHandler(void *pdev, uint8_t hc_num);
+
+static void CDC_RxArm(USB_OTG_CORE_HANDLE *pdev);
 
-static void CDC_ReceiveData(CDC_Xfer_TypeDef *cdc_Data);
+static void CDC_RxHandler(void *pdev, uint8_t hc_num);
 
 static void CDC_ProcessTransmission(USB_OTG_CORE_HANDLE *pdev, USBH_HOST  *phost);
 
@@ -240,7 +238,7 @@ static USBH_Status CDC_InterfaceInit ( USB_OTG_CORE_HANDLE *pdev,
                         CDC_Machine.CDC_DataItf.length);
     
     /*Initilise the Tx/Rx Params*/
-    CDC_InitTxRxParam();
+    CDC_InitTxRxParam(pdev);
     
     
     /*Initialize the class specific request with "GET_LINE_CODING"*/
@@ -266,6 +264,13 @@ static USBH_Status CDC_InterfaceInit ( USB_OTG_CORE_HANDLE *pdev,
 void CDC_InterfaceDeInit ( USB_OTG_CORE_HANDLE *pdev,
                           void *phost)
 {
+  /* no re-arming from the halts below */
+  RX_Enabled = 0;
+  CDC_Rx.armed = 0;
+  CDC_Tx.busy = 0;
+  HCD_HC_SetHandler(pdev, CDC_Machine.CDC_DataItf.hc_num_out, 0);
+  HCD_HC_SetHandler(pdev, CDC_Machine.CDC_DataItf.hc_num_in, 0);
+  
   if ( CDC_Machine.CDC_CommItf.hc_num_in)
   {
     USB_OTG_HC_Halt(pdev, CDC_Machine.CDC_CommItf.hc_num_in);
@@ -340,8 +345,6 @@ static USBH_Status CDC_ClassRequest(USB_OTG_CORE_HANDLE *pdev ,
     {
       /*Change the state */
       CDC_ReqState = CDC_SET_CONTROL_LINE_STATE_REQUEST;
-      /*Also set the state of receive CDCRxParam to IDLE*/
-      CDC_RxParam.CDCState = CDC_IDLE; 
       
       status = USBH_OK; /*This return from class specific routinues request*/
     }
@@ -393,204 +396,338 @@ static USBH_Status CDC_Handle(USB_OTG_CORE_HANDLE *pdev ,
 
 
 /**
-  * @brief  The function is responsible for sending data to the device
+  * @brief  The function hands the sent items back and restarts the
+  *         transmission after a stall; the interrupt handler does the rest
   * @param  pdev: Selected device
   * @retval None
   */
-void CDC_ProcessTransmission(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+static void CDC_ProcessTransmission(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
 {
-  static uint32_t len ;
-  URB_STATE URB_StatusTx = URB_IDLE;
+  CDC_TxItem_TypeDef *item;
   
-  URB_StatusTx =   HCD_GetURB_State(pdev , CDC_Machine.CDC_DataItf.hc_num_out);
+  while (CDC_Tx.done != CDC_Tx.sent)
+  {
+    item = CDC_Tx.item[CDC_Tx.done & CDC_TX_MASK];
+    CDC_Tx.done++;
+    if ((UserCb != 0) && (UserCb->Send != 0))
+    {
+      UserCb->Send(item);
+    }
+  }
   
-  switch(CDC_TxParam.CDCState)
+  /* nothing on the bus: the handler will not run before CDC_TxStart */
+  if ((CDC_Tx.busy == 0) && (CDC_Tx.sent != CDC_Tx.head))
   {
-  case CDC_IDLE:
-    break;
-    
-  case CDC_SEND_DATA:
-    
-    if(( URB_StatusTx == URB_DONE ) || (URB_StatusTx == URB_IDLE))
+    if (HCD_GetURB_State(pdev, CDC_Machine.CDC_DataItf.hc_num_out) == URB_STALL)
     {
-      /*Check the data length is more then the CDC_Machine.CDC_DataItf.CDC_DataItf.length */
-      if(CDC_TxParam.DataLength > CDC_Machine.CDC_DataItf.length)
-      {
-        
-        len = CDC_Machine.CDC_DataItf.length ;
-        /*Send the data */
-        USBH_BulkSendData (pdev,
-                           CDC_TxParam.pRxTxBuff, 
-                           len , 
-                           CDC_Machine.CDC_DataItf.hc_num_out);    
-      }
-      else
+      if (USBH_ClrFeature(pdev,
+                          phost,
+                          CDC_Machine.CDC_DataItf.cdcOutEp,
+                          CDC_Machine.CDC_DataItf.hc_num_out) != USBH_OK)
       {
-        len = CDC_TxParam.DataLength ;
-        /*Send the remaining data */
-        USBH_BulkSendData (pdev,
-                           CDC_TxParam.pRxTxBuff, 
-                           len, 
-                           CDC_Machine.CDC_DataItf.hc_num_out);
-        
+        return;
       }
-      CDC_TxParam.CDCState = CDC_DATA_SENT;
-      
     }
-    
-    break;
-    
-  case CDC_DATA_SENT:
-    /*Check the status done for transmssion*/
-    if(URB_StatusTx == URB_DONE )
-    {         
-      /*Point to next chunc of data*/
-      CDC_TxParam.pRxTxBuff += len ;
-      
-      /*decrease the data length*/
-      CDC_TxParam.DataLength -= len;    
-      
-      if(CDC_TxParam.DataLength == 0)
-      {
-        CDC_TxParam.CDCState = CDC_IDLE;
-      }
-      else
+    CDC_TxStart(pdev);
+  }
+}
+
+/**
+  * @brief  This function responsible for reception of data from the device:
+  *         it tells the user about the data and the flow control, and arms
+  *         the IN pipe when the interrupt handler could not
+  * @param  pdev: Selected device
+  * @retval None
+  */
+static void CDC_ProcessReception(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+{
+  uint8_t full = ((CDC_Rx.wr - CDC_Rx.rd) >= CDC_RX_SLOTS);
+  
+  if ((CDC_Rx.wr != CDC_Rx.rd) && (UserCb != 0) && (UserCb->Receive != 0))
+  {
+    UserCb->Receive();
+  }
+  
+  if (full != CDC_Rx.full)
+  {
+    CDC_Rx.full = full;
+    if ((UserCb != 0) && (UserCb->RxFull != 0))
+    {
+      UserCb->RxFull(full);
+    }
+  }
+  
+  /* not armed: the handler will not run before CDC_RxArm */
+  if ((RX_Enabled == 1) && (CDC_Rx.armed == 0) && (full == 0))
+  {
+    if (HCD_GetURB_State(pdev, CDC_Machine.CDC_DataItf.hc_num_in) == URB_STALL)
+    {
+      if (USBH_ClrFeature(pdev,
+                          phost,
+                          CDC_Machine.CDC_DataItf.cdcInEp,
+                          CDC_Machine.CDC_DataItf.hc_num_in) != USBH_OK)
       {
-        CDC_TxParam.CDCState = CDC_SEND_DATA; 
+        return;
       }
     }
-    else if( URB_StatusTx == URB_NOTREADY )
+    CDC_RxArm(pdev);
+  }
+}
+
+/**
+  * @brief  Start the next packet of the transmit queue, called with no
+  *         transfer on the bus
+  * @param  pdev: Selected device
+  * @retval None
+  */
+static void CDC_TxStart(USB_OTG_CORE_HANDLE *pdev)
+{
+  CDC_TxItem_TypeDef *item;
+  uint32_t len;
+  
+  while (CDC_Tx.sent != CDC_Tx.head)
+  {
+    item = CDC_Tx.item[CDC_Tx.sent & CDC_TX_MASK];
+    if (CDC_Tx.offset < item->length)
     {
-      /*Send the same data */
+      /* one packet per transfer: a NAK resends exactly it */
+      len = item->length - CDC_Tx.offset;
+      if (len > CDC_Machine.CDC_DataItf.length)
+      {
+        len = CDC_Machine.CDC_DataItf.length;
+      }
+      CDC_Tx.chunk = len;
+      CDC_Tx.busy = 1;
       USBH_BulkSendData (pdev,
-                         (CDC_TxParam.pRxTxBuff), 
+                         item->data + CDC_Tx.offset, 
                          len, 
                          CDC_Machine.CDC_DataItf.hc_num_out);
+      return;
     }
+    CDC_Tx.offset = 0;
+    CDC_Tx.sent++;
+  }
+  CDC_Tx.busy = 0;
+}
+
+/**
+  * @brief  End of an OUT transfer, from the interrupt handler
+  * @param  pdev: Selected device
+  * @param  hc_num: OUT pipe
+  * @retval None
+  */
+static void CDC_TxHandler(void *pdev, uint8_t hc_num)
+{
+  CDC_TxItem_TypeDef *item;
+  
+  switch (HCD_GetURB_State(pdev, hc_num))
+  {
+  case URB_DONE:
+    CDC_Tx.offset += CDC_Tx.chunk;
+    CDC_Tx.Bytes += CDC_Tx.chunk;
+    CDC_TxStart(pdev);
+    break;
     
+  case URB_NOTREADY:
+    /*Send the same data */
+    CDC_Tx.Naks++;
+    item = CDC_Tx.item[CDC_Tx.sent & CDC_TX_MASK];
+    USBH_BulkSendData (pdev,
+                       item->data + CDC_Tx.offset, 
+                       CDC_Tx.chunk, 
+                       hc_num);
     break;
     
+  default:
+    /* stall or error: the main loop takes over */
+    CDC_Tx.busy = 0;
+    break;
   }
 }
+
 /**
-  * @brief  This function responsible for reception of data from the device
+  * @brief  Arm the IN pipe on the next free slot of the receive ring
   * @param  pdev: Selected device
   * @retval None
   */
-static void CDC_ProcessReception(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+static void CDC_RxArm(USB_OTG_CORE_HANDLE *pdev)
 {
-  
-  if(RX_Enabled == 1)
+  if ((CDC_Rx.wr - CDC_Rx.rd) >= CDC_RX_SLOTS)
   {
-    URB_STATE URB_StatusRx =   HCD_GetURB_State(pdev , CDC_Machine.CDC_DataItf.hc_num_in);  
-    
-    switch(CDC_RxParam.CDCState)
-    {
-      
-    case CDC_IDLE:
-      
-      
-      /*check the received length lesser then the remaining space available in the 
-      buffer */
-      if(CDC_RxParam.DataLength < (CDC_RxParam.BufferLen - CDC_Machine.CDC_DataItf.length))
-      {
-        /*Receive the data */
-        USBH_BulkReceiveData(pdev,
-                             CDC_RxParam.pFillBuff,
-                             CDC_Machine.CDC_DataItf.length, 
-                             CDC_Machine.CDC_DataItf.hc_num_in);
-        
-        /*change the cdc state to USBH_CDC_GET_DATA*/
-        CDC_RxParam.CDCState = CDC_GET_DATA;
-      }
-      break;
-      
-    case CDC_GET_DATA:
-      /*Check the last state of the device is URB_DONE */
-      if(URB_StatusRx == URB_DONE)
-      {
-        /* Move the pointer as well as datalength */
-        CDC_RxParam.DataLength += pdev->host.hc[CDC_Machine.CDC_DataItf.hc_num_in].xfer_count ;
-        CDC_RxParam.pFillBuff += pdev->host.hc[CDC_Machine.CDC_DataItf.hc_num_in].xfer_count ;
-        
-        
-        /* Process the recived data */
-        CDC_ReceiveData(&CDC_RxParam);
-        
-        /*change the state od the CDC state*/
-        CDC_RxParam.CDCState = CDC_IDLE;
-        
-      }
-      break;
-    }
+    /* the device is NAKed until CDC_RxRelease */
+    CDC_Rx.armed = 0;
+    CDC_Rx.Stalls++;
+    return;
   }
+  CDC_Rx.armed = 1;
+  USBH_BulkReceiveData(pdev,
+                       CDC_Rx.data[CDC_Rx.wr & CDC_RX_MASK],
+                       CDC_RX_SLOT_SIZE, 
+                       CDC_Machine.CDC_DataItf.hc_num_in);
 }
 
 /**
-  * @brief  Initialize the transmit and receive buffer and its parameter
-  * @param  None
+  * @brief  End of an IN transfer, from the interrupt handler: commit the
+  *         slot and re-arm at once
+  * @param  pdev: Selected device
+  * @param  hc_num: IN pipe
   * @retval None
   */
-static void CDC_InitTxRxParam(void)
+static void CDC_RxHandler(void *pdev, uint8_t hc_num)
 {
-  /*Initialize the Transmit buffer and its parameter*/
-  CDC_TxParam.CDCState = CDC_IDLE;
-  CDC_TxParam.DataLength = 0;
-  CDC_TxParam.pRxTxBuff = TxBuf;
+  uint32_t len;
+  
+  if (HCD_GetURB_State(pdev, hc_num) != URB_DONE)
+  {
+    /* stall or error: the main loop takes over */
+    CDC_Rx.armed = 0;
+    return;
+  }
+  
+  len = HCD_GetXferCnt(pdev, hc_num);
+  if (len != 0)
+  {
+    CDC_Rx.len[CDC_Rx.wr & CDC_RX_MASK] = len;
+    CDC_Rx.wr++;
+    CDC_Rx.Bytes += len;
+  }
   
-  /*Initialize the Receive buffer and its parameter*/
-  CDC_RxParam.CDCState = CDC_IDLE;
-  CDC_RxParam.DataLength = 0;
-  CDC_RxParam.pFillBuff = RxBuf;  
-  CDC_RxParam.pEmptyBuff = RxBuf;
-  CDC_RxParam.BufferLen = sizeof(RxBuf);      
+  if (RX_Enabled == 1)
+  {
+    CDC_RxArm(pdev);
+  }
+  else
+  {
+    CDC_Rx.armed = 0;
+  }
 }
 
 /**
-  * @brief  This is a call back function from cdc core layer to redirect the 
-  *         received data on the user out put system
-  * @param  cdc_Data: type of USBH_CDCXfer_TypeDef
+  * @brief  Initialize the transmit queue and the receive ring
+  * @param  pdev: Selected device
   * @retval None
   */
-static void CDC_ReceiveData(CDC_Xfer_TypeDef *cdc_Data)
+static void CDC_InitTxRxParam(USB_OTG_CORE_HANDLE *pdev)
+{
+  /*Initialize the Transmit queue*/
+  CDC_Tx.head = 0;
+  CDC_Tx.sent = 0;
+  CDC_Tx.done = 0;
+  CDC_Tx.offset = 0;
+  CDC_Tx.busy = 0;
+  
+  /*Initialize the Receive ring*/
+  CDC_Rx.wr = 0;
+  CDC_Rx.rd = 0;
+  CDC_Rx.offset = 0;
+  CDC_Rx.armed = 0;
+  CDC_Rx.full = 0;
+  
+  HCD_HC_SetHandler(pdev, CDC_Machine.CDC_DataItf.hc_num_out, CDC_TxHandler);
+  HCD_HC_SetHandler(pdev, CDC_Machine.CDC_DataItf.hc_num_in, CDC_RxHandler);
+  
+  /* a device with nothing to send, or no room, is asked once a frame */
+  HCD_HC_SetNakPolicy(pdev, CDC_Machine.CDC_DataItf.hc_num_out, HC_NAK_PING, 0);
+  HCD_HC_SetNakPolicy(pdev, CDC_Machine.CDC_DataItf.hc_num_in, HC_NAK_NEXT_FRAME, 0);
+}
+
+/**
+  * @brief  Queue a list of buffers to send back to back, without copy. Each
+  *         item is handed back through the Send callback once sent.
+  * @param  list: first item, the others follow through next
+  * @retval 0 if queued, 1 if the queue has no room for the whole list
+  */
+uint8_t CDC_Send(CDC_TxItem_TypeDef *list)
 {
-  uint8_t *ptr; 
+  CDC_TxItem_TypeDef *item;
+  uint32_t n = 0;
   
-  if(cdc_Data->pEmptyBuff < cdc_Data->pFillBuff)
+  for (item = list; item != 0; item = item->next)
   {
-    ptr = cdc_Data->pFillBuff;
-    *ptr = 0x00;
-    
-    /* redirect the received data on the user out put system */
-    UserCb.Receive(cdc_Data->pEmptyBuff);
-    
-    cdc_Data->pFillBuff  = cdc_Data->pEmptyBuff ; 
-    cdc_Data->DataLength = 0;    /*Reset the data length to zero*/
+    n++;
   }
+  if ((CDC_Tx.head - CDC_Tx.done) + n > CDC_TX_QUEUE)
+  {
+    return 1;
+  }
+  
+  for (item = list; item != 0; item = item->next)
+  {
+    CDC_Tx.item[CDC_Tx.head & CDC_TX_MASK] = item;
+    CDC_Tx.head++;
+  }
+  return 0;
 }
 
 /**
-  * @brief  This function send data to the device.
-  * @param  fileName : name of the file 
-  * @retval the filestate will be returned 
-  * FS_SUCCESS : returned to the parent function when the file length become to zero
+  * @brief  This function send data to the device, once the previous data
+  *         is sent.
+  * @param  data : data to send, untouched until sent
+  * @param  length : bytes
+  * @retval None
   */
 void  CDC_SendData(uint8_t *data, uint16_t length)
 {
-  
-  if(CDC_TxParam.CDCState == CDC_IDLE)
+  if (CDC_Tx.done == CDC_Tx.head)
   {
-    CDC_TxParam.pRxTxBuff = data; 
-    CDC_TxParam.DataLength = length;
-    CDC_TxParam.CDCState = CDC_SEND_DATA;  
+    CDC_DataItem.data = data;
+    CDC_DataItem.length = length;
+    CDC_DataItem.next = 0;
+    CDC_Send(&CDC_DataItem);
   }    
 }
 
 /**
-  * @brief  This function send data to the device.
-  * @param  fileName : name of the file 
-  * @retval the filestate will be returned 
-  * FS_SUCCESS : returned to the parent function when the file length become to zero
+  * @brief  Oldest received data not read yet
+  * @param  data : set to the data
+  * @retval bytes at data, 0 if none
+  */
+uint32_t CDC_RxGet(uint8_t **data)
+{
+  uint32_t slot;
+  
+  if (CDC_Rx.rd == CDC_Rx.wr)
+  {
+    return 0;
+  }
+  slot = CDC_Rx.rd & CDC_RX_MASK;
+  *data = &CDC_Rx.data[slot][CDC_Rx.offset];
+  return CDC_Rx.len[slot] - CDC_Rx.offset;
+}
+
+/**
+  * @brief  Mark received data as read, up to what CDC_RxGet returned
+  * @param  length : bytes
+  * @retval None
+  */
+void CDC_RxRelease(uint32_t length)
+{
+  if (CDC_Rx.rd == CDC_Rx.wr)
+  {
+    return;
+  }
+  CDC_Rx.offset += length;
+  if (CDC_Rx.offset >= CDC_Rx.len[CDC_Rx.rd & CDC_RX_MASK])
+  {
+    CDC_Rx.offset = 0;
+    CDC_Rx.rd++;
+  }
+}
+
+/**
+  * @brief  Register the user callbacks.
+  * @param  cb : callbacks, any of them 0
+  * @retval None
+  */
+void CDC_RegisterUserCb(CDC_Usercb_TypeDef *cb)
+{
+  UserCb = cb;
+}
+
+/**
+  * @brief  Start the reception: from here the IN pipe is kept armed.
+  * @param  pdev: Selected device
+  * @retval None
   */
 void  CDC_StartReception( USB_OTG_CORE_HANDLE *pdev)
 {
@@ -598,16 +735,14 @@ void  CDC_StartReception( USB_OTG_CORE_HANDLE *pdev)
 }
 
 /**
-  * @brief  This function send data to the device.
-  * @param  fileName : name of the file 
-  * @retval the filestate will be returned 
-  * FS_SUCCESS : returned to the parent function when the file length become to zero
+  * @brief  Stop the reception, the data received stays in the ring.
+  * @param  pdev: Selected device
+  * @retval None
   */
 void  CDC_StopReception( USB_OTG_CORE_HANDLE *pdev)
 {
   RX_Enabled = 0; 
   USB_OTG_HC_Halt(pdev, CDC_Machine.CDC_DataItf.hc_num_in);
-  USBH_Free_Channel  (pdev,CDC_Machine.CDC_DataItf.hc_num_in);
 }
 
 /**
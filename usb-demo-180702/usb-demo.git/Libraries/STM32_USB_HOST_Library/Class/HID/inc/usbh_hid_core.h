@@ -131,6 +131,9 @@ typedef struct _HID_Process
   uint16_t             poll; 
   __IO uint16_t        timer; 
   HID_cb_TypeDef             *cb;
+  void                 *phost;        /* device served, 0: free */
+  USB_OTG_HC_RING      ring;          /* reports of the IN pipe, filled by the ISR */
+  uint16_t             MaxLatency;    /* frames from completion to Decode */
 }
 HID_Machine_TypeDef;
 
@@ -148,6 +151,11 @@ HID_Machine_TypeDef;
 #define USB_HID_SET_REPORT           0x09
 #define USB_HID_SET_IDLE             0x0A
 #define USB_HID_SET_PROTOCOL         0x0B    
+
+/* HID devices served at once, e.g. keyboard and mouse behind a hub */
+#ifndef USBH_HID_MAX_DEV
+ #define USBH_HID_MAX_DEV            2
+#endif
 /**
   * @}
   */ 
@@ -93,7 +93,7 @@
     #pragma data_alignment=4   
   #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN HID_Machine_TypeDef        HID_Machine __ALIGN_END ;
+__ALIGN_BEGIN HID_Machine_TypeDef        HID_Machine_Pool[USBH_HID_MAX_DEV] __ALIGN_END ;
 
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
   #if defined ( __ICCARM__ ) /*!< IAR Compiler */
@@ -116,7 +116,6 @@ __ALIGN_BEGIN USB_Setup_TypeDef          HID_Setup __ALIGN_END ;
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
 __ALIGN_BEGIN USBH_HIDDesc_TypeDef       HID_Desc __ALIGN_END ; 
 
-__IO uint8_t start_toggle = 0;
 /**
 * @}
 */ 
@@ -189,31 +188,64 @@ static USBH_Status USBH_HID_InterfaceInit ( USB_OTG_CORE_HANDLE *pdev,
     
   uint8_t num =0;
   USBH_Status status = USBH_BUSY ;
-  HID_Machine.state = HID_ERROR;
+  HID_Machine_TypeDef *HID_Machine = 0;
   
   
   if(pphost->device_prop.Itf_Desc[0].bInterfaceSubClass  == HID_BOOT_CODE)
   {
+    /* one instance per device */
+    for (num = 0; num < USBH_HID_MAX_DEV; num++)
+    {
+      if (HID_Machine_Pool[num].phost == 0)
+      {
+        HID_Machine = &HID_Machine_Pool[num];
+        break;
+      }
+    }
+    if (HID_Machine == 0)
+    {
+      /* retried until another HID device goes away */
+      return USBH_BUSY;
+    }
+    HID_Machine->phost = pphost;
+    pphost->ClassData = HID_Machine;
+    HID_Machine->state = HID_ERROR;
+    HID_Machine->hc_num_in = 0;
+    HID_Machine->hc_num_out = 0;
+    
+
     /*Decode Bootclass Protocol: Mouse or Keyboard*/
     if(pphost->device_prop.Itf_Desc[0].bInterfaceProtocol == HID_KEYBRD_BOOT_CODE)
     {
-      HID_Machine.cb = &HID_KEYBRD_cb;
+      HID_Machine->cb = &HID_KEYBRD_cb;
     }
     else if(pphost->device_prop.Itf_Desc[0].bInterfaceProtocol  == HID_MOUSE_BOOT_CODE)		  
     {
-      HID_Machine.cb = &HID_MOUSE_cb;
+      HID_Machine->cb = &HID_MOUSE_cb;
     }
     
-    HID_Machine.state     = HID_IDLE;
-    HID_Machine.ctl_state = HID_REQ_IDLE; 
-    HID_Machine.ep_addr   = pphost->device_prop.Ep_Desc[0][0].bEndpointAddress;
-    HID_Machine.length    = pphost->device_prop.Ep_Desc[0][0].wMaxPacketSize;
-    HID_Machine.poll      = pphost->device_prop.Ep_Desc[0][0].bInterval ;
+    HID_Machine->state     = HID_IDLE;
+    HID_Machine->ctl_state = HID_REQ_IDLE; 
+    HID_Machine->ep_addr   = pphost->device_prop.Ep_Desc[0][0].bEndpointAddress;
+    HID_Machine->length    = pphost->device_prop.Ep_Desc[0][0].wMaxPacketSize;
+    HID_Machine->poll      = pphost->device_prop.Ep_Desc[0][0].bInterval ;
     
-    if (HID_Machine.poll  < HID_MIN_POLL) 
+    /* the ISR polls on bInterval: frames, 2^(bInterval-1) microframes on HS */
+    if (HID_Machine->poll == 0) 
+    {
+       HID_Machine->poll = 1;
+    }
+    if (pphost->device_prop.speed == HPRT0_PRTSPD_HIGH_SPEED)
     {
-       HID_Machine.poll = HID_MIN_POLL;
+      HID_Machine->poll = 1 << (((HID_Machine->poll > 16) ? 16 : HID_Machine->poll) - 1);
     }
+    if (HID_Machine->length > USB_OTG_HC_RING_SLOT)
+    {
+      HID_Machine->length = USB_OTG_HC_RING_SLOT;
+    }
+    HID_Machine->ring.wr = 0;
+    HID_Machine->ring.rd = 0;
+    HID_Machine->MaxLatency = 0;
 
     
     /* Check fo available number of endpoints */
@@ -229,38 +261,37 @@ static USBH_Status USBH_HID_InterfaceInit ( USB_OTG_CORE_HANDLE *pdev,
     {
       if(pphost->device_prop.Ep_Desc[0][num].bEndpointAddress & 0x80)
       {
-        HID_Machine.HIDIntInEp = (pphost->device_prop.Ep_Desc[0][num].bEndpointAddress);
-        HID_Machine.hc_num_in  =\
+        HID_Machine->HIDIntInEp = (pphost->device_prop.Ep_Desc[0][num].bEndpointAddress);
+        HID_Machine->hc_num_in  =\
                USBH_Alloc_Channel(pdev, 
                                   pphost->device_prop.Ep_Desc[0][num].bEndpointAddress);
         
         /* Open channel for IN endpoint */
         USBH_Open_Channel  (pdev,
-                            HID_Machine.hc_num_in,
+                            HID_Machine->hc_num_in,
                             pphost->device_prop.address,
                             pphost->device_prop.speed,
                             EP_TYPE_INTR,
-                            HID_Machine.length); 
+                            HID_Machine->length); 
       }
       else
       {
-        HID_Machine.HIDIntOutEp = (pphost->device_prop.Ep_Desc[0][num].bEndpointAddress);
-        HID_Machine.hc_num_out  =\
+        HID_Machine->HIDIntOutEp = (pphost->device_prop.Ep_Desc[0][num].bEndpointAddress);
+        HID_Machine->hc_num_out  =\
                 USBH_Alloc_Channel(pdev, 
                                    pphost->device_prop.Ep_Desc[0][num].bEndpointAddress);
         
         /* Open channel for OUT endpoint */
         USBH_Open_Channel  (pdev,
-                            HID_Machine.hc_num_out,
+                            HID_Machine->hc_num_out,
                             pphost->device_prop.address,
                             pphost->device_prop.speed,
                             EP_TYPE_INTR,
-                            HID_Machine.length); 
+                            HID_Machine->length); 
       }
       
     }   
     
-     start_toggle =0;
      status = USBH_OK; 
   }
   else
@@ -326,23 +357,31 @@ static USBH_Status USBH_HID_InterfaceInit ( USB_OTG_CORE_HANDLE *pdev,
 void USBH_HID_InterfaceDeInit ( USB_OTG_CORE_HANDLE *pdev,
                                void *phost)
 {	
-   //USBH_HOST *pphost = phost;
+  USBH_HOST *pphost = phost;
+  HID_Machine_TypeDef *HID_Machine = pphost->ClassData;
+  
+  if (HID_Machine == 0)
+  {
+    return;
+  }
     
-  if(HID_Machine.hc_num_in != 0x00)
+  if(HID_Machine->hc_num_in != 0x00)
   {   
-    USB_OTG_HC_Halt(pdev, HID_Machine.hc_num_in);
-    USBH_Free_Channel  (pdev, HID_Machine.hc_num_in);
-    HID_Machine.hc_num_in = 0;     /* Reset the Channel as Free */  
+    HCD_StopRing(pdev, HID_Machine->hc_num_in);
+    USB_OTG_HC_Halt(pdev, HID_Machine->hc_num_in);
+    USBH_Free_Channel  (pdev, HID_Machine->hc_num_in);
+    HID_Machine->hc_num_in = 0;     /* Reset the Channel as Free */  
   }
   
-  if(HID_Machine.hc_num_out != 0x00)
+  if(HID_Machine->hc_num_out != 0x00)
   {   
-    USB_OTG_HC_Halt(pdev, HID_Machine.hc_num_out);
-    USBH_Free_Channel  (pdev, HID_Machine.hc_num_out);
-    HID_Machine.hc_num_out = 0;     /* Reset the Channel as Free */  
+    USB_OTG_HC_Halt(pdev, HID_Machine->hc_num_out);
+    USBH_Free_Channel  (pdev, HID_Machine->hc_num_out);
+    HID_Machine->hc_num_out = 0;     /* Reset the Channel as Free */  
   }
  
-  start_toggle = 0;
+  HID_Machine->phost = 0;
+  pphost->ClassData = 0;
 }
 
 /**
@@ -357,13 +396,14 @@ static USBH_Status USBH_HID_ClassRequest(USB_OTG_CORE_HANDLE *pdev ,
                                          void *phost)
 {   
     USBH_HOST *pphost = phost;
+  HID_Machine_TypeDef *HID_Machine = pphost->ClassData;
     
   USBH_Status status         = USBH_BUSY;
   USBH_Status classReqStatus = USBH_BUSY;
   
   
   /* Switch HID state machine */
-  switch (HID_Machine.ctl_state)
+  switch (HID_Machine->ctl_state)
   {
   case HID_IDLE:  
   case HID_REQ_GET_HID_DESC:
@@ -373,7 +413,7 @@ static USBH_Status USBH_HID_ClassRequest(USB_OTG_CORE_HANDLE *pdev ,
     {
       
       USBH_ParseHIDDesc(&HID_Desc, pdev->host.Rx_Buffer);
-      HID_Machine.ctl_state = HID_REQ_GET_REPORT_DESC;
+      HID_Machine->ctl_state = HID_REQ_GET_REPORT_DESC;
     }
     
     break;     
@@ -383,7 +423,7 @@ static USBH_Status USBH_HID_ClassRequest(USB_OTG_CORE_HANDLE *pdev ,
     /* Get Report Desc */ 
     if (USBH_Get_HID_ReportDescriptor(pdev , pphost, HID_Desc.wItemLength) == USBH_OK)
     {
-      HID_Machine.ctl_state = HID_REQ_SET_IDLE;
+      HID_Machine->ctl_state = HID_REQ_SET_IDLE;
     }
     
     break;
@@ -395,11 +435,11 @@ static USBH_Status USBH_HID_ClassRequest(USB_OTG_CORE_HANDLE *pdev ,
     /* set Idle */
     if (classReqStatus == USBH_OK)
     {
-      HID_Machine.ctl_state = HID_REQ_SET_PROTOCOL;  
+      HID_Machine->ctl_state = HID_REQ_SET_PROTOCOL;  
     }
     else if(classReqStatus == USBH_NOT_SUPPORTED) 
     {
-      HID_Machine.ctl_state = HID_REQ_SET_PROTOCOL;        
+      HID_Machine->ctl_state = HID_REQ_SET_PROTOCOL;        
     } 
     break; 
     
@@ -407,7 +447,7 @@ static USBH_Status USBH_HID_ClassRequest(USB_OTG_CORE_HANDLE *pdev ,
     /* set protocol */
     if (USBH_Set_Protocol (pdev ,pphost, 0) == USBH_OK)
     {
-      HID_Machine.ctl_state = HID_REQ_IDLE;
+      HID_Machine->ctl_state = HID_REQ_IDLE;
       
       /* all requests performed*/
       status = USBH_OK; 
@@ -433,64 +473,65 @@ static USBH_Status USBH_HID_Handle(USB_OTG_CORE_HANDLE *pdev ,
                                    void   *phost)
 {
   USBH_HOST *pphost = phost;
+  HID_Machine_TypeDef *HID_Machine = pphost->ClassData;
   USBH_Status status = USBH_OK;
+  uint8_t *report;
+  uint16_t len, latency;
   
-  switch (HID_Machine.state)
+  switch (HID_Machine->state)
   {
     
   case HID_IDLE:
-    HID_Machine.cb->Init();
-    HID_Machine.state = HID_SYNC;
+    HID_Machine->cb->Init();
+    HID_Machine->state = HID_GET_DATA;
     
-  case HID_SYNC:
+  case HID_GET_DATA:
 
-    /* Sync with start of Even Frame */
-    if(USB_OTG_IsEvenFrame(pdev) == TRUE)
+    /* from here the ISR polls the IN pipe every bInterval */
+    if (HCD_StartRing(pdev,
+                      HID_Machine->hc_num_in,
+                      &HID_Machine->ring,
+                      HID_Machine->length,
+                      HID_Machine->poll) == USB_OTG_OK)
     {
-      HID_Machine.state = HID_GET_DATA;  
+      HID_Machine->state = HID_POLL;
     }
     break;
     
-  case HID_GET_DATA:
-
-    USBH_InterruptReceiveData(pdev, 
-                              HID_Machine.buff,
-                              HID_Machine.length,
-                              HID_Machine.hc_num_in);
-    start_toggle = 1;
-    
-    HID_Machine.state = HID_POLL;
-    HID_Machine.timer = HCD_GetCurrentFrame(pdev);
-    break;
-    
   case HID_POLL:
-    if(( HCD_GetCurrentFrame(pdev) - HID_Machine.timer) >= HID_Machine.poll)
-    {
-      HID_Machine.state = HID_GET_DATA;
-    }
-    else if(HCD_GetURB_State(pdev , HID_Machine.hc_num_in) == URB_DONE)
+    /* the reports that came in since the last visit, oldest first */
+    while ((report = HCD_RingGet(pdev, HID_Machine->hc_num_in, &len)) != 0)
     {
-      if(start_toggle == 1) /* handle data once */
+      latency = (HCD_GetCurrentFrame(pdev) - 
+                 HID_Machine->ring.frame[HID_Machine->ring.rd & USB_OTG_HC_RING_MASK]) & 0x3FFF;
+      if (latency > HID_Machine->MaxLatency)
       {
-        start_toggle = 0;
-        HID_Machine.cb->Decode(HID_Machine.buff);
+        HID_Machine->MaxLatency = latency;
       }
+      HID_Machine->cb->Decode(report);
+      HCD_RingRelease(pdev, HID_Machine->hc_num_in);
     }
-    else if(HCD_GetURB_State(pdev, HID_Machine.hc_num_in) == URB_STALL) /* IN Endpoint Stalled */
+    
+    if(HCD_GetURB_State(pdev, HID_Machine->hc_num_in) == URB_STALL) /* IN Endpoint Stalled */
     {
       
       /* Issue Clear Feature on interrupt IN endpoint */ 
       if( (USBH_ClrFeature(pdev, 
                            pphost,
-                           HID_Machine.ep_addr,
-                           HID_Machine.hc_num_in)) == USBH_OK)
+                           HID_Machine->ep_addr,
+                           HID_Machine->hc_num_in)) == USBH_OK)
       {
         /* Change state to issue next IN token */
-        HID_Machine.state = HID_GET_DATA;
+        HID_Machine->state = HID_GET_DATA;
         
       }
       
     }      
+    else if(HCD_GetURB_State(pdev, HID_Machine->hc_num_in) == URB_ERROR)
+    {
+      /* polling halted on a transaction error, start it again */
+      HID_Machine->state = HID_GET_DATA;
+    }
     break;
     
   default:
@@ -0,0 +1,199 @@
+/**
+  ******************************************************************************
+  * @file    usbh_hub.h
+  * @brief   This file contains all the prototypes for the usbh_hub.c
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive  ----------------------------------------------*/
+#ifndef __USBH_HUB_H
+#define __USBH_HUB_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_core.h"
+#include "usbh_stdreq.h"
+#include "usb_bsp.h"
+#include "usbh_ioreq.h"
+#include "usbh_hcs.h"
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_HUB_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_HUB
+  * @brief This file is the Header file for usbh_hub.c
+  * @{
+  */
+
+
+/** @defgroup USBH_HUB_Exported_Defines
+  * @{
+  */
+/* Hubs served at once */
+#ifndef USBH_HUB_MAX_HUBS
+ #define USBH_HUB_MAX_HUBS             1
+#endif
+
+/* Ports served on each hub, the ports above are left unpowered */
+#ifndef USBH_HUB_MAX_PORTS
+ #define USBH_HUB_MAX_PORTS            4
+#endif
+
+/* Classes USBH_HUB_AddClass can register for the devices on the ports */
+#ifndef USBH_HUB_MAX_CLASSES
+ #define USBH_HUB_MAX_CLASSES          4
+#endif
+
+#define USB_DESC_TYPE_HUB              0x29
+#define USB_HUB_DESC_SIZE              9       /* up to 7 ports */
+
+/* Port features, USB 2.0 table 11-17 */
+#define HUB_FEAT_PORT_CONNECTION       0
+#define HUB_FEAT_PORT_ENABLE           1
+#define HUB_FEAT_PORT_SUSPEND          2
+#define HUB_FEAT_PORT_OVER_CURRENT     3
+#define HUB_FEAT_PORT_RESET            4
+#define HUB_FEAT_PORT_POWER            8
+#define HUB_FEAT_C_PORT_CONNECTION     16      /* C_PORT_x: 16 + bit in wPortChange */
+
+/* wPortStatus bits, the wPortChange bits 0..4 are the C_PORT_x of bits 0..4 */
+#define HUB_PORT_STAT_CONNECTION       0x0001
+#define HUB_PORT_STAT_ENABLE           0x0002
+#define HUB_PORT_STAT_SUSPEND          0x0004
+#define HUB_PORT_STAT_OVER_CURRENT     0x0008
+#define HUB_PORT_STAT_RESET            0x0010
+#define HUB_PORT_STAT_POWER            0x0100
+#define HUB_PORT_STAT_LOW_SPEED        0x0200
+#define HUB_PORT_STAT_HIGH_SPEED       0x0400
+#define HUB_PORT_CHANGE_MASK           0x001F
+
+/* Port resets tried before a device is given up until it is unplugged */
+#define HUB_PORT_MAX_RESETS            3
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HUB_Exported_Types
+  * @{
+  */
+
+/* States for HUB State Machine */
+typedef enum
+{
+  HUB_IDLE= 0,
+  HUB_SYNC,
+  HUB_GET_DATA,
+  HUB_POLL,
+  HUB_GET_PORT_STATUS,
+  HUB_CLEAR_PORT_CHANGE,
+  HUB_RESET_PORT,
+}
+HUB_State;
+
+typedef enum
+{
+  HUB_REQ_IDLE = 0,
+  HUB_REQ_GET_DESC,
+  HUB_REQ_SET_POWER,
+  HUB_REQ_POWER_WAIT,
+}
+HUB_CtlState;
+
+typedef enum
+{
+  HUB_PORT_EMPTY = 0,
+  HUB_PORT_DEBOUNCE,
+  HUB_PORT_RESETTING,
+  HUB_PORT_RECOVERY,
+  HUB_PORT_ACTIVE,
+  HUB_PORT_ERROR,                      /* until the device is unplugged */
+}
+HUB_PortState;
+
+typedef struct _HUB_Port
+{
+  HUB_PortState        state;
+  uint16_t             status;         /* wPortStatus of the last GET_STATUS */
+  uint16_t             change;         /* wPortChange left to clear */
+  uint32_t             timer;          /* end of the debounce / recovery, ms */
+  uint8_t              resets;
+  USBH_HOST            dev;            /* device on the port */
+}
+HUB_Port_TypeDef;
+
+/* Structure for HUB process */
+typedef struct _HUB_Process
+{
+  uint8_t              buff[16];       /* hub descriptor, port status, change bitmap */
+  uint8_t              hc_num_in;
+  HUB_State            state;
+  HUB_CtlState         ctl_state;
+  uint16_t             length;
+  uint8_t              ep_addr;
+  uint16_t             poll;
+  __IO uint16_t        timer;
+  __IO uint8_t         start_toggle;
+  uint8_t              num_ports;
+  uint8_t              port;           /* port of the request in progress, from 1 */
+  uint16_t             changes;        /* ports to read the status of, bit n: port n */
+  uint32_t             pwr_timer;      /* end of bPwrOn2PwrGood, ms */
+  HUB_Port_TypeDef     Port[USBH_HUB_MAX_PORTS];
+  void                 *phost;         /* hub served, 0: free */
+}
+HUB_Machine_TypeDef;
+
+/**
+  * @}
+  */
+
+
+/** @defgroup USBH_HUB_Exported_Macros
+  * @{
+  */
+/**
+  * @}
+  */
+
+/** @defgroup USBH_HUB_Exported_Variables
+  * @{
+  */
+extern USBH_Class_cb_TypeDef  HUB_cb;
+/**
+  * @}
+  */
+
+/** @defgroup USBH_HUB_Exported_FunctionsPrototype
+  * @{
+  */
+uint8_t USBH_HUB_AddClass (uint8_t itf_class, USBH_Class_cb_TypeDef *class_cb);
+/**
+  * @}
+  */
+
+
+#endif /* __USBH_HUB_H */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
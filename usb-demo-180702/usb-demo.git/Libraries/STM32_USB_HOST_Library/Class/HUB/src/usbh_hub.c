@@ -0,0 +1,841 @@
+/**
+  ******************************************************************************
+  * @file    usbh_hub.c
+  * @brief   This file is the HUB Layer Handlers for USB Host HUB class.
+  *
+  * @verbatim
+  *
+  *          ===================================================================
+  *                                HUB Class  Description
+  *          ===================================================================
+  *           This module serves the hubs of the USB 2.0 specification, chapter
+  *           11, and the devices on their ports:
+  *             - the ports are powered, then polled through the status change
+  *               endpoint; a connection is debounced and reset, one port of
+  *               all the hubs at a time since the device answers on address 0
+  *             - each device gets its own USBH_HOST, enumerated by
+  *               USBH_Process like the device of the root port, and the class
+  *               USBH_HUB_AddClass registered for its interface class
+  *             - the pipes of all the devices share the host channels, see
+  *               usbh_hcs.h
+  *           Split transactions are not issued: a full or low speed device
+  *           behind a high speed hub is not supported.
+  *
+  *  @endverbatim
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_hub.h"
+
+/** @addtogroup USBH_LIB
+* @{
+*/
+
+/** @addtogroup USBH_CLASS
+* @{
+*/
+
+/** @addtogroup USBH_HUB_CLASS
+* @{
+*/
+
+/** @defgroup USBH_HUB
+* @brief    This file includes HUB Layer Handlers for USB Host HUB class.
+* @{
+*/
+
+/** @defgroup USBH_HUB_Private_TypesDefinitions
+* @{
+*/
+typedef struct
+{
+  uint8_t                  itf_class;
+  USBH_Class_cb_TypeDef    *class_cb;
+}
+HUB_Class_TypeDef;
+/**
+* @}
+*/
+
+
+/** @defgroup USBH_HUB_Private_Defines
+* @{
+*/
+/**
+* @}
+*/
+
+
+/** @defgroup USBH_HUB_Private_Macros
+* @{
+*/
+/**
+* @}
+*/
+
+
+/** @defgroup USBH_HUB_Private_Variables
+* @{
+*/
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN HUB_Machine_TypeDef        HUB_Machine_Pool[USBH_HUB_MAX_HUBS] __ALIGN_END ;
+
+static HUB_Class_TypeDef  HUB_Classes[USBH_HUB_MAX_CLASSES];
+static uint8_t            HUB_NumClasses;
+
+/* Port between reset and the end of the enumeration of its device, the
+   only one whose device may answer on address 0 */
+static HUB_Port_TypeDef   *HUB_EnumPort;
+/**
+* @}
+*/
+
+
+/** @defgroup USBH_HUB_Private_FunctionPrototypes
+* @{
+*/
+
+static USBH_Status USBH_HUB_InterfaceInit  (USB_OTG_CORE_HANDLE *pdev ,
+                                            void *phost);
+
+static void USBH_HUB_InterfaceDeInit  (USB_OTG_CORE_HANDLE *pdev ,
+                                       void *phost);
+
+static USBH_Status USBH_HUB_Handle(USB_OTG_CORE_HANDLE *pdev ,
+                                   void *phost);
+
+static USBH_Status USBH_HUB_ClassRequest(USB_OTG_CORE_HANDLE *pdev ,
+                                         void *phost);
+
+static USBH_Status USBH_HUB_ChildInit (USB_OTG_CORE_HANDLE *pdev ,
+                                       void *phost);
+
+static void USBH_HUB_ChildDeInit (USB_OTG_CORE_HANDLE *pdev ,
+                                  void *phost);
+
+static USBH_Status USBH_HUB_ChildNone (USB_OTG_CORE_HANDLE *pdev ,
+                                       void *phost);
+
+static uint8_t USBH_HUB_ChildBusy (USBH_HOST *phost);
+
+static void USBH_HUB_PortEvent (USB_OTG_CORE_HANDLE *pdev,
+                                USBH_HOST *phost,
+                                HUB_Machine_TypeDef *HUB_Machine);
+
+static void USBH_HUB_PortTimers (USB_OTG_CORE_HANDLE *pdev,
+                                 USBH_HOST *phost,
+                                 HUB_Machine_TypeDef *HUB_Machine);
+
+static USBH_Status USBH_HUB_GetDescriptor (USB_OTG_CORE_HANDLE *pdev,
+                                           USBH_HOST *phost,
+                                           uint8_t *buff,
+                                           uint16_t length);
+
+static USBH_Status USBH_HUB_GetPortStatus (USB_OTG_CORE_HANDLE *pdev,
+                                           USBH_HOST *phost,
+                                           uint8_t port,
+                                           uint8_t *buff);
+
+static USBH_Status USBH_HUB_PortFeature (USB_OTG_CORE_HANDLE *pdev,
+                                         USBH_HOST *phost,
+                                         uint8_t request,
+                                         uint8_t port,
+                                         uint16_t feature);
+
+
+USBH_Class_cb_TypeDef  HUB_cb =
+{
+  USBH_HUB_InterfaceInit,
+  USBH_HUB_InterfaceDeInit,
+  USBH_HUB_ClassRequest,
+  USBH_HUB_Handle
+};
+
+/* class of the devices on the ports until their interface class is known */
+static USBH_Class_cb_TypeDef  HUB_Child_cb =
+{
+  USBH_HUB_ChildInit,
+  USBH_HUB_ChildDeInit,
+  USBH_HUB_ChildNone,
+  USBH_HUB_ChildNone
+};
+
+/* class of the devices no registered class serves */
+static USBH_Class_cb_TypeDef  HUB_NoClass_cb =
+{
+  USBH_HUB_ChildNone,
+  USBH_HUB_ChildDeInit,
+  USBH_HUB_ChildNone,
+  USBH_HUB_ChildNone
+};
+/**
+* @}
+*/
+
+
+/** @defgroup USBH_HUB_Private_Functions
+* @{
+*/
+
+/**
+* @brief  USBH_HUB_AddClass
+*         Register the class serving the devices on the hub ports whose
+*         first interface is of class itf_class
+* @param  itf_class: bInterfaceClass, e.g. USB_HID
+* @param  class_cb: class callbacks
+* @retval 0 if registered, 1 if the table is full
+*/
+uint8_t USBH_HUB_AddClass (uint8_t itf_class, USBH_Class_cb_TypeDef *class_cb)
+{
+  if (HUB_NumClasses >= USBH_HUB_MAX_CLASSES)
+  {
+    return 1;
+  }
+  HUB_Classes[HUB_NumClasses].itf_class = itf_class;
+  HUB_Classes[HUB_NumClasses].class_cb = class_cb;
+  HUB_NumClasses++;
+  return 0;
+}
+
+/**
+* @brief  USBH_HUB_InterfaceInit
+*         The function init the HUB class.
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @retval  USBH_Status :Response for USB HUB driver initialization
+*/
+static USBH_Status USBH_HUB_InterfaceInit ( USB_OTG_CORE_HANDLE *pdev,
+                                           void *phost)
+{
+  USBH_HOST *pphost = phost;
+  HUB_Machine_TypeDef *HUB_Machine = 0;
+  uint8_t num;
+
+  if (pphost->device_prop.Itf_Desc[0].bInterfaceClass != USB_HUB)
+  {
+    pphost->usr_cb->DeviceNotSupported();
+    return USBH_NOT_SUPPORTED;
+  }
+
+  /* one instance per hub */
+  for (num = 0; num < USBH_HUB_MAX_HUBS; num++)
+  {
+    if (HUB_Machine_Pool[num].phost == 0)
+    {
+      HUB_Machine = &HUB_Machine_Pool[num];
+      break;
+    }
+  }
+  if (HUB_Machine == 0)
+  {
+    /* retried until another hub goes away */
+    return USBH_BUSY;
+  }
+
+  HUB_Machine->phost = pphost;
+  pphost->ClassData = HUB_Machine;
+
+  HUB_Machine->state     = HUB_IDLE;
+  HUB_Machine->ctl_state = HUB_REQ_IDLE;
+  HUB_Machine->ep_addr   = pphost->device_prop.Ep_Desc[0][0].bEndpointAddress;
+  HUB_Machine->length    = pphost->device_prop.Ep_Desc[0][0].wMaxPacketSize;
+  HUB_Machine->poll      = pphost->device_prop.Ep_Desc[0][0].bInterval;
+  HUB_Machine->num_ports = 0;
+  HUB_Machine->port      = 1;
+  HUB_Machine->changes   = 0;
+  HUB_Machine->start_toggle = 0;
+
+  if (HUB_Machine->length > sizeof(HUB_Machine->buff))
+  {
+    HUB_Machine->length = sizeof(HUB_Machine->buff);
+  }
+  for (num = 0; num < USBH_HUB_MAX_PORTS; num++)
+  {
+    HUB_Machine->Port[num].state = HUB_PORT_EMPTY;
+    HUB_Machine->Port[num].dev.gState = HOST_IDLE;
+  }
+
+  /* Status change endpoint */
+  HUB_Machine->hc_num_in = USBH_Alloc_Channel(pdev, HUB_Machine->ep_addr);
+  USBH_Open_Channel  (pdev,
+                      HUB_Machine->hc_num_in,
+                      pphost->device_prop.address,
+                      pphost->device_prop.speed,
+                      EP_TYPE_INTR,
+                      HUB_Machine->length);
+
+  return USBH_OK;
+}
+
+/**
+* @brief  USBH_HUB_InterfaceDeInit
+*         The function DeInit the devices on the ports and the Host Channels
+*         used for the HUB class.
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @retval None
+*/
+static void USBH_HUB_InterfaceDeInit ( USB_OTG_CORE_HANDLE *pdev,
+                                      void *phost)
+{
+  USBH_HOST *pphost = phost;
+  HUB_Machine_TypeDef *HUB_Machine = pphost->ClassData;
+  uint8_t num;
+
+  if (HUB_Machine == 0)
+  {
+    return;
+  }
+
+  for (num = 0; num < USBH_HUB_MAX_PORTS; num++)
+  {
+    if (HUB_Machine->Port[num].state == HUB_PORT_ACTIVE)
+    {
+      USBH_DetachDevice(pdev, &HUB_Machine->Port[num].dev);
+    }
+    if (HUB_EnumPort == &HUB_Machine->Port[num])
+    {
+      HUB_EnumPort = 0;
+    }
+    HUB_Machine->Port[num].state = HUB_PORT_EMPTY;
+  }
+
+  if(HUB_Machine->hc_num_in != 0x00)
+  {
+    USB_OTG_HC_Halt(pdev, HUB_Machine->hc_num_in);
+    USBH_Free_Channel  (pdev, HUB_Machine->hc_num_in);
+    HUB_Machine->hc_num_in = 0;     /* Reset the Channel as Free */
+  }
+
+  HUB_Machine->phost = 0;
+  pphost->ClassData = 0;
+}
+
+/**
+* @brief  USBH_HUB_ClassRequest
+*         Read the hub descriptor, power the ports and wait for the power
+*         to be good.
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @retval  USBH_Status : USBH_OK once the ports are powered
+*/
+static USBH_Status USBH_HUB_ClassRequest(USB_OTG_CORE_HANDLE *pdev ,
+                                         void *phost)
+{
+  USBH_HOST *pphost = phost;
+  HUB_Machine_TypeDef *HUB_Machine = pphost->ClassData;
+  USBH_Status status = USBH_BUSY;
+
+  switch (HUB_Machine->ctl_state)
+  {
+  case HUB_REQ_IDLE:
+  case HUB_REQ_GET_DESC:
+    if (USBH_HUB_GetDescriptor(pdev, pphost, HUB_Machine->buff,
+                               USB_HUB_DESC_SIZE) == USBH_OK)
+    {
+      /* bNbrPorts, bPwrOn2PwrGood in units of 2 ms */
+      HUB_Machine->num_ports = HUB_Machine->buff[2];
+      if (HUB_Machine->num_ports > USBH_HUB_MAX_PORTS)
+      {
+        HUB_Machine->num_ports = USBH_HUB_MAX_PORTS;
+      }
+      HUB_Machine->pwr_timer = 2 * HUB_Machine->buff[5];
+      HUB_Machine->port = 1;
+      HUB_Machine->ctl_state = HUB_REQ_SET_POWER;
+    }
+    break;
+
+  case HUB_REQ_SET_POWER:
+    if (HUB_Machine->port > HUB_Machine->num_ports)
+    {
+      HUB_Machine->pwr_timer += USB_OTG_BSP_GetTick();
+      HUB_Machine->ctl_state = HUB_REQ_POWER_WAIT;
+    }
+    else if (USBH_HUB_PortFeature(pdev, pphost, USB_REQ_SET_FEATURE,
+                                  HUB_Machine->port,
+                                  HUB_FEAT_PORT_POWER) == USBH_OK)
+    {
+      HUB_Machine->port++;
+    }
+    break;
+
+  case HUB_REQ_POWER_WAIT:
+    if ((int32_t)(USB_OTG_BSP_GetTick() - HUB_Machine->pwr_timer) >= 0)
+    {
+      /* the devices present at power on raise C_PORT_CONNECTION */
+      HUB_Machine->ctl_state = HUB_REQ_IDLE;
+      HUB_Machine->port = 1;
+      status = USBH_OK;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return status;
+}
+
+/**
+* @brief  USBH_HUB_Handle
+*         Run the devices on the ports and serve the status changes of the
+*         hub
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @retval USBH_Status
+*/
+static USBH_Status USBH_HUB_Handle(USB_OTG_CORE_HANDLE *pdev ,
+                                   void   *phost)
+{
+  USBH_HOST *pphost = phost;
+  HUB_Machine_TypeDef *HUB_Machine = pphost->ClassData;
+  HUB_Port_TypeDef *port;
+  USBH_Status status = USBH_OK;
+  uint16_t feature;
+  uint8_t num;
+
+  for (num = 0; num < HUB_Machine->num_ports; num++)
+  {
+    if (HUB_Machine->Port[num].state == HUB_PORT_ACTIVE)
+    {
+      USBH_Process(pdev, &HUB_Machine->Port[num].dev);
+    }
+  }
+
+  /* next device may take address 0 */
+  if ((HUB_EnumPort != 0) && (HUB_EnumPort->state == HUB_PORT_ACTIVE) &&
+      (USBH_HUB_ChildBusy(&HUB_EnumPort->dev) == 0))
+  {
+    HUB_EnumPort = 0;
+  }
+
+  port = &HUB_Machine->Port[HUB_Machine->port - 1];
+
+  switch (HUB_Machine->state)
+  {
+  case HUB_IDLE:
+    HUB_Machine->state = HUB_SYNC;
+
+  case HUB_SYNC:
+    /* Sync with start of Even Frame */
+    if(USB_OTG_IsEvenFrame(pdev) == TRUE)
+    {
+      HUB_Machine->state = HUB_GET_DATA;
+    }
+    break;
+
+  case HUB_GET_DATA:
+    USBH_InterruptReceiveData(pdev,
+                              HUB_Machine->buff,
+                              HUB_Machine->length,
+                              HUB_Machine->hc_num_in);
+    HUB_Machine->start_toggle = 1;
+
+    HUB_Machine->state = HUB_POLL;
+    HUB_Machine->timer = HCD_GetCurrentFrame(pdev);
+    break;
+
+  case HUB_POLL:
+    if(HCD_GetURB_State(pdev , HUB_Machine->hc_num_in) == URB_DONE)
+    {
+      if(HUB_Machine->start_toggle == 1) /* handle data once */
+      {
+        HUB_Machine->start_toggle = 0;
+        /* bit 0 is the hub itself, bit n port n */
+        HUB_Machine->changes |= HUB_Machine->buff[0] & 0xFE;
+        if (HUB_Machine->length > 1)
+        {
+          HUB_Machine->changes |= HUB_Machine->buff[1] << 8;
+        }
+      }
+    }
+    else if(HCD_GetURB_State(pdev, HUB_Machine->hc_num_in) == URB_STALL)
+    {
+      /* Issue Clear Feature on interrupt IN endpoint */
+      if( (USBH_ClrFeature(pdev,
+                           pphost,
+                           HUB_Machine->ep_addr,
+                           HUB_Machine->hc_num_in)) == USBH_OK)
+      {
+        HUB_Machine->state = HUB_GET_DATA;
+      }
+      break;
+    }
+
+    if (HUB_Machine->changes != 0)
+    {
+      for (num = 1; (HUB_Machine->changes & (1 << num)) == 0; num++)
+      {
+      }
+      HUB_Machine->changes &= ~(1 << num);
+      if (num <= HUB_Machine->num_ports)
+      {
+        HUB_Machine->port = num;
+        HUB_Machine->state = HUB_GET_PORT_STATUS;
+      }
+      break;
+    }
+
+    USBH_HUB_PortTimers(pdev, pphost, HUB_Machine);
+    if (HUB_Machine->state != HUB_POLL)
+    {
+      break;
+    }
+
+    if(( HCD_GetCurrentFrame(pdev) - HUB_Machine->timer) >= HUB_Machine->poll)
+    {
+      HUB_Machine->state = HUB_GET_DATA;
+    }
+    break;
+
+  case HUB_GET_PORT_STATUS:
+    if (USBH_HUB_GetPortStatus(pdev, pphost, HUB_Machine->port,
+                               HUB_Machine->buff) == USBH_OK)
+    {
+      port->status = LE16(&HUB_Machine->buff[0]);
+      port->change = LE16(&HUB_Machine->buff[2]) & HUB_PORT_CHANGE_MASK;
+      USBH_HUB_PortEvent(pdev, pphost, HUB_Machine);
+      HUB_Machine->state = HUB_CLEAR_PORT_CHANGE;
+    }
+    break;
+
+  case HUB_CLEAR_PORT_CHANGE:
+    if (port->change == 0)
+    {
+      HUB_Machine->state = HUB_POLL;
+      break;
+    }
+    for (feature = 0; (port->change & (1 << feature)) == 0; feature++)
+    {
+    }
+    if (USBH_HUB_PortFeature(pdev, pphost, USB_REQ_CLEAR_FEATURE,
+                             HUB_Machine->port,
+                             HUB_FEAT_C_PORT_CONNECTION + feature) == USBH_OK)
+    {
+      port->change &= ~(1 << feature);
+    }
+    break;
+
+  case HUB_RESET_PORT:
+    if (USBH_HUB_PortFeature(pdev, pphost, USB_REQ_SET_FEATURE,
+                             HUB_Machine->port,
+                             HUB_FEAT_PORT_RESET) == USBH_OK)
+    {
+      /* done when the hub reports C_PORT_RESET */
+      port->resets++;
+      port->state = HUB_PORT_RESETTING;
+      HUB_Machine->state = HUB_POLL;
+    }
+    break;
+
+  default:
+    break;
+  }
+  return status;
+}
+
+/**
+* @brief  USBH_HUB_PortEvent
+*         Follow the port status just read into port->status / change
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @param  HUB_Machine: hub, HUB_Machine->port the port read
+* @retval None
+*/
+static void USBH_HUB_PortEvent (USB_OTG_CORE_HANDLE *pdev,
+                                USBH_HOST *phost,
+                                HUB_Machine_TypeDef *HUB_Machine)
+{
+  HUB_Port_TypeDef *port = &HUB_Machine->Port[HUB_Machine->port - 1];
+
+  if (((port->status & HUB_PORT_STAT_CONNECTION) == 0) ||
+      (port->change & HUB_PORT_STAT_CONNECTION))
+  {
+    /* gone, or replaced */
+    if (port->state == HUB_PORT_ACTIVE)
+    {
+      USBH_DetachDevice(pdev, &port->dev);
+    }
+    if (HUB_EnumPort == port)
+    {
+      HUB_EnumPort = 0;
+    }
+    port->state = HUB_PORT_EMPTY;
+
+    if (port->status & HUB_PORT_STAT_CONNECTION)
+    {
+      port->resets = 0;
+      port->timer = USB_OTG_BSP_GetTick() + USBH_DEBOUNCE_DELAY;
+      port->state = HUB_PORT_DEBOUNCE;
+    }
+  }
+  else if ((port->change & HUB_PORT_STAT_RESET) &&
+           (port->state == HUB_PORT_RESETTING))
+  {
+    if ((port->status & HUB_PORT_STAT_ENABLE) == 0)
+    {
+      /* try again from the debounce, the port is kept meanwhile */
+      port->timer = USB_OTG_BSP_GetTick() + USBH_DEBOUNCE_DELAY;
+      port->state = (port->resets < HUB_PORT_MAX_RESETS) ?
+        HUB_PORT_DEBOUNCE : HUB_PORT_ERROR;
+    }
+    else if ((phost->device_prop.speed == HPRT0_PRTSPD_HIGH_SPEED) &&
+             ((port->status & HUB_PORT_STAT_HIGH_SPEED) == 0))
+    {
+      /* would take split transactions */
+      phost->usr_cb->DeviceNotSupported();
+      port->state = HUB_PORT_ERROR;
+    }
+    else
+    {
+      port->timer = USB_OTG_BSP_GetTick() + USBH_RESET_RECOVERY_DELAY;
+      port->state = HUB_PORT_RECOVERY;
+    }
+
+    if ((port->state == HUB_PORT_ERROR) && (HUB_EnumPort == port))
+    {
+      HUB_EnumPort = 0;
+    }
+  }
+  else if (port->change & HUB_PORT_STAT_OVER_CURRENT)
+  {
+    phost->usr_cb->OverCurrentDetected();
+  }
+}
+
+/**
+* @brief  USBH_HUB_PortTimers
+*         Reset the debounced ports and attach the devices whose reset
+*         recovery is over
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @param  HUB_Machine: hub
+* @retval None
+*/
+static void USBH_HUB_PortTimers (USB_OTG_CORE_HANDLE *pdev,
+                                 USBH_HOST *phost,
+                                 HUB_Machine_TypeDef *HUB_Machine)
+{
+  HUB_Port_TypeDef *port;
+  uint8_t speed;
+  uint8_t num;
+
+  for (num = 0; num < HUB_Machine->num_ports; num++)
+  {
+    port = &HUB_Machine->Port[num];
+
+    if ((int32_t)(USB_OTG_BSP_GetTick() - port->timer) < 0)
+    {
+      continue;
+    }
+
+    if ((port->state == HUB_PORT_DEBOUNCE) &&
+        ((HUB_EnumPort == 0) || (HUB_EnumPort == port)))
+    {
+      HUB_EnumPort = port;
+      HUB_Machine->port = num + 1;
+      HUB_Machine->state = HUB_RESET_PORT;
+      break;
+    }
+    else if (port->state == HUB_PORT_RECOVERY)
+    {
+      if (port->status & HUB_PORT_STAT_LOW_SPEED)
+      {
+        speed = HPRT0_PRTSPD_LOW_SPEED;
+      }
+      else if (port->status & HUB_PORT_STAT_HIGH_SPEED)
+      {
+        speed = HPRT0_PRTSPD_HIGH_SPEED;
+      }
+      else
+      {
+        speed = HPRT0_PRTSPD_FULL_SPEED;
+      }
+
+      port->dev.usr_cb = phost->usr_cb;
+      port->dev.class_cb = &HUB_Child_cb;
+      port->state = HUB_PORT_ACTIVE;
+      USBH_AttachDevice(pdev, &port->dev, phost, num + 1, speed);
+    }
+  }
+}
+
+/**
+* @brief  USBH_HUB_ChildBusy
+*         Tell whether a device on a port is still enumerating or setting
+*         up its class, i.e. owns address 0 and pdev->host.Rx_Buffer
+* @param  phost: Host Handle of the device
+* @retval 1 while busy
+*/
+static uint8_t USBH_HUB_ChildBusy (USBH_HOST *phost)
+{
+  switch (phost->gState)
+  {
+  case HOST_ENUMERATION:
+  case HOST_USR_INPUT:
+  case HOST_CLASS_REQUEST:
+    return 1;
+
+  case HOST_CTRL_XFER:
+    return (phost->gStateBkp != HOST_CLASS);
+
+  default:
+    return 0;
+  }
+}
+
+/**
+* @brief  USBH_HUB_ChildInit
+*         Hand a device on a port to the class registered for its interface
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the device
+* @retval USBH_Status : status of the class Init
+*/
+static USBH_Status USBH_HUB_ChildInit (USB_OTG_CORE_HANDLE *pdev ,
+                                       void *phost)
+{
+  USBH_HOST *pphost = phost;
+  uint8_t num;
+
+  for (num = 0; num < HUB_NumClasses; num++)
+  {
+    if (HUB_Classes[num].itf_class ==
+        pphost->device_prop.Itf_Desc[0].bInterfaceClass)
+    {
+      pphost->class_cb = HUB_Classes[num].class_cb;
+      return pphost->class_cb->Init(pdev, phost);
+    }
+  }
+
+  pphost->usr_cb->DeviceNotSupported();
+  pphost->class_cb = &HUB_NoClass_cb;
+  return USBH_OK;
+}
+
+/**
+* @brief  USBH_HUB_ChildDeInit
+*         Nothing to release for a device without a class
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the device
+* @retval None
+*/
+static void USBH_HUB_ChildDeInit (USB_OTG_CORE_HANDLE *pdev ,
+                                  void *phost)
+{
+}
+
+/**
+* @brief  USBH_HUB_ChildNone
+*         Requests / Machine of a device without a class
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the device
+* @retval USBH_OK
+*/
+static USBH_Status USBH_HUB_ChildNone (USB_OTG_CORE_HANDLE *pdev ,
+                                       void *phost)
+{
+  return USBH_OK;
+}
+
+/**
+* @brief  USBH_HUB_GetDescriptor
+*         Issue the class GET_DESCRIPTOR of the hub descriptor
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @param  buff: buffer for the descriptor
+* @param  length: bytes to read
+* @retval USBH_Status : Response for the request
+*/
+static USBH_Status USBH_HUB_GetDescriptor (USB_OTG_CORE_HANDLE *pdev,
+                                           USBH_HOST *phost,
+                                           uint8_t *buff,
+                                           uint16_t length)
+{
+  phost->Control.setup.b.bmRequestType = USB_D2H | USB_REQ_RECIPIENT_DEVICE |\
+    USB_REQ_TYPE_CLASS;
+
+  phost->Control.setup.b.bRequest = USB_REQ_GET_DESCRIPTOR;
+  phost->Control.setup.b.wValue.w = USB_DESC_TYPE_HUB << 8;
+  phost->Control.setup.b.wIndex.w = 0;
+  phost->Control.setup.b.wLength.w = length;
+
+  return USBH_CtlReq(pdev, phost, buff , length );
+}
+
+/**
+* @brief  USBH_HUB_GetPortStatus
+*         Issue GET_STATUS of a port: wPortStatus then wPortChange
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @param  port: port, from 1
+* @param  buff: 4 bytes buffer
+* @retval USBH_Status : Response for the request
+*/
+static USBH_Status USBH_HUB_GetPortStatus (USB_OTG_CORE_HANDLE *pdev,
+                                           USBH_HOST *phost,
+                                           uint8_t port,
+                                           uint8_t *buff)
+{
+  phost->Control.setup.b.bmRequestType = USB_D2H | USB_REQ_RECIPIENT_OTHER |\
+    USB_REQ_TYPE_CLASS;
+
+  phost->Control.setup.b.bRequest = USB_REQ_GET_STATUS;
+  phost->Control.setup.b.wValue.w = 0;
+  phost->Control.setup.b.wIndex.w = port;
+  phost->Control.setup.b.wLength.w = 4;
+
+  return USBH_CtlReq(pdev, phost, buff , 4 );
+}
+
+/**
+* @brief  USBH_HUB_PortFeature
+*         Issue SET_FEATURE / CLEAR_FEATURE of a port feature
+* @param  pdev: Selected device
+* @param  phost: Host Handle of the hub
+* @param  request: USB_REQ_SET_FEATURE or USB_REQ_CLEAR_FEATURE
+* @param  port: port, from 1
+* @param  feature: HUB_FEAT_xxx
+* @retval USBH_Status : Response for the request
+*/
+static USBH_Status USBH_HUB_PortFeature (USB_OTG_CORE_HANDLE *pdev,
+                                         USBH_HOST *phost,
+                                         uint8_t request,
+                                         uint8_t port,
+                                         uint16_t feature)
+{
+  phost->Control.setup.b.bmRequestType = USB_H2D | USB_REQ_RECIPIENT_OTHER |\
+    USB_REQ_TYPE_CLASS;
+
+  phost->Control.setup.b.bRequest = request;
+  phost->Control.setup.b.wValue.w = feature;
+  phost->Control.setup.b.wIndex.w = port;
+  phost->Control.setup.b.wLength.w = 0;
+
+  return USBH_CtlReq(pdev, phost, 0 , 0 );
+}
+
+/**
+* @}
+*/
+
+/**
+* @}
+*/
+
+/**
+* @}
+*/
+
+/**
+* @}
+*/
+
+/**
+* @}
+*/
@@ -31,6 +31,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "usbh_stdreq.h"
+#include <stddef.h>
 
 
 /** @addtogroup USBH_LIB
@@ -87,6 +88,36 @@ typedef enum
 MSCState;
 
 
+typedef union _USBH_CSW_Block
+{
+  struct __CSW
+  {
+    uint32_t CSWSignature;
+    uint32_t CSWTag;
+    uint32_t CSWDataResidue;
+    uint8_t  CSWStatus;
+  }field;
+  uint8_t CSWArray[13];
+}HostCSWPkt_TypeDef;
+
+/* One queued SCSI command with its own CBW/CSW */
+typedef struct _USBH_MSC_Cmd
+{
+  HostCBWPkt_TypeDef CBW;               /* word aligned for the HS DMA */
+  uint8_t  Sense[20];                   /* auto REQUEST SENSE data */
+  HostCSWPkt_TypeDef CSW;
+  uint8_t  CSWSpare[64 - sizeof(HostCSWPkt_TypeDef)]; /* CSW is read with
+                                           USBH_MSC_CSW_MAX_LENGTH */
+  uint8_t *pBuff;
+  uint32_t Seq;                         /* submission order */
+  uint8_t  State;                       /* USBH_MSC_CMD_xxx */
+  uint8_t  Status;                      /* USBH_MSC_Status_TypeDef once DONE */
+  uint8_t  AutoSense;                   /* REQUEST SENSE running in this slot */
+  uint8_t  SenseKey;
+  uint8_t  ASC;
+  uint8_t  ASCQ;
+} USBH_MSC_Cmd_TypeDef;
+
 typedef struct _BOTXfer
 {
 uint8_t MSCState;
@@ -99,20 +130,10 @@ uint8_t* pRxTxBuff;
 uint16_t DataLength;
 uint8_t BOTXferErrorCount;
 uint8_t BOTXferStatus;
+USBH_MSC_Cmd_TypeDef *pCmd;             /* command on the bus */
 } USBH_BOTXfer_TypeDef;
 
 
-typedef union _USBH_CSW_Block
-{
-  struct __CSW
-  {
-    uint32_t CSWSignature;
-    uint32_t CSWTag;
-    uint32_t CSWDataResidue;
-    uint8_t  CSWStatus;
-  }field;
-  uint8_t CSWArray[13];
-}HostCSWPkt_TypeDef;
 
 /**
   * @}
@@ -123,6 +144,7 @@ typedef union _USBH_CSW_Block
 /** @defgroup USBH_MSC_BOT_Exported_Defines
   * @{
   */ 
+#define USBH_MSC_BOT_IDLE                 0
 #define USBH_MSC_SEND_CBW                 1
 #define USBH_MSC_SENT_CBW                 2
 #define USBH_MSC_BOT_DATAIN_STATE         3
@@ -134,7 +156,7 @@ typedef union _USBH_CSW_Block
 
 
 #define USBH_MSC_BOT_CBW_SIGNATURE        0x43425355
-#define USBH_MSC_BOT_CBW_TAG              0x20304050             
+#define USBH_MSC_BOT_CBW_TAG              0x20304050   /* first tag, then +1 per CBW */
 #define USBH_MSC_BOT_CSW_SIGNATURE        0x53425355           
 #define USBH_MSC_CSW_DATA_LENGTH          0x000D
 #define USBH_MSC_BOT_CBW_PACKET_LENGTH    31
@@ -153,6 +175,22 @@ typedef union _USBH_CSW_Block
 #define USBH_MSC_DIR_OUT                  1
 #define USBH_MSC_BOTH_DIR                 2
 
+/* Command slots; the queue keeps the next CBW ready while one is on the bus */
+#ifndef USBH_MSC_CMD_QUEUE_DEPTH
+ #define USBH_MSC_CMD_QUEUE_DEPTH         4
+#endif
+
+/* Highest LUN count accepted from GET MAX LUN (card readers) */
+#ifndef USBH_MSC_MAX_LUN
+ #define USBH_MSC_MAX_LUN                 4
+#endif
+
+#define USBH_MSC_CMD_FREE                 0
+#define USBH_MSC_CMD_OWNED                1   /* being filled in by the caller */
+#define USBH_MSC_CMD_QUEUED               2
+#define USBH_MSC_CMD_ACTIVE               3
+#define USBH_MSC_CMD_DONE                 4   /* Status valid until released */
+
 //#define USBH_MSC_PAGE_LENGTH                 0x40
 #define USBH_MSC_PAGE_LENGTH              512
 
@@ -184,8 +222,6 @@ typedef union _USBH_CSW_Block
   * @{
   */ 
 extern USBH_BOTXfer_TypeDef USBH_MSC_BOTXferParam;
-extern HostCBWPkt_TypeDef USBH_MSC_CBWData;
-extern HostCSWPkt_TypeDef USBH_MSC_CSWData;
 /**
   * @}
   */ 
@@ -198,6 +234,9 @@ void USBH_MSC_HandleBOTXfer(USB_OTG_CORE_HANDLE *pdev,
 uint8_t USBH_MSC_DecodeCSW(USB_OTG_CORE_HANDLE *pdev,
                            USBH_HOST *phost);
 void USBH_MSC_Init(USB_OTG_CORE_HANDLE *pdev);
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdAlloc(uint8_t lun);
+void USBH_MSC_CmdSubmit(USBH_MSC_Cmd_TypeDef *cmd);
+void USBH_MSC_CmdRelease(USBH_MSC_Cmd_TypeDef *cmd);
 USBH_Status USBH_MSC_BOT_Abort(USB_OTG_CORE_HANDLE *pdev, 
                                USBH_HOST *phost,
                                uint8_t direction);
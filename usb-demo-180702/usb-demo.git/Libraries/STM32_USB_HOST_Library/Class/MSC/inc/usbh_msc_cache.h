@@ -0,0 +1,121 @@
+/**
+  ******************************************************************************
+  * @file    usbh_msc_cache.h
+  * @brief   Header file for usbh_msc_cache.c
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive  ----------------------------------------------*/
+#ifndef __USBH_MSC_CACHE_H__
+#define __USBH_MSC_CACHE_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_msc_io.h"
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_MSC_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_MSC_CACHE
+  * @brief Set-associative write-back sector cache
+  * @{
+  */
+
+/** @defgroup USBH_MSC_CACHE_Exported_Defines
+  * @{
+  */
+/* Sets (a power of two) x ways, one sector per line */
+#ifndef USBH_MSC_CACHE_SETS
+ #define USBH_MSC_CACHE_SETS              4
+#endif
+
+#ifndef USBH_MSC_CACHE_WAYS
+ #define USBH_MSC_CACHE_WAYS              4
+#endif
+
+/* Ways per set that FAT / directory sectors keep against data sectors;
+   0 leaves that class to plain LRU */
+#ifndef USBH_MSC_CACHE_FAT_WAYS
+ #define USBH_MSC_CACHE_FAT_WAYS          1
+#endif
+
+#ifndef USBH_MSC_CACHE_DIR_WAYS
+ #define USBH_MSC_CACHE_DIR_WAYS          1
+#endif
+
+/* Requests longer than this many sectors go straight to the disk */
+#ifndef USBH_MSC_CACHE_BYPASS
+ #define USBH_MSC_CACHE_BYPASS            2
+#endif
+
+/* Millisecond time base for the transfer time statistic */
+#ifndef USBH_MSC_CACHE_TICK
+ #define USBH_MSC_CACHE_TICK()            0
+#endif
+
+/* disk_ioctl() codes, above the ones FatFs uses */
+#define USBH_MSC_CACHE_GET_STATS          0x80  /* USBH_MSC_Cache_Stats_TypeDef */
+#define USBH_MSC_CACHE_CLEAR_STATS        0x81
+/**
+  * @}
+  */
+
+/** @defgroup USBH_MSC_CACHE_Exported_Types
+  * @{
+  */
+typedef struct
+{
+  uint32_t ReadHit;             /* sectors */
+  uint32_t ReadMiss;
+  uint32_t WriteHit;
+  uint32_t WriteMiss;
+  uint32_t Bypass;              /* requests */
+  uint32_t Evict;               /* lines */
+  uint32_t WriteBack;           /* dirty lines written to the disk */
+  uint32_t XferSectors;         /* sectors moved over USB */
+  uint32_t XferTime;            /* USBH_MSC_CACHE_TICK units spent moving them */
+} USBH_MSC_Cache_Stats_TypeDef;
+/**
+  * @}
+  */
+
+/** @defgroup USBH_MSC_CACHE_Exported_FunctionsPrototype
+  * @{
+  */
+void    USBH_MSC_Cache_Reset      (void);
+uint8_t USBH_MSC_Cache_Read       (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                                   uint8_t *buff, uint32_t sector, uint32_t count);
+uint8_t USBH_MSC_Cache_Write      (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                                   const uint8_t *buff, uint32_t sector, uint32_t count);
+uint8_t USBH_MSC_Cache_Flush      (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost);
+void    USBH_MSC_Cache_GetStats   (USBH_MSC_Cache_Stats_TypeDef *stats);
+void    USBH_MSC_Cache_ClearStats (void);
+/**
+  * @}
+  */
+
+#endif  /* __USBH_MSC_CACHE_H__ */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
@@ -0,0 +1,112 @@
+/**
+  ******************************************************************************
+  * @file    usbh_msc_io.h
+  * @brief   Header file for usbh_msc_io.c
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive  ----------------------------------------------*/
+#ifndef __USBH_MSC_IO_H__
+#define __USBH_MSC_IO_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_msc_core.h"
+#include "usbh_msc_scsi.h"
+#include "usbh_msc_bot.h"
+#include <stddef.h>
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_MSC_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_MSC_IO
+  * @brief Queued sector I/O with read-ahead and write-behind
+  * @{
+  */
+
+/** @defgroup USBH_MSC_IO_Exported_Defines
+  * @{
+  */
+/* Sectors fetched by one read-ahead READ(10), at least 1 */
+#ifndef USBH_MSC_IO_RA_SECTORS
+ #define USBH_MSC_IO_RA_SECTORS           8
+#endif
+
+/* Sectors coalesced into one write-behind WRITE(10), at least 1 */
+#ifndef USBH_MSC_IO_WB_SECTORS
+ #define USBH_MSC_IO_WB_SECTORS           8
+#endif
+
+/* Times a command failing in its CSW is sent again before giving up */
+#ifndef USBH_MSC_IO_RETRY
+ #define USBH_MSC_IO_RETRY                3
+#endif
+
+#define USBH_MSC_IO_READ                  0
+#define USBH_MSC_IO_WRITE                 1
+#define USBH_MSC_IO_SYNC                  2   /* completes once write-behind is on the disk */
+/**
+  * @}
+  */
+
+/** @defgroup USBH_MSC_IO_Exported_Types
+  * @{
+  */
+typedef struct _USBH_MSC_IO_Req USBH_MSC_IO_Req_TypeDef;
+
+/* Owned by the caller until it completes: status leaves USBH_MSC_BUSY and
+   the callback, if any, runs from USBH_MSC_IO_Process */
+struct _USBH_MSC_IO_Req
+{
+  uint8_t   op;                 /* USBH_MSC_IO_READ/WRITE/SYNC */
+  __IO uint8_t status;          /* USBH_MSC_Status_TypeDef */
+  uint8_t  *buff;
+  uint32_t  sector;
+  uint32_t  count;              /* in USBH_MSC_PAGE_LENGTH sectors */
+  void    (*cb)(USBH_MSC_IO_Req_TypeDef *req);
+  void     *ctx;                /* free for the caller */
+  USBH_MSC_IO_Req_TypeDef *next;
+};
+/**
+  * @}
+  */
+
+/** @defgroup USBH_MSC_IO_Exported_FunctionsPrototype
+  * @{
+  */
+void    USBH_MSC_IO_Reset   (void);
+uint8_t USBH_MSC_IO_Submit  (USBH_MSC_IO_Req_TypeDef *req);
+void    USBH_MSC_IO_Process (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost);
+uint8_t USBH_MSC_IO_Wait    (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                             USBH_MSC_IO_Req_TypeDef *req);
+uint8_t USBH_MSC_IO_Idle    (void);
+uint8_t USBH_MSC_IO_Error   (void);
+/**
+  * @}
+  */
+
+#endif  /* __USBH_MSC_IO_H__ */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
@@ -31,6 +31,7 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "usbh_stdreq.h"
+#include "usbh_msc_bot.h"
 
 
 /** @addtogroup USBH_LIB
@@ -142,6 +143,17 @@ uint8_t USBH_MSC_Read10(USB_OTG_CORE_HANDLE *pdev,
                         uint32_t );
 void USBH_MSC_StateMachine(USB_OTG_CORE_HANDLE *pdev);
 
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdTestUnitReady(uint8_t lun);
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdRequestSense(uint8_t lun, uint8_t *buff);
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdRead10(uint8_t lun,
+                                         uint8_t *dataBuffer,
+                                         uint32_t address,
+                                         uint32_t nbOfbytes);
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdWrite10(uint8_t lun,
+                                          uint8_t *dataBuffer,
+                                          uint32_t address,
+                                          uint32_t nbOfbytes);
+
 /**
   * @}
   */ 
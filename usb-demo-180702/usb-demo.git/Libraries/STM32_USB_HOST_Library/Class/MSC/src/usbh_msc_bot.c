@@ -62,6 +62,11 @@
 /** @defgroup USBH_MSC_BOT_Private_Defines
 * @{
 */ 
+/* One channel transfer carries at most 256 packets (USB_OTG_HC_StartXfer)
+   and a 16-bit length (USBH_BulkReceiveData) */
+#define USBH_MSC_BOT_MAX_PKT_CNT        256
+
+#define USBH_MSC_SENSE_LENGTH           18
 /**
 * @}
 */ 
@@ -83,18 +88,15 @@
     #pragma data_alignment=4   
   #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */ 
-__ALIGN_BEGIN HostCBWPkt_TypeDef USBH_MSC_CBWData __ALIGN_END ;
-
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
-    #pragma data_alignment=4   
-  #endif
-#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-__ALIGN_BEGIN HostCSWPkt_TypeDef USBH_MSC_CSWData __ALIGN_END ;
+__ALIGN_BEGIN static USBH_MSC_Cmd_TypeDef USBH_MSC_CmdQueue[USBH_MSC_CMD_QUEUE_DEPTH] __ALIGN_END ;
 
 
 static uint32_t BOTStallErrorCount;   /* Keeps count of STALL Error Cases*/
 static uint8_t xfer_error_count;
+static uint32_t dataXferLength;       /* Length of the DATA IN transfer in flight */
+static uint32_t BOTTag;               /* Tag of the next CBW */
+static uint32_t BOTSeq;               /* Submission counter */
+static uint8_t  BOTLastLun;           /* LUN served last, for the round robin */
 
 /**
 * @}
@@ -104,6 +106,14 @@ static uint8_t xfer_error_count;
 /** @defgroup USBH_MSC_BOT_Private_FunctionPrototypes
 * @{
 */ 
+static void USBH_MSC_BOTDataIn(USB_OTG_CORE_HANDLE *pdev,
+                               uint8_t *buff,
+                               uint32_t length);
+static USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdNext(void);
+static void USBH_MSC_BOTSendCBW(USB_OTG_CORE_HANDLE *pdev,
+                                USBH_MSC_Cmd_TypeDef *cmd);
+static void USBH_MSC_BOTDone(USB_OTG_CORE_HANDLE *pdev,
+                             uint8_t status);
 /**
 * @}
 */ 
@@ -131,11 +141,18 @@ USBH_BOTXfer_TypeDef USBH_MSC_BOTXferParam;
 */
 void USBH_MSC_Init(USB_OTG_CORE_HANDLE *pdev )
 {
+  uint8_t index;
+  
   if(HCD_IsDeviceConnected(pdev))
   {      
-    USBH_MSC_CBWData.field.CBWSignature = USBH_MSC_BOT_CBW_SIGNATURE;
-    USBH_MSC_CBWData.field.CBWTag = USBH_MSC_BOT_CBW_TAG;
-    USBH_MSC_CBWData.field.CBWLUN = 0;
+    for(index = 0; index < USBH_MSC_CMD_QUEUE_DEPTH; index++)
+    {
+      USBH_MSC_CmdQueue[index].State = USBH_MSC_CMD_FREE;
+    }
+    BOTTag = USBH_MSC_BOT_CBW_TAG;
+    BOTLastLun = 0;
+    USBH_MSC_BOTXferParam.pCmd = NULL;
+    USBH_MSC_BOTXferParam.BOTState = USBH_MSC_BOT_IDLE;
     USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;  
   }
   
@@ -143,6 +160,252 @@ void USBH_MSC_Init(USB_OTG_CORE_HANDLE *pdev )
   MSCErrorCount = 0;
 }
 
+/**
+* @brief  USBH_MSC_CmdAlloc 
+*         Takes a free command slot for the caller to fill in the CDB, the
+*         transfer length, flags and data buffer of.
+* @param  lun: Logical unit the command goes to
+* @retval The slot, NULL when all are in use
+*/
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdAlloc(uint8_t lun)
+{
+  USBH_MSC_Cmd_TypeDef *cmd;
+  uint8_t index;
+  
+  for(index = 0; index < USBH_MSC_CMD_QUEUE_DEPTH; index++)
+  {
+    cmd = &USBH_MSC_CmdQueue[index];
+    if(cmd->State == USBH_MSC_CMD_FREE)
+    {
+      cmd->State = USBH_MSC_CMD_OWNED;
+      cmd->Status = USBH_MSC_BUSY;
+      cmd->AutoSense = 0;
+      cmd->SenseKey = 0;
+      cmd->ASC = 0;
+      cmd->ASCQ = 0;
+      cmd->pBuff = NULL;
+      cmd->CBW.field.CBWSignature = USBH_MSC_BOT_CBW_SIGNATURE;
+      cmd->CBW.field.CBWTransferLength = 0;
+      cmd->CBW.field.CBWFlags = USB_EP_DIR_OUT;
+      cmd->CBW.field.CBWLUN = lun;
+      cmd->CBW.field.CBWLength = CBW_LENGTH;
+      for(index = 0; index < CBW_CB_LENGTH; index++)
+      {
+        cmd->CBW.field.CBWCB[index] = 0x00;
+      }
+      return cmd;
+    }
+  }
+  return NULL;
+}
+
+/**
+* @brief  USBH_MSC_CmdSubmit 
+*         Queues a filled in command. It goes out as soon as the bus is
+*         free, the CBW right after the previous CSW; check cmd->State for
+*         USBH_MSC_CMD_DONE, then cmd->Status.
+* @param  cmd: Command from USBH_MSC_CmdAlloc
+* @retval None
+*/
+void USBH_MSC_CmdSubmit(USBH_MSC_Cmd_TypeDef *cmd)
+{
+  cmd->CBW.field.CBWTag = BOTTag++;
+  cmd->Seq = BOTSeq++;
+  cmd->State = USBH_MSC_CMD_QUEUED;
+}
+
+/**
+* @brief  USBH_MSC_CmdRelease 
+*         Gives a done (or never submitted) slot back
+* @param  cmd: Command from USBH_MSC_CmdAlloc
+* @retval None
+*/
+void USBH_MSC_CmdRelease(USBH_MSC_Cmd_TypeDef *cmd)
+{
+  if((cmd->State == USBH_MSC_CMD_DONE) || (cmd->State == USBH_MSC_CMD_OWNED))
+  {
+    cmd->State = USBH_MSC_CMD_FREE;
+  }
+}
+
+/**
+* @brief  USBH_MSC_CmdNext 
+*         Picks the queued command to run next: the oldest one for the LUN
+*         after the last one served, so that every LUN of a card reader
+*         gets its turn, or the oldest of all.
+* @param  None
+* @retval The command, NULL if none is queued
+*/
+static USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdNext(void)
+{
+  USBH_MSC_Cmd_TypeDef *cmd, *best = NULL, *oldest = NULL;
+  uint8_t index, lun, turn, bestTurn = 0xFF;
+  uint8_t nbLun = MSC_Machine.maxLun + 1;
+  
+  for(index = 0; index < USBH_MSC_CMD_QUEUE_DEPTH; index++)
+  {
+    cmd = &USBH_MSC_CmdQueue[index];
+    if(cmd->State != USBH_MSC_CMD_QUEUED)
+    {
+      continue;
+    }
+    if((oldest == NULL) || ((int32_t)(cmd->Seq - oldest->Seq) < 0))
+    {
+      oldest = cmd;
+    }
+    lun = cmd->CBW.field.CBWLUN;
+    if(lun >= nbLun)
+    {
+      continue;
+    }
+    /* 0 for the LUN after the last one served, nbLun - 1 for itself */
+    turn = (lun + nbLun - BOTLastLun - 1) % nbLun;
+    if((turn < bestTurn) ||
+       ((turn == bestTurn) && ((int32_t)(cmd->Seq - best->Seq) < 0)))
+    {
+      best = cmd;
+      bestTurn = turn;
+    }
+  }
+  return (best != NULL) ? best : oldest;
+}
+
+/**
+* @brief  USBH_MSC_BOTSendCBW 
+*         Puts the CBW of a command on the bus
+* @param  pdev: Selected device
+* @param  cmd: Command
+* @retval None
+*/
+static void USBH_MSC_BOTSendCBW(USB_OTG_CORE_HANDLE *pdev,
+                                USBH_MSC_Cmd_TypeDef *cmd)
+{
+  cmd->State = USBH_MSC_CMD_ACTIVE;
+  BOTLastLun = cmd->CBW.field.CBWLUN;
+  USBH_MSC_BOTXferParam.pCmd = cmd;
+  
+  USBH_BulkSendData (pdev,
+                     &cmd->CBW.CBWArray[0], 
+                     USBH_MSC_BOT_CBW_PACKET_LENGTH , 
+                     MSC_Machine.hc_num_out);
+  
+  USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_SEND_CBW;
+  USBH_MSC_BOTXferParam.BOTState = USBH_MSC_SENT_CBW;
+  xfer_error_count= 0;
+}
+
+/**
+* @brief  USBH_MSC_BOTDone 
+*         Ends the command on the bus. A failed command first fetches its
+*         sense data in the same slot; a phase error fails everything
+*         queued, the device needs a reset recovery. The next queued CBW
+*         goes out right away.
+* @param  pdev: Selected device
+* @param  status: Outcome of the command
+* @retval None
+*/
+static void USBH_MSC_BOTDone(USB_OTG_CORE_HANDLE *pdev,
+                             uint8_t status)
+{
+  USBH_MSC_Cmd_TypeDef *cmd = USBH_MSC_BOTXferParam.pCmd;
+  uint8_t index;
+  
+  USBH_MSC_BOTXferParam.BOTXferStatus = status;
+  USBH_MSC_BOTXferParam.BOTState = USBH_MSC_BOT_IDLE;
+  USBH_MSC_BOTXferParam.pCmd = NULL;
+  
+  if(cmd == NULL)
+  {
+    return;
+  }
+  
+  if(cmd->AutoSense)
+  {
+    if(status == USBH_MSC_OK)
+    {
+      cmd->SenseKey = cmd->Sense[2] & 0x0F;
+      cmd->ASC = cmd->Sense[12];
+      cmd->ASCQ = cmd->Sense[13];
+      (((uint8_t*)&USBH_MSC_Param.MSSenseKey )[3]) = cmd->Sense[0];
+      (((uint8_t*)&USBH_MSC_Param.MSSenseKey )[2]) = cmd->Sense[1];
+      (((uint8_t*)&USBH_MSC_Param.MSSenseKey )[1]) = cmd->Sense[2];
+      (((uint8_t*)&USBH_MSC_Param.MSSenseKey )[0]) = cmd->Sense[3];
+    }
+    /* The command itself failed, whatever the sense did */
+    status = (status == USBH_MSC_PHASE_ERROR) ? USBH_MSC_PHASE_ERROR : USBH_MSC_FAIL;
+    USBH_MSC_BOTXferParam.BOTXferStatus = status;
+  }
+  else if((status == USBH_MSC_FAIL) &&
+          (cmd->CBW.field.CBWCB[0] != OPCODE_REQUEST_SENSE))
+  {
+    /* Turn the slot into a REQUEST SENSE for the same LUN */
+    cmd->AutoSense = 1;
+    cmd->pBuff = cmd->Sense;
+    cmd->CBW.field.CBWTag = BOTTag++;
+    cmd->CBW.field.CBWTransferLength = USBH_MSC_SENSE_LENGTH;
+    cmd->CBW.field.CBWFlags = USB_EP_DIR_IN;
+    cmd->CBW.field.CBWLength = CBW_LENGTH_TEST_UNIT_READY;
+    for(index = 0; index < CBW_CB_LENGTH; index++)
+    {
+      cmd->CBW.field.CBWCB[index] = 0x00;
+    }
+    cmd->CBW.field.CBWCB[0] = OPCODE_REQUEST_SENSE;
+    cmd->CBW.field.CBWCB[4] = USBH_MSC_SENSE_LENGTH;
+    USBH_MSC_BOTSendCBW(pdev, cmd);
+    return;
+  }
+  
+  cmd->Status = status;
+  cmd->State = USBH_MSC_CMD_DONE;
+  
+  if(status == USBH_MSC_PHASE_ERROR)
+  {
+    for(index = 0; index < USBH_MSC_CMD_QUEUE_DEPTH; index++)
+    {
+      if(USBH_MSC_CmdQueue[index].State == USBH_MSC_CMD_QUEUED)
+      {
+        USBH_MSC_CmdQueue[index].Status = USBH_MSC_PHASE_ERROR;
+        USBH_MSC_CmdQueue[index].State = USBH_MSC_CMD_DONE;
+      }
+    }
+    return;
+  }
+  
+  cmd = USBH_MSC_CmdNext();
+  if(cmd != NULL)
+  {
+    USBH_MSC_BOTSendCBW(pdev, cmd);
+  }
+}
+
+/**
+* @brief  USBH_MSC_BOTDataIn 
+*         Starts one DATA IN channel transfer of up to length bytes, as much
+*         as the channel can take in one go.
+* @param  pdev: Selected device
+* @param  buff: Destination buffer
+* @param  length: Remaining length of the data stage
+* @retval None
+*/
+static void USBH_MSC_BOTDataIn(USB_OTG_CORE_HANDLE *pdev,
+                               uint8_t *buff,
+                               uint32_t length)
+{
+  uint32_t mps = MSC_Machine.MSBulkInEpSize;
+  uint32_t max = mps * USBH_MSC_BOT_MAX_PKT_CNT;
+  
+  if(max > 0xFFFF)
+  {
+    max = 0xFFFF - (0xFFFF % mps);
+  }
+  dataXferLength = (length > max) ? max : length;
+  
+  USBH_BulkReceiveData (pdev,
+                        buff, 
+                        dataXferLength, 
+                        MSC_Machine.hc_num_in);
+}
+
 /**
 * @brief  USBH_MSC_HandleBOTXfer 
 *         This function manages the different states of BOT transfer and 
@@ -154,6 +417,8 @@ void USBH_MSC_Init(USB_OTG_CORE_HANDLE *pdev )
 void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
 {
   uint8_t xferDirection, index;
+  uint32_t dataXferCount;
+  USBH_MSC_Cmd_TypeDef *cmd = USBH_MSC_BOTXferParam.pCmd;
   static uint32_t remainingDataLength;
   static uint8_t *datapointer , *datapointer_prev;
   static uint8_t error_direction;
@@ -166,16 +431,18 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
     
     switch (USBH_MSC_BOTXferParam.BOTState)
     {
-    case USBH_MSC_SEND_CBW:
-      /* send CBW */    
-      USBH_BulkSendData (pdev,
-                         &USBH_MSC_CBWData.CBWArray[0], 
-                         USBH_MSC_BOT_CBW_PACKET_LENGTH , 
-                         MSC_Machine.hc_num_out);
+    case USBH_MSC_BOT_IDLE:
+      /* Nothing on the bus: start the next queued command */
+      cmd = USBH_MSC_CmdNext();
+      if(cmd != NULL)
+      {
+        USBH_MSC_BOTSendCBW(pdev, cmd);
+      }
+      break;
       
-      USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_SEND_CBW;
-      USBH_MSC_BOTXferParam.BOTState = USBH_MSC_SENT_CBW;
-      xfer_error_count= 0;
+    case USBH_MSC_SEND_CBW:
+      /* send CBW again */    
+      USBH_MSC_BOTSendCBW(pdev, cmd);
       break;
       
     case USBH_MSC_SENT_CBW:
@@ -187,12 +454,12 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
         USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_SENT_CBW; 
         
         /* If the CBW Pkt is sent successful, then change the state */
-        xferDirection = (USBH_MSC_CBWData.field.CBWFlags & USB_REQ_DIR_MASK);
+        xferDirection = (cmd->CBW.field.CBWFlags & USB_REQ_DIR_MASK);
         
-        if ( USBH_MSC_CBWData.field.CBWTransferLength != 0 )
+        if ( cmd->CBW.field.CBWTransferLength != 0 )
         {
-          remainingDataLength = USBH_MSC_CBWData.field.CBWTransferLength ;
-          datapointer = USBH_MSC_BOTXferParam.pRxTxBuff;
+          remainingDataLength = cmd->CBW.field.CBWTransferLength ;
+          datapointer = cmd->pBuff;
           datapointer_prev = datapointer;
           
           /* If there is Data Transfer Stage */
@@ -234,7 +501,7 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
         else
         {
          /* unrecoverd error */
-         USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_PHASE_ERROR;
+         USBH_MSC_BOTDone(pdev, USBH_MSC_PHASE_ERROR);
         }
         
       }
@@ -244,35 +511,35 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
     case USBH_MSC_BOT_DATAIN_STATE:
       
       URB_Status =   HCD_GetURB_State(pdev , MSC_Machine.hc_num_in);
-      /* BOT DATA IN stage */
-      if((URB_Status == URB_DONE) ||(USBH_MSC_BOTXferParam.BOTStateBkp != USBH_MSC_BOT_DATAIN_STATE))
+      /* BOT DATA IN stage: the whole remaining length goes out as one channel
+         transfer, the HCD handles the packets (and the HS DMA) */
+      if(USBH_MSC_BOTXferParam.BOTStateBkp != USBH_MSC_BOT_DATAIN_STATE)
       {
         BOTStallErrorCount = 0;
         USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_BOT_DATAIN_STATE;    
-        
-        if(remainingDataLength > MSC_Machine.MSBulkInEpSize)
+        USBH_MSC_BOTDataIn(pdev, datapointer, remainingDataLength);
+      }
+      else if(URB_Status == URB_DONE)
+      {
+        BOTStallErrorCount = 0;
+        xfer_error_count = 0;
+        dataXferCount = HCD_GetXferCnt(pdev, MSC_Machine.hc_num_in);
+        if(dataXferCount > remainingDataLength)
         {
-          USBH_BulkReceiveData (pdev,
-	                        datapointer, 
-			        MSC_Machine.MSBulkInEpSize , 
-			        MSC_Machine.hc_num_in);
-          
-          remainingDataLength -= MSC_Machine.MSBulkInEpSize;
-          datapointer = datapointer + MSC_Machine.MSBulkInEpSize;
+          dataXferCount = remainingDataLength;
         }
-        else if ( remainingDataLength == 0)
+        remainingDataLength -= dataXferCount;
+        datapointer += dataXferCount;
+        
+        if((remainingDataLength == 0) || (dataXferCount < dataXferLength))
         {
-          /* If value was 0, and successful transfer, then change the state */
+          /* All done, or the device ended the stage with a short packet */
           USBH_MSC_BOTXferParam.BOTState = USBH_MSC_RECEIVE_CSW_STATE;
         }
         else
-        {       
-          USBH_BulkReceiveData (pdev,
-	                        datapointer, 
-			        remainingDataLength , 
-			        MSC_Machine.hc_num_in);
-          
-          remainingDataLength = 0; /* Reset this value and keep in same state */
+        {
+          /* Longer than one channel transfer can carry: next chunk */
+          USBH_MSC_BOTDataIn(pdev, datapointer, remainingDataLength);
         }
       }
       else if(URB_Status == URB_STALL)
@@ -302,12 +569,20 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
        
         if (xfer_error_count < 3)
         {
-          USBH_MSC_BOTXferParam.BOTState  = USBH_MSC_BOTXferParam.BOTStateBkp; 
+          /* Keep what arrived before the error and ask for the rest */
+          dataXferCount = HCD_GetXferCnt(pdev, MSC_Machine.hc_num_in);
+          if(dataXferCount > remainingDataLength)
+          {
+            dataXferCount = remainingDataLength;
+          }
+          remainingDataLength -= dataXferCount;
+          datapointer += dataXferCount;
+          USBH_MSC_BOTDataIn(pdev, datapointer, remainingDataLength);
         }
         else
         {
          /* unrecoverd error */
-         USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_PHASE_ERROR;
+         USBH_MSC_BOTDone(pdev, USBH_MSC_PHASE_ERROR);
         }   
       }
       break;   
@@ -398,7 +673,7 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
         else
         {
          /* unrecoverd error */
-         USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_PHASE_ERROR;
+         USBH_MSC_BOTDone(pdev, USBH_MSC_PHASE_ERROR);
         }
       }
       break;
@@ -410,15 +685,15 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
         
         USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_RECEIVE_CSW_STATE;
         
-        USBH_MSC_BOTXferParam.pRxTxBuff = USBH_MSC_CSWData.CSWArray;
+        USBH_MSC_BOTXferParam.pRxTxBuff = cmd->CSW.CSWArray;
         USBH_MSC_BOTXferParam.DataLength = USBH_MSC_CSW_MAX_LENGTH;
         
         for(index = USBH_MSC_CSW_LENGTH-1; index != 0; index--)
         {
-          USBH_MSC_CSWData.CSWArray[index] = 0;
+          cmd->CSW.CSWArray[index] = 0;
         }
         
-        USBH_MSC_CSWData.CSWArray[0] = 0;
+        cmd->CSW.CSWArray[0] = 0;
         
         USBH_BulkReceiveData (pdev,
                               USBH_MSC_BOTXferParam.pRxTxBuff, 
@@ -439,7 +714,8 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
         
         USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOTXferParam.MSCStateCurrent ;
         
-        USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_DecodeCSW(pdev , phost);
+        /* Completes the command and sends the next CBW straight away */
+        USBH_MSC_BOTDone(pdev, USBH_MSC_DecodeCSW(pdev , phost));
       }
       else if(URB_Status == URB_STALL)     
       {
@@ -458,7 +734,7 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
         else
         {
           /* unrecovered error */
-         USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_PHASE_ERROR;
+         USBH_MSC_BOTDone(pdev, USBH_MSC_PHASE_ERROR);
         }
       }
       break;
@@ -482,7 +758,7 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
       else if (status == USBH_UNRECOVERED_ERROR)
       {
         /* This means that there is a STALL Error limit, Do Reset Recovery */
-        USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_PHASE_ERROR;
+        USBH_MSC_BOTDone(pdev, USBH_MSC_PHASE_ERROR);
       }
       break;
       
@@ -495,7 +771,7 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
       else if (status == USBH_UNRECOVERED_ERROR)
       {
         /* This means that there is a STALL Error limit, Do Reset Recovery */
-        USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_PHASE_ERROR;
+        USBH_MSC_BOTDone(pdev, USBH_MSC_PHASE_ERROR);
       }
       break;
       
@@ -570,6 +846,7 @@ uint8_t USBH_MSC_DecodeCSW(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
 {
   uint8_t status;
   uint32_t dataXferCount = 0;
+  HostCSWPkt_TypeDef *csw = &USBH_MSC_BOTXferParam.pCmd->CSW;
   status = USBH_MSC_FAIL;
   
   if(HCD_IsDeviceConnected(pdev))
@@ -595,15 +872,21 @@ uint8_t USBH_MSC_DecodeCSW(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
     { /* CSW length is Correct */
       
       /* Check validity of the CSW Signature and CSWStatus */
-      if(USBH_MSC_CSWData.field.CSWSignature == USBH_MSC_BOT_CSW_SIGNATURE)
+      if(csw->field.CSWSignature == USBH_MSC_BOT_CSW_SIGNATURE)
       {/* Check Condition 1. dCSWSignature is equal to 53425355h */
         
-        if(USBH_MSC_CSWData.field.CSWTag == USBH_MSC_CBWData.field.CBWTag)
+        if(csw->field.CSWTag != USBH_MSC_BOTXferParam.pCmd->CBW.field.CBWTag)
+        {
+          /* Not the CSW of this command: the device is out of step and
+          needs a reset recovery */
+          status = USBH_MSC_PHASE_ERROR;
+        }
+        else
         {
           /* Check Condition 3. dCSWTag matches the dCBWTag from the 
           corresponding CBW */
           
-          if(USBH_MSC_CSWData.field.CSWStatus == USBH_MSC_OK) 
+          if(csw->field.CSWStatus == USBH_MSC_OK) 
           {
             /* Refer to USB Mass-Storage Class : BOT (www.usb.org) 
             
@@ -627,12 +910,12 @@ uint8_t USBH_MSC_DecodeCSW(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
             
             status = USBH_MSC_OK;
           }
-          else if(USBH_MSC_CSWData.field.CSWStatus == USBH_MSC_FAIL)
+          else if(csw->field.CSWStatus == USBH_MSC_FAIL)
           {
             status = USBH_MSC_FAIL;
           }
           
-          else if(USBH_MSC_CSWData.field.CSWStatus == USBH_MSC_PHASE_ERROR)
+          else if(csw->field.CSWStatus == USBH_MSC_PHASE_ERROR)
           { 
             /* Refer to USB Mass-Storage Class : BOT (www.usb.org) 
             Section 6.7 
@@ -0,0 +1,457 @@
+/**
+  ******************************************************************************
+  * @file    usbh_msc_cache.c
+  * @brief   Sector cache between FatFs and the MSC transport.
+  *
+  *          USBH_MSC_CACHE_SETS x USBH_MSC_CACHE_WAYS lines of one sector,
+  *          a sector goes to set (sector % SETS) and replaces the least
+  *          recently used way. Writes stay in the cache (dirty) until the
+  *          line is evicted or USBH_MSC_Cache_Flush is called.
+  *
+  *          The volume boot sector is recognised when it is read through
+  *          the cache and gives the FAT area and the FAT12/16 root
+  *          directory. In each set, up to USBH_MSC_CACHE_FAT_WAYS FAT lines
+  *          and USBH_MSC_CACHE_DIR_WAYS directory lines are kept out of
+  *          reach of data sectors, so streaming file data does not push
+  *          out the sectors f_open and f_readdir keep coming back to.
+  *          FAT32 directories live in data clusters and are not told
+  *          apart from file data.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_msc_cache.h"
+#include <string.h>
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_MSC_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_MSC_CACHE
+  * @brief    This file includes the mass storage sector cache
+  * @{
+  */
+
+/** @defgroup USBH_MSC_CACHE_Private_Defines
+  * @{
+  */
+#define CACHE_SECTOR            USBH_MSC_PAGE_LENGTH
+#define CACHE_LINES             (USBH_MSC_CACHE_SETS * USBH_MSC_CACHE_WAYS)
+
+#define CACHE_VALID             0x01
+#define CACHE_DIRTY             0x02
+
+#define CACHE_CLASS_DATA        0
+#define CACHE_CLASS_FAT         1
+#define CACHE_CLASS_DIR         2
+
+#define CACHE_LD16(p)           ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8))
+#define CACHE_LD32(p)           (CACHE_LD16(p) | (CACHE_LD16((p) + 2) << 16))
+
+#if (USBH_MSC_CACHE_SETS & (USBH_MSC_CACHE_SETS - 1)) || (USBH_MSC_CACHE_SETS == 0)
+  #error "USBH_MSC_CACHE_SETS must be a power of two"
+#endif
+
+#if (USBH_MSC_CACHE_FAT_WAYS + USBH_MSC_CACHE_DIR_WAYS) >= USBH_MSC_CACHE_WAYS
+  #error "USBH_MSC_CACHE_FAT_WAYS + USBH_MSC_CACHE_DIR_WAYS must leave a way for data"
+#endif
+/**
+  * @}
+  */
+
+/** @defgroup USBH_MSC_CACHE_Private_Variables
+  * @{
+  */
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN static uint8_t Cache_Data[CACHE_LINES][CACHE_SECTOR] __ALIGN_END;
+static uint32_t Cache_Tag[CACHE_LINES];
+static uint32_t Cache_Age[CACHE_LINES];
+static uint8_t  Cache_Flags[CACHE_LINES];
+static uint32_t Cache_Clock;
+
+/* From the boot sector: [FatStart, FatEnd) FATs, [FatEnd, DirEnd) root dir */
+static uint32_t Cache_FatStart;
+static uint32_t Cache_FatEnd;
+static uint32_t Cache_DirEnd;
+
+static USBH_MSC_Cache_Stats_TypeDef Cache_Stats;
+/**
+  * @}
+  */
+
+/** @defgroup USBH_MSC_CACHE_Private_Functions
+  * @{
+  */
+
+static uint8_t Cache_Xfer(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost, uint8_t op,
+                          uint8_t *buff, uint32_t sector, uint32_t count)
+{
+  USBH_MSC_IO_Req_TypeDef req;
+  uint32_t t0 = USBH_MSC_CACHE_TICK();
+  uint8_t status;
+
+  req.op     = op;
+  req.buff   = buff;
+  req.sector = sector;
+  req.count  = count;
+  req.cb     = NULL;
+  status = USBH_MSC_IO_Wait(pdev, phost, &req);
+
+  Cache_Stats.XferSectors += count;
+  Cache_Stats.XferTime += USBH_MSC_CACHE_TICK() - t0;
+  return status;
+}
+
+static uint8_t Cache_Class(uint32_t sector)
+{
+  if ((sector >= Cache_FatStart) && (sector < Cache_FatEnd))
+  {
+    return CACHE_CLASS_FAT;
+  }
+  if ((sector >= Cache_FatEnd) && (sector < Cache_DirEnd))
+  {
+    return CACHE_CLASS_DIR;
+  }
+  return CACHE_CLASS_DATA;
+}
+
+/* Pick up the FAT layout if this line holds a FAT volume boot sector */
+static void Cache_ParseBoot(uint32_t line)
+{
+  const uint8_t *b = Cache_Data[line];
+  uint32_t fatsz;
+
+  if ((b[510] != 0x55) || (b[511] != 0xAA) ||
+      ((b[0] != 0xEB) && (b[0] != 0xE9)) ||
+      (CACHE_LD16(&b[11]) != CACHE_SECTOR) ||
+      (b[16] == 0) || (b[16] > 2))
+  {
+    return;
+  }
+  fatsz = CACHE_LD16(&b[22]);
+  if (fatsz == 0)
+  {
+    fatsz = CACHE_LD32(&b[36]);
+  }
+  Cache_FatStart = Cache_Tag[line] + CACHE_LD16(&b[14]);
+  Cache_FatEnd   = Cache_FatStart + b[16] * fatsz;
+  Cache_DirEnd   = Cache_FatEnd + (CACHE_LD16(&b[17]) * 32 + CACHE_SECTOR - 1) / CACHE_SECTOR;
+}
+
+static int32_t Cache_Find(uint32_t sector)
+{
+  uint32_t line = (sector & (USBH_MSC_CACHE_SETS - 1)) * USBH_MSC_CACHE_WAYS;
+  uint32_t w;
+
+  for (w = 0; w < USBH_MSC_CACHE_WAYS; w++, line++)
+  {
+    if ((Cache_Flags[line] & CACHE_VALID) && (Cache_Tag[line] == sector))
+    {
+      return line;
+    }
+  }
+  return -1;
+}
+
+/**
+  * @brief  Cache_Victim
+  *         Least recently used way of the set, skipping FAT and directory
+  *         lines while their class is within its quota in the set (a class
+  *         may always replace its own lines)
+  * @param  sector: sector to be placed
+  * @retval line
+  */
+static uint32_t Cache_Victim(uint32_t sector)
+{
+  static const uint8_t quota[3] = { 0, USBH_MSC_CACHE_FAT_WAYS, USBH_MSC_CACHE_DIR_WAYS };
+  uint32_t base = (sector & (USBH_MSC_CACHE_SETS - 1)) * USBH_MSC_CACHE_WAYS;
+  uint8_t  cls[USBH_MSC_CACHE_WAYS];
+  uint8_t  used[3] = { 0, 0, 0 };
+  uint8_t  own = Cache_Class(sector);
+  uint32_t w, victim = base;
+  uint32_t oldest = 0;
+
+  for (w = 0; w < USBH_MSC_CACHE_WAYS; w++)
+  {
+    if (!(Cache_Flags[base + w] & CACHE_VALID))
+    {
+      return base + w;
+    }
+    cls[w] = Cache_Class(Cache_Tag[base + w]);
+    used[cls[w]]++;
+  }
+
+  for (w = 0; w < USBH_MSC_CACHE_WAYS; w++)
+  {
+    if ((cls[w] != own) && (used[cls[w]] <= quota[cls[w]]))
+    {
+      continue;
+    }
+    if (Cache_Clock - Cache_Age[base + w] >= oldest)
+    {
+      oldest = Cache_Clock - Cache_Age[base + w];
+      victim = base + w;
+    }
+  }
+  return victim;
+}
+
+/* Make room for sector, writing back what it replaces */
+static uint8_t Cache_Alloc(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                           uint32_t sector, uint32_t *line)
+{
+  uint32_t v = Cache_Victim(sector);
+
+  if (Cache_Flags[v] & CACHE_DIRTY)
+  {
+    if (Cache_Xfer(pdev, phost, USBH_MSC_IO_WRITE, Cache_Data[v], Cache_Tag[v], 1) != USBH_MSC_OK)
+    {
+      return USBH_MSC_FAIL;
+    }
+    Cache_Stats.WriteBack++;
+  }
+  if (Cache_Flags[v] & CACHE_VALID)
+  {
+    Cache_Stats.Evict++;
+  }
+  Cache_Tag[v] = sector;
+  Cache_Flags[v] = CACHE_VALID;
+  *line = v;
+  return USBH_MSC_OK;
+}
+
+/**
+  * @brief  USBH_MSC_Cache_Reset
+  *         Drop every line without writing it back and forget the volume
+  *         layout; for a new or removed device
+  * @param  None
+  * @retval None
+  */
+void USBH_MSC_Cache_Reset(void)
+{
+  memset(Cache_Flags, 0, sizeof(Cache_Flags));
+  Cache_FatStart = 0;
+  Cache_FatEnd = 0;
+  Cache_DirEnd = 0;
+}
+
+/**
+  * @brief  USBH_MSC_Cache_Read
+  *         Read sectors through the cache
+  * @param  pdev: Selected device
+  * @param  phost: Selected device property
+  * @param  buff: destination
+  * @param  sector: first sector
+  * @param  count: sectors
+  * @retval USBH_MSC_OK or USBH_MSC_FAIL
+  */
+uint8_t USBH_MSC_Cache_Read(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                            uint8_t *buff, uint32_t sector, uint32_t count)
+{
+  uint32_t i, line;
+  int32_t  hit;
+
+  if (count > USBH_MSC_CACHE_BYPASS)
+  {
+    Cache_Stats.Bypass++;
+    if (Cache_Xfer(pdev, phost, USBH_MSC_IO_READ, buff, sector, count) != USBH_MSC_OK)
+    {
+      return USBH_MSC_FAIL;
+    }
+    /* The disk does not have the dirty lines yet */
+    for (i = 0; i < count; i++)
+    {
+      hit = Cache_Find(sector + i);
+      if ((hit >= 0) && (Cache_Flags[hit] & CACHE_DIRTY))
+      {
+        memcpy(buff + i * CACHE_SECTOR, Cache_Data[hit], CACHE_SECTOR);
+      }
+    }
+    return USBH_MSC_OK;
+  }
+
+  for (i = 0; i < count; i++, buff += CACHE_SECTOR)
+  {
+    hit = Cache_Find(sector + i);
+    if (hit >= 0)
+    {
+      Cache_Stats.ReadHit++;
+      line = hit;
+    }
+    else
+    {
+      Cache_Stats.ReadMiss++;
+      if (Cache_Alloc(pdev, phost, sector + i, &line) != USBH_MSC_OK)
+      {
+        return USBH_MSC_FAIL;
+      }
+      if (Cache_Xfer(pdev, phost, USBH_MSC_IO_READ, Cache_Data[line], sector + i, 1) != USBH_MSC_OK)
+      {
+        Cache_Flags[line] = 0;
+        return USBH_MSC_FAIL;
+      }
+      Cache_ParseBoot(line);
+    }
+    Cache_Age[line] = ++Cache_Clock;
+    memcpy(buff, Cache_Data[line], CACHE_SECTOR);
+  }
+  return USBH_MSC_OK;
+}
+
+/**
+  * @brief  USBH_MSC_Cache_Write
+  *         Write sectors through the cache; short writes stay dirty in the
+  *         cache, long ones go to the disk and replace the cached copies
+  * @param  pdev: Selected device
+  * @param  phost: Selected device property
+  * @param  buff: source
+  * @param  sector: first sector
+  * @param  count: sectors
+  * @retval USBH_MSC_OK or USBH_MSC_FAIL
+  */
+uint8_t USBH_MSC_Cache_Write(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                             const uint8_t *buff, uint32_t sector, uint32_t count)
+{
+  uint32_t i, line;
+  int32_t  hit;
+
+  if (count > USBH_MSC_CACHE_BYPASS)
+  {
+    Cache_Stats.Bypass++;
+    for (i = 0; i < count; i++)
+    {
+      hit = Cache_Find(sector + i);
+      if (hit >= 0)
+      {
+        Cache_Flags[hit] = 0;
+      }
+    }
+    return Cache_Xfer(pdev, phost, USBH_MSC_IO_WRITE, (uint8_t *)buff, sector, count);
+  }
+
+  for (i = 0; i < count; i++, buff += CACHE_SECTOR)
+  {
+    hit = Cache_Find(sector + i);
+    if (hit >= 0)
+    {
+      Cache_Stats.WriteHit++;
+      line = hit;
+    }
+    else
+    {
+      Cache_Stats.WriteMiss++;
+      if (Cache_Alloc(pdev, phost, sector + i, &line) != USBH_MSC_OK)
+      {
+        return USBH_MSC_FAIL;
+      }
+    }
+    memcpy(Cache_Data[line], buff, CACHE_SECTOR);
+    Cache_Flags[line] |= CACHE_DIRTY;
+    Cache_Age[line] = ++Cache_Clock;
+  }
+  return USBH_MSC_OK;
+}
+
+/**
+  * @brief  USBH_MSC_Cache_Flush
+  *         Write every dirty line back, lowest sector first so that runs
+  *         merge in the write-behind buffer, then sync the transport
+  * @param  pdev: Selected device
+  * @param  phost: Selected device property
+  * @retval USBH_MSC_OK or USBH_MSC_FAIL
+  */
+uint8_t USBH_MSC_Cache_Flush(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+{
+  USBH_MSC_IO_Req_TypeDef req;
+  uint8_t  status = USBH_MSC_OK;
+  uint32_t i;
+  int32_t  next;
+
+  for (;;)
+  {
+    next = -1;
+    for (i = 0; i < CACHE_LINES; i++)
+    {
+      if ((Cache_Flags[i] & CACHE_DIRTY) &&
+          ((next < 0) || (Cache_Tag[i] < Cache_Tag[next])))
+      {
+        next = i;
+      }
+    }
+    if (next < 0)
+    {
+      break;
+    }
+    if (Cache_Xfer(pdev, phost, USBH_MSC_IO_WRITE, Cache_Data[next], Cache_Tag[next], 1) != USBH_MSC_OK)
+    {
+      /* Give the line up rather than retrying it forever */
+      Cache_Flags[next] = 0;
+      status = USBH_MSC_FAIL;
+      continue;
+    }
+    Cache_Flags[next] &= ~CACHE_DIRTY;
+    Cache_Stats.WriteBack++;
+  }
+
+  req.op = USBH_MSC_IO_SYNC;
+  req.cb = NULL;
+  if (USBH_MSC_IO_Wait(pdev, phost, &req) != USBH_MSC_OK)
+  {
+    status = USBH_MSC_FAIL;
+  }
+  return status;
+}
+
+/**
+  * @brief  USBH_MSC_Cache_GetStats
+  *         Copy the counters out
+  * @param  stats: destination
+  * @retval None
+  */
+void USBH_MSC_Cache_GetStats(USBH_MSC_Cache_Stats_TypeDef *stats)
+{
+  *stats = Cache_Stats;
+}
+
+/**
+  * @brief  USBH_MSC_Cache_ClearStats
+  *         Zero the counters
+  * @param  None
+  * @retval None
+  */
+void USBH_MSC_Cache_ClearStats(void)
+{
+  memset(&Cache_Stats, 0, sizeof(Cache_Stats));
+}
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
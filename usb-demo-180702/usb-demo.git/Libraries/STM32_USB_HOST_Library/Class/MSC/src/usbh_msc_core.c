@@ -353,8 +353,9 @@ static USBH_Status USBH_MSC_Handle(USB_OTG_CORE_HANDLE *pdev ,
       {
         MSC_Machine.maxLun = *(MSC_Machine.buff) ;
         
-        /* If device has more that one logical unit then it is not supported */
-        if((MSC_Machine.maxLun > 0) && (maxLunExceed == FALSE))
+        /* Card readers with up to USBH_MSC_MAX_LUN units are served in
+        turn by the command queue, more are not supported */
+        if((MSC_Machine.maxLun >= USBH_MSC_MAX_LUN) && (maxLunExceed == FALSE))
         {
           maxLunExceed = TRUE;
           pphost->usr_cb->DeviceNotSupported();
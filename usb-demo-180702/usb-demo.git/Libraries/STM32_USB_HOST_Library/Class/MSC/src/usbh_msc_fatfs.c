@@ -2,6 +2,7 @@
 #include "usb_conf.h"
 #include "diskio.h"
 #include "usbh_msc_core.h"
+#include "usbh_msc_cache.h"
 /*--------------------------------------------------------------------------
 
 Module Private Functions and Variables
@@ -10,10 +11,23 @@ Module Private Functions and Variables
 DWORD get_fattime(void);
 
 static volatile DSTATUS Stat = STA_NOINIT;	/* Disk status */
+/* Buffered data failed to reach the disk: every disk_read, disk_write and
+   CTRL_SYNC fails until CTRL_SYNC has reported it */
+static uint8_t DiskError = 0;
 
 extern USB_OTG_CORE_HANDLE          USB_OTG_Core;
 extern USBH_HOST                     USB_Host;
 
+/* Latch a failed write-behind flush of the transport */
+static uint8_t disk_failed (void)
+{
+  if (USBH_MSC_IO_Error())
+  {
+    DiskError = 1;
+  }
+  return DiskError;
+}
+
 /*-----------------------------------------------------------------------*/
 /* Initialize Disk Drive                                                 */
 /*-----------------------------------------------------------------------*/
@@ -25,6 +39,9 @@ DSTATUS disk_initialize (
   
   if(HCD_IsDeviceConnected(&USB_OTG_Core))
   {  
+    USBH_MSC_IO_Reset();
+    USBH_MSC_Cache_Reset();
+    DiskError = 0;
     Stat &= ~STA_NOINIT;
   }
   
@@ -64,25 +81,15 @@ DRESULT disk_read (
   
   if (pdrv || !count) return RES_PARERR;
   if (Stat & STA_NOINIT) return RES_NOTRDY;
+  if (disk_failed()) return RES_ERROR;
   
   
   if(HCD_IsDeviceConnected(&USB_OTG_Core))
   {  
-    
-    do
-    {
-      status = USBH_MSC_Read10(&USB_OTG_Core, buff,sector,512 * count);
-      USBH_MSC_HandleBOTXfer(&USB_OTG_Core ,&USB_Host);
-      
-      if(!HCD_IsDeviceConnected(&USB_OTG_Core))
-      { 
-        return RES_ERROR;
-      }      
-    }
-    while(status == USBH_MSC_BUSY );
+    status = USBH_MSC_Cache_Read(&USB_OTG_Core, &USB_Host, buff, sector, count);
   }
   
-  if(status == USBH_MSC_OK)
+  if(status == USBH_MSC_OK && !disk_failed())
     return RES_OK;
   return RES_ERROR;
   
@@ -106,26 +113,17 @@ DRESULT disk_write (
   if (pdrv || !count) return RES_PARERR;
   if (Stat & STA_NOINIT) return RES_NOTRDY;
   if (Stat & STA_PROTECT) return RES_WRPRT;
+  if (disk_failed()) return RES_ERROR;
   
   
   if(HCD_IsDeviceConnected(&USB_OTG_Core))
   {  
-    do
-    {
-      status = USBH_MSC_Write10(&USB_OTG_Core,(BYTE*)buff,sector,512 * count);
-      USBH_MSC_HandleBOTXfer(&USB_OTG_Core, &USB_Host);
-      
-      if(!HCD_IsDeviceConnected(&USB_OTG_Core))
-      { 
-        return RES_ERROR;
-      }
-    }
-    
-    while(status == USBH_MSC_BUSY );
-    
+    /* Completes once the data is in the cache or the write-behind
+       buffer, CTRL_SYNC puts it on the disk */
+    status = USBH_MSC_Cache_Write(&USB_OTG_Core, &USB_Host, buff, sector, count);
   }
   
-  if(status == USBH_MSC_OK)
+  if(status == USBH_MSC_OK && !disk_failed())
     return RES_OK;
   return RES_ERROR;
 }
@@ -155,7 +153,12 @@ DRESULT disk_ioctl (
   switch (ctrl) {
   case CTRL_SYNC :		/* Make sure that no pending write process */
     
-    res = RES_OK;
+    if(USBH_MSC_Cache_Flush(&USB_OTG_Core, &USB_Host) == USBH_MSC_OK &&
+       !DiskError)
+    {
+      res = RES_OK;
+    }
+    DiskError = 0;
     break;
     
   case GET_SECTOR_COUNT :	/* Get number of sectors on the disk (DWORD) */
@@ -175,6 +178,16 @@ DRESULT disk_ioctl (
     
     break;
     
+  case USBH_MSC_CACHE_GET_STATS :	/* Cache hit/miss and transfer counters */
+    USBH_MSC_Cache_GetStats((USBH_MSC_Cache_Stats_TypeDef*)buff);
+    res = RES_OK;
+    break;
+    
+  case USBH_MSC_CACHE_CLEAR_STATS :
+    USBH_MSC_Cache_ClearStats();
+    res = RES_OK;
+    break;
+    
     
   default:
     res = RES_PARERR;
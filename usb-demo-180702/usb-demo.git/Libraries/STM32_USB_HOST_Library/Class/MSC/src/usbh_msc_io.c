@@ -0,0 +1,464 @@
+/**
+  ******************************************************************************
+  * @file    usbh_msc_io.c
+  * @brief   Queued sector I/O on top of the MSC BOT state machine.
+  *
+  *          Callers queue USBH_MSC_IO_Req_TypeDef requests with
+  *          USBH_MSC_IO_Submit and return at once; USBH_MSC_IO_Process,
+  *          called from the main loop, moves one READ(10)/WRITE(10) forward
+  *          per call and completes the requests in queue order.
+  *
+  *          - Read-ahead: a read starting where the previous one ended
+  *            fetches a whole USBH_MSC_IO_RA_SECTORS window, later reads
+  *            inside the window are served from memory.
+  *          - Write-behind: writes land in a USBH_MSC_IO_WB_SECTORS buffer
+  *            and complete at once; adjacent and overlapping writes are
+  *            merged, and the buffer goes out as one WRITE(10) when a write
+  *            does not fit, a read overlaps it, or on USBH_MSC_IO_SYNC.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_msc_io.h"
+#include <string.h>
+
+/** @addtogroup USBH_LIB
+  * @{
+  */
+
+/** @addtogroup USBH_CLASS
+  * @{
+  */
+
+/** @addtogroup USBH_MSC_CLASS
+  * @{
+  */
+
+/** @defgroup USBH_MSC_IO
+  * @brief    This file includes the queued mass storage sector I/O
+  * @{
+  */
+
+/** @defgroup USBH_MSC_IO_Private_Defines
+  * @{
+  */
+#define IO_SECTOR               USBH_MSC_PAGE_LENGTH
+
+#define IO_CMD_NONE             0
+#define IO_CMD_USER             1   /* straight into/out of the request buffer */
+#define IO_CMD_RA               2   /* read-ahead window into IO_RaBuf */
+#define IO_CMD_WB               3   /* write-behind flush of IO_WbBuf */
+
+#if (USBH_MSC_IO_RA_SECTORS < 1) || (USBH_MSC_IO_WB_SECTORS < 1)
+  #error "USBH_MSC_IO_RA_SECTORS and USBH_MSC_IO_WB_SECTORS must be at least 1"
+#endif
+/**
+  * @}
+  */
+
+/** @defgroup USBH_MSC_IO_Private_Variables
+  * @{
+  */
+static USBH_MSC_IO_Req_TypeDef *IO_Head = NULL;
+static USBH_MSC_IO_Req_TypeDef *IO_Tail = NULL;
+
+/* Command on the BOT machine */
+static uint8_t   IO_Cmd = IO_CMD_NONE;
+static uint8_t   IO_CmdOp;
+static uint8_t  *IO_CmdBuff;
+static uint32_t  IO_CmdSector;
+static uint32_t  IO_CmdCount;
+static uint8_t   IO_CmdRetry;
+
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN static uint8_t IO_RaBuf[USBH_MSC_IO_RA_SECTORS * IO_SECTOR] __ALIGN_END;
+static uint32_t  IO_RaSector;
+static uint32_t  IO_RaCount;            /* sectors held, 0 when empty */
+static uint32_t  IO_NextSector;         /* where the last read ended */
+
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN static uint8_t IO_WbBuf[USBH_MSC_IO_WB_SECTORS * IO_SECTOR] __ALIGN_END;
+static uint32_t  IO_WbSector;
+static uint32_t  IO_WbCount;            /* sectors held, 0 when empty */
+static uint8_t   IO_WbError;            /* a flush failed, reported on SYNC */
+/**
+  * @}
+  */
+
+/** @defgroup USBH_MSC_IO_Private_Functions
+  * @{
+  */
+
+static uint8_t IO_Overlap(uint32_t s1, uint32_t n1, uint32_t s2, uint32_t n2)
+{
+  return (n1 != 0) && (n2 != 0) && (s1 < s2 + n2) && (s2 < s1 + n1);
+}
+
+/* Dequeue the head request and hand it back to its owner */
+static void IO_Complete(uint8_t status)
+{
+  USBH_MSC_IO_Req_TypeDef *req = IO_Head;
+
+  IO_Head = req->next;
+  if (IO_Head == NULL)
+  {
+    IO_Tail = NULL;
+  }
+  req->next = NULL;
+  req->status = status;
+  if (req->cb != NULL)
+  {
+    req->cb(req);
+  }
+}
+
+static void IO_Start(uint8_t cmd, uint8_t op, uint8_t *buff,
+                     uint32_t sector, uint32_t count)
+{
+  IO_Cmd       = cmd;
+  IO_CmdOp     = op;
+  IO_CmdBuff   = buff;
+  IO_CmdSector = sector;
+  IO_CmdCount  = count;
+  IO_CmdRetry  = 0;
+}
+
+static void IO_StartFlush(void)
+{
+  IO_Start(IO_CMD_WB, USBH_MSC_IO_WRITE, IO_WbBuf, IO_WbSector, IO_WbCount);
+}
+
+/* Serve a read from the read-ahead window if it holds all of it */
+static uint8_t IO_RaHit(USBH_MSC_IO_Req_TypeDef *req)
+{
+  if ((IO_RaCount == 0) ||
+      (req->sector < IO_RaSector) ||
+      (req->sector + req->count > IO_RaSector + IO_RaCount))
+  {
+    return 0;
+  }
+  memcpy(req->buff, &IO_RaBuf[(req->sector - IO_RaSector) * IO_SECTOR],
+         req->count * IO_SECTOR);
+  return 1;
+}
+
+/* Merge a write into the write-behind buffer if it extends or overlaps it */
+static uint8_t IO_WbMerge(USBH_MSC_IO_Req_TypeDef *req)
+{
+  uint32_t end = req->sector + req->count;
+
+  if (IO_WbCount == 0)
+  {
+    if (req->count > USBH_MSC_IO_WB_SECTORS)
+    {
+      return 0;
+    }
+    IO_WbSector = req->sector;
+  }
+  else if ((req->sector < IO_WbSector) ||
+           (req->sector > IO_WbSector + IO_WbCount) ||
+           (end - IO_WbSector > USBH_MSC_IO_WB_SECTORS))
+  {
+    return 0;
+  }
+  memcpy(&IO_WbBuf[(req->sector - IO_WbSector) * IO_SECTOR], req->buff,
+         req->count * IO_SECTOR);
+  if (end - IO_WbSector > IO_WbCount)
+  {
+    IO_WbCount = end - IO_WbSector;
+  }
+  return 1;
+}
+
+/**
+  * @brief  IO_Schedule
+  *         Complete whatever the buffers can serve from the head of the
+  *         queue, and start the command the next request needs.
+  * @param  None
+  * @retval None
+  */
+static void IO_Schedule(void)
+{
+  USBH_MSC_IO_Req_TypeDef *req;
+  uint8_t  sequential;
+  uint32_t n;
+
+  while ((IO_Cmd == IO_CMD_NONE) && ((req = IO_Head) != NULL))
+  {
+    switch (req->op)
+    {
+    case USBH_MSC_IO_READ:
+      /* The disk has to see pending writes before they are read back */
+      if (IO_Overlap(req->sector, req->count, IO_WbSector, IO_WbCount))
+      {
+        IO_StartFlush();
+        break;
+      }
+      sequential = (req->sector == IO_NextSector);
+      IO_NextSector = req->sector + req->count;
+
+      if (IO_RaHit(req))
+      {
+        IO_Complete(USBH_MSC_OK);
+        break;
+      }
+      if (sequential && (req->count < USBH_MSC_IO_RA_SECTORS) &&
+          (USBH_MSC_Param.MSCapacity >= req->sector))
+      {
+        /* Sequential stream: fetch the whole window in one READ(10),
+           clipped to the last LBA */
+        n = USBH_MSC_Param.MSCapacity - req->sector + 1;
+        if (n > USBH_MSC_IO_RA_SECTORS)
+        {
+          n = USBH_MSC_IO_RA_SECTORS;
+        }
+        if (n >= req->count)
+        {
+          IO_RaCount = 0;
+          IO_Start(IO_CMD_RA, USBH_MSC_IO_READ, IO_RaBuf, req->sector, n);
+          break;
+        }
+      }
+      IO_Start(IO_CMD_USER, USBH_MSC_IO_READ, req->buff, req->sector, req->count);
+      break;
+
+    case USBH_MSC_IO_WRITE:
+      if (IO_Overlap(req->sector, req->count, IO_RaSector, IO_RaCount))
+      {
+        IO_RaCount = 0;
+      }
+      if (IO_WbMerge(req))
+      {
+        IO_Complete(USBH_MSC_OK);
+      }
+      else if (IO_WbCount != 0)
+      {
+        IO_StartFlush();
+      }
+      else
+      {
+        /* Larger than the whole buffer: write it straight away */
+        IO_Start(IO_CMD_USER, USBH_MSC_IO_WRITE, req->buff, req->sector, req->count);
+      }
+      break;
+
+    case USBH_MSC_IO_SYNC:
+      if (IO_WbCount != 0)
+      {
+        IO_StartFlush();
+      }
+      else
+      {
+        IO_Complete(IO_WbError ? USBH_MSC_FAIL : USBH_MSC_OK);
+        IO_WbError = 0;
+      }
+      break;
+
+    default:
+      IO_Complete(USBH_MSC_FAIL);
+      break;
+    }
+  }
+}
+
+/* The command on the BOT machine finished */
+static void IO_Done(uint8_t status)
+{
+  uint8_t cmd = IO_Cmd;
+
+  IO_Cmd = IO_CMD_NONE;
+  switch (cmd)
+  {
+  case IO_CMD_USER:
+    IO_Complete(status);
+    break;
+
+  case IO_CMD_RA:
+    /* The head read is served from the window on the next schedule, or
+       read on its own if the window could not be fetched */
+    if (status == USBH_MSC_OK)
+    {
+      IO_RaSector = IO_CmdSector;
+      IO_RaCount  = IO_CmdCount;
+    }
+    break;
+
+  case IO_CMD_WB:
+    if (status != USBH_MSC_OK)
+    {
+      IO_WbError = 1;
+    }
+    IO_WbCount = 0;
+    break;
+
+  default:
+    break;
+  }
+}
+
+/**
+  * @brief  USBH_MSC_IO_Reset
+  *         Fail every queued request and drop both buffers, e.g. when the
+  *         device is disconnected or a new one is mounted
+  * @param  None
+  * @retval None
+  */
+void USBH_MSC_IO_Reset(void)
+{
+  IO_Cmd = IO_CMD_NONE;
+  while (IO_Head != NULL)
+  {
+    IO_Complete(USBH_MSC_FAIL);
+  }
+  IO_RaCount = 0;
+  IO_NextSector = 0;
+  IO_WbCount = 0;
+  IO_WbError = 0;
+  USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
+}
+
+/**
+  * @brief  USBH_MSC_IO_Submit
+  *         Queue a request; it completes from USBH_MSC_IO_Process
+  * @param  req: request, owned by the queue until it completes
+  * @retval USBH_MSC_BUSY (queued), or USBH_MSC_FAIL for a bad request
+  */
+uint8_t USBH_MSC_IO_Submit(USBH_MSC_IO_Req_TypeDef *req)
+{
+  if ((req->op != USBH_MSC_IO_SYNC) && ((req->count == 0) || (req->buff == NULL)))
+  {
+    req->status = USBH_MSC_FAIL;
+    return USBH_MSC_FAIL;
+  }
+  req->status = USBH_MSC_BUSY;
+  req->next = NULL;
+  if (IO_Tail == NULL)
+  {
+    IO_Head = req;
+  }
+  else
+  {
+    IO_Tail->next = req;
+  }
+  IO_Tail = req;
+  return USBH_MSC_BUSY;
+}
+
+/**
+  * @brief  USBH_MSC_IO_Process
+  *         Move the queue one step: complete what the buffers can serve,
+  *         then drive the READ(10)/WRITE(10) in flight. Call it from the
+  *         main loop (or while waiting on a request); it never blocks.
+  * @param  pdev: Selected device
+  * @param  phost: Selected device property
+  * @retval None
+  */
+void USBH_MSC_IO_Process(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+{
+  uint8_t status;
+
+  IO_Schedule();
+  if (IO_Cmd == IO_CMD_NONE)
+  {
+    return;
+  }
+
+  if (IO_CmdOp == USBH_MSC_IO_READ)
+  {
+    status = USBH_MSC_Read10(pdev, IO_CmdBuff, IO_CmdSector, IO_CmdCount * IO_SECTOR);
+  }
+  else
+  {
+    status = USBH_MSC_Write10(pdev, IO_CmdBuff, IO_CmdSector, IO_CmdCount * IO_SECTOR);
+  }
+  USBH_MSC_HandleBOTXfer(pdev, phost);
+
+  if (status == USBH_MSC_BUSY)
+  {
+    return;
+  }
+  if ((status == USBH_MSC_FAIL) && (++IO_CmdRetry < USBH_MSC_IO_RETRY))
+  {
+    /* The CSW reported a failure: send the command again on the next call */
+    return;
+  }
+  IO_Done((status == USBH_MSC_OK) ? USBH_MSC_OK : USBH_MSC_FAIL);
+  IO_Schedule();
+}
+
+/**
+  * @brief  USBH_MSC_IO_Wait
+  *         Queue a request and run the queue until it completes, for
+  *         callers that need the result before going on (FatFs)
+  * @param  pdev: Selected device
+  * @param  phost: Selected device property
+  * @param  req: request
+  * @retval Status of the request, USBH_MSC_FAIL if the device went away
+  */
+uint8_t USBH_MSC_IO_Wait(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                         USBH_MSC_IO_Req_TypeDef *req)
+{
+  USBH_MSC_IO_Submit(req);
+  while (req->status == USBH_MSC_BUSY)
+  {
+    if (!HCD_IsDeviceConnected(pdev))
+    {
+      USBH_MSC_IO_Reset();
+      return USBH_MSC_FAIL;
+    }
+    USBH_MSC_IO_Process(pdev, phost);
+  }
+  return req->status;
+}
+
+/**
+  * @brief  USBH_MSC_IO_Idle
+  *         Nothing queued and no command on the bus. Write-behind data may
+  *         still be buffered: queue a USBH_MSC_IO_SYNC to flush it.
+  * @param  None
+  * @retval 1 if idle
+  */
+uint8_t USBH_MSC_IO_Idle(void)
+{
+  return (IO_Head == NULL) && (IO_Cmd == IO_CMD_NONE);
+}
+
+/**
+  * @brief  USBH_MSC_IO_Error
+  *         A write-behind flush failed since the last USBH_MSC_IO_SYNC;
+  *         the SYNC still reports it and clears it
+  * @param  None
+  * @retval 1 if a flush failed
+  */
+uint8_t USBH_MSC_IO_Error(void)
+{
+  return IO_WbError;
+}
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
+
+/**
+  * @}
+  */
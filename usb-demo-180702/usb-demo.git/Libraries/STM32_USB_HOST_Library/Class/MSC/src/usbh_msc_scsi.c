@@ -92,6 +92,8 @@ __ALIGN_BEGIN uint8_t USBH_DataInBuffer[512] __ALIGN_END ;
   #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
 __ALIGN_BEGIN uint8_t USBH_DataOutBuffer[512] __ALIGN_END ;
+
+static USBH_MSC_Cmd_TypeDef *SCSI_Cmd;   /* Command of the functions below */
 /**
   * @}
   */ 
@@ -121,6 +123,169 @@ __ALIGN_BEGIN uint8_t USBH_DataOutBuffer[512] __ALIGN_END ;
 
 
 
+/**
+  * @brief  USBH_MSC_SCSIStart 
+  *         Hands the command of one of the functions below to the queue and
+  *         lets the MSC state machine drive the BOT transfer.
+  * @param  cmd: Queued command, NULL if no slot was free
+  * @retval Status
+  */
+static uint8_t USBH_MSC_SCSIStart(USBH_MSC_Cmd_TypeDef *cmd)
+{
+  if(cmd == NULL)
+  {
+    /* Queue full, try again on the next call */
+    return USBH_MSC_BUSY;
+  }
+  SCSI_Cmd = cmd;
+  
+  /* Start the transfer, then let the state machine manage the other 
+                                                            transactions */
+  USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
+  USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
+  USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
+  return USBH_MSC_BUSY;
+}
+
+/**
+  * @brief  USBH_MSC_SCSIWait 
+  *         Status of the command started by USBH_MSC_SCSIStart; the slot is
+  *         released once it is done.
+  * @param  None
+  * @retval Status
+  */
+static uint8_t USBH_MSC_SCSIWait(void)
+{
+  uint8_t status;
+  
+  if(SCSI_Cmd->State != USBH_MSC_CMD_DONE)
+  {
+    /* Wait for the Commands to get Completed; still queued, or its sense
+    data is being fetched, so keep the BOT machine running */
+    USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
+    return USBH_MSC_BUSY;
+  }
+  status = SCSI_Cmd->Status;
+  USBH_MSC_CmdRelease(SCSI_Cmd);
+  USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
+  return status;
+}
+
+/**
+  * @brief  USBH_MSC_CmdTestUnitReady 
+  *         Queues a 'Test unit ready' command
+  * @param  lun: Logical unit
+  * @retval Command, NULL if the queue is full
+  */
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdTestUnitReady(uint8_t lun)
+{
+  USBH_MSC_Cmd_TypeDef *cmd = USBH_MSC_CmdAlloc(lun);
+  
+  if(cmd != NULL)
+  {
+    cmd->CBW.field.CBWTransferLength = 0;       /* No Data Transfer */
+    cmd->CBW.field.CBWFlags = USB_EP_DIR_OUT;
+    cmd->CBW.field.CBWLength = CBW_LENGTH_TEST_UNIT_READY;
+    cmd->CBW.field.CBWCB[0]  = OPCODE_TEST_UNIT_READY; 
+    USBH_MSC_CmdSubmit(cmd);
+  }
+  return cmd;
+}
+
+/**
+  * @brief  USBH_MSC_CmdRequestSense 
+  *         Queues a 'Request sense' command
+  * @param  lun: Logical unit
+  * @param  buff: ALLOCATION_LENGTH_REQUEST_SENSE bytes for the sense data
+  * @retval Command, NULL if the queue is full
+  */
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdRequestSense(uint8_t lun, uint8_t *buff)
+{
+  USBH_MSC_Cmd_TypeDef *cmd = USBH_MSC_CmdAlloc(lun);
+  
+  if(cmd != NULL)
+  {
+    cmd->CBW.field.CBWTransferLength = ALLOCATION_LENGTH_REQUEST_SENSE;
+    cmd->CBW.field.CBWFlags = USB_EP_DIR_IN;
+    cmd->pBuff = buff;
+    cmd->CBW.field.CBWCB[0]  = OPCODE_REQUEST_SENSE; 
+    cmd->CBW.field.CBWCB[1]  = DESC_REQUEST_SENSE;
+    cmd->CBW.field.CBWCB[4]  = ALLOCATION_LENGTH_REQUEST_SENSE;
+    USBH_MSC_CmdSubmit(cmd);
+  }
+  return cmd;
+}
+
+/**
+  * @brief  USBH_MSC_CmdReadWrite10 
+  *         Queues a READ(10) or WRITE(10)
+  * @param  lun: Logical unit
+  * @param  opcode: OPCODE_READ10 or OPCODE_WRITE10
+  * @param  dataBuffer : Data to write / room for the data read
+  * @param  address : First block
+  * @param  nbOfbytes : Length, a multiple of USBH_MSC_PAGE_LENGTH
+  * @retval Command, NULL if the queue is full
+  */
+static USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdReadWrite10(uint8_t lun,
+                                                     uint8_t opcode,
+                                                     uint8_t *dataBuffer,
+                                                     uint32_t address,
+                                                     uint32_t nbOfbytes)
+{
+  USBH_MSC_Cmd_TypeDef *cmd = USBH_MSC_CmdAlloc(lun);
+  uint16_t nbOfPages;
+  
+  if(cmd != NULL)
+  {
+    cmd->CBW.field.CBWTransferLength = nbOfbytes;
+    cmd->CBW.field.CBWFlags = (opcode == OPCODE_READ10) ? USB_EP_DIR_IN : USB_EP_DIR_OUT;
+    cmd->pBuff = dataBuffer;
+    
+    cmd->CBW.field.CBWCB[0]  = opcode; 
+    
+    /*logical block address*/
+    cmd->CBW.field.CBWCB[2]  = (((uint8_t*)&address)[3]);
+    cmd->CBW.field.CBWCB[3]  = (((uint8_t*)&address)[2]);
+    cmd->CBW.field.CBWCB[4]  = (((uint8_t*)&address)[1]);
+    cmd->CBW.field.CBWCB[5]  = (((uint8_t*)&address)[0]);
+    
+    /*USBH_MSC_PAGE_LENGTH = 512*/
+    nbOfPages = nbOfbytes/ USBH_MSC_PAGE_LENGTH;  
+    
+    /*Transfer length */
+    cmd->CBW.field.CBWCB[7]  = (((uint8_t *)&nbOfPages)[1]) ; 
+    cmd->CBW.field.CBWCB[8]  = (((uint8_t *)&nbOfPages)[0]) ; 
+    USBH_MSC_CmdSubmit(cmd);
+  }
+  return cmd;
+}
+
+/**
+  * @brief  USBH_MSC_CmdRead10 
+  *         Queues a READ(10); see USBH_MSC_CmdReadWrite10
+  * @retval Command, NULL if the queue is full
+  */
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdRead10(uint8_t lun,
+                                         uint8_t *dataBuffer,
+                                         uint32_t address,
+                                         uint32_t nbOfbytes)
+{
+  return USBH_MSC_CmdReadWrite10(lun, OPCODE_READ10, dataBuffer, address, nbOfbytes);
+}
+
+/**
+  * @brief  USBH_MSC_CmdWrite10 
+  *         Queues a WRITE(10); see USBH_MSC_CmdReadWrite10
+  * @retval Command, NULL if the queue is full
+  */
+USBH_MSC_Cmd_TypeDef *USBH_MSC_CmdWrite10(uint8_t lun,
+                                          uint8_t *dataBuffer,
+                                          uint32_t address,
+                                          uint32_t nbOfbytes)
+{
+  return USBH_MSC_CmdReadWrite10(lun, OPCODE_WRITE10, dataBuffer, address, nbOfbytes);
+}
+
 /**
   * @brief  USBH_MSC_TestUnitReady 
   *         Issues 'Test unit ready' command to the device. Once the response  
@@ -130,7 +295,6 @@ __ALIGN_BEGIN uint8_t USBH_DataOutBuffer[512] __ALIGN_END ;
   */
 uint8_t USBH_MSC_TestUnitReady (USB_OTG_CORE_HANDLE *pdev)
 {
-  uint8_t index;
   USBH_MSC_Status_TypeDef status = USBH_MSC_BUSY;
   
   if(HCD_IsDeviceConnected(pdev))
@@ -138,51 +302,12 @@ uint8_t USBH_MSC_TestUnitReady (USB_OTG_CORE_HANDLE *pdev)
     switch(USBH_MSC_BOTXferParam.CmdStateMachine)
     {
     case CMD_SEND_STATE:  
-      /*Prepare the CBW and relevent field*/
-      USBH_MSC_CBWData.field.CBWTransferLength = 0;       /* No Data Transfer */
-      USBH_MSC_CBWData.field.CBWFlags = USB_EP_DIR_OUT;
-      USBH_MSC_CBWData.field.CBWLength = CBW_LENGTH_TEST_UNIT_READY;
-      USBH_MSC_BOTXferParam.pRxTxBuff = USBH_MSC_CSWData.CSWArray;
-      USBH_MSC_BOTXferParam.DataLength = USBH_MSC_CSW_MAX_LENGTH;
       USBH_MSC_BOTXferParam.MSCStateCurrent = USBH_MSC_TEST_UNIT_READY;
-      
-      for(index = CBW_CB_LENGTH - 1; index != 0; index--)
-      {
-        USBH_MSC_CBWData.field.CBWCB[index] = 0x00;
-      }
-      
-      USBH_MSC_CBWData.field.CBWCB[0]  = OPCODE_TEST_UNIT_READY; 
-      USBH_MSC_BOTXferParam.BOTState = USBH_MSC_SEND_CBW;
-      /* Start the transfer, then let the state 
-      machine magage the other transactions */
-      USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
-      USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
-      USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
-      
-      status = USBH_MSC_BUSY; 
+      status = USBH_MSC_SCSIStart(USBH_MSC_CmdTestUnitReady(0));
       break;
       
     case CMD_WAIT_STATUS: 
-      if(USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_OK)
-      { 
-        /* Commands successfully sent and Response Received  */       
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-       
-        status = USBH_MSC_OK;      
-      }
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_FAIL )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_FAIL;
-      }
-      
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_PHASE_ERROR )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_PHASE_ERROR;    
-      }  
+      status = USBH_MSC_SCSIWait();
       break;
       
     default:
@@ -202,7 +327,7 @@ uint8_t USBH_MSC_TestUnitReady (USB_OTG_CORE_HANDLE *pdev)
   */
 uint8_t USBH_MSC_ReadCapacity10(USB_OTG_CORE_HANDLE *pdev)
 {
-  uint8_t index;
+  USBH_MSC_Cmd_TypeDef *cmd;
   USBH_MSC_Status_TypeDef status = USBH_MSC_BUSY;
   
   if(HCD_IsDeviceConnected(pdev))
@@ -211,32 +336,22 @@ uint8_t USBH_MSC_ReadCapacity10(USB_OTG_CORE_HANDLE *pdev)
     {
     case CMD_SEND_STATE:
       /*Prepare the CBW and relevent field*/
-      USBH_MSC_CBWData.field.CBWTransferLength = XFER_LEN_READ_CAPACITY10;
-      USBH_MSC_CBWData.field.CBWFlags = USB_EP_DIR_IN;
-      USBH_MSC_CBWData.field.CBWLength = CBW_LENGTH;
-      
-      USBH_MSC_BOTXferParam.pRxTxBuff = USBH_DataInBuffer;
-      USBH_MSC_BOTXferParam.MSCStateCurrent = USBH_MSC_READ_CAPACITY10;
-      
-      for(index = CBW_CB_LENGTH -1; index != 0; index--)
+      cmd = USBH_MSC_CmdAlloc(0);
+      if(cmd != NULL)
       {
-        USBH_MSC_CBWData.field.CBWCB[index] = 0x00;
-      }    
-      
-      USBH_MSC_CBWData.field.CBWCB[0]  = OPCODE_READ_CAPACITY10; 
-      USBH_MSC_BOTXferParam.BOTState = USBH_MSC_SEND_CBW;
-      
-      /* Start the transfer, then let the state machine manage the other 
-                                                                transactions */
-      USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
-      USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
-      USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
-      
-      status = USBH_MSC_BUSY;
+        cmd->CBW.field.CBWTransferLength = XFER_LEN_READ_CAPACITY10;
+        cmd->CBW.field.CBWFlags = USB_EP_DIR_IN;
+        cmd->pBuff = USBH_DataInBuffer;
+        cmd->CBW.field.CBWCB[0]  = OPCODE_READ_CAPACITY10; 
+        USBH_MSC_CmdSubmit(cmd);
+      }
+      USBH_MSC_BOTXferParam.MSCStateCurrent = USBH_MSC_READ_CAPACITY10;
+      status = USBH_MSC_SCSIStart(cmd);
       break;
       
     case CMD_WAIT_STATUS:
-      if(USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_OK)
+      status = USBH_MSC_SCSIWait();
+      if(status == USBH_MSC_OK)
       {
         /*assign the capacity*/
         (((uint8_t*)&USBH_MSC_Param.MSCapacity )[3]) = USBH_DataInBuffer[0];
@@ -247,27 +362,6 @@ uint8_t USBH_MSC_ReadCapacity10(USB_OTG_CORE_HANDLE *pdev)
         /*assign the page length*/
         (((uint8_t*)&USBH_MSC_Param.MSPageLength )[1]) = USBH_DataInBuffer[6];
         (((uint8_t*)&USBH_MSC_Param.MSPageLength )[0]) = USBH_DataInBuffer[7];
-        
-        /* Commands successfully sent and Response Received  */       
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_OK;      
-      }
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_FAIL )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_FAIL;
-      }  
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_PHASE_ERROR )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_PHASE_ERROR;    
-      } 
-      else
-      {
-        /* Wait for the Commands to get Completed */
-        /* NO Change in state Machine */
       }
       break;
       
@@ -288,7 +382,7 @@ uint8_t USBH_MSC_ReadCapacity10(USB_OTG_CORE_HANDLE *pdev)
   */
 uint8_t USBH_MSC_ModeSense6(USB_OTG_CORE_HANDLE *pdev)
 {
-  uint8_t index;
+  USBH_MSC_Cmd_TypeDef *cmd;
   USBH_MSC_Status_TypeDef status = USBH_MSC_BUSY;
   
   if(HCD_IsDeviceConnected(pdev))
@@ -297,37 +391,25 @@ uint8_t USBH_MSC_ModeSense6(USB_OTG_CORE_HANDLE *pdev)
     {
     case CMD_SEND_STATE:
       /*Prepare the CBW and relevent field*/
-      USBH_MSC_CBWData.field.CBWTransferLength = XFER_LEN_MODE_SENSE6;
-      USBH_MSC_CBWData.field.CBWFlags = USB_EP_DIR_IN;
-      USBH_MSC_CBWData.field.CBWLength = CBW_LENGTH;
-      
-      USBH_MSC_BOTXferParam.pRxTxBuff = USBH_DataInBuffer;
-      USBH_MSC_BOTXferParam.MSCStateCurrent = USBH_MSC_MODE_SENSE6;
-      
-      for(index = CBW_CB_LENGTH - 1; index != 0; index--)
+      cmd = USBH_MSC_CmdAlloc(0);
+      if(cmd != NULL)
       {
-        USBH_MSC_CBWData.field.CBWCB[index] = 0x00;
-      }    
-      
-      USBH_MSC_CBWData.field.CBWCB[0]  = OPCODE_MODE_SENSE6; 
-      USBH_MSC_CBWData.field.CBWCB[2]  = MODE_SENSE_PAGE_CONTROL_FIELD | \
-                                         MODE_SENSE_PAGE_CODE;
-                                           
-      USBH_MSC_CBWData.field.CBWCB[4]  = XFER_LEN_MODE_SENSE6;
-                                                                                      
-      USBH_MSC_BOTXferParam.BOTState = USBH_MSC_SEND_CBW;
-      
-      /* Start the transfer, then let the state machine manage the other 
-                                                                transactions */
-      USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
-      USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
-      USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
-      
-      status = USBH_MSC_BUSY;
+        cmd->CBW.field.CBWTransferLength = XFER_LEN_MODE_SENSE6;
+        cmd->CBW.field.CBWFlags = USB_EP_DIR_IN;
+        cmd->pBuff = USBH_DataInBuffer;
+        cmd->CBW.field.CBWCB[0]  = OPCODE_MODE_SENSE6; 
+        cmd->CBW.field.CBWCB[2]  = MODE_SENSE_PAGE_CONTROL_FIELD | \
+                                   MODE_SENSE_PAGE_CODE;
+        cmd->CBW.field.CBWCB[4]  = XFER_LEN_MODE_SENSE6;
+        USBH_MSC_CmdSubmit(cmd);
+      }
+      USBH_MSC_BOTXferParam.MSCStateCurrent = USBH_MSC_MODE_SENSE6;
+      status = USBH_MSC_SCSIStart(cmd);
       break;
       
     case CMD_WAIT_STATUS:
-      if(USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_OK)
+      status = USBH_MSC_SCSIWait();
+      if(status == USBH_MSC_OK)
       {
         /* Assign the Write Protect status */
         /* If WriteProtect = 0, Writing is allowed 
@@ -340,27 +422,6 @@ uint8_t USBH_MSC_ModeSense6(USB_OTG_CORE_HANDLE *pdev)
         {
           USBH_MSC_Param.MSWriteProtect   = 0;
         }
-        
-        /* Commands successfully sent and Response Received  */       
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_OK;      
-      }
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_FAIL )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_FAIL;
-      }
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_PHASE_ERROR )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_PHASE_ERROR;    
-      }
-      else
-      {
-        /* Wait for the Commands to get Completed */
-        /* NO Change in state Machine */
       }
       break;
       
@@ -382,77 +443,25 @@ uint8_t USBH_MSC_RequestSense(USB_OTG_CORE_HANDLE *pdev)
 {
   USBH_MSC_Status_TypeDef status = USBH_MSC_BUSY;
   
-  uint8_t index;
-  
-  
   if(HCD_IsDeviceConnected(pdev))
   {  
     switch(USBH_MSC_BOTXferParam.CmdStateMachine)
     {
     case CMD_SEND_STATE:
-      
-      /*Prepare the CBW and relevant field*/
-      USBH_MSC_CBWData.field.CBWTransferLength = \
-                                                ALLOCATION_LENGTH_REQUEST_SENSE;
-      USBH_MSC_CBWData.field.CBWFlags = USB_EP_DIR_IN;
-      USBH_MSC_CBWData.field.CBWLength = CBW_LENGTH;
-      USBH_MSC_BOTXferParam.pRxTxBuff = USBH_DataInBuffer;
       USBH_MSC_BOTXferParam.MSCStateBkp = USBH_MSC_BOTXferParam.MSCStateCurrent;
       USBH_MSC_BOTXferParam.MSCStateCurrent = USBH_MSC_REQUEST_SENSE;
-      
-
-      for(index = CBW_CB_LENGTH - 1; index != 0; index--)
-      {
-        USBH_MSC_CBWData.field.CBWCB[index] = 0x00;
-      }    
-      
-      USBH_MSC_CBWData.field.CBWCB[0]  = OPCODE_REQUEST_SENSE; 
-      USBH_MSC_CBWData.field.CBWCB[1]  = DESC_REQUEST_SENSE;
-      USBH_MSC_CBWData.field.CBWCB[4]  = ALLOCATION_LENGTH_REQUEST_SENSE;
-      
-      USBH_MSC_BOTXferParam.BOTState = USBH_MSC_SEND_CBW;
-      /* Start the transfer, then let the state machine manage 
-      the other transactions */
-      USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
-      USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
-      USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
-      
-      status = USBH_MSC_BUSY;
-      
+      status = USBH_MSC_SCSIStart(USBH_MSC_CmdRequestSense(0, USBH_DataInBuffer));
       break;
       
     case CMD_WAIT_STATUS:
-      
-      if(USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_OK)
+      status = USBH_MSC_SCSIWait();
+      if(status == USBH_MSC_OK)
       {
         /* Get Sense data*/
         (((uint8_t*)&USBH_MSC_Param.MSSenseKey )[3]) = USBH_DataInBuffer[0];
         (((uint8_t*)&USBH_MSC_Param.MSSenseKey )[2]) = USBH_DataInBuffer[1];
         (((uint8_t*)&USBH_MSC_Param.MSSenseKey )[1]) = USBH_DataInBuffer[2];
         (((uint8_t*)&USBH_MSC_Param.MSSenseKey )[0]) = USBH_DataInBuffer[3];
-        
-        /* Commands successfully sent and Response Received  */       
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_OK;      
-      }
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_FAIL )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_FAIL;
-      }
-      
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_PHASE_ERROR )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_PHASE_ERROR;    
-      }
-      
-      else
-      {
-        /* Wait for the Commands to get Completed */
-        /* NO Change in state Machine */
       }
       break;
       
@@ -478,71 +487,18 @@ uint8_t USBH_MSC_Write10(USB_OTG_CORE_HANDLE *pdev,
                          uint32_t address,
                          uint32_t nbOfbytes)
 {
-  uint8_t index;
   USBH_MSC_Status_TypeDef status = USBH_MSC_BUSY;
-  uint16_t nbOfPages;
   
   if(HCD_IsDeviceConnected(pdev))
   {  
     switch(USBH_MSC_BOTXferParam.CmdStateMachine)
     {
     case CMD_SEND_STATE:   
-      USBH_MSC_CBWData.field.CBWTransferLength = nbOfbytes;
-      USBH_MSC_CBWData.field.CBWFlags = USB_EP_DIR_OUT;
-      USBH_MSC_CBWData.field.CBWLength = CBW_LENGTH;
-      USBH_MSC_BOTXferParam.pRxTxBuff = dataBuffer;
-      
-      
-      for(index = CBW_CB_LENGTH - 1; index != 0; index--)  
-      {
-        USBH_MSC_CBWData.field.CBWCB[index] = 0x00;
-      }
-      
-      USBH_MSC_CBWData.field.CBWCB[0]  = OPCODE_WRITE10; 
-      
-      /*logical block address*/
-      USBH_MSC_CBWData.field.CBWCB[2]  = (((uint8_t*)&address)[3]) ;
-      USBH_MSC_CBWData.field.CBWCB[3]  = (((uint8_t*)&address)[2]);
-      USBH_MSC_CBWData.field.CBWCB[4]  = (((uint8_t*)&address)[1]);
-      USBH_MSC_CBWData.field.CBWCB[5]  = (((uint8_t*)&address)[0]);
-      
-      /*USBH_MSC_PAGE_LENGTH = 512*/
-      nbOfPages = nbOfbytes/ USBH_MSC_PAGE_LENGTH; 
-      
-      /*Transfer length */
-      USBH_MSC_CBWData.field.CBWCB[7]  = (((uint8_t *)&nbOfPages)[1]) ; 
-      USBH_MSC_CBWData.field.CBWCB[8]  = (((uint8_t *)&nbOfPages)[0]) ; 
-      
-      USBH_MSC_BOTXferParam.BOTState = USBH_MSC_SEND_CBW;
-      /* Start the transfer, then let the state machine 
-      manage the other transactions */
-      USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
-      USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
-      USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
-      
-      status = USBH_MSC_BUSY;
-      
+      status = USBH_MSC_SCSIStart(USBH_MSC_CmdWrite10(0, dataBuffer, address, nbOfbytes));
       break;
       
     case CMD_WAIT_STATUS:
-      if(USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_OK)
-      { 
-        /* Commands successfully sent and Response Received  */       
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_OK;      
-      }
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_FAIL )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-      }
-      
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_PHASE_ERROR )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_PHASE_ERROR;    
-      }
+      status = USBH_MSC_SCSIWait();
       break;
       
     default:
@@ -566,83 +522,18 @@ uint8_t USBH_MSC_Read10(USB_OTG_CORE_HANDLE *pdev,
                         uint32_t address,
                         uint32_t nbOfbytes)
 {
-  uint8_t index;
-  static USBH_MSC_Status_TypeDef status = USBH_MSC_BUSY;
-  uint16_t nbOfPages;
-  status = USBH_MSC_BUSY;
+  USBH_MSC_Status_TypeDef status = USBH_MSC_BUSY;
   
   if(HCD_IsDeviceConnected(pdev))
   {
     switch(USBH_MSC_BOTXferParam.CmdStateMachine)
     {
     case CMD_SEND_STATE:
-      /*Prepare the CBW and relevant field*/
-      USBH_MSC_CBWData.field.CBWTransferLength = nbOfbytes;
-      USBH_MSC_CBWData.field.CBWFlags = USB_EP_DIR_IN;
-      USBH_MSC_CBWData.field.CBWLength = CBW_LENGTH;
-      
-      USBH_MSC_BOTXferParam.pRxTxBuff = dataBuffer;
-      
-      for(index = CBW_CB_LENGTH - 1; index != 0; index--)
-      {
-        USBH_MSC_CBWData.field.CBWCB[index] = 0x00;
-      }
-      
-      USBH_MSC_CBWData.field.CBWCB[0]  = OPCODE_READ10; 
-      
-      /*logical block address*/
-      
-      USBH_MSC_CBWData.field.CBWCB[2]  = (((uint8_t*)&address)[3]);
-      USBH_MSC_CBWData.field.CBWCB[3]  = (((uint8_t*)&address)[2]);
-      USBH_MSC_CBWData.field.CBWCB[4]  = (((uint8_t*)&address)[1]);
-      USBH_MSC_CBWData.field.CBWCB[5]  = (((uint8_t*)&address)[0]);
-      
-      /*USBH_MSC_PAGE_LENGTH = 512*/
-      nbOfPages = nbOfbytes/ USBH_MSC_PAGE_LENGTH;  
-      
-      /*Transfer length */
-      USBH_MSC_CBWData.field.CBWCB[7]  = (((uint8_t *)&nbOfPages)[1]) ; 
-      USBH_MSC_CBWData.field.CBWCB[8]  = (((uint8_t *)&nbOfPages)[0]) ; 
-      
-      
-      USBH_MSC_BOTXferParam.BOTState = USBH_MSC_SEND_CBW;
-      /* Start the transfer, then let the state machine 
-      manage the other transactions */
-      USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
-      USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
-      USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
-      
-      status = USBH_MSC_BUSY;
-      
+      status = USBH_MSC_SCSIStart(USBH_MSC_CmdRead10(0, dataBuffer, address, nbOfbytes));
       break;
       
     case CMD_WAIT_STATUS:
-      
-      if((USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_OK) && \
-        (HCD_IsDeviceConnected(pdev)))
-      { 
-        /* Commands successfully sent and Response Received  */       
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_OK;      
-      }
-      else if (( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_FAIL ) && \
-        (HCD_IsDeviceConnected(pdev)))
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-      }
-      
-      else if ( USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_PHASE_ERROR )
-      {
-        /* Failure Mode */
-        USBH_MSC_BOTXferParam.CmdStateMachine = CMD_SEND_STATE;
-        status = USBH_MSC_PHASE_ERROR;    
-      }
-      else
-      {
-        /* Wait for the Commands to get Completed */
-        /* NO Change in state Machine */
-      }
+      status = USBH_MSC_SCSIWait();
       break;
       
     default:
@@ -52,6 +52,14 @@
 #define USBH_MSC_MPS_SIZE                 0x200
 #endif
 
+/* usbh_msc_io.c read-ahead / write-behind window, in sectors */
+/* #define USBH_MSC_IO_RA_SECTORS            8 */
+/* #define USBH_MSC_IO_WB_SECTORS            8 */
+
+/* usbh_msc_cache.c geometry: sets x ways sectors */
+/* #define USBH_MSC_CACHE_SETS               4 */
+/* #define USBH_MSC_CACHE_WAYS               4 */
+
 /**
   * @}
   */ 
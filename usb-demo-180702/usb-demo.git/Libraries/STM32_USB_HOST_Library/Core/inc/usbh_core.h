@@ -74,9 +74,29 @@
 
 #define USBH_MAX_ERROR_COUNT                            2
 #define USBH_DEVICE_ADDRESS_DEFAULT                     0
-#define USBH_DEVICE_ADDRESS                             1
+#define USBH_DEVICE_ADDRESS                             1  /* first one of the pool */
+#define USBH_MAX_DEVICE_ADDRESS                         127
 #define CFG_DESC_MAX_SIZE                               512
 
+/* Attach timings in ms (USB_OTG_BSP_GetTick), waited for without blocking */
+#define USBH_DEBOUNCE_DELAY                             100
+#define USBH_RESET_DELAY                                100  /* 10 ms min. + margin */
+#define USBH_RESET_RECOVERY_DELAY                       20
+#define USBH_ATTACH_DELAY                               50
+#define USBH_SET_ADDRESS_DELAY                          2
+/* VBUS cycle after a disconnect, the off time also covers the core re-init */
+#define USBH_VBUS_OFF_DELAY                             200
+#define USBH_VBUS_ON_DELAY                              200
+
+/* Enumeration time histogram: USBH_ENUM_HIST buckets of USBH_ENUM_HIST_MS,
+   the last one collects everything longer */
+#ifndef USBH_ENUM_HIST
+ #define USBH_ENUM_HIST                                 8
+#endif
+#ifndef USBH_ENUM_HIST_MS
+ #define USBH_ENUM_HIST_MS                              100
+#endif
+
 
 /**
   * @}
@@ -100,7 +120,15 @@ typedef enum {
 /* Following states are used for gState */
 typedef enum {
   HOST_IDLE =0,
+  /* VBUS cycle after a disconnect, no device can be there yet */
+  HOST_VBUS_OFF,
+  HOST_VBUS_ON,
+  /* attach: the port may be disabled up to HOST_WAIT_PRT_ENABLED */
+  HOST_DEV_DEBOUNCE,
+  HOST_PORT_RESET,
+  HOST_PORT_RECOVERY,
   HOST_WAIT_PRT_ENABLED,
+  HOST_DEV_SETTLE,
   HOST_DEV_ATTACHED,
   HOST_DEV_DISCONNECTED,  
   HOST_DETECT_DEVICE_SPEED,
@@ -119,6 +147,7 @@ typedef enum {
   ENUM_IDLE = 0,
   ENUM_GET_FULL_DEV_DESC,
   ENUM_SET_ADDR,
+  ENUM_SET_ADDR_WAIT,
   ENUM_GET_CFG_DESC,
   ENUM_GET_FULL_CFG_DESC,
   ENUM_GET_MFC_STRING_DESC,
@@ -173,6 +202,7 @@ typedef struct _Ctrl
   uint16_t              length;
   uint8_t               errorcount;
   uint16_t              timer;  
+  uint16_t              timeout;  
   CTRL_STATUS           status;
   USB_Setup_TypeDef     setup;
   CTRL_State            state;  
@@ -180,6 +210,15 @@ typedef struct _Ctrl
 } USBH_Ctrl_TypeDef;
 
 
+typedef struct _EnumStats
+{
+  uint32_t              Start;              /* connection seen */
+  uint32_t              Last;               /* ms, connection -> EnumerationDone */
+  uint32_t              Max;
+  uint16_t              Hist[USBH_ENUM_HIST];
+} USBH_EnumStats_TypeDef;
+
+
 
 typedef struct _DeviceProp
 {
@@ -242,11 +281,20 @@ typedef struct _Host_TypeDef
   ENUM_State            EnumState;    /* Enumeration state Machine */
   CMD_State             RequestState;       
   USBH_Ctrl_TypeDef     Control;
+  uint32_t              Deadline;     /* end of the current attach wait */
+  uint8_t               PortResets;   /* resets done on this attach */
+  USBH_EnumStats_TypeDef EnumStats;
+  uint8_t               DevAddress;   /* taken from the address pool, 0: none */
   
   USBH_Device_TypeDef   device_prop; 
   
   USBH_Class_cb_TypeDef               *class_cb;  
   USBH_Usr_cb_TypeDef  	              *usr_cb;
+  
+  /* devices behind a hub: the hub drives their attach, USBH_Process the rest */
+  struct _Host_TypeDef  *Parent;      /* hub, 0 on the root port */
+  uint8_t               Port;         /* port of the hub */
+  void                  *ClassData;   /* class instance serving the device */
 
   
 } USBH_HOST, *pUSBH_HOST;
@@ -288,6 +336,13 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev ,
                   USBH_HOST *phost);
 void USBH_ErrorHandle(USBH_HOST *phost, 
                       USBH_Status errType);
+void USBH_AttachDevice(USB_OTG_CORE_HANDLE *pdev,
+                       USBH_HOST *phost,
+                       USBH_HOST *parent,
+                       uint8_t port,
+                       uint8_t speed);
+void USBH_DetachDevice(USB_OTG_CORE_HANDLE *pdev,
+                       USBH_HOST *phost);
 
 /**
   * @}
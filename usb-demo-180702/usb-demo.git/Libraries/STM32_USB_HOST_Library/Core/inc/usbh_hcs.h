@@ -48,7 +48,9 @@
 /** @defgroup USBH_HCS_Exported_Defines
   * @{
   */
-#define HC_MAX           8
+/* Pipes handed out: every endpoint of every device gets one, the HCD binds
+   them to the pdev->cfg.host_channels host channels (8 FS, 12 HS) on demand */
+#define HC_MAX           USB_OTG_MAX_TX_FIFOS
 
 #define HC_OK            0x0000
 #define HC_USED          0x8000
@@ -103,6 +105,12 @@ uint8_t USBH_Modify_Channel (USB_OTG_CORE_HANDLE *pdev,
                             uint8_t speed,
                             uint8_t ep_type,
                             uint16_t mps);
+
+uint8_t USBH_Set_Channel_Priority (USB_OTG_CORE_HANDLE *pdev,
+                                   uint8_t hc_num,
+                                   uint8_t priority);
+
+uint8_t USBH_Count_Channels (USB_OTG_CORE_HANDLE *pdev, uint8_t dev_address);
 /**
   * @}
   */ 
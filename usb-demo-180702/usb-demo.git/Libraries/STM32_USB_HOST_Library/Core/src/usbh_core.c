@@ -94,6 +94,9 @@ USBH_HCD_INT_cb_TypeDef  *USBH_HCD_INT_fops = &USBH_HCD_INT_cb;
   * @{
   */ 
 __IO uint32_t suspend_flag = 0;
+
+/* Device addresses in use, bit n: address n */
+static uint32_t USBH_AddrMap[(USBH_MAX_DEVICE_ADDRESS + 32) / 32];
 /**
   * @}
   */ 
@@ -103,6 +106,11 @@ __IO uint32_t suspend_flag = 0;
   * @{
   */
 static USBH_Status USBH_HandleEnum(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost);
+static void USBH_StartTimer(USBH_HOST *phost, uint32_t ms);
+static uint8_t USBH_TimerExpired(USBH_HOST *phost);
+static void USBH_EnumTimeUpdate(USBH_HOST *phost);
+static uint8_t USBH_AllocAddress(void);
+static void USBH_FreeAddress(uint8_t address);
 USBH_Status USBH_HandleControl (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost);
 
 void USB_OTG_BSP_Resume(USB_OTG_CORE_HANDLE *pdev);                                                                 
@@ -245,11 +253,86 @@ USBH_Status USBH_DeInit(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
   phost->device_prop.address = USBH_DEVICE_ADDRESS_DEFAULT;
   phost->device_prop.speed = HPRT0_PRTSPD_FULL_SPEED;
   
+  USBH_FreeAddress(phost->DevAddress);
+  phost->DevAddress = 0;
+  
   USBH_Free_Channel  (pdev, phost->Control.hc_num_in);
   USBH_Free_Channel  (pdev, phost->Control.hc_num_out);  
   return USBH_OK;
 }
 
+/**
+  * @brief  USBH_AttachDevice 
+  *         Start the enumeration of a device a hub has reset, the hub then
+  *         runs USBH_Process on it
+  * @param  phost: Host Handle of the device
+  * @param  parent: Host Handle of the hub
+  * @param  port: hub port
+  * @param  speed: device speed, HPRT0_PRTSPD_xxx
+  * @retval None
+  */
+void USBH_AttachDevice(USB_OTG_CORE_HANDLE *pdev,
+                       USBH_HOST *phost,
+                       USBH_HOST *parent,
+                       uint8_t port,
+                       uint8_t speed)
+{
+  phost->gState = HOST_ENUMERATION;
+  phost->gStateBkp = HOST_ENUMERATION; 
+  phost->EnumState = ENUM_IDLE;
+  phost->RequestState = CMD_SEND;  
+  
+  phost->Control.state = CTRL_SETUP;
+  phost->Control.errorcount = 0;
+  phost->Control.ep0size = USB_OTG_MAX_EP0_SIZE;  
+  
+  phost->device_prop.address = USBH_DEVICE_ADDRESS_DEFAULT;
+  phost->device_prop.speed = speed;
+  phost->DevAddress = 0;
+  phost->EnumStats.Start = USB_OTG_BSP_GetTick();
+  
+  phost->Parent = parent;
+  phost->Port = port;
+  phost->ClassData = 0;
+  
+  phost->usr_cb->DeviceAttached();
+  phost->Control.hc_num_out = USBH_Alloc_Channel(pdev, 0x00);
+  phost->Control.hc_num_in = USBH_Alloc_Channel(pdev, 0x80);  
+  
+  USBH_Open_Channel (pdev,
+                     phost->Control.hc_num_in,
+                     phost->device_prop.address,
+                     phost->device_prop.speed,
+                     EP_TYPE_CTRL,
+                     phost->Control.ep0size); 
+  
+  USBH_Open_Channel (pdev,
+                     phost->Control.hc_num_out,
+                     phost->device_prop.address,
+                     phost->device_prop.speed,
+                     EP_TYPE_CTRL,
+                     phost->Control.ep0size);          
+  
+  phost->usr_cb->DeviceSpeedDetected(phost->device_prop.speed);
+}
+
+/**
+  * @brief  USBH_DetachDevice 
+  *         Release a device behind a hub: its class, pipes and address
+  * @param  phost: Host Handle of the device
+  * @retval None
+  */
+void USBH_DetachDevice(USB_OTG_CORE_HANDLE *pdev,
+                       USBH_HOST *phost)
+{
+  if (phost->gState != HOST_IDLE)
+  {
+    phost->usr_cb->DeviceDisconnected();
+    phost->class_cb->DeInit(pdev, phost);
+    USBH_DeInit(pdev, phost);
+  }
+}
+
 /**
 * @brief  USBH_Process
 *         USB Host core main state machine process
@@ -260,8 +343,16 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
 {
   volatile USBH_Status status = USBH_FAIL;
 
-  /* check for Host port events */
-  if (((HCD_IsDeviceConnected(pdev) == 0)|| (HCD_IsPortEnabled(pdev) == 0))&& (phost->gState != HOST_IDLE)) 
+  if (phost->Parent == 0)
+  {
+    /* transfers waiting for a host channel */
+    HCD_ProcessPending(pdev);
+  }
+  
+  /* check for Host port events, the port resets of the attach disable it */
+  if (((HCD_IsDeviceConnected(pdev) == 0)||
+       ((HCD_IsPortEnabled(pdev) == 0) && (phost->gState > HOST_WAIT_PRT_ENABLED)))&&
+      (phost->gState > HOST_VBUS_ON)) 
   {
     if(phost->gState != HOST_DEV_DISCONNECTED) 
     {
@@ -274,40 +365,69 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
   
   case HOST_IDLE :
     
-    if (HCD_IsDeviceConnected(pdev))  
+    /* devices behind a hub leave it by USBH_AttachDevice */
+    if ((phost->Parent == 0) && HCD_IsDeviceConnected(pdev))  
     {
-      phost->gState = HOST_WAIT_PRT_ENABLED; 
+      phost->EnumStats.Start = USB_OTG_BSP_GetTick();
+      phost->PortResets = 0;
       
       /*wait denounce delay */
-      USB_OTG_BSP_mDelay(100);
-      
+      USBH_StartTimer(phost, USBH_DEBOUNCE_DELAY);
+      phost->gState = HOST_DEV_DEBOUNCE; 
+    }
+    break;
+    
+  case HOST_VBUS_OFF:
+    if (USBH_TimerExpired(phost))
+    {
+      HCD_DriveVbus(pdev, 1);
+      USBH_StartTimer(phost, USBH_VBUS_ON_DELAY);
+      phost->gState = HOST_VBUS_ON; 
+    }
+    break;
+    
+  case HOST_VBUS_ON:
+    if (USBH_TimerExpired(phost))
+    {
+      /* ready for the next device */
+      phost->gState = HOST_IDLE; 
+    }
+    break;
+    
+  case HOST_DEV_DEBOUNCE:
+    if (USBH_TimerExpired(phost))
+    {
       /* Apply a port RESET */
-      HCD_ResetPort(pdev);
-      
-      /* User RESET callback*/
-      phost->usr_cb->ResetDevice();
+      HCD_DrivePortReset(pdev, 1);
+      USBH_StartTimer(phost, USBH_RESET_DELAY);
+      phost->gState = HOST_PORT_RESET; 
     }
     break;
     
-  case HOST_WAIT_PRT_ENABLED:
-    if (pdev->host.PortEnabled == 1)
-    { 
-      phost->gState = HOST_DEV_ATTACHED; 
-      USB_OTG_BSP_mDelay(50);
+  case HOST_PORT_RESET:
+    if (USBH_TimerExpired(phost))
+    {
+      HCD_DrivePortReset(pdev, 0);
+      phost->PortResets++;
+      USBH_StartTimer(phost, USBH_RESET_RECOVERY_DELAY);
+      phost->gState = HOST_PORT_RECOVERY; 
     }
     break;
-      
-  case HOST_DEV_ATTACHED :
     
-    phost->usr_cb->DeviceAttached();
-    phost->Control.hc_num_out = USBH_Alloc_Channel(pdev, 0x00);
-    phost->Control.hc_num_in = USBH_Alloc_Channel(pdev, 0x80);  
-  
-    /* Reset USB Device */
-    if ( HCD_ResetPort(pdev) == 0)
+  case HOST_PORT_RECOVERY:
+    if (!USBH_TimerExpired(phost))
+    {
+      break;
+    }
+    /* User RESET callback*/
+    phost->usr_cb->ResetDevice();
+    
+    if (phost->PortResets == 1)
+    {
+      phost->gState = HOST_WAIT_PRT_ENABLED; 
+    }
+    else
     {
-      phost->usr_cb->ResetDevice();
-     
       /* Host is Now ready to start the Enumeration */
       phost->device_prop.speed = HCD_GetCurrentSpeed(pdev);
       
@@ -332,11 +452,39 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
     }
     break;
     
+  case HOST_WAIT_PRT_ENABLED:
+    if (pdev->host.PortEnabled == 1)
+    { 
+      USBH_StartTimer(phost, USBH_ATTACH_DELAY);
+      phost->gState = HOST_DEV_SETTLE; 
+    }
+    break;
+    
+  case HOST_DEV_SETTLE:
+    if (USBH_TimerExpired(phost))
+    {
+      phost->gState = HOST_DEV_ATTACHED; 
+    }
+    break;
+      
+  case HOST_DEV_ATTACHED :
+    
+    phost->usr_cb->DeviceAttached();
+    phost->Control.hc_num_out = USBH_Alloc_Channel(pdev, 0x00);
+    phost->Control.hc_num_in = USBH_Alloc_Channel(pdev, 0x80);  
+  
+    /* Reset USB Device, enumeration starts once it has recovered */
+    HCD_DrivePortReset(pdev, 1);
+    USBH_StartTimer(phost, USBH_RESET_DELAY);
+    phost->gState = HOST_PORT_RESET; 
+    break;
+    
   case HOST_ENUMERATION:     
     /* Check for enumeration status */  
     if ( USBH_HandleEnum(pdev , phost) == USBH_OK)
     { 
       /* The function shall return USBH_OK when full enumeration is complete */
+      USBH_EnumTimeUpdate(phost);
       
       /* user callback for end of device basic enumeration */
       phost->usr_cb->EnumerationDone();
@@ -411,29 +559,39 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
     /* Re-Initialize Host for new Enumeration */
     USBH_DeInit(pdev, phost);
     phost->usr_cb->DeInit();
-    phost->class_cb->DeInit(pdev, &phost->device_prop);
+    phost->class_cb->DeInit(pdev, phost);
     break;
     
   case HOST_DEV_DISCONNECTED :
     
+    if (phost->Parent != 0)
+    {
+      /* the root port went away under the hub */
+      USBH_DetachDevice(pdev, phost);
+      break;
+    }
+    
     /* Manage User disconnect operations*/
     phost->usr_cb->DeviceDisconnected();
     
     /* Re-Initialize Host for new Enumeration */
     USBH_DeInit(pdev, phost);
     phost->usr_cb->DeInit();
-    phost->class_cb->DeInit(pdev, &phost->device_prop); 
+    phost->class_cb->DeInit(pdev, phost); 
     USBH_DeAllocate_AllChannel(pdev);  
-    phost->gState = HOST_IDLE;
    
-    /* Re-Initialize Host for new Enumeration */
-    HCD_Init(pdev, 
+    /* Re-Initialize Host for new Enumeration, with VBUS cycled off and on
+       again by the HOST_VBUS_* states */
+    HCD_DriveVbus(pdev, 0);
+    HCD_ReInit(pdev, 
 #ifdef USE_USB_OTG_FS
             USB_OTG_FS_CORE_ID
 #else
             USB_OTG_HS_CORE_ID
 #endif
 );
+    USBH_StartTimer(phost, USBH_VBUS_OFF_DELAY);
+    phost->gState = HOST_VBUS_OFF;
     
     break;
     
@@ -444,6 +602,85 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
 }
 
 
+/**
+  * @brief  USBH_StartTimer
+  *         Start an attach / enumeration wait, USBH_Process polls it
+  * @param  phost: Host Handle
+  * @param  ms: wait in ms
+  * @retval None
+  */
+static void USBH_StartTimer(USBH_HOST *phost, uint32_t ms)
+{
+  phost->Deadline = USB_OTG_BSP_GetTick() + ms;
+}
+
+/**
+  * @brief  USBH_TimerExpired
+  *         Check the wait started by USBH_StartTimer. It ends one tick
+  *         late so that at least the requested time has passed.
+  * @param  phost: Host Handle
+  * @retval 1 once the wait is over
+  */
+static uint8_t USBH_TimerExpired(USBH_HOST *phost)
+{
+  return ((int32_t)(USB_OTG_BSP_GetTick() - phost->Deadline) > 0);
+}
+
+/**
+  * @brief  USBH_EnumTimeUpdate
+  *         File the time from connection to the end of the enumeration
+  * @param  phost: Host Handle
+  * @retval None
+  */
+static void USBH_EnumTimeUpdate(USBH_HOST *phost)
+{
+  USBH_EnumStats_TypeDef *s = &phost->EnumStats;
+  uint32_t b;
+  
+  s->Last = USB_OTG_BSP_GetTick() - s->Start;
+  if (s->Last > s->Max)
+  {
+    s->Max = s->Last;
+  }
+  b = s->Last / USBH_ENUM_HIST_MS;
+  s->Hist[(b < USBH_ENUM_HIST) ? b : USBH_ENUM_HIST - 1]++;
+}
+
+/**
+  * @brief  USBH_AllocAddress
+  *         Take a device address from the pool
+  * @param  None
+  * @retval address, 0 when all are in use
+  */
+static uint8_t USBH_AllocAddress(void)
+{
+  uint8_t address;
+  
+  for (address = USBH_DEVICE_ADDRESS; address <= USBH_MAX_DEVICE_ADDRESS; address++)
+  {
+    if ((USBH_AddrMap[address / 32] & (1UL << (address % 32))) == 0)
+    {
+      USBH_AddrMap[address / 32] |= (1UL << (address % 32));
+      return address;
+    }
+  }
+  return 0;
+}
+
+/**
+  * @brief  USBH_FreeAddress
+  *         Give a device address back to the pool
+  * @param  address: device address, 0 is ignored
+  * @retval None
+  */
+static void USBH_FreeAddress(uint8_t address)
+{
+  if ((address != 0) && (address <= USBH_MAX_DEVICE_ADDRESS))
+  {
+    USBH_AddrMap[address / 32] &= ~(1UL << (address % 32));
+  }
+}
+
 /**
   * @brief  USBH_ErrorHandle 
   *         This function handles the Error on Host side.
@@ -520,10 +757,22 @@ static USBH_Status USBH_HandleEnum(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
    
   case ENUM_SET_ADDR: 
     /* set address */
-    if ( USBH_SetAddress(pdev, phost, USBH_DEVICE_ADDRESS) == USBH_OK)
+    if (phost->DevAddress == 0)
+    {
+      phost->DevAddress = USBH_AllocAddress();
+    }
+    if ( USBH_SetAddress(pdev, phost, phost->DevAddress) == USBH_OK)
+    {
+      /* give the device its SET_ADDRESS recovery time */
+      USBH_StartTimer(phost, USBH_SET_ADDRESS_DELAY);
+      phost->EnumState = ENUM_SET_ADDR_WAIT;
+    }
+    break;
+    
+  case ENUM_SET_ADDR_WAIT: 
+    if (USBH_TimerExpired(phost))
     {
-      USB_OTG_BSP_mDelay(2);
-      phost->device_prop.address = USBH_DEVICE_ADDRESS;
+      phost->device_prop.address = phost->DevAddress;
       
       /* user callback for device address assigned */
       phost->usr_cb->DeviceAddressAssigned();
@@ -673,7 +922,6 @@ static USBH_Status USBH_HandleEnum(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
 USBH_Status USBH_HandleControl (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
 {
   uint8_t direction;  
-  static uint16_t timeout = 0;
   USBH_Status status = USBH_OK;
   URB_STATE URB_Status = URB_IDLE;
   
@@ -701,7 +949,7 @@ USBH_Status USBH_HandleControl (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
       /* check if there is a data stage */
       if (phost->Control.setup.b.wLength.w != 0 )
       {        
-        timeout = DATA_STAGE_TIMEOUT;
+        phost->Control.timeout = DATA_STAGE_TIMEOUT;
         if (direction == USB_D2H)
         {
           /* Data Direction is IN */
@@ -716,7 +964,7 @@ USBH_Status USBH_HandleControl (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
       /* No DATA stage */
       else
       {
-        timeout = NODATA_STAGE_TIMEOUT;
+        phost->Control.timeout = NODATA_STAGE_TIMEOUT;
         
         /* If there is No Data Transfer Stage */
         if (direction == USB_D2H)
@@ -772,7 +1020,7 @@ USBH_Status USBH_HandleControl (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
       /* Device error */
       phost->Control.state = CTRL_ERROR;    
     }
-    else if ((HCD_GetCurrentFrame(pdev)- phost->Control.timer) > timeout)
+    else if ((HCD_GetCurrentFrame(pdev)- phost->Control.timer) > phost->Control.timeout)
     {
       /* timeout for IN transfer */
       phost->Control.state = CTRL_ERROR; 
@@ -846,7 +1094,7 @@ USBH_Status USBH_HandleControl (USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
     }
     
     else if((HCD_GetCurrentFrame(pdev)\
-      - phost->Control.timer) > timeout)
+      - phost->Control.timer) > phost->Control.timeout)
     {
       phost->Control.state = CTRL_ERROR; 
     }
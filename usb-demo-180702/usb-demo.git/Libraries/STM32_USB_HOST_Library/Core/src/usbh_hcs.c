@@ -120,7 +120,21 @@ uint8_t USBH_Open_Channel  (USB_OTG_CORE_HANDLE *pdev,
     pdev->host.hc[hc_num].do_ping = 1;
   }
   
-  USB_OTG_HC_Init(pdev, hc_num) ;
+  /* polled endpoints first when the host channels run short */
+  if (ep_type == EP_TYPE_INTR)
+  {
+    pdev->host.Priority[hc_num] = USB_OTG_HC_PRIO_INTR;
+  }
+  else if (ep_type == EP_TYPE_CTRL)
+  {
+    pdev->host.Priority[hc_num] = USB_OTG_HC_PRIO_CTRL;
+  }
+  else
+  {
+    pdev->host.Priority[hc_num] = USB_OTG_HC_PRIO_BULK;
+  }
+  
+  HCD_HC_Init(pdev, hc_num) ;
   
   return HC_OK; 
 
@@ -160,9 +174,51 @@ uint8_t USBH_Modify_Channel (USB_OTG_CORE_HANDLE *pdev,
     pdev->host.hc[hc_num].speed = speed; 
   }
   
-  USB_OTG_HC_Init(pdev, hc_num);
+  HCD_HC_Init(pdev, hc_num);
+  return HC_OK; 
+
+}
+
+/**
+  * @brief  USBH_Set_Channel_Priority
+  *         Change the rank of a pipe when it waits for a host channel,
+  *         USBH_Open_Channel sets it from the endpoint type
+  * @param  pdev : Selected device
+  * @param  hc_num: Host channel Number
+  * @param  priority: USB_OTG_HC_PRIO_xxx, higher goes first
+  * @retval Status
+  */
+uint8_t USBH_Set_Channel_Priority (USB_OTG_CORE_HANDLE *pdev,
+                                   uint8_t hc_num,
+                                   uint8_t priority)
+{
+  if(hc_num < HC_MAX)
+  {
+    pdev->host.Priority[hc_num] = priority;
+  }
   return HC_OK; 
+}
 
+/**
+  * @brief  USBH_Count_Channels
+  *         Count the pipes open on a device
+  * @param  pdev : Selected device
+  * @param  dev_address: USB Device address
+  * @retval number of pipes
+  */
+uint8_t USBH_Count_Channels (USB_OTG_CORE_HANDLE *pdev, uint8_t dev_address)
+{
+  uint8_t idx, count = 0;
+  
+  for (idx = 0 ; idx < HC_MAX ; idx++)
+  {
+    if (((pdev->host.channel[idx] & HC_USED) != 0) &&
+        (pdev->host.hc[idx].dev_addr == dev_address))
+    {
+      count++;
+    }
+  }
+  return count;
 }
 
 /**
@@ -195,6 +251,7 @@ uint8_t USBH_Free_Channel  (USB_OTG_CORE_HANDLE *pdev, uint8_t idx)
    if(idx < HC_MAX)
    {
 	 pdev->host.channel[idx] &= HC_USED_MASK;
+	 HCD_HC_Free(pdev, idx);
    }
    return USBH_OK;
 }
@@ -213,6 +270,7 @@ uint8_t USBH_DeAllocate_AllChannel  (USB_OTG_CORE_HANDLE *pdev)
    for (idx = 2; idx < HC_MAX ; idx ++)
    {
 	 pdev->host.channel[idx] = 0;
+	 HCD_HC_Free(pdev, idx);
    }
    return USBH_OK;
 }
@@ -80,6 +80,7 @@ void BSP_Init(void);
 void USB_OTG_BSP_Init (USB_OTG_CORE_HANDLE *pdev);
 void USB_OTG_BSP_uDelay (const uint32_t usec);
 void USB_OTG_BSP_mDelay (const uint32_t msec);
+uint32_t USB_OTG_BSP_GetTick (void);
 void USB_OTG_BSP_EnableInterrupt (USB_OTG_CORE_HANDLE *pdev);
 void USB_OTG_BSP_TimerIRQ (void);
 #ifdef USE_HOST_MODE
@@ -33,6 +33,7 @@
 #include "usb_conf.h"
 #include "usb_regs.h"
 #include "usb_defines.h"
+#include <stddef.h>
 
 
 /** @addtogroup USB_OTG_DRIVER
@@ -66,6 +67,27 @@
 #define USB_OTG_EP_RX_STALL     0x1000
 #define USB_OTG_EP_RX_NAK       0x2000
 #define USB_OTG_EP_RX_VALID     0x3000
+
+/* Host pipes (hc[] and friends) are bound to a host channel on demand */
+#define USB_OTG_HC_NONE         0xFF    /* pipe without channel / free channel */
+
+#define USB_OTG_HC_PRIO_BULK    0
+#define USB_OTG_HC_PRIO_CTRL    1
+#define USB_OTG_HC_PRIO_INTR    2
+
+/* Waiting pipes gain one priority level per USB_OTG_HC_AGE_FRAMES */
+#ifndef USB_OTG_HC_AGE_FRAMES
+ #define USB_OTG_HC_AGE_FRAMES  8
+#endif
+
+/* Report ring of an interrupt IN pipe polled from the interrupt handler */
+#ifndef USB_OTG_HC_RING_SIZE
+ #define USB_OTG_HC_RING_SIZE   8       /* reports, a power of two */
+#endif
+#ifndef USB_OTG_HC_RING_SLOT
+ #define USB_OTG_HC_RING_SLOT   64      /* bytes, at least the pipe max_packet */
+#endif
+#define USB_OTG_HC_RING_MASK    (USB_OTG_HC_RING_SIZE - 1)
 /**
   * @}
   */ 
@@ -101,6 +123,27 @@ typedef enum {
   URB_STALL
 }URB_STATE;
 
+typedef enum {
+  RING_OFF = 0,
+  RING_ARMED,                           /* waiting for its due frame */
+  RING_BUSY,                            /* IN transfer on the bus */
+  RING_FULL,                            /* not polled until a report is read */
+  RING_HALTED,                          /* stall or error, see URB_State */
+}RING_STATE;
+
+typedef enum {
+  HC_NAK_IMMEDIATE = 0,                 /* retried at once */
+  HC_NAK_NEXT_FRAME,                    /* retried in the next (micro)frame */
+  HC_NAK_BACKOFF,                       /* after 1, 2, 4 .. frames, 1 again on data */
+  HC_NAK_PING,                          /* high speed OUT: PING until the device has room */
+}HC_NAK_POLICY;
+
+typedef enum {
+  NAK_IDLE = 0,
+  NAK_PARKED,                           /* halted on a NAK, waiting for its frame */
+  NAK_PING,                             /* PING on the bus */
+}NAK_STATE;
+
 typedef enum {
   CTRL_START = 0,
   CTRL_XFRC,
@@ -143,6 +186,7 @@ typedef struct USB_OTG_ep
   uint8_t        even_odd_frame;
   uint16_t       tx_fifo_num;
   uint32_t       maxpacket;
+  uint8_t        mc;             /* transactions per (micro)frame, periodic IN */
   /* transaction level variables*/
   uint8_t        *xfer_buff;
   uint32_t       dma_addr;  
@@ -224,6 +268,14 @@ typedef struct _Device_cb
 #ifdef USB_SUPPORT_USER_STRING_DESC 
   uint8_t  *(*GetUsrStrDescriptor)( uint8_t speed ,uint8_t index,  uint16_t *length);   
 #endif  
+  /* optional, for classes whose configuration differs per core (e.g. per
+     host OS): GetConfigDescriptor for the device instance that asks */
+  uint8_t  *(*GetCoreConfigDescriptor)( void *pdev , uint8_t speed , uint16_t *length); 
+  /* optional: the idx-th class descriptor (HID, report...) interface itf
+     answers GET_DESCRIPTOR with, and its wValue; NULL past the last one.
+     The core serves them from its descriptor table. */
+  uint8_t  *(*GetItfDescriptor)( void *pdev , uint8_t itf , uint8_t idx ,
+                                 uint16_t *wValue , uint16_t *length);
   
 } USBD_Class_cb_TypeDef;
 
@@ -260,10 +312,46 @@ typedef struct _DCD
   USBD_Usr_cb_TypeDef           *usr_cb;
   USBD_DEVICE                   *usr_device;  
   uint8_t        *pConfig_descriptor;
+  /* DCD_EP_SetHandler: transfer complete goes straight to these */
+  uint8_t        (*in_ep_handler [USB_OTG_MAX_TX_FIFOS])(void *pdev , uint8_t epnum);
+  uint8_t        (*out_ep_handler[USB_OTG_MAX_TX_FIFOS])(void *pdev , uint8_t epnum);
  }
 DCD_DEV , *DCD_PDEV;
 
 
+/* Reports of an interrupt IN pipe: the interrupt handler re-submits the
+   transfer every interval frames into slot wr, the main loop reads slot rd.
+   wr has a single writer, the handler, and rd the main loop. */
+typedef struct _USB_OTG_HC_RING
+{
+  uint8_t                  data [USB_OTG_HC_RING_SIZE][USB_OTG_HC_RING_SLOT];
+  uint16_t                 len [USB_OTG_HC_RING_SIZE];
+  uint16_t                 frame [USB_OTG_HC_RING_SIZE];   /* completion frame */
+  __IO uint32_t            wr;
+  __IO uint32_t            rd;
+  __IO RING_STATE          state;
+  uint16_t                 length;                         /* bytes per transfer */
+  uint16_t                 interval;                       /* frames */
+  uint16_t                 due;                            /* frame of the next poll */
+  uint32_t                 Reports;
+  uint32_t                 Pauses;                         /* polls held on a full ring */
+  uint32_t                 Late;                           /* polls started after their frame */
+}
+USB_OTG_HC_RING;
+
+/* NAK throttling of a bulk or control pipe, slave mode only */
+typedef struct USB_OTG_hc_nak
+{
+  HC_NAK_POLICY            policy;
+  uint8_t                  max_shift;                      /* HC_NAK_BACKOFF: 2^max_shift frames at most */
+  uint8_t                  shift;
+  __IO NAK_STATE           state;
+  uint16_t                 due;                            /* frame of the retry */
+  uint32_t                 Naks;
+  uint32_t                 Retries;                        /* transactions started again after a NAK */
+}
+USB_OTG_HC_NAK;
+
 typedef struct _HCD
 {
   uint8_t                  Rx_Buffer [MAX_DATA_LENGTH];  
@@ -275,6 +363,19 @@ typedef struct _HCD
   __IO URB_STATE           URB_State[USB_OTG_MAX_TX_FIFOS];
   USB_OTG_HC               hc [USB_OTG_MAX_TX_FIFOS];
   uint16_t                 channel [USB_OTG_MAX_TX_FIFOS];
+  uint8_t                  ChNum [USB_OTG_MAX_TX_FIFOS];    /* pipe -> host channel */
+  uint8_t                  ChPipe [USB_OTG_MAX_TX_FIFOS];   /* host channel -> pipe */
+  uint8_t                  Priority [USB_OTG_MAX_TX_FIFOS]; /* USB_OTG_HC_PRIO_xxx */
+  uint8_t                  Pending [USB_OTG_MAX_TX_FIFOS];  /* submitted, no channel yet */
+  uint16_t                 WaitFrame [USB_OTG_MAX_TX_FIFOS];
+  uint32_t                 LastUse [USB_OTG_MAX_TX_FIFOS];  /* XferSeq of the last start */
+  uint32_t                 XferSeq;
+  uint32_t                 Evictions;                       /* channels taken from idle pipes */
+  uint32_t                 Deferrals;                       /* transfers that waited for one */
+  USB_OTG_HC_RING          *Ring [USB_OTG_MAX_TX_FIFOS];    /* pipes polled by the handler */
+  /* HCD_HC_SetHandler: the end of each transfer goes straight to these */
+  void                     (*hc_handler [USB_OTG_MAX_TX_FIFOS])(void *pdev , uint8_t hc_num);
+  USB_OTG_HC_NAK           Nak [USB_OTG_MAX_TX_FIFOS];      /* HCD_HC_SetNakPolicy */
 }
 HCD_DEV , *USB_OTG_USBH_PDEV;
 
@@ -329,6 +430,7 @@ USB_OTG_CORE_HANDLE , *PUSB_OTG_CORE_HANDLE;
 
 
 USB_OTG_STS  USB_OTG_CoreInit        (USB_OTG_CORE_HANDLE *pdev);
+USB_OTG_STS  USB_OTG_CoreSetup       (USB_OTG_CORE_HANDLE *pdev);
 USB_OTG_STS  USB_OTG_SelectCore      (USB_OTG_CORE_HANDLE *pdev, 
                                       USB_OTG_CORE_ID_TypeDef coreID);
 USB_OTG_STS  USB_OTG_EnableGlobalInt (USB_OTG_CORE_HANDLE *pdev);
@@ -351,10 +453,13 @@ uint32_t     USB_OTG_GetMode         (USB_OTG_CORE_HANDLE *pdev);
 USB_OTG_STS  USB_OTG_PhyInit         (USB_OTG_CORE_HANDLE *pdev);
 USB_OTG_STS  USB_OTG_SetCurrentMode  (USB_OTG_CORE_HANDLE *pdev,
     uint8_t mode);
+USB_OTG_STS  USB_OTG_ForceMode       (USB_OTG_CORE_HANDLE *pdev,
+    uint8_t mode);
 
 /*********************** HOST APIs ********************************************/
 #ifdef USE_HOST_MODE
 USB_OTG_STS  USB_OTG_CoreInitHost    (USB_OTG_CORE_HANDLE *pdev);
+USB_OTG_STS  USB_OTG_CoreSetupHost   (USB_OTG_CORE_HANDLE *pdev);
 USB_OTG_STS  USB_OTG_EnableHostInt   (USB_OTG_CORE_HANDLE *pdev);
 USB_OTG_STS  USB_OTG_HC_Init         (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
 USB_OTG_STS  USB_OTG_HC_Halt         (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
@@ -362,8 +467,10 @@ USB_OTG_STS  USB_OTG_HC_StartXfer    (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num)
 USB_OTG_STS  USB_OTG_HC_DoPing       (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num);
 uint32_t     USB_OTG_ReadHostAllChannels_intr    (USB_OTG_CORE_HANDLE *pdev);
 uint32_t     USB_OTG_ResetPort       (USB_OTG_CORE_HANDLE *pdev);
+void         USB_OTG_DrivePortReset  (USB_OTG_CORE_HANDLE *pdev, uint8_t state);
 uint32_t     USB_OTG_ReadHPRT0       (USB_OTG_CORE_HANDLE *pdev);
 void         USB_OTG_DriveVbus       (USB_OTG_CORE_HANDLE *pdev, uint8_t state);
+void         USB_OTG_SetVbus         (USB_OTG_CORE_HANDLE *pdev, uint8_t state);
 void         USB_OTG_InitFSLSPClkSel (USB_OTG_CORE_HANDLE *pdev ,uint8_t freq);
 uint8_t      USB_OTG_IsEvenFrame     (USB_OTG_CORE_HANDLE *pdev) ;
 void         USB_OTG_StopHost        (USB_OTG_CORE_HANDLE *pdev);
@@ -371,6 +478,8 @@ void         USB_OTG_StopHost        (USB_OTG_CORE_HANDLE *pdev);
 /********************* DEVICE APIs ********************************************/
 #ifdef USE_DEVICE_MODE
 USB_OTG_STS  USB_OTG_CoreInitDev         (USB_OTG_CORE_HANDLE *pdev);
+uint32_t     USB_OTG_GetTxFifoSpace      (USB_OTG_CORE_HANDLE *pdev);
+USB_OTG_STS  USB_OTG_SetTxFifos          (USB_OTG_CORE_HANDLE *pdev , const uint16_t *depth);
 USB_OTG_STS  USB_OTG_EnableDevInt        (USB_OTG_CORE_HANDLE *pdev);
 uint32_t     USB_OTG_ReadDevAllInEPItr           (USB_OTG_CORE_HANDLE *pdev);
 enum USB_OTG_SPEED USB_OTG_GetDeviceSpeed (USB_OTG_CORE_HANDLE *pdev);
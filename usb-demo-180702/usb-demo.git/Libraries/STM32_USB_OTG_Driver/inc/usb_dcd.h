@@ -120,6 +120,10 @@ uint32_t    DCD_EP_Open(USB_OTG_CORE_HANDLE *pdev ,
 uint32_t    DCD_EP_Close  (USB_OTG_CORE_HANDLE *pdev,
                                 uint8_t  ep_addr);
 
+void        DCD_EP_SetHandler (USB_OTG_CORE_HANDLE *pdev,
+                               uint8_t  ep_addr,
+                               uint8_t  (*handler)(void *pdev , uint8_t epnum));
+
 
 uint32_t   DCD_EP_PrepareRx ( USB_OTG_CORE_HANDLE *pdev,
                         uint8_t   ep_addr,                                  
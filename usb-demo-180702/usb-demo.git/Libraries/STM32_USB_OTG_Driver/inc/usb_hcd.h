@@ -79,12 +79,38 @@
   */ 
 uint32_t  HCD_Init                 (USB_OTG_CORE_HANDLE *pdev ,
                                     USB_OTG_CORE_ID_TypeDef coreID);
+uint32_t  HCD_ReInit               (USB_OTG_CORE_HANDLE *pdev ,
+                                    USB_OTG_CORE_ID_TypeDef coreID);
 uint32_t  HCD_HC_Init              (USB_OTG_CORE_HANDLE *pdev , 
                                     uint8_t hc_num); 
+uint32_t  HCD_HC_Free              (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t hc_num); 
 uint32_t  HCD_SubmitRequest        (USB_OTG_CORE_HANDLE *pdev , 
                                     uint8_t hc_num) ;
+void      HCD_ProcessPending       (USB_OTG_CORE_HANDLE *pdev);
+void      HCD_HC_SetHandler        (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t hc_num,
+                                    void (*handler)(void *pdev , uint8_t hc_num));
+void      HCD_HC_SetNakPolicy      (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t hc_num,
+                                    HC_NAK_POLICY policy,
+                                    uint8_t max_shift);
+uint32_t  HCD_StartRing            (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t hc_num,
+                                    USB_OTG_HC_RING *ring,
+                                    uint16_t length,
+                                    uint16_t interval);
+void      HCD_StopRing             (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t hc_num);
+uint8_t  *HCD_RingGet              (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t hc_num,
+                                    uint16_t *len);
+void      HCD_RingRelease          (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t hc_num);
 uint32_t  HCD_GetCurrentSpeed      (USB_OTG_CORE_HANDLE *pdev);
 uint32_t  HCD_ResetPort            (USB_OTG_CORE_HANDLE *pdev);
+uint32_t  HCD_DrivePortReset       (USB_OTG_CORE_HANDLE *pdev, uint8_t state);
+uint32_t  HCD_DriveVbus            (USB_OTG_CORE_HANDLE *pdev, uint8_t state);
 uint32_t  HCD_IsDeviceConnected    (USB_OTG_CORE_HANDLE *pdev);
 uint32_t  HCD_IsPortEnabled         (USB_OTG_CORE_HANDLE *pdev);
 
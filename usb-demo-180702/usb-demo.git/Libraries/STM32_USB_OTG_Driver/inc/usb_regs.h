@@ -69,6 +69,9 @@
 #define USB_OTG_HS_MAX_PACKET_SIZE           512
 #define USB_OTG_FS_MAX_PACKET_SIZE           64
 #define USB_OTG_MAX_EP0_SIZE                 64
+#define USB_OTG_DMA_FIFO_RESERVED            12   /* words, HS internal DMA */
+#define USB_OTG_FS_TOTAL_FIFO_SIZE           320  /* words of FIFO RAM */
+#define USB_OTG_HS_TOTAL_FIFO_SIZE           1024
 /**
   * @}
   */ 
@@ -178,6 +178,17 @@ void USB_OTG_BSP_mDelay (const uint32_t msec)
 
 }
 
+/**
+  * @brief  USB_OTG_BSP_GetTick
+  *         Millisecond counter the host waits are timed with, free running
+  * @param  None
+  * @retval time in ms
+  */
+uint32_t USB_OTG_BSP_GetTick (void)
+{
+  return 0;
+}
+
 
 /**
   * @brief  USB_OTG_BSP_TimerIRQ
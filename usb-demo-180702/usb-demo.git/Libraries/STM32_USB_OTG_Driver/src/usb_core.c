@@ -156,6 +156,113 @@ static USB_OTG_STS USB_OTG_CoreReset(USB_OTG_CORE_HANDLE *pdev)
   return status;
 }
 
+#ifndef USB_OTG_FIFO_COPY_REF
+/*
+ * FIFO copy fast paths. Any address of the 4 KB DFIFO window pushes/pops the
+ * same FIFO, so a burst can use fifo[0..7] and let the compiler emit LDM/STM
+ * on the memory side. Word-aligned buffers take plain word accesses, others
+ * __packed ones. The last 1-3 bytes go byte by byte, so the buffer is never
+ * read or written past len.
+ */
+static void USB_OTG_FifoWrite(__IO uint32_t *fifo, const uint8_t *src, uint32_t len)
+{
+  uint32_t n = len >> 2;
+  uint32_t tail = len & 3;
+  uint32_t w;
+
+  if (((uint32_t)src & 3) == 0)
+  {
+    const uint32_t *s = (const uint32_t *)src;
+
+    for (; n >= 8; n -= 8, s += 8)
+    {
+      fifo[0] = s[0]; fifo[1] = s[1]; fifo[2] = s[2]; fifo[3] = s[3];
+      fifo[4] = s[4]; fifo[5] = s[5]; fifo[6] = s[6]; fifo[7] = s[7];
+    }
+    for (; n >= 4; n -= 4, s += 4)
+    {
+      fifo[0] = s[0]; fifo[1] = s[1]; fifo[2] = s[2]; fifo[3] = s[3];
+    }
+    while (n--)
+    {
+      *fifo = *s++;
+    }
+    src = (const uint8_t *)s;
+  }
+  else
+  {
+    for (; n >= 4; n -= 4, src += 16)
+    {
+      fifo[0] = ((__packed const uint32_t *)src)[0];
+      fifo[1] = ((__packed const uint32_t *)src)[1];
+      fifo[2] = ((__packed const uint32_t *)src)[2];
+      fifo[3] = ((__packed const uint32_t *)src)[3];
+    }
+    for (; n; n--, src += 4)
+    {
+      *fifo = *(__packed const uint32_t *)src;
+    }
+  }
+
+  if (tail)
+  {
+    w = src[0];
+    if (tail > 1) w |= (uint32_t)src[1] << 8;
+    if (tail > 2) w |= (uint32_t)src[2] << 16;
+    *fifo = w;
+  }
+}
+
+static void USB_OTG_FifoRead(__IO uint32_t *fifo, uint8_t *dest, uint32_t len)
+{
+  uint32_t n = len >> 2;
+  uint32_t tail = len & 3;
+  uint32_t w;
+
+  if (((uint32_t)dest & 3) == 0)
+  {
+    uint32_t *d = (uint32_t *)dest;
+
+    for (; n >= 8; n -= 8, d += 8)
+    {
+      d[0] = fifo[0]; d[1] = fifo[1]; d[2] = fifo[2]; d[3] = fifo[3];
+      d[4] = fifo[4]; d[5] = fifo[5]; d[6] = fifo[6]; d[7] = fifo[7];
+    }
+    for (; n >= 4; n -= 4, d += 4)
+    {
+      d[0] = fifo[0]; d[1] = fifo[1]; d[2] = fifo[2]; d[3] = fifo[3];
+    }
+    while (n--)
+    {
+      *d++ = *fifo;
+    }
+    dest = (uint8_t *)d;
+  }
+  else
+  {
+    for (; n >= 4; n -= 4, dest += 16)
+    {
+      ((__packed uint32_t *)dest)[0] = fifo[0];
+      ((__packed uint32_t *)dest)[1] = fifo[1];
+      ((__packed uint32_t *)dest)[2] = fifo[2];
+      ((__packed uint32_t *)dest)[3] = fifo[3];
+    }
+    for (; n; n--, dest += 4)
+    {
+      *(__packed uint32_t *)dest = *fifo;
+    }
+  }
+
+  if (tail)
+  {
+    w = *fifo;
+    dest[0] = (uint8_t)w;
+    if (tail > 1) dest[1] = (uint8_t)(w >> 8);
+    if (tail > 2) dest[2] = (uint8_t)(w >> 16);
+  }
+}
+#endif /* USB_OTG_FIFO_COPY_REF */
+
 /**
 * @brief  USB_OTG_WritePacket : Writes a packet into the Tx FIFO associated 
 *         with the EP
@@ -173,6 +280,7 @@ USB_OTG_STS USB_OTG_WritePacket(USB_OTG_CORE_HANDLE *pdev,
   USB_OTG_STS status = USB_OTG_OK;
   if (pdev->cfg.dma_enable == 0)
   {
+#ifdef USB_OTG_FIFO_COPY_REF
     uint32_t count32b= 0 , i= 0;
     __IO uint32_t *fifo;
     
@@ -183,6 +291,9 @@ USB_OTG_STS USB_OTG_WritePacket(USB_OTG_CORE_HANDLE *pdev,
       USB_OTG_WRITE_REG32( fifo, *((__packed uint32_t *)src) );
       src+=4;
     }
+#else
+    USB_OTG_FifoWrite(pdev->regs.DFIFO[ch_ep_num], src, len);
+#endif
   }
   return status;
 }
@@ -199,6 +310,7 @@ void *USB_OTG_ReadPacket(USB_OTG_CORE_HANDLE *pdev,
                          uint8_t *dest, 
                          uint16_t len)
 {
+#ifdef USB_OTG_FIFO_COPY_REF
   uint32_t i=0;
   uint32_t count32b = (len + 3) / 4;
   
@@ -210,6 +322,10 @@ void *USB_OTG_ReadPacket(USB_OTG_CORE_HANDLE *pdev,
     dest += 4 ;
   }
   return ((void *)dest);
+#else
+  USB_OTG_FifoRead(pdev->regs.DFIFO[0], dest, len);
+  return ((void *)(dest + len));
+#endif
 }
 
 /**
@@ -238,7 +354,7 @@ USB_OTG_STS USB_OTG_SelectCore(USB_OTG_CORE_HANDLE *pdev,
     pdev->cfg.coreID           = USB_OTG_FS_CORE_ID;
     pdev->cfg.host_channels    = 8 ;
     pdev->cfg.dev_endpoints    = 4 ;
-    pdev->cfg.TotalFifoSize    = 320; /* in 32-bits */
+    pdev->cfg.TotalFifoSize    = USB_OTG_FS_TOTAL_FIFO_SIZE; /* in 32-bits */
     pdev->cfg.phy_itface       = USB_OTG_EMBEDDED_PHY;     
     
 #ifdef USB_OTG_FS_SOF_OUTPUT_ENABLED    
@@ -255,7 +371,7 @@ USB_OTG_STS USB_OTG_SelectCore(USB_OTG_CORE_HANDLE *pdev,
     pdev->cfg.coreID           = USB_OTG_HS_CORE_ID;    
     pdev->cfg.host_channels    = 12 ;
     pdev->cfg.dev_endpoints    = 6 ;
-    pdev->cfg.TotalFifoSize    = 1280;/* in 32-bits */
+    pdev->cfg.TotalFifoSize    = USB_OTG_HS_TOTAL_FIFO_SIZE;/* in 32-bits */
     
 #ifdef USB_OTG_ULPI_PHY_ENABLED
     pdev->cfg.phy_itface       = USB_OTG_ULPI_PHY;
@@ -327,6 +443,26 @@ USB_OTG_STS USB_OTG_SelectCore(USB_OTG_CORE_HANDLE *pdev,
 * @retval USB_OTG_STS : status
 */
 USB_OTG_STS USB_OTG_CoreInit(USB_OTG_CORE_HANDLE *pdev)
+{
+  USB_OTG_STS status;
+  
+  status = USB_OTG_CoreSetup(pdev);
+  if (pdev->cfg.phy_itface != USB_OTG_ULPI_PHY)
+  {
+    /* embedded PHY power up */
+    USB_OTG_BSP_mDelay(20);
+  }
+  return status;
+}
+
+/**
+* @brief  USB_OTG_CoreSetup
+*         Same as USB_OTG_CoreInit without waiting for the embedded PHY to
+*         power up: the caller lets 20 ms pass before using the bus
+* @param  pdev : Selected device
+* @retval USB_OTG_STS : status
+*/
+USB_OTG_STS USB_OTG_CoreSetup(USB_OTG_CORE_HANDLE *pdev)
 {
   USB_OTG_STS status = USB_OTG_OK;
   USB_OTG_GUSBCFG_TypeDef  usbcfg;
@@ -404,7 +540,6 @@ USB_OTG_STS USB_OTG_CoreInit(USB_OTG_CORE_HANDLE *pdev)
     }
     
     USB_OTG_WRITE_REG32 (&pdev->regs.GREGS->GCCFG, gccfg.d32);
-    USB_OTG_BSP_mDelay(20);
   }
   /* case the HS core is working in FS mode */
   if(pdev->cfg.dma_enable == 1)
@@ -542,6 +677,22 @@ USB_OTG_STS USB_OTG_FlushRxFifo( USB_OTG_CORE_HANDLE *pdev )
 * @retval USB_OTG_STS : status
 */
 USB_OTG_STS USB_OTG_SetCurrentMode(USB_OTG_CORE_HANDLE *pdev , uint8_t mode)
+{
+  USB_OTG_STS status;
+  
+  status = USB_OTG_ForceMode(pdev, mode);
+  USB_OTG_BSP_mDelay(50);
+  return status;
+}
+
+/**
+* @brief  USB_OTG_ForceMode : Set ID line without waiting for the mode to
+*         take effect, the caller lets 50 ms pass
+* @param  pdev : Selected device
+* @param  mode :  (Host/device)
+* @retval USB_OTG_STS : status
+*/
+USB_OTG_STS USB_OTG_ForceMode(USB_OTG_CORE_HANDLE *pdev , uint8_t mode)
 {
   USB_OTG_STS status = USB_OTG_OK;
   USB_OTG_GUSBCFG_TypeDef  usbcfg;
@@ -566,7 +717,6 @@ USB_OTG_STS USB_OTG_SetCurrentMode(USB_OTG_CORE_HANDLE *pdev , uint8_t mode)
   }
   
   USB_OTG_WRITE_REG32(&pdev->regs.GREGS->GUSBCFG, usbcfg.d32);
-  USB_OTG_BSP_mDelay(50);
   return status;
 }
 
@@ -635,6 +785,25 @@ uint32_t USB_OTG_ReadOtgItr (USB_OTG_CORE_HANDLE *pdev)
 * @retval status
 */
 USB_OTG_STS USB_OTG_CoreInitHost(USB_OTG_CORE_HANDLE *pdev)
+{
+  USB_OTG_STS status;
+  
+  status = USB_OTG_CoreSetupHost(pdev);
+  USB_OTG_ResetPort(pdev);
+#ifndef USE_OTG_MODE
+  USB_OTG_DriveVbus(pdev, 1);
+#endif
+  return status;
+}
+
+/**
+* @brief  USB_OTG_CoreSetupHost : Sets the core up for host mode like
+*         USB_OTG_CoreInitHost, without the port reset and with VBUS left
+*         as it is, so that nothing waits
+* @param  pdev : Selected device
+* @retval status
+*/
+USB_OTG_STS USB_OTG_CoreSetupHost(USB_OTG_CORE_HANDLE *pdev)
 {
   USB_OTG_STS                     status = USB_OTG_OK;
   USB_OTG_FSIZ_TypeDef            nptxfifosize;
@@ -670,7 +839,6 @@ USB_OTG_STS USB_OTG_CoreInitHost(USB_OTG_CORE_HANDLE *pdev)
   {
     USB_OTG_InitFSLSPClkSel(pdev , HCFG_48_MHZ); 
   }
-  USB_OTG_ResetPort(pdev);
   
   hcfg.d32 = USB_OTG_READ_REG32(&pdev->regs.HREGS->HCFG);
   hcfg.b.fslssupp = 0;
@@ -724,9 +892,6 @@ USB_OTG_STS USB_OTG_CoreInitHost(USB_OTG_CORE_HANDLE *pdev)
     USB_OTG_WRITE_REG32( &pdev->regs.HC_REGS[i]->HCINT, 0xFFFFFFFF );
     USB_OTG_WRITE_REG32( &pdev->regs.HC_REGS[i]->HCINTMSK, 0 );
   }
-#ifndef USE_OTG_MODE
-  USB_OTG_DriveVbus(pdev, 1);
-#endif
   
   USB_OTG_EnableHostInt(pdev);
   return status;
@@ -750,6 +915,19 @@ uint8_t USB_OTG_IsEvenFrame (USB_OTG_CORE_HANDLE *pdev)
 * @retval None
 */
 void USB_OTG_DriveVbus (USB_OTG_CORE_HANDLE *pdev, uint8_t state)
+{
+  USB_OTG_SetVbus(pdev, state);
+  USB_OTG_BSP_mDelay(200);
+}
+
+/**
+* @brief  USB_OTG_SetVbus : set/reset vbus without waiting for it to settle,
+*         for callers timing it themselves (see USB_OTG_DriveVbus)
+* @param  pdev : Selected device
+* @param  state : VBUS state
+* @retval None
+*/
+void USB_OTG_SetVbus (USB_OTG_CORE_HANDLE *pdev, uint8_t state)
 {
   USB_OTG_HPRT0_TypeDef     hprt0;
   
@@ -770,8 +948,6 @@ void USB_OTG_DriveVbus (USB_OTG_CORE_HANDLE *pdev, uint8_t state)
     hprt0.b.prtpwr = 0;
     USB_OTG_WRITE_REG32(pdev->regs.HPRT0, hprt0.d32);
   }
-  
-  USB_OTG_BSP_mDelay(200);
 }
 /**
 * @brief  USB_OTG_EnableHostInt: Enables the Host mode interrupts
@@ -866,35 +1042,52 @@ uint32_t USB_OTG_ReadHostAllChannels_intr (USB_OTG_CORE_HANDLE *pdev)
 *   before clearing the reset bit.
 */
 uint32_t USB_OTG_ResetPort(USB_OTG_CORE_HANDLE *pdev)
+{
+  USB_OTG_DrivePortReset(pdev, 1);
+  USB_OTG_BSP_mDelay (100);                                /* See Note #1 */
+  USB_OTG_DrivePortReset(pdev, 0);
+  USB_OTG_BSP_mDelay (20);   
+  return 1;
+}
+
+/**
+* @brief  USB_OTG_DrivePortReset : drive / release the reset of the Host Port,
+*         for callers timing the reset themselves (see USB_OTG_ResetPort)
+* @param  pdev : Selected device
+* @param  state : 1 starts the reset, 0 ends it
+* @retval None
+*/
+void USB_OTG_DrivePortReset(USB_OTG_CORE_HANDLE *pdev, uint8_t state)
 {
   USB_OTG_HPRT0_TypeDef  hprt0;
   
   hprt0.d32 = USB_OTG_ReadHPRT0(pdev);
-  hprt0.b.prtrst = 1;
+  hprt0.b.prtrst = state;
   USB_OTG_WRITE_REG32(pdev->regs.HPRT0, hprt0.d32);
-  USB_OTG_BSP_mDelay (100);                                /* See Note #1 */
-  hprt0.b.prtrst = 0;
-  USB_OTG_WRITE_REG32(pdev->regs.HPRT0, hprt0.d32);
-  USB_OTG_BSP_mDelay (20);   
-  return 1;
 }
 
 
 /**
 * @brief  USB_OTG_HC_Init : Prepares a host channel for transferring packets
 * @param  pdev : Selected device
-* @param  hc_num : channel number
+* @param  hc_num : pipe, its host channel is pdev->host.ChNum[hc_num]
 * @retval USB_OTG_STS : status
 */
 USB_OTG_STS USB_OTG_HC_Init(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 {
   USB_OTG_STS status = USB_OTG_OK;
+  uint8_t ch = pdev->host.ChNum[hc_num];
   uint32_t intr_enable = 0;
   USB_OTG_HCINTMSK_TypeDef  hcintmsk;
   USB_OTG_GINTMSK_TypeDef    gintmsk;
   USB_OTG_HCCHAR_TypeDef     hcchar;
   USB_OTG_HCINTn_TypeDef     hcint;
   
+  if (ch == USB_OTG_HC_NONE)
+  {
+    /* bound later, by HCD_SubmitRequest */
+    return USB_OTG_FAIL;
+  }
   
   gintmsk.d32 = 0;
   hcintmsk.d32 = 0;
@@ -902,7 +1095,7 @@ USB_OTG_STS USB_OTG_HC_Init(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
   
   /* Clear old interrupt conditions for this host channel. */
   hcint.d32 = 0xFFFFFFFF;
-  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCINT, hcint.d32);
+  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCINT, hcint.d32);
   
   /* Enable channel interrupts required for this transfer. */
   hcintmsk.d32 = 0;
@@ -962,11 +1155,11 @@ USB_OTG_STS USB_OTG_HC_Init(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
   }
   
   
-  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCINTMSK, hcintmsk.d32);
+  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCINTMSK, hcintmsk.d32);
   
   
   /* Enable the top level host channel interrupt. */
-  intr_enable = (1 << hc_num);
+  intr_enable = (1 << ch);
   USB_OTG_MODIFY_REG32(&pdev->regs.HREGS->HAINTMSK, 0, intr_enable);
   
   /* Make sure host channel interrupts are enabled. */
@@ -985,7 +1178,7 @@ USB_OTG_STS USB_OTG_HC_Init(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
   {
     hcchar.b.oddfrm  = 1;
   }
-  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR, hcchar.d32);
+  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32);
   return status;
 }
 
@@ -993,12 +1186,13 @@ USB_OTG_STS USB_OTG_HC_Init(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 /**
 * @brief  USB_OTG_HC_StartXfer : Start transfer
 * @param  pdev : Selected device
-* @param  hc_num : channel number
+* @param  hc_num : pipe, its host channel is pdev->host.ChNum[hc_num]
 * @retval USB_OTG_STS : status
 */
 USB_OTG_STS USB_OTG_HC_StartXfer(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 {
   USB_OTG_STS status = USB_OTG_OK;
+  uint8_t ch = pdev->host.ChNum[hc_num];
   USB_OTG_HCCHAR_TypeDef   hcchar;
   USB_OTG_HCTSIZn_TypeDef  hctsiz;
   USB_OTG_HNPTXSTS_TypeDef hnptxsts; 
@@ -1009,6 +1203,11 @@ USB_OTG_STS USB_OTG_HC_StartXfer(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
   uint16_t num_packets;
   uint16_t max_hc_pkt_count;
   
+  if (ch == USB_OTG_HC_NONE)
+  {
+    return USB_OTG_FAIL;
+  }
+  
   max_hc_pkt_count = 256;
   hctsiz.d32 = 0;
   hcchar.d32 = 0;
@@ -1040,21 +1239,21 @@ USB_OTG_STS USB_OTG_HC_StartXfer(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
   hctsiz.b.xfersize = pdev->host.hc[hc_num].xfer_len;
   hctsiz.b.pktcnt = num_packets;
   hctsiz.b.pid = pdev->host.hc[hc_num].data_pid;
-  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCTSIZ, hctsiz.d32);
+  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCTSIZ, hctsiz.d32);
   
   if (pdev->cfg.dma_enable == 1)
   {
-    USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCDMA, (unsigned int)pdev->host.hc[hc_num].xfer_buff);
+    USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCDMA, (unsigned int)pdev->host.hc[hc_num].xfer_buff);
   }
   
   
-  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR);
+  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR);
   hcchar.b.oddfrm = USB_OTG_IsEvenFrame(pdev);
   
   /* Set host channel enable */
   hcchar.b.chen = 1;
   hcchar.b.chdis = 0;
-  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR, hcchar.d32);
+  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32);
   
   if (pdev->cfg.dma_enable == 0) /* Slave mode */
   {  
@@ -1100,7 +1299,7 @@ USB_OTG_STS USB_OTG_HC_StartXfer(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
       /* Write packet into the Tx FIFO. */
       USB_OTG_WritePacket(pdev, 
                           pdev->host.hc[hc_num].xfer_buff , 
-                          hc_num, pdev->host.hc[hc_num].xfer_len);
+                          ch, pdev->host.hc[hc_num].xfer_len);
     }
   }
   return status;
@@ -1110,19 +1309,28 @@ USB_OTG_STS USB_OTG_HC_StartXfer(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 /**
 * @brief  USB_OTG_HC_Halt : Halt channel
 * @param  pdev : Selected device
-* @param  hc_num : channel number
+* @param  hc_num : pipe, its host channel is pdev->host.ChNum[hc_num]
 * @retval USB_OTG_STS : status
 */
 USB_OTG_STS USB_OTG_HC_Halt(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 {
   USB_OTG_STS status = USB_OTG_OK;
+  uint8_t ch = pdev->host.ChNum[hc_num];
   USB_OTG_HNPTXSTS_TypeDef            nptxsts;
   USB_OTG_HPTXSTS_TypeDef             hptxsts;
   USB_OTG_HCCHAR_TypeDef              hcchar;
   
+  if (ch == USB_OTG_HC_NONE)
+  {
+    /* nothing in flight without a channel */
+    return status;
+  }
+  
   nptxsts.d32 = 0;
   hptxsts.d32 = 0;
-  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR);
+  /* no NAK retry of what is halted */
+  pdev->host.Nak[hc_num].state = NAK_IDLE;
+  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR);
   
   hcchar.b.chdis = 1;
   
@@ -1133,7 +1341,7 @@ USB_OTG_STS USB_OTG_HC_Halt(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
     if (nptxsts.b.nptxqspcavail == 0)
     {
       hcchar.b.chen = 0;
-      USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR, hcchar.d32);
+      USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32);
     }
   }
   else
@@ -1142,11 +1350,11 @@ USB_OTG_STS USB_OTG_HC_Halt(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
     if (hptxsts.b.ptxqspcavail == 0)
     {
       hcchar.b.chen = 0;
-      USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR, hcchar.d32);
+      USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32);
     }
   }
   hcchar.b.chen = 1;
-  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR, hcchar.d32);
+  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32);
   return status;
 }
 
@@ -1158,18 +1366,24 @@ USB_OTG_STS USB_OTG_HC_Halt(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 USB_OTG_STS USB_OTG_HC_DoPing(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 {
   USB_OTG_STS               status = USB_OTG_OK;
+  uint8_t ch = pdev->host.ChNum[hc_num];
   USB_OTG_HCCHAR_TypeDef    hcchar;
   USB_OTG_HCTSIZn_TypeDef   hctsiz;  
   
+  if (ch == USB_OTG_HC_NONE)
+  {
+    return USB_OTG_FAIL;
+  }
+  
   hctsiz.d32 = 0;
   hctsiz.b.dopng = 1;
   hctsiz.b.pktcnt = 1;
-  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCTSIZ, hctsiz.d32);
+  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCTSIZ, hctsiz.d32);
   
-  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR);
+  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR);
   hcchar.b.chen = 1;
   hcchar.b.chdis = 0;
-  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[hc_num]->HCCHAR, hcchar.d32);
+  USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32);
   return status;  
 }
 
@@ -1400,6 +1614,70 @@ USB_OTG_STS USB_OTG_CoreInitDev (USB_OTG_CORE_HANDLE *pdev)
 }
 
 
+/**
+* @brief  USB_OTG_GetTxFifoSpace : Words of FIFO RAM left for Tx FIFO 1 and
+*         up, behind the Rx and EP0 Tx FIFOs set by USB_OTG_CoreInitDev
+* @param  pdev : Selected device
+* @retval space in 32-bit words
+*/
+uint32_t USB_OTG_GetTxFifoSpace(USB_OTG_CORE_HANDLE *pdev)
+{
+  USB_OTG_FSIZ_TypeDef  nptxfifosize;
+  uint32_t end;
+  
+  nptxfifosize.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->DIEPTXF0_HNPTXFSIZ);
+  end = pdev->cfg.TotalFifoSize;
+  if (pdev->cfg.dma_enable == 1)
+  {
+    /* the internal DMA keeps its registers at the top of the RAM */
+    end -= USB_OTG_DMA_FIFO_RESERVED;
+  }
+  if (nptxfifosize.b.startaddr + nptxfifosize.b.depth >= end)
+  {
+    return 0;
+  }
+  return end - (nptxfifosize.b.startaddr + nptxfifosize.b.depth);
+}
+
+/**
+* @brief  USB_OTG_SetTxFifos : Repartitions Tx FIFO 1 and up. Only to be
+*         called while no IN endpoint but EP0 is enabled.
+* @param  pdev : Selected device
+* @param  depth : depth in 32-bit words of each Tx FIFO, [0] is ignored and
+*         a FIFO in use takes at least 16 words
+* @retval USB_OTG_STS : status, on USB_OTG_FAIL the layout is left as it was
+*/
+USB_OTG_STS USB_OTG_SetTxFifos(USB_OTG_CORE_HANDLE *pdev, const uint16_t *depth)
+{
+  USB_OTG_FSIZ_TypeDef  txfifosize;
+  uint32_t i, total = 0;
+  
+  for (i = 1; i < pdev->cfg.dev_endpoints; i++)
+  {
+    if ((depth[i] != 0) && (depth[i] < 16))
+    {
+      return USB_OTG_FAIL;
+    }
+    total += depth[i];
+  }
+  if (total > USB_OTG_GetTxFifoSpace(pdev))
+  {
+    return USB_OTG_FAIL;
+  }
+  
+  txfifosize.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->DIEPTXF0_HNPTXFSIZ);
+  txfifosize.b.startaddr += txfifosize.b.depth;
+  for (i = 1; i < pdev->cfg.dev_endpoints; i++)
+  {
+    txfifosize.b.depth = depth[i];
+    USB_OTG_WRITE_REG32( &pdev->regs.GREGS->DIEPTXF[i - 1], txfifosize.d32 );
+    txfifosize.b.startaddr += depth[i];
+  }
+  USB_OTG_FlushTxFifo(pdev , 0x10); /* all Tx FIFOs */
+  return USB_OTG_OK;
+}
+
+
 /**
 * @brief  USB_OTG_EnableDevInt : Enables the Device mode interrupts
 * @param  pdev : Selected device
@@ -1649,7 +1927,12 @@ USB_OTG_STS USB_OTG_EPStartXfer(USB_OTG_CORE_HANDLE *pdev , USB_OTG_EP *ep)
       if (ep->type == EP_TYPE_ISOC)
       {
         deptsiz.b.mc = 1;
-      }       
+      }
+      else if ((ep->type == EP_TYPE_INTR) && (ep->mc > 1))
+      {
+        /* high-bandwidth interrupt: up to mc packets per microframe */
+        deptsiz.b.mc = (deptsiz.b.pktcnt < ep->mc) ? deptsiz.b.pktcnt : ep->mc;
+      }
     }
     USB_OTG_WRITE_REG32(&pdev->regs.INEP_REGS[ep->num]->DIEPTSIZ, deptsiz.d32);
     
@@ -180,7 +180,9 @@ uint32_t DCD_EP_Open(USB_OTG_CORE_HANDLE *pdev ,
   ep->num   = ep_addr & 0x7F;
   
   ep->is_in = (0x80 & ep_addr) != 0;
-  ep->maxpacket = ep_mps;
+  /* ep_mps is wMaxPacketSize: bits 12:11 are the HS additional transactions */
+  ep->maxpacket = ep_mps & 0x7FF;
+  ep->mc = ((ep_mps >> 11) & 0x3) + 1;
   ep->type = ep_type;
   if (ep->is_in)
   {
@@ -216,9 +218,41 @@ uint32_t DCD_EP_Close(USB_OTG_CORE_HANDLE *pdev , uint8_t  ep_addr)
   ep->num   = ep_addr & 0x7F;
   ep->is_in = (0x80 & ep_addr) != 0;
   USB_OTG_EPDeactivate(pdev , ep );
+  DCD_EP_SetHandler(pdev, ep_addr, NULL);
   return 0;
 }
 
+/**
+* @brief  DCD_EP_SetHandler
+*         Registers the transfer complete handler of a non-control endpoint.
+*         The ISR calls it directly instead of going through
+*         USBD_DataInStage/USBD_DataOutStage and the class callbacks; it is
+*         dropped when the endpoint is closed and on bus reset.
+* @param pdev: device instance
+* @param ep_addr: endpoint address
+* @param handler: class DataIn/DataOut style handler, NULL to unregister
+* @retval : None
+*/
+void DCD_EP_SetHandler(USB_OTG_CORE_HANDLE *pdev,
+                       uint8_t  ep_addr,
+                       uint8_t  (*handler)(void *pdev , uint8_t epnum))
+{
+  uint8_t epnum = ep_addr & 0x7F;
+  
+  if ((epnum == 0) || (epnum >= USB_OTG_MAX_TX_FIFOS))
+  {
+    return;
+  }
+  if ((ep_addr&0x80) == 0x80)
+  {
+    pdev->dev.in_ep_handler[epnum] = handler;
+  }
+  else
+  {
+    pdev->dev.out_ep_handler[epnum] = handler;
+  }
+}
+
 
 /**
 * @brief  DCD_EP_PrepareRx
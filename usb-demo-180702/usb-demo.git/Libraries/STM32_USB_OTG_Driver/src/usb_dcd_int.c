@@ -40,6 +40,20 @@
 /** @defgroup USB_DCD_INT_Private_Defines
 * @{
 */ 
+/* GINTSTS bit numbers, for the dispatch table */
+#define DCD_INT_MODEMISMATCH    1
+#define DCD_INT_OTG             2
+#define DCD_INT_SOF             3
+#define DCD_INT_RXSTSQLVL       4
+#define DCD_INT_USBSUSPEND      11
+#define DCD_INT_USBRESET        12
+#define DCD_INT_ENUMDONE        13
+#define DCD_INT_INEP            18
+#define DCD_INT_OUTEP           19
+#define DCD_INT_INCOMPLISOIN    20
+#define DCD_INT_INCOMPLISOOUT   21
+#define DCD_INT_SESSREQ         30
+#define DCD_INT_WKUP            31
 /**
 * @}
 */ 
@@ -74,7 +88,6 @@
 * @{
 */ 
 /* static functions */
-static uint32_t DCD_ReadDevInEP (USB_OTG_CORE_HANDLE *pdev, uint8_t epnum);
 
 /* Interrupt Handlers */
 static uint32_t DCD_HandleInEP_ISR(USB_OTG_CORE_HANDLE *pdev);
@@ -91,11 +104,62 @@ static uint32_t DCD_HandleUSBSuspend_ISR(USB_OTG_CORE_HANDLE *pdev);
 
 static uint32_t DCD_IsoINIncomplete_ISR(USB_OTG_CORE_HANDLE *pdev);
 static uint32_t DCD_IsoOUTIncomplete_ISR(USB_OTG_CORE_HANDLE *pdev);
+static uint32_t DCD_ModeMismatch_ISR(USB_OTG_CORE_HANDLE *pdev);
 #ifdef VBUS_SENSING_ENABLED
 static uint32_t DCD_SessionRequest_ISR(USB_OTG_CORE_HANDLE *pdev);
 static uint32_t DCD_OTG_ISR(USB_OTG_CORE_HANDLE *pdev);
 #endif
 
+/* GINTSTS bit -> handler, NULL for sources the device side does not use */
+static uint32_t (* const DCD_IntHandler[32])(USB_OTG_CORE_HANDLE *pdev) =
+{
+  NULL,                                 /*  0 curmode */
+  DCD_ModeMismatch_ISR,                 /*  1 */
+#ifdef VBUS_SENSING_ENABLED
+  DCD_OTG_ISR,                          /*  2 */
+#else
+  NULL,
+#endif
+  DCD_HandleSof_ISR,                    /*  3 */
+  DCD_HandleRxStatusQueueLevel_ISR,     /*  4 */
+  NULL, NULL, NULL, NULL, NULL, NULL,   /*  5..10 */
+  DCD_HandleUSBSuspend_ISR,             /* 11 */
+  DCD_HandleUsbReset_ISR,               /* 12 */
+  DCD_HandleEnumDone_ISR,               /* 13 */
+  NULL, NULL, NULL, NULL,               /* 14..17 */
+  DCD_HandleInEP_ISR,                   /* 18 */
+  DCD_HandleOutEP_ISR,                  /* 19 */
+  DCD_IsoINIncomplete_ISR,              /* 20 */
+  DCD_IsoOUTIncomplete_ISR,             /* 21 */
+  NULL, NULL, NULL, NULL, NULL, NULL,   /* 22..27 */
+  NULL, NULL,                           /* 28..29 */
+#ifdef VBUS_SENSING_ENABLED
+  DCD_SessionRequest_ISR,               /* 30 */
+#else
+  NULL,
+#endif
+  DCD_HandleResume_ISR,                 /* 31 */
+};
+
+/* The order the sources are served in within one interrupt: endpoint
+   traffic first, bus events after it, as the driver always did */
+static const uint8_t DCD_IntOrder[] =
+{
+  DCD_INT_OUTEP,
+  DCD_INT_INEP,
+  DCD_INT_MODEMISMATCH,
+  DCD_INT_WKUP,
+  DCD_INT_USBSUSPEND,
+  DCD_INT_SOF,
+  DCD_INT_RXSTSQLVL,
+  DCD_INT_USBRESET,
+  DCD_INT_ENUMDONE,
+  DCD_INT_INCOMPLISOIN,
+  DCD_INT_INCOMPLISOOUT,
+  DCD_INT_SESSREQ,
+  DCD_INT_OTG,
+};
+
 /**
 * @}
 */ 
@@ -135,8 +199,15 @@ uint32_t USBD_OTG_EP1OUT_ISR_Handler (USB_OTG_CORE_HANDLE *pdev)
     }    
     /* Inform upper layer: data ready */
     /* RX COMPLETE */
-    USBD_DCD_INT_fops->DataOutStage(pdev , 1);
-    
+    if ((pdev->dev.out_ep_handler[1] != NULL) &&
+        (pdev->dev.device_status == USB_OTG_CONFIGURED))
+    {
+      pdev->dev.out_ep_handler[1](pdev , 1);
+    }
+    else
+    {
+      USBD_DCD_INT_fops->DataOutStage(pdev , 1);
+    }
   }
   
   /* Endpoint disable  */
@@ -172,7 +243,15 @@ uint32_t USBD_OTG_EP1IN_ISR_Handler (USB_OTG_CORE_HANDLE *pdev)
     USB_OTG_MODIFY_REG32(&pdev->regs.DREGS->DIEPEMPMSK, fifoemptymsk, 0);
     CLEAR_IN_EP_INTR(1, xfercompl);
     /* TX COMPLETE */
-    USBD_DCD_INT_fops->DataInStage(pdev , 1);
+    if ((pdev->dev.in_ep_handler[1] != NULL) &&
+        (pdev->dev.device_status == USB_OTG_CONFIGURED))
+    {
+      pdev->dev.in_ep_handler[1](pdev , 1);
+    }
+    else
+    {
+      USBD_DCD_INT_fops->DataInStage(pdev , 1);
+    }
   }
   if ( diepint.b.epdisabled )
   {
@@ -208,6 +287,7 @@ uint32_t USBD_OTG_ISR_Handler (USB_OTG_CORE_HANDLE *pdev)
 {
   USB_OTG_GINTSTS_TypeDef  gintr_status;
   uint32_t retval = 0;
+  uint32_t pending, bit, i;
   
   if (USB_OTG_IsDeviceMode(pdev)) /* ensure that we are in device mode */
   {
@@ -216,82 +296,42 @@ uint32_t USBD_OTG_ISR_Handler (USB_OTG_CORE_HANDLE *pdev)
     {
       return 0;
     }
+    pending = gintr_status.d32;
     
-    if (gintr_status.b.outepintr)
-    {
-      retval |= DCD_HandleOutEP_ISR(pdev);
-    }    
-    
-    if (gintr_status.b.inepint)
-    {
-      retval |= DCD_HandleInEP_ISR(pdev);
-    }
-    
-    if (gintr_status.b.modemismatch)
-    {
-      USB_OTG_GINTSTS_TypeDef  gintsts;
-      
-      /* Clear interrupt */
-      gintsts.d32 = 0;
-      gintsts.b.modemismatch = 1;
-      USB_OTG_WRITE_REG32(&pdev->regs.GREGS->GINTSTS, gintsts.d32);
-    }
-    
-    if (gintr_status.b.wkupintr)
-    {
-      retval |= DCD_HandleResume_ISR(pdev);
-    }
-    
-    if (gintr_status.b.usbsuspend)
-    {
-      retval |= DCD_HandleUSBSuspend_ISR(pdev);
-    }
-    if (gintr_status.b.sofintr)
-    {
-      retval |= DCD_HandleSof_ISR(pdev);
-      
-    }
-    
-    if (gintr_status.b.rxstsqlvl)
-    {
-      retval |= DCD_HandleRxStatusQueueLevel_ISR(pdev);
-      
-    }
-    
-    if (gintr_status.b.usbreset)
-    {
-      retval |= DCD_HandleUsbReset_ISR(pdev);
-      
-    }
-    if (gintr_status.b.enumdone)
-    {
-      retval |= DCD_HandleEnumDone_ISR(pdev);
-    }
-    
-    if (gintr_status.b.incomplisoin)
-    {
-      retval |= DCD_IsoINIncomplete_ISR(pdev);
-    }
-
-    if (gintr_status.b.incomplisoout)
+    /* Fixed priority order; stop as soon as nothing is left */
+    for (i = 0; pending && (i < sizeof(DCD_IntOrder)); i++)
     {
-      retval |= DCD_IsoOUTIncomplete_ISR(pdev);
-    }    
-#ifdef VBUS_SENSING_ENABLED
-    if (gintr_status.b.sessreqintr)
-    {
-      retval |= DCD_SessionRequest_ISR(pdev);
+      bit = DCD_IntOrder[i];
+      if (pending & (1UL << bit))
+      {
+        pending &= ~(1UL << bit);
+        if (DCD_IntHandler[bit] != NULL)
+        {
+          retval |= DCD_IntHandler[bit](pdev);
+        }
+      }
     }
-
-    if (gintr_status.b.otgintr)
-    {
-      retval |= DCD_OTG_ISR(pdev);
-    }   
-#endif    
   }
   return retval;
 }
 
+/**
+* @brief  DCD_ModeMismatch_ISR
+*         Clears the mode mismatch interrupt
+* @param  pdev: device instance
+* @retval status
+*/
+static uint32_t DCD_ModeMismatch_ISR(USB_OTG_CORE_HANDLE *pdev)
+{
+  USB_OTG_GINTSTS_TypeDef  gintsts;
+  
+  /* Clear interrupt */
+  gintsts.d32 = 0;
+  gintsts.b.modemismatch = 1;
+  USB_OTG_WRITE_REG32(&pdev->regs.GREGS->GINTSTS, gintsts.d32);
+  return 0;
+}
+
 #ifdef VBUS_SENSING_ENABLED
 /**
 * @brief  DCD_SessionRequest_ISR
@@ -423,56 +463,68 @@ static uint32_t DCD_HandleInEP_ISR(USB_OTG_CORE_HANDLE *pdev)
   USB_OTG_DIEPINTn_TypeDef  diepint;
   
   uint32_t ep_intr;
-  uint32_t epnum = 0;
+  uint32_t epnum;
   uint32_t fifoemptymsk;
+  uint32_t msk, emp;
   diepint.d32 = 0;
   ep_intr = USB_OTG_ReadDevAllInEPItr(pdev);
+  msk = USB_OTG_READ_REG32(&pdev->regs.DREGS->DIEPMSK);
+  emp = USB_OTG_READ_REG32(&pdev->regs.DREGS->DIEPEMPMSK);
   
   while ( ep_intr )
   {
-    if ((ep_intr & 0x1) == 0x01) /* In ITR */
+    /* Straight to the lowest pending endpoint: EP0 first, as before */
+    epnum = 31 - __CLZ(ep_intr & (~ep_intr + 1));
+    ep_intr &= ~(1UL << epnum);
+    
+    /* Get In ITR status */
+    diepint.d32 = USB_OTG_READ_REG32(&pdev->regs.INEP_REGS[epnum]->DIEPINT) &
+                  (msk | (((emp >> epnum) & 0x1) << 7));
+    if ( diepint.b.xfercompl )
     {
-      diepint.d32 = DCD_ReadDevInEP(pdev , epnum); /* Get In ITR status */
-      if ( diepint.b.xfercompl )
-      {
-        fifoemptymsk = 0x1 << epnum;
-        USB_OTG_MODIFY_REG32(&pdev->regs.DREGS->DIEPEMPMSK, fifoemptymsk, 0);
-        CLEAR_IN_EP_INTR(epnum, xfercompl);
-        /* TX COMPLETE */
-        USBD_DCD_INT_fops->DataInStage(pdev , epnum);
-        
-        if (pdev->cfg.dma_enable == 1)
-        {
-          if((epnum == 0) && (pdev->dev.device_state == USB_OTG_EP0_STATUS_IN))
-          {
-            /* prepare to rx more setup packets */
-            USB_OTG_EP0_OutStart(pdev);
-          }
-        }           
-      }
-      if ( diepint.b.timeout )
-      {
-        CLEAR_IN_EP_INTR(epnum, timeout);
-      }
-      if (diepint.b.intktxfemp)
+      fifoemptymsk = 0x1 << epnum;
+      USB_OTG_MODIFY_REG32(&pdev->regs.DREGS->DIEPEMPMSK, fifoemptymsk, 0);
+      CLEAR_IN_EP_INTR(epnum, xfercompl);
+      /* TX COMPLETE */
+      if ((pdev->dev.in_ep_handler[epnum] != NULL) &&
+          (pdev->dev.device_status == USB_OTG_CONFIGURED))
       {
-        CLEAR_IN_EP_INTR(epnum, intktxfemp);
+        pdev->dev.in_ep_handler[epnum](pdev , epnum);
       }
-      if (diepint.b.inepnakeff)
+      else
       {
-        CLEAR_IN_EP_INTR(epnum, inepnakeff);
+        USBD_DCD_INT_fops->DataInStage(pdev , epnum);
       }
-      if ( diepint.b.epdisabled )
-      {
-        CLEAR_IN_EP_INTR(epnum, epdisabled);
-      }       
-      if (diepint.b.emptyintr)
+      
+      if (pdev->cfg.dma_enable == 1)
       {
-        DCD_WriteEmptyTxFifo(pdev , epnum);
-      }
+        if((epnum == 0) && (pdev->dev.device_state == USB_OTG_EP0_STATUS_IN))
+        {
+          /* prepare to rx more setup packets */
+          USB_OTG_EP0_OutStart(pdev);
+        }
+      }           
+    }
+    if ( diepint.b.timeout )
+    {
+      CLEAR_IN_EP_INTR(epnum, timeout);
+    }
+    if (diepint.b.intktxfemp)
+    {
+      CLEAR_IN_EP_INTR(epnum, intktxfemp);
+    }
+    if (diepint.b.inepnakeff)
+    {
+      CLEAR_IN_EP_INTR(epnum, inepnakeff);
+    }
+    if ( diepint.b.epdisabled )
+    {
+      CLEAR_IN_EP_INTR(epnum, epdisabled);
+    }       
+    if (diepint.b.emptyintr)
+    {
+      DCD_WriteEmptyTxFifo(pdev , epnum);
     }
-    epnum++;
-    ep_intr >>= 1;
   }
   
   return 1;
@@ -489,7 +541,7 @@ static uint32_t DCD_HandleOutEP_ISR(USB_OTG_CORE_HANDLE *pdev)
   uint32_t ep_intr;
   USB_OTG_DOEPINTn_TypeDef  doepint;
   USB_OTG_DEPXFRSIZ_TypeDef  deptsiz;
-  uint32_t epnum = 0;
+  uint32_t epnum;
   
   doepint.d32 = 0;
   
@@ -498,7 +550,9 @@ static uint32_t DCD_HandleOutEP_ISR(USB_OTG_CORE_HANDLE *pdev)
   
   while ( ep_intr )
   {
-    if (ep_intr&0x1)
+    /* Straight to the lowest pending endpoint: EP0 first, as before */
+    epnum = 31 - __CLZ(ep_intr & (~ep_intr + 1));
+    ep_intr &= ~(1UL << epnum);
     {
       
       doepint.d32 = USB_OTG_ReadDevOutEP_itr(pdev, epnum);
@@ -511,13 +565,24 @@ static uint32_t DCD_HandleOutEP_ISR(USB_OTG_CORE_HANDLE *pdev)
         if (pdev->cfg.dma_enable == 1)
         {
           deptsiz.d32 = USB_OTG_READ_REG32(&(pdev->regs.OUTEP_REGS[epnum]->DOEPTSIZ));
-          /*ToDo : handle more than one single MPS size packet */
-          pdev->dev.out_ep[epnum].xfer_count = pdev->dev.out_ep[epnum].maxpacket - \
+          /* The start programmed xfer_len rounded up to whole packets, or
+             one packet for a zero length transfer */
+          pdev->dev.out_ep[epnum].xfer_count =
+            ((pdev->dev.out_ep[epnum].xfer_len != 0) ?
+             pdev->dev.out_ep[epnum].xfer_len : pdev->dev.out_ep[epnum].maxpacket) -
             deptsiz.b.xfersize;
         }
         /* Inform upper layer: data ready */
         /* RX COMPLETE */
-        USBD_DCD_INT_fops->DataOutStage(pdev , epnum);
+        if ((pdev->dev.out_ep_handler[epnum] != NULL) &&
+            (pdev->dev.device_status == USB_OTG_CONFIGURED))
+        {
+          pdev->dev.out_ep_handler[epnum](pdev , epnum);
+        }
+        else
+        {
+          USBD_DCD_INT_fops->DataOutStage(pdev , epnum);
+        }
         
         if (pdev->cfg.dma_enable == 1)
         {
@@ -544,8 +609,6 @@ static uint32_t DCD_HandleOutEP_ISR(USB_OTG_CORE_HANDLE *pdev)
         CLEAR_OUT_EP_INTR(epnum, setup);
       }
     }
-    epnum++;
-    ep_intr >>= 1;
   }
   return 1;
 }
@@ -717,6 +780,9 @@ static uint32_t DCD_HandleUsbReset_ISR(USB_OTG_CORE_HANDLE *pdev)
   {
     USB_OTG_WRITE_REG32( &pdev->regs.INEP_REGS[i]->DIEPINT, 0xFF);
     USB_OTG_WRITE_REG32( &pdev->regs.OUTEP_REGS[i]->DOEPINT, 0xFF);
+    /* the configuration is gone, so are the class endpoint handlers */
+    pdev->dev.in_ep_handler[i] = NULL;
+    pdev->dev.out_ep_handler[i] = NULL;
   }
   USB_OTG_WRITE_REG32( &pdev->regs.DREGS->DAINT, 0xFFFFFFFF );
   
@@ -912,21 +978,6 @@ static uint32_t DCD_IsoOUTIncomplete_ISR(USB_OTG_CORE_HANDLE *pdev)
   USB_OTG_WRITE_REG32(&pdev->regs.GREGS->GINTSTS, gintsts.d32);
   return 1;
 }
-/**
-* @brief  DCD_ReadDevInEP
-*         Reads ep flags
-* @param  pdev: device instance
-* @retval status
-*/
-static uint32_t DCD_ReadDevInEP (USB_OTG_CORE_HANDLE *pdev, uint8_t epnum)
-{
-  uint32_t v, msk, emp;
-  msk = USB_OTG_READ_REG32(&pdev->regs.DREGS->DIEPMSK);
-  emp = USB_OTG_READ_REG32(&pdev->regs.DREGS->DIEPEMPMSK);
-  msk |= ((emp >> epnum) & 0x1) << 7;
-  v = USB_OTG_READ_REG32(&pdev->regs.INEP_REGS[epnum]->DIEPINT) & msk;
-  return v;
-}
 
 /**
 * @}
@@ -78,6 +78,10 @@
 /** @defgroup USB_HCD_Private_FunctionPrototypes
   * @{
   */ 
+static uint8_t  HCD_BindChannel   (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
+static uint8_t  HCD_ChannelIdle   (USB_OTG_CORE_HANDLE *pdev, uint8_t ch);
+static uint32_t HCD_WaitPriority  (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
+static void     HCD_ResetState    (USB_OTG_CORE_HANDLE *pdev);
 /**
   * @}
   */ 
@@ -97,16 +101,7 @@
 uint32_t HCD_Init(USB_OTG_CORE_HANDLE *pdev , 
                   USB_OTG_CORE_ID_TypeDef coreID)
 {
-  uint8_t i = 0;
-  pdev->host.ConnSts = 0;
-  
-  for (i= 0; i< USB_OTG_MAX_TX_FIFOS; i++)
-  {
-  pdev->host.ErrCnt[i]  = 0;
-  pdev->host.XferCnt[i]   = 0;
-  pdev->host.HC_Status[i]   = HC_IDLE;
-  }
-  pdev->host.hc[0].max_packet  = 8; 
+  HCD_ResetState(pdev);
 
   USB_OTG_SelectCore(pdev, coreID);
 #ifndef DUAL_ROLE_MODE_ENABLED
@@ -122,6 +117,78 @@ uint32_t HCD_Init(USB_OTG_CORE_HANDLE *pdev ,
   return 0;
 }
 
+/**
+  * @brief  HCD_ReInit 
+  *         Initialize the HOST portion of the driver again after a
+  *         disconnect, like HCD_Init but without any wait: the port power
+  *         stays off and the caller lets the PHY and the forced host mode
+  *         settle (at least 70 ms) before HCD_DriveVbus turns it on
+  * @param  pdev: Selected device
+  * @param  coreID: USB OTG core ID
+  * @retval Status
+  */
+uint32_t HCD_ReInit(USB_OTG_CORE_HANDLE *pdev , 
+                    USB_OTG_CORE_ID_TypeDef coreID)
+{
+  HCD_ResetState(pdev);
+
+  USB_OTG_SelectCore(pdev, coreID);
+#ifndef DUAL_ROLE_MODE_ENABLED
+  USB_OTG_DisableGlobalInt(pdev);
+  USB_OTG_CoreSetup(pdev);
+  USB_OTG_ForceMode(pdev , HOST_MODE);
+  USB_OTG_CoreSetupHost(pdev);
+  USB_OTG_EnableGlobalInt(pdev);
+#endif
+   
+  return 0;
+}
+
+/**
+  * @brief  HCD_DriveVbus
+  *         Switch VBUS on (state 1) or off (state 0), the caller waits for
+  *         it to settle. In OTG mode VBUS is left to the OTG logic.
+  * @param  pdev : Selected device
+  * @param  state : VBUS state
+  * @retval Status
+  */
+uint32_t HCD_DriveVbus(USB_OTG_CORE_HANDLE *pdev, uint8_t state)
+{
+#ifndef USE_OTG_MODE
+  USB_OTG_SetVbus(pdev, state);
+#endif
+  return 0;
+}
+
+/**
+  * @brief  HCD_ResetState 
+  *         Forget the connection and every channel
+  * @param  pdev: Selected device
+  * @retval None
+  */
+static void HCD_ResetState(USB_OTG_CORE_HANDLE *pdev)
+{
+  uint8_t i = 0;
+  pdev->host.ConnSts = 0;
+  
+  for (i= 0; i< USB_OTG_MAX_TX_FIFOS; i++)
+  {
+  pdev->host.ErrCnt[i]  = 0;
+  pdev->host.XferCnt[i]   = 0;
+  pdev->host.HC_Status[i]   = HC_IDLE;
+  pdev->host.ChNum[i]  = USB_OTG_HC_NONE;
+  pdev->host.ChPipe[i]  = USB_OTG_HC_NONE;
+  pdev->host.Pending[i]  = 0;
+  pdev->host.Ring[i]  = 0;
+  pdev->host.hc_handler[i]  = 0;
+  pdev->host.Nak[i].policy  = HC_NAK_IMMEDIATE;
+  pdev->host.Nak[i].state  = NAK_IDLE;
+  pdev->host.Nak[i].Naks  = 0;
+  pdev->host.Nak[i].Retries  = 0;
+  }
+  pdev->host.hc[0].max_packet  = 8; 
+}
+
 
 /**
   * @brief  HCD_GetCurrentSpeed
@@ -157,6 +224,20 @@ uint32_t HCD_ResetPort(USB_OTG_CORE_HANDLE *pdev)
   return 0;
 }
 
+/**
+  * @brief  HCD_DrivePortReset
+  *         Start (state 1) or end (state 0) the reset of the device, the
+  *         caller keeps it at least 10 ms and lets the device recover after
+  * @param  pdev : Selected device
+  * @param  state : reset state
+  * @retval Status
+  */
+uint32_t HCD_DrivePortReset(USB_OTG_CORE_HANDLE *pdev, uint8_t state)
+{
+  USB_OTG_DrivePortReset(pdev, state);
+  return 0;
+}
+
 /**
   * @brief  HCD_IsDeviceConnected
   *         Check if the device is connected.
@@ -234,21 +315,53 @@ HC_STATUS HCD_GetHCState (USB_OTG_CORE_HANDLE *pdev ,  uint8_t ch_num)
 
 /**
   * @brief  HCD_HC_Init 
-  *         This function prepare a HC and start a transfer
+  *         This function programs a pipe on its host channel. A pipe
+  *         without a channel gets one when a transfer is submitted.
   * @param  pdev: Selected device
-  * @param  hc_num: Channel number 
+  * @param  hc_num: Pipe number 
   * @retval status 
   */
 uint32_t HCD_HC_Init (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num) 
 {
+  if (pdev->host.ChNum[hc_num] == USB_OTG_HC_NONE)
+  {
+    return USB_OTG_OK;
+  }
   return USB_OTG_HC_Init(pdev, hc_num);  
 }
 
+/**
+  * @brief  HCD_HC_Free 
+  *         This function gives the host channel of a halted pipe back
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @retval status 
+  */
+uint32_t HCD_HC_Free (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num) 
+{
+  uint8_t ch = pdev->host.ChNum[hc_num];
+  
+  pdev->host.Pending[hc_num] = 0;
+  HCD_StopRing(pdev, hc_num);
+  pdev->host.hc_handler[hc_num] = 0;
+  pdev->host.Nak[hc_num].policy = HC_NAK_IMMEDIATE;
+  pdev->host.Nak[hc_num].state = NAK_IDLE;
+  if (ch != USB_OTG_HC_NONE)
+  {
+    USB_OTG_MODIFY_REG32(&pdev->regs.HREGS->HAINTMSK, (1 << ch), 0);
+    pdev->host.ChPipe[ch] = USB_OTG_HC_NONE;
+    pdev->host.ChNum[hc_num] = USB_OTG_HC_NONE;
+  }
+  return USB_OTG_OK;
+}
+
 /**
   * @brief  HCD_SubmitRequest 
-  *         This function prepare a HC and start a transfer
+  *         This function prepare a HC and start a transfer. When every
+  *         host channel is busy the transfer waits, URB_IDLE, until
+  *         HCD_ProcessPending finds it one.
   * @param  pdev: Selected device
-  * @param  hc_num: Channel number 
+  * @param  hc_num: Pipe number 
   * @retval status
   */
 uint32_t HCD_SubmitRequest (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num) 
@@ -256,9 +369,309 @@ uint32_t HCD_SubmitRequest (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
   
   pdev->host.URB_State[hc_num] =   URB_IDLE;  
   pdev->host.hc[hc_num].xfer_count = 0 ;
+  pdev->host.XferCnt[hc_num] = 0;
+  pdev->host.Nak[hc_num].state = NAK_IDLE;
+  
+  if (HCD_BindChannel(pdev, hc_num) == USB_OTG_HC_NONE)
+  {
+    if (pdev->host.Pending[hc_num] == 0)
+    {
+      pdev->host.Pending[hc_num] = 1;
+      pdev->host.WaitFrame[hc_num] = HCD_GetCurrentFrame(pdev);
+      pdev->host.Deferrals++;
+    }
+    return USB_OTG_OK;
+  }
+  pdev->host.Pending[hc_num] = 0;
+  pdev->host.LastUse[hc_num] = ++pdev->host.XferSeq;
   return USB_OTG_HC_StartXfer(pdev, hc_num);
 }
 
+/**
+  * @brief  HCD_ProcessPending 
+  *         This function starts the transfers waiting for a host channel,
+  *         highest priority first. Call it from the host main loop.
+  * @param  pdev: Selected device
+  * @retval None
+  */
+void HCD_ProcessPending (USB_OTG_CORE_HANDLE *pdev) 
+{
+  uint8_t i, best;
+  
+  do
+  {
+    best = USB_OTG_HC_NONE;
+    for (i = 0; i < USB_OTG_MAX_TX_FIFOS; i++)
+    {
+      if ((pdev->host.Pending[i] != 0) && 
+          ((best == USB_OTG_HC_NONE) ||
+           (HCD_WaitPriority(pdev, i) > HCD_WaitPriority(pdev, best))))
+      {
+        best = i;
+      }
+    }
+    
+    if ((best == USB_OTG_HC_NONE) ||
+        (HCD_BindChannel(pdev, best) == USB_OTG_HC_NONE))
+    {
+      break;
+    }
+    pdev->host.Pending[best] = 0;
+    pdev->host.LastUse[best] = ++pdev->host.XferSeq;
+    USB_OTG_HC_StartXfer(pdev, best);
+  }
+  while (1);
+}
+
+/**
+  * @brief  HCD_HC_SetHandler 
+  *         Have the interrupt handler call handler at the end of each
+  *         transfer of a pipe, URB_State then telling how it ended, so that
+  *         the next one can start right away. The pipe keeps its host
+  *         channel until the handler is removed (handler 0) or HCD_HC_Free.
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @param  handler: called from the interrupt handler
+  * @retval None
+  */
+void HCD_HC_SetHandler (USB_OTG_CORE_HANDLE *pdev , 
+                        uint8_t hc_num,
+                        void (*handler)(void *pdev , uint8_t hc_num)) 
+{
+  pdev->host.hc_handler[hc_num] = handler;
+}
+
+/**
+  * @brief  HCD_HC_SetNakPolicy 
+  *         Choose when a bulk or control pipe is retried after a NAK. Out
+  *         of HC_NAK_IMMEDIATE the channel is halted and the SOF handler
+  *         starts the transaction again: IN goes on where it stopped, OUT
+  *         is handed back URB_NOTREADY or, HC_NAK_PING on a high speed
+  *         pipe, first PINGs the device. The pipe keeps its host channel
+  *         while it waits. DMA mode retries in the core, as before.
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @param  policy: HC_NAK_xxx
+  * @param  max_shift: HC_NAK_BACKOFF waits up to 2^max_shift frames
+  * @retval None
+  */
+void HCD_HC_SetNakPolicy (USB_OTG_CORE_HANDLE *pdev , 
+                          uint8_t hc_num,
+                          HC_NAK_POLICY policy,
+                          uint8_t max_shift) 
+{
+  pdev->host.Nak[hc_num].policy = policy;
+  pdev->host.Nak[hc_num].max_shift = (max_shift < 10) ? max_shift : 10;
+  pdev->host.Nak[hc_num].shift = 0;
+}
+
+/**
+  * @brief  HCD_StartRing 
+  *         Poll an interrupt IN pipe from the interrupt handler: a transfer
+  *         of length bytes every interval frames, each completion stored in
+  *         the next slot of ring. The pipe keeps its host channel until
+  *         HCD_StopRing. A stall or an error halts the polling, the
+  *         URB_State of the pipe telling which, until HCD_StartRing again.
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @param  ring: report ring, wr and rd left as they are
+  * @param  length: bytes per transfer, up to USB_OTG_HC_RING_SLOT
+  * @param  interval: frames between two polls
+  * @retval USB_OTG_FAIL when no host channel can be had now
+  */
+uint32_t HCD_StartRing (USB_OTG_CORE_HANDLE *pdev , 
+                        uint8_t hc_num,
+                        USB_OTG_HC_RING *ring,
+                        uint16_t length,
+                        uint16_t interval) 
+{
+  if ((length > USB_OTG_HC_RING_SLOT) ||
+      (HCD_BindChannel(pdev, hc_num) == USB_OTG_HC_NONE))
+  {
+    return USB_OTG_FAIL;
+  }
+  
+  ring->length = length;
+  ring->interval = (interval != 0) ? interval : 1;
+  /* the SOF of this frame is past, the next one starts what is due after it */
+  ring->due = (HCD_GetCurrentFrame(pdev) + 2) & 0x3FFF;
+  pdev->host.URB_State[hc_num] = URB_IDLE;
+  pdev->host.LastUse[hc_num] = ++pdev->host.XferSeq;
+  pdev->host.Ring[hc_num] = ring;
+  
+  /* the handler takes it from here, at the next SOF */
+  ring->state = RING_ARMED;
+  return USB_OTG_OK;
+}
+
+/**
+  * @brief  HCD_StopRing 
+  *         Stop the polling of HCD_StartRing, a transfer on the bus is left
+  *         to USB_OTG_HC_Halt
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @retval None
+  */
+void HCD_StopRing (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num) 
+{
+  USB_OTG_HC_RING *ring = pdev->host.Ring[hc_num];
+  
+  if (ring != 0)
+  {
+    ring->state = RING_OFF;
+    pdev->host.Ring[hc_num] = 0;
+  }
+}
+
+/**
+  * @brief  HCD_RingGet 
+  *         Oldest report of the ring of a pipe, left in place until
+  *         HCD_RingRelease
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @param  len: bytes of the report
+  * @retval report, 0 when the ring is empty
+  */
+uint8_t *HCD_RingGet (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num, uint16_t *len) 
+{
+  USB_OTG_HC_RING *ring = pdev->host.Ring[hc_num];
+  
+  if ((ring == 0) || (ring->rd == ring->wr))
+  {
+    return 0;
+  }
+  *len = ring->len[ring->rd & USB_OTG_HC_RING_MASK];
+  return ring->data[ring->rd & USB_OTG_HC_RING_MASK];
+}
+
+/**
+  * @brief  HCD_RingRelease 
+  *         Free the report of HCD_RingGet, the polling held on a full ring
+  *         resumes on the next frame
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @retval None
+  */
+void HCD_RingRelease (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num) 
+{
+  USB_OTG_HC_RING *ring = pdev->host.Ring[hc_num];
+  
+  if ((ring == 0) || (ring->rd == ring->wr))
+  {
+    return;
+  }
+  ring->rd++;
+  if (ring->state == RING_FULL)
+  {
+    ring->due = (HCD_GetCurrentFrame(pdev) + 2) & 0x3FFF;
+    ring->state = RING_ARMED;
+  }
+}
+
+/**
+  * @brief  HCD_WaitPriority 
+  *         Priority of a pipe, raised by one level per USB_OTG_HC_AGE_FRAMES
+  *         its transfer has been waiting for a channel
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @retval priority
+  */
+static uint32_t HCD_WaitPriority (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num) 
+{
+  uint32_t prio = pdev->host.Priority[hc_num];
+  
+  if (pdev->host.Pending[hc_num] != 0)
+  {
+    prio += ((HCD_GetCurrentFrame(pdev) - pdev->host.WaitFrame[hc_num]) & 0x3FFF)
+            / USB_OTG_HC_AGE_FRAMES;
+  }
+  return prio;
+}
+
+/**
+  * @brief  HCD_ChannelIdle 
+  *         Check that a host channel is neither enabled nor has events
+  *         left for the interrupt handler
+  * @param  pdev: Selected device
+  * @param  ch: Host channel
+  * @retval 1 when the channel can be given to another pipe
+  */
+static uint8_t HCD_ChannelIdle (USB_OTG_CORE_HANDLE *pdev, uint8_t ch) 
+{
+  USB_OTG_HCCHAR_TypeDef  hcchar;
+  uint32_t                hcint;
+  
+  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR);
+  hcint = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCINT) &
+          USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCINTMSK);
+  
+  return ((hcchar.b.chen == 0) && (hcint == 0));
+}
+
+/**
+  * @brief  HCD_BindChannel 
+  *         Give a pipe a host channel: a free one, else the one of the idle
+  *         pipe of lowest priority (least recently used first) that ranks
+  *         below the pipe. The pipes keep their channel between transfers.
+  * @param  pdev: Selected device
+  * @param  hc_num: Pipe number 
+  * @retval host channel, USB_OTG_HC_NONE when none can be had now
+  */
+static uint8_t HCD_BindChannel (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num) 
+{
+  uint8_t  ch, v, victim = USB_OTG_HC_NONE;
+  uint32_t prio;
+  
+  if (pdev->host.ChNum[hc_num] != USB_OTG_HC_NONE)
+  {
+    return pdev->host.ChNum[hc_num];
+  }
+  
+  for (ch = 0; ch < pdev->cfg.host_channels; ch++)
+  {
+    if (pdev->host.ChPipe[ch] == USB_OTG_HC_NONE)
+    {
+      break;
+    }
+  }
+  
+  if (ch == pdev->cfg.host_channels)
+  {
+    prio = HCD_WaitPriority(pdev, hc_num);
+    for (ch = 0; ch < pdev->cfg.host_channels; ch++)
+    {
+      v = pdev->host.ChPipe[ch];
+      /* the pipes the interrupt handler re-submits keep their channel */
+      if ((pdev->host.Priority[v] >= prio) || (pdev->host.Ring[v] != 0) ||
+          (pdev->host.hc_handler[v] != 0) || (pdev->host.Nak[v].state != NAK_IDLE) ||
+          (HCD_ChannelIdle(pdev, ch) == 0))
+      {
+        continue;
+      }
+      if ((victim == USB_OTG_HC_NONE) ||
+          (pdev->host.Priority[v] < pdev->host.Priority[pdev->host.ChPipe[victim]]) ||
+          ((pdev->host.Priority[v] == pdev->host.Priority[pdev->host.ChPipe[victim]]) &&
+           ((int32_t)(pdev->host.LastUse[v] - pdev->host.LastUse[pdev->host.ChPipe[victim]]) < 0)))
+      {
+        victim = ch;
+      }
+    }
+    
+    if (victim == USB_OTG_HC_NONE)
+    {
+      return USB_OTG_HC_NONE;
+    }
+    ch = victim;
+    pdev->host.ChNum[pdev->host.ChPipe[ch]] = USB_OTG_HC_NONE;
+    pdev->host.Evictions++;
+  }
+  
+  pdev->host.ChPipe[ch] = hc_num;
+  pdev->host.ChNum[hc_num] = ch;
+  USB_OTG_HC_Init(pdev, hc_num);
+  return ch;
+}
+
 
 /**
 * @}
@@ -90,14 +90,20 @@ static uint32_t USB_OTG_USBH_handle_sof_ISR(USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_port_ISR(USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_hc_ISR (USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev ,
-                                                 uint32_t num);
+                                                 uint32_t ch);
 static uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , 
-                                                  uint32_t num);
+                                                  uint32_t ch);
 static uint32_t USB_OTG_USBH_handle_rx_qlvl_ISR (USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_nptxfempty_ISR (USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_ptxfempty_ISR (USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_Disconnect_ISR (USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_IncompletePeriodicXfer_ISR (USB_OTG_CORE_HANDLE *pdev);
+static void USB_OTG_USBH_ring_submit (USB_OTG_CORE_HANDLE *pdev , uint8_t num);
+static void USB_OTG_USBH_nak_park (USB_OTG_CORE_HANDLE *pdev , uint8_t num);
+static void USB_OTG_USBH_nak_retry (USB_OTG_CORE_HANDLE *pdev , uint8_t num);
+static void USB_OTG_USBH_ring_done (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t num,
+                                    uint8_t received);
 
 /**
 * @}
@@ -201,7 +207,12 @@ static uint32_t USB_OTG_USBH_handle_hc_ISR (USB_OTG_CORE_HANDLE *pdev)
     {
       hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[i]->HCCHAR);
       
-      if (hcchar.b.epdir)
+      if (pdev->host.ChPipe[i] == USB_OTG_HC_NONE)
+      {
+        /* left over from a pipe that gave its channel back */
+        USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[i]->HCINT, 0xFFFFFFFF);
+      }
+      else if (hcchar.b.epdir)
       {
         retval |= USB_OTG_USBH_handle_hc_n_In_ISR (pdev, i);
       }
@@ -224,8 +235,22 @@ static uint32_t USB_OTG_USBH_handle_hc_ISR (USB_OTG_CORE_HANDLE *pdev)
 static uint32_t USB_OTG_USBH_handle_sof_ISR (USB_OTG_CORE_HANDLE *pdev)
 {
   USB_OTG_GINTSTS_TypeDef      gintsts;
+  uint8_t num;
   gintsts.d32 = 0;
   
+  /* interrupt IN pipes due in the next frame, NAKed pipes due now */
+  for (num = 0; num < USB_OTG_MAX_TX_FIFOS; num++)
+  {
+    if (pdev->host.Ring[num] != 0)
+    {
+      USB_OTG_USBH_ring_submit(pdev, num);
+    }
+    else if (pdev->host.Nak[num].state == NAK_PARKED)
+    {
+      USB_OTG_USBH_nak_retry(pdev, num);
+    }
+  }
+  
   USBH_HCD_INT_fops->SOF(pdev);
   
   /* Clear interrupt */
@@ -269,34 +294,36 @@ static uint32_t USB_OTG_USBH_handle_nptxfempty_ISR (USB_OTG_CORE_HANDLE *pdev)
   USB_OTG_GINTMSK_TypeDef      intmsk;
   USB_OTG_HNPTXSTS_TypeDef     hnptxsts; 
   uint16_t                     len_words , len; 
+  uint8_t                      pipe;
   
   hnptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->HNPTXSTS);
+  pipe = pdev->host.ChPipe[hnptxsts.b.nptxqtop.chnum];
   
-  len_words = (pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_len + 3) / 4;
+  len_words = (pdev->host.hc[pipe].xfer_len + 3) / 4;
   
   while ((hnptxsts.b.nptxfspcavail > len_words)&&
-         (pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_len != 0))
+         (pdev->host.hc[pipe].xfer_len != 0))
   {
     
     len = hnptxsts.b.nptxfspcavail * 4;
     
-    if (len > pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_len)
+    if (len > pdev->host.hc[pipe].xfer_len)
     {
       /* Last packet */
-      len = pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_len;
+      len = pdev->host.hc[pipe].xfer_len;
       
       intmsk.d32 = 0;
       intmsk.b.nptxfempty = 1;
       USB_OTG_MODIFY_REG32( &pdev->regs.GREGS->GINTMSK, intmsk.d32, 0);       
     }
     
-    len_words = (pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_len + 3) / 4;
+    len_words = (pdev->host.hc[pipe].xfer_len + 3) / 4;
     
-    USB_OTG_WritePacket (pdev , pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_buff, hnptxsts.b.nptxqtop.chnum, len);
+    USB_OTG_WritePacket (pdev , pdev->host.hc[pipe].xfer_buff, hnptxsts.b.nptxqtop.chnum, len);
     
-    pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_buff  += len;
-    pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_len   -= len;
-    pdev->host.hc[hnptxsts.b.nptxqtop.chnum].xfer_count  += len; 
+    pdev->host.hc[pipe].xfer_buff  += len;
+    pdev->host.hc[pipe].xfer_len   -= len;
+    pdev->host.hc[pipe].xfer_count  += len; 
     
     hnptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->HNPTXSTS);
   }  
@@ -317,33 +344,35 @@ static uint32_t USB_OTG_USBH_handle_ptxfempty_ISR (USB_OTG_CORE_HANDLE *pdev)
   USB_OTG_GINTMSK_TypeDef      intmsk;
   USB_OTG_HPTXSTS_TypeDef      hptxsts; 
   uint16_t                     len_words , len; 
+  uint8_t                      pipe;
   
   hptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.HREGS->HPTXSTS);
+  pipe = pdev->host.ChPipe[hptxsts.b.ptxqtop.chnum];
   
-  len_words = (pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_len + 3) / 4;
+  len_words = (pdev->host.hc[pipe].xfer_len + 3) / 4;
   
   while ((hptxsts.b.ptxfspcavail > len_words)&&
-         (pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_len != 0))    
+         (pdev->host.hc[pipe].xfer_len != 0))    
   {
     
     len = hptxsts.b.ptxfspcavail * 4;
     
-    if (len > pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_len)
+    if (len > pdev->host.hc[pipe].xfer_len)
     {
-      len = pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_len;
+      len = pdev->host.hc[pipe].xfer_len;
       /* Last packet */
       intmsk.d32 = 0;
       intmsk.b.ptxfempty = 1;
       USB_OTG_MODIFY_REG32( &pdev->regs.GREGS->GINTMSK, intmsk.d32, 0); 
     }
     
-    len_words = (pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_len + 3) / 4;
+    len_words = (pdev->host.hc[pipe].xfer_len + 3) / 4;
     
-    USB_OTG_WritePacket (pdev , pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_buff, hptxsts.b.ptxqtop.chnum, len);
+    USB_OTG_WritePacket (pdev , pdev->host.hc[pipe].xfer_buff, hptxsts.b.ptxqtop.chnum, len);
     
-    pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_buff  += len;
-    pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_len   -= len;
-    pdev->host.hc[hptxsts.b.ptxqtop.chnum].xfer_count  += len; 
+    pdev->host.hc[pipe].xfer_buff  += len;
+    pdev->host.hc[pipe].xfer_len   -= len;
+    pdev->host.hc[pipe].xfer_count  += len; 
     
     hptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.HREGS->HPTXSTS);
   }  
@@ -458,52 +487,69 @@ static uint32_t USB_OTG_USBH_handle_port_ISR (USB_OTG_CORE_HANDLE *pdev)
 * @brief  USB_OTG_USBH_handle_hc_n_Out_ISR 
 *         Handles interrupt for a specific Host Channel
 * @param  pdev: Selected device
-* @param  hc_num: Channel number
+* @param  ch: Host channel, it serves pipe pdev->host.ChPipe[ch]
 * @retval status 
 */
-uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t num)
+uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t ch)
 {
   
   USB_OTG_HCINTn_TypeDef     hcint;
   USB_OTG_HCINTMSK_TypeDef  hcintmsk;
   USB_OTG_HC_REGS *hcreg;
+  uint32_t num = pdev->host.ChPipe[ch];  /* pipe */
   USB_OTG_HCCHAR_TypeDef     hcchar; 
+  uint8_t ping = (pdev->host.Nak[num].state == NAK_PING);
   
-  hcreg = pdev->regs.HC_REGS[num];
+  hcreg = pdev->regs.HC_REGS[ch];
   hcint.d32 = USB_OTG_READ_REG32(&hcreg->HCINT);
   hcintmsk.d32 = USB_OTG_READ_REG32(&hcreg->HCINTMSK);
   hcint.d32 = hcint.d32 & hcintmsk.d32;
   
-  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[num]->HCCHAR);
+  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR);
   
   if (hcint.b.ahberr)
   {
     CLEAR_HC_INT(hcreg ,ahberr);
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
   } 
   else if (hcint.b.ack)
   {
     CLEAR_HC_INT(hcreg , ack);
+    if (ping)
+    {
+      /* the device has room: the data can go */
+      UNMASK_HOST_INT_CHH (ch);
+      USB_OTG_HC_Halt(pdev, num);
+      pdev->host.HC_Status[num] = HC_HALTED;
+    }
   }
   else if (hcint.b.frmovrun)
   {
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     USB_OTG_HC_Halt(pdev, num);
     CLEAR_HC_INT(hcreg ,frmovrun);
   }
   else if (hcint.b.xfercompl)
   {
     pdev->host.ErrCnt[num] = 0;
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     USB_OTG_HC_Halt(pdev, num);
     CLEAR_HC_INT(hcreg , xfercompl);
-    pdev->host.HC_Status[num] = HC_XFRC;            
+    if (ping)
+    {
+      pdev->host.HC_Status[num] = HC_HALTED;
+    }
+    else
+    {
+      pdev->host.Nak[num].shift = 0;
+      pdev->host.HC_Status[num] = HC_XFRC;            
+    }
   }
   
   else if (hcint.b.stall)
   {
     CLEAR_HC_INT(hcreg , stall);
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     USB_OTG_HC_Halt(pdev, num);
     pdev->host.HC_Status[num] = HC_STALL;      
   }
@@ -511,7 +557,8 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
   else if (hcint.b.nak)
   {
     pdev->host.ErrCnt[num] = 0;
-    UNMASK_HOST_INT_CHH (num);
+    pdev->host.Nak[num].Naks++;
+    UNMASK_HOST_INT_CHH (ch);
     if (pdev->cfg.dma_enable == 0)
     {
       USB_OTG_HC_Halt(pdev, num);
@@ -522,7 +569,7 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
   
   else if (hcint.b.xacterr)
   {
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     USB_OTG_HC_Halt(pdev, num);
     pdev->host.HC_Status[num] = HC_XACTERR;
     CLEAR_HC_INT(hcreg , xacterr);
@@ -530,7 +577,7 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
   else if (hcint.b.nyet)
   {
     pdev->host.ErrCnt[num] = 0;
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     if (pdev->cfg.dma_enable == 0)
     {
       USB_OTG_HC_Halt(pdev, num);
@@ -540,7 +587,7 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
   }
   else if (hcint.b.datatglerr)
   {
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     USB_OTG_HC_Halt(pdev, num);
     CLEAR_HC_INT(hcreg , nak);   
     pdev->host.HC_Status[num] = HC_DATATGLERR;
@@ -549,7 +596,7 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
   }  
   else if (hcint.b.chhltd)
   {
-    MASK_HOST_INT_CHH (num);
+    MASK_HOST_INT_CHH (ch);
     
     if(pdev->host.HC_Status[num] == HC_XFRC)
     {
@@ -562,8 +609,22 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
     }
     else if(pdev->host.HC_Status[num] == HC_NAK)
     {
-      pdev->host.URB_State[num] = URB_NOTREADY;      
+      if ((pdev->host.Nak[num].policy != HC_NAK_IMMEDIATE) &&
+          (pdev->cfg.dma_enable == 0))
+      {
+        USB_OTG_USBH_nak_park(pdev, num);
+      }
+      else
+      {
+        pdev->host.Nak[num].Retries++;
+        pdev->host.URB_State[num] = URB_NOTREADY;      
+      }
     }    
+    else if(pdev->host.HC_Status[num] == HC_HALTED)
+    {
+      /* PING answered */
+      pdev->host.URB_State[num] = URB_NOTREADY;      
+    }
     else if(pdev->host.HC_Status[num] == HC_NYET)
     {
       if(pdev->host.hc[num].do_ping == 1)
@@ -583,6 +644,12 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
       }
     }
     CLEAR_HC_INT(hcreg , chhltd);    
+    
+    if ((pdev->host.hc_handler[num] != 0) &&
+        (pdev->host.URB_State[num] != URB_IDLE))
+    {
+      pdev->host.hc_handler[num](pdev, num);
+    }
   }
   
   
@@ -595,28 +662,30 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
 * @brief  USB_OTG_USBH_handle_hc_n_In_ISR 
 *         Handles interrupt for a specific Host Channel
 * @param  pdev: Selected device
-* @param  hc_num: Channel number
+* @param  ch: Host channel, it serves pipe pdev->host.ChPipe[ch]
 * @retval status 
 */
-uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t num)
+uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t ch)
 {
   USB_OTG_HCINTn_TypeDef     hcint;
   USB_OTG_HCINTMSK_TypeDef  hcintmsk;
   USB_OTG_HCCHAR_TypeDef     hcchar; 
   USB_OTG_HCTSIZn_TypeDef  hctsiz;
   USB_OTG_HC_REGS *hcreg;
+  uint32_t num = pdev->host.ChPipe[ch];  /* pipe */
+  uint32_t count, mps;
   
-  hcreg = pdev->regs.HC_REGS[num];
+  hcreg = pdev->regs.HC_REGS[ch];
   hcint.d32 = USB_OTG_READ_REG32(&hcreg->HCINT);
   hcintmsk.d32 = USB_OTG_READ_REG32(&hcreg->HCINTMSK);
   hcint.d32 = hcint.d32 & hcintmsk.d32;
-  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[num]->HCCHAR);
+  hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR);
   hcintmsk.d32 = 0;
   
   if (hcint.b.ahberr)
   {
     CLEAR_HC_INT(hcreg ,ahberr);
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
   }  
   else if (hcint.b.ack)
   {
@@ -625,7 +694,7 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
   
   else if (hcint.b.stall)  
   {
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     pdev->host.HC_Status[num] = HC_STALL; 
     CLEAR_HC_INT(hcreg , nak);   /* Clear the NAK Condition */
     CLEAR_HC_INT(hcreg , stall); /* Clear the STALL Condition */
@@ -636,7 +705,7 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
   }
   else if (hcint.b.datatglerr)
   {
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     USB_OTG_HC_Halt(pdev, num);
     CLEAR_HC_INT(hcreg , nak);   
     pdev->host.HC_Status[num] = HC_DATATGLERR; 
@@ -645,7 +714,7 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
   
   if (hcint.b.frmovrun)
   {
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     USB_OTG_HC_Halt(pdev, num);
     CLEAR_HC_INT(hcreg ,frmovrun);
   }
@@ -654,33 +723,47 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
   {
     if (pdev->cfg.dma_enable == 1)
     {
-      hctsiz.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[num]->HCTSIZ);
+      hctsiz.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCTSIZ);
       pdev->host.XferCnt[num] =  pdev->host.hc[num].xfer_len - hctsiz.b.xfersize;
     }
     
     pdev->host.HC_Status[num] = HC_XFRC;     
     pdev->host.ErrCnt [num]= 0;
+    pdev->host.Nak[num].shift = 0;
     CLEAR_HC_INT(hcreg , xfercompl);
     
     if ((hcchar.b.eptype == EP_TYPE_CTRL)||
         (hcchar.b.eptype == EP_TYPE_BULK))
     {
-      UNMASK_HOST_INT_CHH (num);
+      UNMASK_HOST_INT_CHH (ch);
       USB_OTG_HC_Halt(pdev, num);
       CLEAR_HC_INT(hcreg , nak); 
-      pdev->host.hc[num].toggle_in ^= 1;
+      /* One toggle per packet: a multi-packet transfer ends either on the
+         full length or on a short packet */
+      count = pdev->host.XferCnt[num];
+      mps = pdev->host.hc[num].max_packet;
+      if (count < pdev->host.hc[num].xfer_len)
+      {
+        count = count / mps + 1;
+      }
+      else
+      {
+        count = (count + mps - 1) / mps;
+      }
+      pdev->host.hc[num].toggle_in ^= (count & 1);
       
     }
     else if(hcchar.b.eptype == EP_TYPE_INTR)
     {
       hcchar.b.oddfrm  = 1;
-      USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[num]->HCCHAR, hcchar.d32); 
+      USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32); 
       pdev->host.URB_State[num] = URB_DONE;  
+      USB_OTG_USBH_ring_done(pdev, num, 1);
     } 
   }
   else if (hcint.b.chhltd)
   {
-    MASK_HOST_INT_CHH (num);
+    MASK_HOST_INT_CHH (ch);
     
     if(pdev->host.HC_Status[num] == HC_XFRC)
     {
@@ -690,6 +773,10 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
     else if (pdev->host.HC_Status[num] == HC_STALL) 
     {
       pdev->host.URB_State[num] = URB_STALL;
+      if (pdev->host.Ring[num] != 0)
+      {
+        pdev->host.Ring[num]->state = RING_HALTED;
+      }
     }   
     
     else if((pdev->host.HC_Status[num] == HC_XACTERR) ||
@@ -697,28 +784,40 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
     {
       pdev->host.ErrCnt[num] = 0;
       pdev->host.URB_State[num] = URB_ERROR;  
-      
+      if (pdev->host.Ring[num] != 0)
+      {
+        pdev->host.Ring[num]->state = RING_HALTED;
+      }
     }
     else if(hcchar.b.eptype == EP_TYPE_INTR)
     {
+      /* NAK, or frame overrun: no data, the toggle is not spent */
       pdev->host.hc[num].toggle_in ^= 1;
+      USB_OTG_USBH_ring_done(pdev, num, 0);
     }
     
     CLEAR_HC_INT(hcreg , chhltd);    
     
+    if ((pdev->host.hc_handler[num] != 0) &&
+        (pdev->host.URB_State[num] != URB_IDLE))
+    {
+      pdev->host.hc_handler[num](pdev, num);
+    }
+    
   }    
   else if (hcint.b.xacterr)
   {
-    UNMASK_HOST_INT_CHH (num);
+    UNMASK_HOST_INT_CHH (ch);
     pdev->host.HC_Status[num] = HC_XACTERR;
     USB_OTG_HC_Halt(pdev, num);
     CLEAR_HC_INT(hcreg , xacterr);    
   }
   else if (hcint.b.nak)  
   {  
+    pdev->host.Nak[num].Naks++;
     if(hcchar.b.eptype == EP_TYPE_INTR)
     {
-      UNMASK_HOST_INT_CHH (num);
+      UNMASK_HOST_INT_CHH (ch);
       if (pdev->cfg.dma_enable == 0)
       {
         USB_OTG_HC_Halt(pdev, num);
@@ -731,10 +830,22 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
     if  ((hcchar.b.eptype == EP_TYPE_CTRL)||
               (hcchar.b.eptype == EP_TYPE_BULK))
     {
-      /* re-activate the channel  */
-      hcchar.b.chen = 1;
-      hcchar.b.chdis = 0;
-      USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[num]->HCCHAR, hcchar.d32); 
+      if ((pdev->host.Nak[num].policy != HC_NAK_IMMEDIATE) &&
+          (pdev->cfg.dma_enable == 0))
+      {
+        /* halted here, re-activated from the SOF handler */
+        UNMASK_HOST_INT_CHH (ch);
+        USB_OTG_HC_Halt(pdev, num);
+        USB_OTG_USBH_nak_park(pdev, num);
+      }
+      else
+      {
+        /* re-activate the channel  */
+        pdev->host.Nak[num].Retries++;
+        hcchar.b.chen = 1;
+        hcchar.b.chdis = 0;
+        USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32); 
+      }
     }
   }
   
@@ -759,6 +870,7 @@ static uint32_t USB_OTG_USBH_handle_rx_qlvl_ISR (USB_OTG_CORE_HANDLE *pdev)
   USB_OTG_HCTSIZn_TypeDef       hctsiz; 
   USB_OTG_HCCHAR_TypeDef        hcchar;
   __IO uint8_t                  channelnum =0;  
+  uint8_t                       pipe;
   uint32_t                      count;    
   
   /* Disable the Rx Status Queue Level interrupt */
@@ -768,23 +880,25 @@ static uint32_t USB_OTG_USBH_handle_rx_qlvl_ISR (USB_OTG_CORE_HANDLE *pdev)
   
   grxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->GRXSTSP);
   channelnum = grxsts.b.chnum;  
+  pipe = pdev->host.ChPipe[channelnum];
   hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[channelnum]->HCCHAR);
   
   switch (grxsts.b.pktsts)
   {
   case GRXSTS_PKTSTS_IN:
     /* Read the data into the host buffer. */
-    if ((grxsts.b.bcnt > 0) && (pdev->host.hc[channelnum].xfer_buff != (void  *)0))
+    if ((grxsts.b.bcnt > 0) && (pipe != USB_OTG_HC_NONE) &&
+        (pdev->host.hc[pipe].xfer_buff != (void  *)0))
     {  
       
-      USB_OTG_ReadPacket(pdev, pdev->host.hc[channelnum].xfer_buff, grxsts.b.bcnt);
+      USB_OTG_ReadPacket(pdev, pdev->host.hc[pipe].xfer_buff, grxsts.b.bcnt);
       /*manage multiple Xfer */
-      pdev->host.hc[grxsts.b.chnum].xfer_buff += grxsts.b.bcnt;           
-      pdev->host.hc[grxsts.b.chnum].xfer_count  += grxsts.b.bcnt;
+      pdev->host.hc[pipe].xfer_buff += grxsts.b.bcnt;           
+      pdev->host.hc[pipe].xfer_count  += grxsts.b.bcnt;
       
       
-      count = pdev->host.hc[channelnum].xfer_count;
-      pdev->host.XferCnt[channelnum]  = count;
+      count = pdev->host.hc[pipe].xfer_count;
+      pdev->host.XferCnt[pipe]  = count;
       
       hctsiz.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[channelnum]->HCTSIZ);
       if(hctsiz.b.pktcnt > 0)
@@ -842,6 +956,155 @@ static uint32_t USB_OTG_USBH_handle_IncompletePeriodicXfer_ISR (USB_OTG_CORE_HAN
   return 1;
 }
 
+/**
+* @brief  USB_OTG_USBH_ring_submit 
+*         Start the poll of a pipe of HCD_StartRing when it is due in the
+*         next frame, into the next free slot of its ring
+* @param  pdev: Selected device
+* @param  num: Pipe number
+* @retval None
+*/
+static void USB_OTG_USBH_ring_submit (USB_OTG_CORE_HANDLE *pdev , uint8_t num)
+{
+  USB_OTG_HC_RING *ring = pdev->host.Ring[num];
+  USB_OTG_HC *hc = &pdev->host.hc[num];
+  uint16_t next = (HCD_GetCurrentFrame(pdev) + 1) & 0x3FFF;
+  
+  if ((ring->state != RING_ARMED) || (((next - ring->due) & 0x3FFF) >= 0x2000) ||
+      (pdev->host.ChNum[num] == USB_OTG_HC_NONE))
+  {
+    return;
+  }
+  
+  if ((ring->wr - ring->rd) >= USB_OTG_HC_RING_SIZE)
+  {
+    /* the device keeps its report until HCD_RingRelease */
+    ring->state = RING_FULL;
+    ring->Pauses++;
+    return;
+  }
+  
+  if (next != ring->due)
+  {
+    ring->Late++;
+    ring->due = next;
+  }
+  
+  hc->ep_is_in = 1;
+  hc->xfer_buff = ring->data[ring->wr & USB_OTG_HC_RING_MASK];
+  hc->xfer_len = ring->length;
+  hc->xfer_count = 0;
+  hc->data_pid = (hc->toggle_in == 0) ? HC_PID_DATA0 : HC_PID_DATA1;
+  hc->toggle_in ^= 1;
+  
+  pdev->host.XferCnt[num] = 0;
+  pdev->host.HC_Status[num] = HC_IDLE;
+  pdev->host.URB_State[num] = URB_IDLE;
+  ring->state = RING_BUSY;
+  USB_OTG_HC_StartXfer(pdev, num);
+}
+
+/**
+* @brief  USB_OTG_USBH_ring_done 
+*         End of a poll of a pipe of HCD_StartRing: commit the report and
+*         schedule the next poll interval frames after this one
+* @param  pdev: Selected device
+* @param  num: Pipe number
+* @param  received: 1 for data, 0 for a NAK
+* @retval None
+*/
+static void USB_OTG_USBH_ring_done (USB_OTG_CORE_HANDLE *pdev , 
+                                    uint8_t num,
+                                    uint8_t received)
+{
+  USB_OTG_HC_RING *ring = pdev->host.Ring[num];
+  uint32_t slot;
+  
+  if ((ring == 0) || (ring->state != RING_BUSY))
+  {
+    return;
+  }
+  
+  if (received)
+  {
+    slot = ring->wr & USB_OTG_HC_RING_MASK;
+    ring->len[slot] = pdev->host.XferCnt[num];
+    ring->frame[slot] = HCD_GetCurrentFrame(pdev) & 0x3FFF;
+    ring->wr++;
+    ring->Reports++;
+  }
+  ring->due = (ring->due + ring->interval) & 0x3FFF;
+  ring->state = RING_ARMED;
+}
+
+/**
+* @brief  USB_OTG_USBH_nak_park 
+*         Leave a pipe halted on a NAK until the frame its policy retries
+*         it in, called once its channel is halted
+* @param  pdev: Selected device
+* @param  num: Pipe number
+* @retval None
+*/
+static void USB_OTG_USBH_nak_park (USB_OTG_CORE_HANDLE *pdev , uint8_t num)
+{
+  USB_OTG_HC_NAK *nak = &pdev->host.Nak[num];
+  
+  nak->due = (HCD_GetCurrentFrame(pdev) + (1 << nak->shift)) & 0x3FFF;
+  if ((nak->policy == HC_NAK_BACKOFF) && (nak->shift < nak->max_shift))
+  {
+    nak->shift++;
+  }
+  nak->state = NAK_PARKED;
+}
+
+/**
+* @brief  USB_OTG_USBH_nak_retry 
+*         Start a pipe parked on a NAK again once its frame has come: IN
+*         re-activates the channel, which kept its transfer size, packet
+*         count and PID; OUT PINGs the device or hands the transfer back
+*         URB_NOTREADY to be sent again
+* @param  pdev: Selected device
+* @param  num: Pipe number
+* @retval None
+*/
+static void USB_OTG_USBH_nak_retry (USB_OTG_CORE_HANDLE *pdev , uint8_t num)
+{
+  USB_OTG_HC_NAK *nak = &pdev->host.Nak[num];
+  uint8_t ch = pdev->host.ChNum[num];
+  USB_OTG_HCCHAR_TypeDef hcchar;
+  
+  if ((((HCD_GetCurrentFrame(pdev) - nak->due) & 0x3FFF) >= 0x2000) ||
+      (ch == USB_OTG_HC_NONE))
+  {
+    return;
+  }
+  
+  nak->state = NAK_IDLE;
+  nak->Retries++;
+  
+  if (pdev->host.hc[num].ep_is_in)
+  {
+    hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR);
+    hcchar.b.chen = 1;
+    hcchar.b.chdis = 0;
+    USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[ch]->HCCHAR, hcchar.d32); 
+  }
+  else if ((nak->policy == HC_NAK_PING) && (pdev->host.hc[num].do_ping == 1))
+  {
+    nak->state = NAK_PING;
+    pdev->host.HC_Status[num] = HC_IDLE;
+    USB_OTG_HC_DoPing(pdev, num);
+  }
+  else
+  {
+    pdev->host.URB_State[num] = URB_NOTREADY;
+    if (pdev->host.hc_handler[num] != 0)
+    {
+      pdev->host.hc_handler[num](pdev, num);
+    }
+  }
+}
+
 /**
 * @}
 */ 
@@ -0,0 +1,26 @@
+#ifndef __APP_EVENT_H
+#define __APP_EVENT_H
+#include "stm32f4xx.h"
+
+/*
+ * Events posted by interrupt handlers and run by the main loop.
+ * The main loop sleeps in APP_EventWait() until one is pending, then
+ * APP_EventRun() runs the tasks of a table in table order.
+ */
+#define APP_EVT_HID_OUT     0x01    /* HID OUT report latched (EP1_OUT_Callback) */
+#define APP_EVT_USB_STATE   0x02    /* device configured or suspended */
+#define APP_EVT_UART_RX     0x04    /* EVAL_COM1 RX DMA moved APP_Rx_ptr_in */
+#define APP_EVT_TICK        0x08    /* SysTick changed the LED state */
+#define APP_EVT_TRACE       0x10    /* trace record written (usbd_trace.c) */
+#define APP_EVT_CDC_OUT     0x20    /* CDC OUT buffer filled or EVAL_COM1 TX done */
+
+typedef struct {
+    uint32_t evt;                   /* events that make the task run */
+    void (*run)(void);
+} APP_Task_TypeDef;
+
+extern void APP_EventPost(uint32_t evt);
+extern uint32_t APP_EventWait(void);
+extern void APP_EventRun(const APP_Task_TypeDef *task, int num, uint32_t evt);
+
+#endif
@@ -148,11 +148,19 @@
 *        so total FIFO size should be 1012 Only instead of 1024       
 *******************************************************************************/
  
+/* TX1..TXn only hold until SetConfiguration: USBD_SetCfg then sizes them
+   from the endpoints of the selected configuration (USBD_CalcTxFifos), and
+   stalls the request if they do not all fit */
+ 
 /****************** USB OTG HS CONFIGURATION **********************************/
+/* No OUT EP of the HS core is over 64 bytes (HID and CDC data): Rx takes
+   10 + 1 + 2 x 17 + 1 per OUT EP, rounded up to 128 so the DMA has slack,
+   and EP0 two packets. The 852 words left fit the batched HID EP3 at
+   1024 x 3 per microframe (768) next to every other IN EP. */
 #ifdef USB_OTG_HS_CORE
- #define RX_FIFO_HS_SIZE                          512
- #define TX0_FIFO_HS_SIZE                         128
- #define TX1_FIFO_HS_SIZE                         372
+ #define RX_FIFO_HS_SIZE                          128
+ #define TX0_FIFO_HS_SIZE                          32
+ #define TX1_FIFO_HS_SIZE                         852
  #define TX2_FIFO_HS_SIZE                          0
  #define TX3_FIFO_HS_SIZE                          0
  #define TX4_FIFO_HS_SIZE                          0
@@ -184,6 +192,7 @@
 
 /****************** USB OTG MISC CONFIGURATION ********************************/
 //#define VBUS_SENSING_ENABLED
+/* #define USB_OTG_FIFO_COPY_REF */   /* plain one word per loop FIFO copy */
 
 /****************** USB OTG MODE CONFIGURATION ********************************/
 /* #define USE_HOST_MODE */
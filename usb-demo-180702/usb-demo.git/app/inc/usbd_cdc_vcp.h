@@ -64,6 +64,8 @@ typedef struct
  #define EVAL_COM_IRQHandler            USART1_IRQHandler 
  #define EVAL_COM4_IRQHandler           UART4_IRQHandler 
 #endif /* USE_STM322xG_EVAL */
+#define VCP_RX_DMA_IRQHandler           DMA2_Stream2_IRQHandler
+#define VCP_TX_DMA_IRQHandler           DMA2_Stream7_IRQHandler
 
 
 #define DEFAULT_CONFIG                  0
@@ -73,6 +75,10 @@ typedef struct
 /* Exported functions ------------------------------------------------------- */
 void EVAL_COM_IRQHandler(void);
 void EVAL_COM4_IRQHandler(void);
+void VCP_RX_DMA_IRQHandler(void);
+void VCP_TX_DMA_IRQHandler(void);
+void VCP_TxService(void);
+uint32_t VCP_RxOverrunCount(void);
 void EVAL_COM_TX_BYTE(char c);
 #endif /* __USBD_CDC_VCP_H */
 
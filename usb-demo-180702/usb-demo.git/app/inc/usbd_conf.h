@@ -39,7 +39,15 @@
 
 
 #define USBD_CFG_MAX_NUM           1
+
+/* HID + CDC composite on the HS core (usbd_comp_core.c), see app.c */
+/* #define USBD_COMPOSITE */
+
+#ifdef USBD_COMPOSITE
+#define USBD_ITF_MAX_NUM           5    /* 3 HID + CDC control and data */
+#else
 #define USBD_ITF_MAX_NUM           3///1
+#endif
 
 #define USB_MAX_STR_DESC_SIZ       255 //64 
 
@@ -52,9 +60,16 @@
 /** @defgroup USB_VCP_Class_Layer_Parameter
   * @{
   */ 
+#ifdef USBD_COMPOSITE
+/* behind the HID endpoints 1..3, the HS core has EP0..EP5 */
+#define CDC_IN_EP                       0x84  /* EP4 for data IN */
+#define CDC_OUT_EP                      0x04  /* EP4 for data OUT */
+#define CDC_CMD_EP                      0x85  /* EP5 for CDC commands */
+#else
 #define CDC_IN_EP                       0x81  /* EP1 for data IN */
 #define CDC_OUT_EP                      0x01  /* EP1 for data OUT */
 #define CDC_CMD_EP                      0x82  /* EP2 for CDC commands */
+#endif
 
 /* CDC Endpoints parameters: you can fine tune these values depending on the needed baudrates and performance. */
 //#ifndef USE_USB_OTG_HS
@@ -75,6 +90,10 @@
                                                 APP_RX_DATA_SIZE*8/MAX_BAUDARATE*1000 should be > CDC_IN_FRAME_INTERVAL */
 #endif /* USE_USB_OTG_HS */
 
+#define CDC_IN_XFER_SIZE               (CDC_DATA_MAX_PACKET_SIZE * 8) /* Max bytes per IN transfer,
+                                                size of each half of the IN ping-pong buffer */
+#define CDC_RX_POOL_SIZE               4    /* Max OUT buffers the application can lend (power of 2) */
+
 #define APP_VCP_FOPS                    VCP_fops
 
 /** @defgroup USB_HID_Class_Layer_Parameter
@@ -93,6 +112,40 @@
 #define HID_OUT_PACKET               64
 
 #define HID_TXRX_DATA_SIZE              256
+
+/* Touch report scheduler, see USBD_HID_SOF */
+#define USBD_HID_SCHED_LATENCY       0    /* one report per frame, newest state per finger */
+#define USBD_HID_SCHED_COMPLETE      1    /* never merge away a finger down/up transition */
+#ifndef USBD_HID_SCHED_POLICY
+  #define USBD_HID_SCHED_POLICY      USBD_HID_SCHED_LATENCY
+#endif
+
+/* HS batching of the vendor pipe (interface 2, EP3): its queued reports are
+   packed into one DMA transfer of up to USBD_HID_HS_MULT packets of
+   USBD_HID_HS_MPS bytes per microframe. A HID host driver takes one report
+   per transfer and drops the rest, so only turn it on for a host reading EP3
+   with the vendor parser; the mouse, keyboard and touch interfaces are never
+   batched. Needs the HS core in high speed (ULPI PHY) with internal DMA.
+   The EP3 Tx FIFO takes MPS x MULT bytes out of the 852 words left by the
+   Rx and EP0 FIFOs (usb_conf.h), see USBD_HID_HS_FifoCheck. */
+/* #define USBD_HID_HS_BATCH */
+#define USBD_HID_HS_BATCH_EP         HID_IN_EP3
+#ifndef USBD_HID_HS_MPS
+  #define USBD_HID_HS_MPS            1024
+  #define USBD_HID_HS_MULT           3
+#endif
+
+/* Per-endpoint queue / latency statistics of the HID IN reports
+   (usbd_stats.h), read by the USBD_HID_REQ_GET_STATS vendor request */
+/* #define USBD_HID_STATS */
+
+/* Serve the macOS descriptor set when the enumeration fingerprint
+   (usbd_hostos.c) says the host is a Mac */
+/* #define USBD_HID_HOST_OS_DESC */
+
+/* Millisecond counter for the enumeration timings (app.c SysTick) */
+extern volatile uint32_t jiff;
+#define USBD_HOSTOS_TICK()           jiff
 /**
   * @}
   */ 
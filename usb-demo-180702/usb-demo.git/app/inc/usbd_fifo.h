@@ -1,26 +1,99 @@
 #ifndef __USBD_FIFO_H
 #define __USBD_FIFO_H
+#include <stddef.h>
 #include "usb_conf.h"
-#define USBD_FIFO_SIZE 20
+
+/*
+ * Single-producer/single-consumer report ring.
+ * Producer: main loop (USBD_HID_SendReport / touch engine).
+ * Consumer: USB ISR (USBD_HID_DataIn).
+ * wr is only written by the producer, rd only by the consumer, both run
+ * freely and are masked on access, so no critical section is needed.
+ */
+#define USBD_FIFO_SIZE      32      /* must be a power of two */
+#define USBD_FIFO_MASK      (USBD_FIFO_SIZE-1)
+#define USBD_FIFO_SLOT_SIZE 64
+
+#if (USBD_FIFO_SIZE & USBD_FIFO_MASK)
+  #error "USBD_FIFO_SIZE must be a power of two"
+#endif
 
 typedef struct {
-    int nr;
-    int wr;
-    int rd;
-    u8 dat[USBD_FIFO_SIZE][65];
+    u8  dat[USBD_FIFO_SLOT_SIZE];   /* first member, keeps DMA alignment */
+    u32 len;
+} USBD_FIFO_slot;
+
+typedef struct {
+    __IO u32 wr;
+    __IO u32 rd;
+    USBD_FIFO_slot slot[USBD_FIFO_SIZE];
 } USBD_FIFO_type;
 
-extern USBD_FIFO_type USBD_HID_TxFIFO_EP1;
-extern USBD_FIFO_type USBD_HID_TxFIFO_EP2;
-extern USBD_FIFO_type USBD_HID_TxFIFO_EP3;
+/* USBD_FIFO_Push status */
+#define USBD_FIFO_OK        0
+#define USBD_FIFO_FULL      1       /* report dropped */
+#define USBD_FIFO_TOO_LONG  2       /* *len > USBD_FIFO_SLOT_SIZE, nothing queued */
 
-extern void USBD_FIFO_Push(USBD_FIFO_type *p, u8 *report, u16 *len);
+extern int  USBD_FIFO_Push(USBD_FIFO_type *p, u8 *report, u16 *len);
 extern void USBD_FIFO_Pop(USBD_FIFO_type *p, u8 *report, u16 *len);
 extern void USBD_FIFO_Flush(USBD_FIFO_type *p);
 
+/* producer side: reserve the next free slot, fill it in place, commit */
+__inline u8 *USBD_FIFO_Reserve(USBD_FIFO_type *p)
+{
+    if (p->wr - p->rd >= USBD_FIFO_SIZE)
+        return NULL;
+    return p->slot[p->wr & USBD_FIFO_MASK].dat;
+}
+
+__inline void USBD_FIFO_Commit(USBD_FIFO_type *p, u16 len)
+{
+    p->slot[p->wr & USBD_FIFO_MASK].len = len;
+    __DMB();                        /* publish slot data before the index */
+    p->wr++;
+}
+
+/* consumer side: the head slot stays valid until it is released */
+__inline u8 *USBD_FIFO_Front(USBD_FIFO_type *p, u16 *len)
+{
+    USBD_FIFO_slot *s;
+
+    if (p->wr == p->rd)
+        return NULL;
+    __DMB();                        /* index read before slot data */
+    s = &p->slot[p->rd & USBD_FIFO_MASK];
+    *len = s->len;
+    return s->dat;
+}
+
+/* n-th queued slot after the head, to gather several reports at once */
+__inline u8 *USBD_FIFO_At(USBD_FIFO_type *p, u32 n, u16 *len)
+{
+    USBD_FIFO_slot *s;
+
+    if (p->wr - p->rd <= n)
+        return NULL;
+    __DMB();
+    s = &p->slot[(p->rd + n) & USBD_FIFO_MASK];
+    *len = s->len;
+    return s->dat;
+}
+
+__inline void USBD_FIFO_Release(USBD_FIFO_type *p)
+{
+    __DMB();                        /* finish with the slot before freeing it */
+    p->rd++;
+}
+
+__inline void USBD_FIFO_ReleaseN(USBD_FIFO_type *p, u32 n)
+{
+    __DMB();
+    p->rd += n;
+}
+
 __inline int USBD_FIFO_Peek(USBD_FIFO_type *p)
 {
-    return p->nr;
+    return p->wr - p->rd;
 }
 
 __inline int USBD_FIFO_Capacity(USBD_FIFO_type *p)
@@ -30,12 +103,12 @@ __inline int USBD_FIFO_Capacity(USBD_FIFO_type *p)
 
 __inline int USBD_FIFO_Used(USBD_FIFO_type *p)
 {
-    return p->nr;
+    return p->wr - p->rd;
 }
 
 __inline int USBD_FIFO_Unused(USBD_FIFO_type *p)
 {
-    return USBD_FIFO_SIZE - p->nr;
+    return USBD_FIFO_SIZE - (p->wr - p->rd);
 }
 
 #endif
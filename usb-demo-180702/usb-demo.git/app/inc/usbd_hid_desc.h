@@ -90,6 +90,9 @@ extern  uint8_t USBD_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC];
 extern  uint8_t USBD_LangIDDesc[USB_SIZ_STRING_LANGID];
 //extern  USBD_DEVICE USR_MSC_desc; 
 extern  USBD_DEVICE USR_HID_desc; 
+#ifdef USBD_COMPOSITE
+extern  USBD_DEVICE USR_COMP_desc;
+#endif
 /**
   * @}
   */ 
@@ -100,6 +103,9 @@ extern  USBD_DEVICE USR_HID_desc;
 
 
 uint8_t *     USBD_HID_DeviceDescriptor( uint8_t speed , uint16_t *length);
+#ifdef USBD_COMPOSITE
+uint8_t *     USBD_COMP_DeviceDescriptor( uint8_t speed , uint16_t *length);
+#endif
 uint8_t *     USBD_HID_LangIDStrDescriptor( uint8_t speed , uint16_t *length);
 uint8_t *     USBD_HID_ManufacturerStrDescriptor ( uint8_t speed , uint16_t *length);
 uint8_t *     USBD_HID_ProductStrDescriptor ( uint8_t speed , uint16_t *length);
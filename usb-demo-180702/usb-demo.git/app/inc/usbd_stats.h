@@ -0,0 +1,72 @@
+#ifndef __USBD_STATS_H
+#define __USBD_STATS_H
+#include "usb_conf.h"
+#include "usbd_fifo.h"
+
+/*
+ * Per-endpoint statistics of a report ring (usbd_fifo.h).
+ * The producer counts queued and dropped reports and stamps each slot with
+ * DWT->CYCCNT when it is committed; the consumer counts sent reports and
+ * bytes and files the time each one waited in a histogram of power-of-two
+ * buckets. Each counter has a single writer, like wr / rd of the ring.
+ * Compiled out unless USBD_HID_STATS is defined (usbd_conf.h); the cycle
+ * counter must be running (USBD_TRACE_Init).
+ */
+#define USBD_STATS_HIST         16      /* histogram buckets */
+#define USBD_STATS_HIST_SHIFT   10      /* bucket 0: below 2^10 cycles, ~6 us at 168 MHz */
+
+typedef struct {
+    u32 Queued;                     /* reports, producer */
+    u32 Dropped;                    /* reports, producer */
+    u32 MaxDepth;                   /* slots, producer */
+    u32 Sent;                       /* reports, consumer */
+    u32 Bytes;                      /* consumer */
+    u32 MaxLatency;                 /* cycles from commit to DataIn, consumer */
+    u32 Hist[USBD_STATS_HIST];      /* bucket b: below 2^(b+USBD_STATS_HIST_SHIFT) cycles */
+} USBD_STATS_ep;
+
+typedef struct {
+    USBD_STATS_ep ep;
+    u32 stamp[USBD_FIFO_SIZE];      /* commit time of each slot */
+} USBD_STATS_type;
+
+#ifdef USBD_HID_STATS
+/* producer, right before USBD_FIFO_Commit(p) */
+__inline void USBD_STATS_Commit(USBD_STATS_type *s, USBD_FIFO_type *p)
+{
+    u32 depth = p->wr - p->rd + 1;
+
+    s->stamp[p->wr & USBD_FIFO_MASK] = DWT->CYCCNT;
+    s->ep.Queued++;
+    if (depth > s->ep.MaxDepth)
+        s->ep.MaxDepth = depth;
+}
+
+/* consumer, right before USBD_FIFO_ReleaseN(p, n) */
+__inline void USBD_STATS_Release(USBD_STATS_type *s, USBD_FIFO_type *p, u32 n)
+{
+    u32 now = DWT->CYCCNT;
+    u32 i, idx, lat, b;
+
+    for (i = 0; i < n; i++) {
+        idx = (p->rd + i) & USBD_FIFO_MASK;
+        lat = now - s->stamp[idx];
+        b = 32 - __CLZ(lat >> USBD_STATS_HIST_SHIFT);
+        s->ep.Hist[(b < USBD_STATS_HIST) ? b : USBD_STATS_HIST - 1]++;
+        if (lat > s->ep.MaxLatency)
+            s->ep.MaxLatency = lat;
+        s->ep.Bytes += p->slot[idx].len;
+    }
+    s->ep.Sent += n;
+}
+
+#define USBD_STATS_COMMIT(s, p)         USBD_STATS_Commit(s, p)
+#define USBD_STATS_RELEASE(s, p, n)     USBD_STATS_Release(s, p, n)
+#define USBD_STATS_DROP(s)              ((s)->ep.Dropped++)
+#else
+#define USBD_STATS_COMMIT(s, p)
+#define USBD_STATS_RELEASE(s, p, n)
+#define USBD_STATS_DROP(s)
+#endif
+
+#endif
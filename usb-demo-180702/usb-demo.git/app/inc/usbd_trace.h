@@ -0,0 +1,56 @@
+#ifndef __USBD_TRACE_H
+#define __USBD_TRACE_H
+#include "usb_conf.h"
+
+/*
+ * Binary trace for interrupt context: a trace point stores a message ID,
+ * up to four raw arguments and the DWT cycle count, the text is only formatted
+ * by USBD_TRACE_Drain() in the main loop.
+ * Any context may write (the index is taken with LDREX/STREX), only the
+ * main loop reads. A record is valid once its seq is written, last.
+ */
+#define USBD_TRACE_SIZE     64      /* records, must be a power of two */
+#define USBD_TRACE_MASK     (USBD_TRACE_SIZE-1)
+
+#if (USBD_TRACE_SIZE & USBD_TRACE_MASK)
+  #error "USBD_TRACE_SIZE must be a power of two"
+#endif
+
+/* message ID, printf format of the arguments */
+#define USBD_TRACE_LIST \
+    X(TRACE_HID_OUT,        "USBD_HID_DataOut core=%d epnum=%d \n") \
+    X(TRACE_HID_OUT_DATA,   "DataOUT  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n") \
+    X(TRACE_HID_STARTED,    "> HID Interface started.\n") \
+    X(TRACE_HID_SUSPEND,    "> HID Device in Suspend Mode.\n") \
+    X(TRACE_CDC_STARTED,    "> CDC Interface started.\n") \
+    X(TRACE_CDC_SUSPEND,    "> CDC Device in Suspend Mode.\n") \
+    X(TRACE_COM4_IRQ,       "EVAL_COM4_IRQHandler 111 \n") \
+    X(TRACE_COM4_RX,        "EVAL_COM4_IRQHandler 222 data=%x \n") \
+    X(TRACE_COM4_ORE,       "EVAL_COM4_IRQHandler 333 data=%x \n") \
+    X(TRACE_VCP_RX_OVERRUN, "VCP RX overrun, %d so far \n")
+
+#define X(id, fmt)  id,
+typedef enum {
+    USBD_TRACE_LIST
+    TRACE_ID_MAX
+} USBD_TRACE_id;
+#undef X
+
+typedef struct {
+    __IO u32 seq;                   /* write index + 1, 0 while written */
+    u32 ts;                         /* DWT->CYCCNT */
+    u32 id;
+    u32 arg[4];
+} USBD_TRACE_rec;
+
+extern void USBD_TRACE_Init(void);
+extern void USBD_TRACE_Put(u32 id, u32 a0, u32 a1, u32 a2, u32 a3);
+extern void USBD_TRACE_Drain(void);
+extern u32  USBD_TRACE_Lost;
+
+#define TRACE0(id)              USBD_TRACE_Put(id, 0, 0, 0, 0)
+#define TRACE1(id, a)           USBD_TRACE_Put(id, (u32)(a), 0, 0, 0)
+#define TRACE2(id, a, b)        USBD_TRACE_Put(id, (u32)(a), (u32)(b), 0, 0)
+#define TRACE4(id, a, b, c, d)  USBD_TRACE_Put(id, (u32)(a), (u32)(b), (u32)(c), (u32)(d))
+
+#endif
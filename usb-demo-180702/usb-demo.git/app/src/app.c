@@ -30,6 +30,9 @@
 #include "usbd_hid_core.h"
 //#include "usbd_msc_core.h"
 #include "usbd_cdc_core.h"
+#ifdef USBD_COMPOSITE
+#include "usbd_comp_core.h"
+#endif
 //#include "usbd_cdc_core_loopback.h"
 #include "usbd_usr.h"
 //#include "usbd_msc_desc.h"
@@ -38,6 +41,8 @@
 #include "usb_conf.h"
 #include "usbd_cdc_vcp.h"
 #include "usb_bsp.h"
+#include "app_event.h"
+#include "usbd_trace.h"
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
   * @{
   */
@@ -1335,6 +1340,7 @@ void SysTick_Handler(void) //
         {
 			//printf("led_on_ms = %d 111 \n",led_on_ms);
             LED_R_OFF();
+            APP_EventPost(APP_EVT_TICK);
         }
     }
     else// if(led_off_ms)
@@ -1346,6 +1352,7 @@ void SysTick_Handler(void) //
             LED_R_ON();
             led_on_ms = 200;
             led_off_ms = 800;
+            APP_EventPost(APP_EVT_TICK);
         }
     }
 }
@@ -1389,9 +1396,7 @@ int dly_cnt = 0;
 int dly_repet = 0;
 
 extern int my_usb_status;
-extern int usb_check;
 extern int usbd_cdc_trigger_reset(void);
-extern u8 USBD_HID_RcvBuf[64];
 
 int cdc_configer_sr = 0;
 
@@ -1405,29 +1410,87 @@ int fgetc(FILE *f)
     return ch;
 }
 
+/* HID OUT hook of usbd_hid_core.c, called from the USB ISR */
+void EP1_OUT_Callback(u8 *buf)
+{
+    APP_EventPost(APP_EVT_HID_OUT);
+}
+
+/* echoes left before the ports are unplugged, as the old k++ < 10 */
+#define APP_HID_ECHO_MAX    10
+static uint8_t APP_HidEchoCnt = 0;
+
+/* echo an OUT report of either port: buf[3] 0 on FS, 1 on HS */
+static void APP_HidEchoOne(uint8_t *rx)
+{
+    if(APP_HidEchoCnt >= APP_HID_ECHO_MAX)
+        return;
+    if(rx[3] == 0)
+    {
+        APP_HidEchoCnt++;
+        USBD_HID_SendReport (&USB_OTG_FS_dev,   
+                                                 rx,  
+                                                 4);  
+        printf("FS DataIN  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",rx[0],rx[1],rx[2],rx[3]);
+    }
+    else if(rx[3] == 1)
+    {
+        APP_HidEchoCnt++;
+        USBD_HID_SendReport (&USB_OTG_HS_dev,   
+                                                 rx,  
+                                                 4);  
+        printf("HS DataIN  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",rx[0],rx[1],rx[2],rx[3]);
+    }
+}
+
+static void APP_HidEcho(void)
+{
+    uint8_t rx[HID_OUT_PACKET];
+
+    if(!my_usb_status)
+        return;
+    if(USBD_HID_ReadOutReport(&USB_OTG_FS_dev, rx))
+        APP_HidEchoOne(rx);
+    if(USBD_HID_ReadOutReport(&USB_OTG_HS_dev, rx))
+        APP_HidEchoOne(rx);
+}
+
+/* LED stays on while a port is configured, blinks from SysTick otherwise */
+static void APP_LedUpdate(void)
+{
+    if(my_usb_status){
+        if(GPIO_ReadOutputDataBit(GPIOC,GPIO_Pin_3))
+        {
+            printf("led on 11 \n");
+            LED_R_ON();
+        }
+    }
+    else{
+        APP_HidEchoCnt = 0;
+        if(!GPIO_ReadOutputDataBit(GPIOC,GPIO_Pin_3))
+        {
+            printf("led off 22 \n");
+            LED_R_OFF();
+        }
+    }
+}
+
+static const APP_Task_TypeDef APP_Tasks[] =
+{
+    { APP_EVT_HID_OUT,                      APP_HidEcho      },
+    { APP_EVT_USB_STATE | APP_EVT_TICK,     APP_LedUpdate    },
+    { APP_EVT_TRACE,                        USBD_TRACE_Drain },
+    { APP_EVT_CDC_OUT | APP_EVT_USB_STATE,  VCP_TxService    },
+};
+
 int main(void)
 {
-    int stop;
-    
     uint32_t i = 0;
-    int k;
-#if 0
-    uint8_t buf_fs[4]; 
-    uint8_t buf_hs[4]; 
-    buf_fs[0]=0;  
-    buf_fs[1]=7;  
-    buf_fs[2]=7;  
-    buf_fs[3]=0;  
-     
-    buf_hs[0]=0;  
-    buf_hs[1]=8;  
-    buf_hs[2]=8;  
-    buf_hs[3]=0;  
-#endif
+
     i = 0x1000;
-    stop = 0;
     while (i--);
 
+    USBD_TRACE_Init();
     APP_VCP_FOPS.pIf_Init();
     //I2C_Config();
     /*!< At this stage the microcontroller clock setting is already configured,
@@ -1442,7 +1505,24 @@ int main(void)
             &USR_HID_desc,
             &USBD_HID_cb,
             &USR_FS_cb);
-    #if 1//chg by huangcaihui 180621
+    #if defined(USBD_COMPOSITE)
+    /* touch reports and the CDC diagnostic stream on the HS core */
+    if ((USBD_COMP_Add(&USBD_HID_cb1, 0) != USBD_OK) ||
+        (USBD_COMP_Add(&USBD_CDC_cb, USBD_COMP_IAD) != USBD_OK))
+    {
+        /* a class left out (endpoint clash, descriptor too long) would
+           enumerate a device missing a function: keep the HS core off */
+        printf("composite HS device: class does not fit, not started\n");
+    }
+    else
+    {
+        USBD_Init(&USB_OTG_HS_dev,
+                USB_OTG_HS_CORE_ID,
+                &USR_COMP_desc,
+                &USBD_COMP_cb,
+                &USR_HS_cb);
+    }
+    #elif 1//chg by huangcaihui 180621
     USBD_Init(&USB_OTG_HS_dev,
             USB_OTG_HS_CORE_ID,
             &USR_HID_desc,
@@ -1459,70 +1539,14 @@ int main(void)
     // system tick configer
     SysTick_Config(SystemCoreClock / 1000);
     
-    //
-#if 1
-    while(1)
-    {
-			if (i++ == 0x20000)
-			{
-                if(my_usb_status){
-                    if(GPIO_ReadOutputDataBit(GPIOC,GPIO_Pin_3))
-                    {
-                        printf("led on 11 \n");
-				        LED_R_ON();
-                    }
-                }
-                else{
-                    if(!GPIO_ReadOutputDataBit(GPIOC,GPIO_Pin_3))
-                    {
-                        printf("led off 22 \n");
-                        LED_R_OFF();
-                    }
-                }
-
-                if(my_usb_status)
-                {
-                    if((usb_check ==1) && (k++ <10))
-                    {
-                        if(USBD_HID_RcvBuf[3] == 0)
-                        {
-                        USBD_HID_SendReport (&USB_OTG_FS_dev,   
-                                                                 USBD_HID_RcvBuf,  
-                                                                 4);  
-                        printf("FS DataIN  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",USBD_HID_RcvBuf[0],USBD_HID_RcvBuf[1],USBD_HID_RcvBuf[2],USBD_HID_RcvBuf[3]);
-                        }
-                        else if(USBD_HID_RcvBuf[3] == 1)
-                        {
-                        USBD_HID_SendReport (&USB_OTG_HS_dev,   
-                                                                 USBD_HID_RcvBuf,  
-                                                                 4);  
-                        printf("HS DataIN  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",USBD_HID_RcvBuf[0],USBD_HID_RcvBuf[1],USBD_HID_RcvBuf[2],USBD_HID_RcvBuf[3]);
-                        }
-                    }
-                    
-                    
-                }
-                else
-                {
-                    k = 0;
-                    usb_check = 0;
-                }
-                //printf("DataSENT  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",USBD_HID_RcvBuf[0],USBD_HID_RcvBuf[1],USBD_HID_RcvBuf[2],USBD_HID_RcvBuf[3]);
-                if(stop == 0)
-                {
-                    printf("device main() 1111111111111111111 \n");
-                    //I2C_Test();
-                    stop = 1;
-                }
-				i = 0;
-			}
-    }
-#else
-    /* Main loop */
+    printf("device main() 1111111111111111111 \n");
+    //I2C_Test();
+
+    /* Main loop: sleep until an interrupt posts work */
     while (1)
     {
+        APP_EventRun(APP_Tasks, sizeof(APP_Tasks) / sizeof(APP_Tasks[0]), APP_EventWait());
     }
-#endif
 }
 
 #ifdef USE_FULL_ASSERT
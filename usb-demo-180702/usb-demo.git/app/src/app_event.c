@@ -0,0 +1,41 @@
+#include "app_event.h"
+
+static __IO uint32_t APP_EventPending;
+
+/* ISR or main loop: set the bits without masking interrupts */
+void APP_EventPost(uint32_t evt)
+{
+    uint32_t v;
+
+    do {
+        v = __LDREXW((uint32_t *)&APP_EventPending) | evt;
+    } while (__STREXW(v, (uint32_t *)&APP_EventPending));
+}
+
+/* sleep until an event is pending, then take all of them */
+uint32_t APP_EventWait(void)
+{
+    uint32_t evt;
+
+    __disable_irq();
+    while (APP_EventPending == 0) {
+        /* a pending interrupt still ends WFI while PRIMASK is set,
+           so a post between the test and the WFI is not lost */
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    evt = APP_EventPending;
+    APP_EventPending = 0;
+    __enable_irq();
+    return evt;
+}
+
+void APP_EventRun(const APP_Task_TypeDef *task, int num, uint32_t evt)
+{
+    int i;
+
+    for (i = 0; i < num; i++)
+        if (task[i].evt & evt)
+            task[i].run();
+}
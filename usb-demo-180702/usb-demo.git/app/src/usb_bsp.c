@@ -342,6 +342,17 @@ void USB_OTG_BSP_mDelay (const uint32_t msec)
   USB_OTG_BSP_uDelay(msec * 1000);   
 }
 
+/**
+* @brief  USB_OTG_BSP_GetTick
+*          Millisecond counter the host waits are timed with
+* @param  None
+* @retval time in ms
+*/
+uint32_t USB_OTG_BSP_GetTick (void)
+{
+  return jiff;                        /* app.c SysTick, see usbd_conf.h */
+}
+
 /**
 * @}
 */ 
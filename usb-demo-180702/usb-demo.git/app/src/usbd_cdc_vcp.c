@@ -32,6 +32,8 @@
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_cdc_vcp.h"
 #include "usb_conf.h"
+#include "app_event.h"
+#include "usbd_trace.h"
 
 #include "stdio.h"
 
@@ -53,6 +55,25 @@
 
 #define UART_DEFAULT_BAUD   115200//921600
 
+/* EVAL_COM1 RX runs on DMA2 Stream2 Channel4 in circular mode */
+#define VCP_RX_DMA_STREAM   DMA2_Stream2
+#define VCP_RX_DMA_CHANNEL  DMA_Channel_4
+#define VCP_RX_DMA_IRQn     DMA2_Stream2_IRQn
+#define VCP_RX_DMA_IT_HT    DMA_IT_HTIF2
+#define VCP_RX_DMA_IT_TC    DMA_IT_TCIF2
+
+/* EVAL_COM1 TX runs on DMA2 Stream7 Channel4, straight out of the CDC OUT buffers */
+#define VCP_TX_DMA_STREAM   DMA2_Stream7
+#define VCP_TX_DMA_CHANNEL  DMA_Channel_4
+#define VCP_TX_DMA_IRQn     DMA2_Stream7_IRQn
+#define VCP_TX_DMA_IT_TC    DMA_IT_TCIF7
+#define VCP_TX_DMA_FLAGS    (DMA_FLAG_FEIF7 | DMA_FLAG_DMEIF7 | DMA_FLAG_TEIF7 | \
+                             DMA_FLAG_HTIF7 | DMA_FLAG_TCIF7)
+
+/* Buffers lent to the CDC OUT endpoint */
+#define VCP_RX_BUF_NUM      CDC_RX_POOL_SIZE
+#define VCP_RX_BUF_SIZE     (CDC_DATA_OUT_PACKET_SIZE * 4)
+
 #define  UART_CLK           ((uint32_t)84000000)
 
 #define __DIV(__PCLK, __BAUD)       ((__PCLK*25)/(4*__BAUD))
@@ -173,16 +194,16 @@ LINE_CODING linecoding =
 
 
 USART_InitTypeDef USART_InitStructure;
-#if 0
+
 /* These are external variables imported from CDC core to be used for IN 
    transfer management. */
-extern uint8_t  APP_Rx_Buffer []; /* Write CDC received data in this buffer.
+extern uint8_t  APP_Rx_Buffer []; /* Written by the RX DMA in circular mode.
                                      These data will be sent over USB IN endpoint
                                      in the CDC core functions. */
-extern uint32_t APP_Rx_ptr_in;    /* Increment this pointer or roll it back to
-                                     start address when writing received data
-                                     in the buffer APP_Rx_Buffer. */
-#endif
+extern __IO uint32_t APP_Rx_ptr_in; /* Follows the RX DMA write position, moved
+                                     from the idle-line and DMA interrupts. */
+extern uint32_t APP_Rx_ptr_out;     /* How far the CDC core has sent. */
+extern __IO uint8_t APP_Rx_overrun; /* Set here when the DMA overtook ptr_out. */
 /* Private function prototypes -----------------------------------------------*/
 static uint16_t VCP_Init     (void);
 static uint16_t VCP_DeInit   (void);
@@ -191,6 +212,18 @@ static uint16_t VCP_DataTx   (void);
 static uint16_t VCP_DataRx   (uint8_t* Buf, uint32_t Len);
 
 static uint16_t VCP_COMConfig(uint8_t Conf);
+static void     VCP_RxDmaInit(void);
+static void     VCP_TxDmaInit(void);
+
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4   
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN static uint8_t VCP_RxPool[VCP_RX_BUF_NUM][VCP_RX_BUF_SIZE] __ALIGN_END;
+static uint8_t       *VCP_TxBuf = NULL;   /* OUT buffer on the TX DMA, owned by main */
+static __IO uint8_t   VCP_TxBusy = 0;
+static uint32_t       VCP_RxOverruns = 0;  /* times the RX DMA lapped the CDC core */
 
 CDC_IF_Prop_TypeDef VCP_fops = 
 {
@@ -231,6 +264,13 @@ static uint16_t VCP_Init(void)
   /* Configure and enable the USART */
   STM_EVAL_COMInit(&USART_InitStructure);
 
+  /* Receive by DMA straight into the CDC IN ring */
+  VCP_RxDmaInit();
+
+  /* Transmit by DMA straight out of the CDC OUT buffers; VCP_TxService
+     lends them all once the interface is configured */
+  VCP_TxDmaInit();
+
   /* Enable the USART Receive interrupt */
 //  USART_ITConfig(EVAL_COM1, USART_IT_RXNE, ENABLE);
 
@@ -391,8 +431,17 @@ static uint16_t VCP_DataTx (void)
 {
     return USBD_OK;
 }
+/**
+  * @brief  VCP_DataRx
+  *         An OUT buffer was filled: it is queued in the CDC core already,
+  *         VCP_TxService takes it from there in the main loop.
+  * @param  Buf: Buffer of data received
+  * @param  Len: Number of data received (in bytes)
+  * @retval USBD_OK
+  */
 static uint16_t VCP_DataRx (uint8_t* Buf, uint32_t Len)
 {
+  APP_EventPost(APP_EVT_CDC_OUT);
   return USBD_OK;
 }
 #endif
@@ -498,6 +547,231 @@ static uint16_t VCP_COMConfig(uint8_t Conf)
   return USBD_OK;
 }
 
+/**
+  * @brief  VCP_RxDmaInit
+  *         Run EVAL_COM1 reception on DMA in circular mode over APP_Rx_Buffer.
+  *         The CPU no longer touches each byte: the idle-line interrupt and
+  *         the DMA half/full transfer interrupts only publish the DMA write
+  *         position in APP_Rx_ptr_in for the CDC core to pick up.
+  * @param  None.
+  * @retval None.
+  */
+static void VCP_RxDmaInit(void)
+{
+  DMA_InitTypeDef  DMA_InitStructure;
+  NVIC_InitTypeDef NVIC_InitStructure;
+
+  RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
+
+  DMA_Cmd(VCP_RX_DMA_STREAM, DISABLE);
+  while (DMA_GetCmdStatus(VCP_RX_DMA_STREAM) != DISABLE);
+  DMA_DeInit(VCP_RX_DMA_STREAM);
+
+  DMA_StructInit(&DMA_InitStructure);
+  DMA_InitStructure.DMA_Channel = VCP_RX_DMA_CHANNEL;
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&EVAL_COM1->DR;
+  DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)APP_Rx_Buffer;
+  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
+  DMA_InitStructure.DMA_BufferSize = APP_RX_DATA_SIZE;
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+  DMA_Init(VCP_RX_DMA_STREAM, &DMA_InitStructure);
+
+  APP_Rx_ptr_in = 0;
+  DMA_ITConfig(VCP_RX_DMA_STREAM, DMA_IT_HT | DMA_IT_TC, ENABLE);
+  DMA_Cmd(VCP_RX_DMA_STREAM, ENABLE);
+
+  USART_DMACmd(EVAL_COM1, USART_DMAReq_Rx, ENABLE);
+  USART_ITConfig(EVAL_COM1, USART_IT_IDLE, ENABLE);
+
+  NVIC_InitStructure.NVIC_IRQChannel = VCP_RX_DMA_IRQn;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+  NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&NVIC_InitStructure);
+
+  NVIC_InitStructure.NVIC_IRQChannel = EVAL_COM1_IRQn;
+  NVIC_Init(&NVIC_InitStructure);
+}
+
+/**
+  * @brief  VCP_TxDmaInit
+  *         Prepare the EVAL_COM1 TX DMA; VCP_TxService points it at each
+  *         filled OUT buffer in turn.
+  * @param  None.
+  * @retval None.
+  */
+static void VCP_TxDmaInit(void)
+{
+  DMA_InitTypeDef  DMA_InitStructure;
+  NVIC_InitTypeDef NVIC_InitStructure;
+
+  RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
+
+  DMA_Cmd(VCP_TX_DMA_STREAM, DISABLE);
+  while (DMA_GetCmdStatus(VCP_TX_DMA_STREAM) != DISABLE);
+  DMA_DeInit(VCP_TX_DMA_STREAM);
+  VCP_TxBusy = 0;
+
+  DMA_StructInit(&DMA_InitStructure);
+  DMA_InitStructure.DMA_Channel = VCP_TX_DMA_CHANNEL;
+  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&EVAL_COM1->DR;
+  DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)VCP_RxPool[0];
+  DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+  DMA_InitStructure.DMA_BufferSize = 1;
+  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+  DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+  DMA_InitStructure.DMA_Priority = DMA_Priority_Medium;
+  DMA_Init(VCP_TX_DMA_STREAM, &DMA_InitStructure);
+  DMA_ITConfig(VCP_TX_DMA_STREAM, DMA_IT_TC, ENABLE);
+
+  USART_DMACmd(EVAL_COM1, USART_DMAReq_Tx, ENABLE);
+
+  NVIC_InitStructure.NVIC_IRQChannel = VCP_TX_DMA_IRQn;
+  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1;
+  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+  NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+  NVIC_Init(&NVIC_InitStructure);
+}
+
+/**
+  * @brief  VCP_TxService
+  *         Main loop side of the USB to UART path: lend the buffer the TX
+  *         DMA finished with back to the OUT endpoint, and start the DMA on
+  *         the next filled one. Data is never copied on the way through.
+  *         After a (re)configuration it restarts the CDC OUT rings, which
+  *         only this side may empty, and lends the pool again.
+  * @param  None.
+  * @retval None.
+  */
+void VCP_TxService(void)
+{
+  uint8_t  *buf;
+  uint32_t len, i;
+
+  if (VCP_TxBusy)
+  {
+    return;
+  }
+  /* (re)configured: every buffer came back, lend the whole pool again */
+  if (usbd_cdc_RxPending())
+  {
+    VCP_TxBuf = NULL;
+    usbd_cdc_RxRestart();
+    for (i = 0; i < VCP_RX_BUF_NUM; i++)
+    {
+      usbd_cdc_RxLend(VCP_RxPool[i], VCP_RX_BUF_SIZE);
+    }
+    return;
+  }
+  if (VCP_TxBuf != NULL)
+  {
+    usbd_cdc_RxLend(VCP_TxBuf, VCP_RX_BUF_SIZE);
+    VCP_TxBuf = NULL;
+  }
+
+  while ((buf = usbd_cdc_RxGet(&len)) != NULL && len == 0)
+  {
+    usbd_cdc_RxLend(buf, VCP_RX_BUF_SIZE);
+  }
+  if (buf == NULL)
+  {
+    return;
+  }
+
+  VCP_TxBuf = buf;
+  VCP_TxBusy = 1;
+  DMA_ClearFlag(VCP_TX_DMA_STREAM, VCP_TX_DMA_FLAGS);
+  DMA_MemoryTargetConfig(VCP_TX_DMA_STREAM, (uint32_t)buf, DMA_Memory_0);
+  DMA_SetCurrDataCounter(VCP_TX_DMA_STREAM, len);
+  DMA_Cmd(VCP_TX_DMA_STREAM, ENABLE);
+}
+
+/**
+  * @brief  VCP_TX_DMA_IRQHandler
+  *         TX buffer drained into the USART: let the main loop recycle it
+  * @param  None.
+  * @retval None.
+  */
+void VCP_TX_DMA_IRQHandler(void)
+{
+  if (DMA_GetITStatus(VCP_TX_DMA_STREAM, VCP_TX_DMA_IT_TC) != RESET)
+  {
+    DMA_ClearITPendingBit(VCP_TX_DMA_STREAM, VCP_TX_DMA_IT_TC);
+    VCP_TxBusy = 0;
+    APP_EventPost(APP_EVT_CDC_OUT);
+  }
+}
+
+/**
+  * @brief  VCP_RxDmaUpdate
+  *         Publish how far the RX DMA has written into APP_Rx_Buffer
+  * @param  None.
+  * @retval None.
+  */
+static void VCP_RxDmaUpdate(void)
+{
+  uint32_t in = APP_RX_DATA_SIZE - DMA_GetCurrDataCounter(VCP_RX_DMA_STREAM);
+  uint32_t prev = APP_Rx_ptr_in;
+  uint32_t used, moved;
+
+  if (in >= APP_RX_DATA_SIZE)
+  {
+    in = 0;
+  }
+  /* The half and full transfer interrupts bound the move to less than the
+     ring. Reaching ptr_out means the oldest unsent bytes were overwritten. */
+  used  = (prev + APP_RX_DATA_SIZE - APP_Rx_ptr_out) % APP_RX_DATA_SIZE;
+  moved = (in + APP_RX_DATA_SIZE - prev) % APP_RX_DATA_SIZE;
+  if (used + moved >= APP_RX_DATA_SIZE)
+  {
+    VCP_RxOverruns++;
+    APP_Rx_overrun = 1;
+    TRACE1(TRACE_VCP_RX_OVERRUN, VCP_RxOverruns);
+  }
+  APP_Rx_ptr_in = in;
+  APP_EventPost(APP_EVT_UART_RX);
+}
+
+/**
+  * @brief  VCP_RxOverrunCount
+  *         Number of times UART data was lost because the CDC IN side did
+  *         not keep up with the RX DMA
+  * @param  None.
+  * @retval count
+  */
+uint32_t VCP_RxOverrunCount(void)
+{
+  return VCP_RxOverruns;
+}
+
+/**
+  * @brief  VCP_RX_DMA_IRQHandler
+  *         Half and full transfer of the RX ring: keeps long bursts flowing
+  *         before the line goes idle.
+  * @param  None.
+  * @retval None.
+  */
+void VCP_RX_DMA_IRQHandler(void)
+{
+  if (DMA_GetITStatus(VCP_RX_DMA_STREAM, VCP_RX_DMA_IT_HT) != RESET)
+  {
+    DMA_ClearITPendingBit(VCP_RX_DMA_STREAM, VCP_RX_DMA_IT_HT);
+  }
+  if (DMA_GetITStatus(VCP_RX_DMA_STREAM, VCP_RX_DMA_IT_TC) != RESET)
+  {
+    DMA_ClearITPendingBit(VCP_RX_DMA_STREAM, VCP_RX_DMA_IT_TC);
+  }
+  VCP_RxDmaUpdate();
+}
+
 /**
   * @brief  EVAL_COM_IRQHandler
   *         
@@ -509,32 +783,33 @@ static uint16_t VCP_COMConfig(uint8_t Conf)
 void EVAL_COM4_IRQHandler(void)
 {
     uint16_t  data;
-    printf("EVAL_COM4_IRQHandler 111 \n");
+    TRACE0(TRACE_COM4_IRQ);
     
   if (USART_GetITStatus(EVAL_COM4, USART_IT_RXNE) != RESET)
   {
     /* Send the received data to the PC Host*/
 //    VCP_DataTx ();
     data = USART_ReceiveData(EVAL_COM4);
-    printf("EVAL_COM4_IRQHandler 222 data=%x \n",data);
+    TRACE1(TRACE_COM4_RX, data);
   }
 
   /* If overrun condition occurs, clear the ORE flag and recover communication */
   if (USART_GetFlagStatus(EVAL_COM4, USART_FLAG_ORE) != RESET)
   {
     data = USART_ReceiveData(EVAL_COM4);
-    printf("EVAL_COM4_IRQHandler 333 data=%x \n",data);
+    TRACE1(TRACE_COM4_ORE, data);
   }
 }
 #endif
 
 void EVAL_COM_IRQHandler(void)
 {
-  if (USART_GetITStatus(EVAL_COM1, USART_IT_RXNE) != RESET)
+  if (USART_GetITStatus(EVAL_COM1, USART_IT_IDLE) != RESET)
   {
-    /* Send the received data to the PC Host*/
-//    VCP_DataTx ();
+    /* Line went idle: hand the tail of the burst to the PC Host now. The
+       SR then DR read clears IDLE; the DMA already took the data. */
     (void)USART_ReceiveData(EVAL_COM1);
+    VCP_RxDmaUpdate();
   }
 
   /* If overrun condition occurs, clear the ORE flag and recover communication */
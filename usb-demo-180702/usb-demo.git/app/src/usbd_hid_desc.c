@@ -58,6 +58,11 @@
 #define USBD_HID_VID                     FW_VID
 #define USBD_HID_PID                     FW_PID
 
+/* The composite gets its own PID: hosts cache the driver binding per PID */
+#ifndef USBD_COMP_PID
+ #define USBD_COMP_PID                   (FW_PID + 1)
+#endif
+
 #define USBD_HID_LANGID_STRING            0x409
 #define USBD_HID_MANUFACTURER_STRING      "STMicroelectronics"
 #define USBD_HID_PRODUCT_FS_STRING        "Joystick in FS Mode"
@@ -93,6 +98,20 @@ USBD_DEVICE USR_HID_desc =
   USBD_HID_InterfaceStrDescriptor,
 };
 
+#ifdef USBD_COMPOSITE
+/* same strings, composite device descriptor */
+USBD_DEVICE USR_COMP_desc =
+{
+  USBD_COMP_DeviceDescriptor,
+  USBD_HID_LangIDStrDescriptor, 
+  USBD_HID_ManufacturerStrDescriptor,
+  USBD_HID_ProductStrDescriptor,
+  USBD_HID_SerialStrDescriptor,
+  USBD_HID_ConfigStrDescriptor,
+  USBD_HID_InterfaceStrDescriptor,
+};
+#endif
+
 
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
   #if defined ( __ICCARM__ ) /*!< IAR Compiler */
@@ -122,6 +141,36 @@ __ALIGN_BEGIN uint8_t USBD_HID_DeviceDesc[USB_SIZ_DEVICE_DESC] __ALIGN_END =
   USBD_CFG_MAX_NUM            /*bNumConfigurations*/
 }; /* USB_DeviceDescriptor */
 
+#ifdef USBD_COMPOSITE
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4   
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+/* USB Standard Device Descriptor, composite with IADs */
+__ALIGN_BEGIN uint8_t USBD_COMP_DeviceDesc[USB_SIZ_DEVICE_DESC] __ALIGN_END =
+{
+  0x12,                       /*bLength */
+  USB_DEVICE_DESCRIPTOR_TYPE, /*bDescriptorType*/
+  0x00,                       /*bcdUSB */
+  0x02,
+  0xEF,                       /*bDeviceClass: Miscellaneous*/
+  0x02,                       /*bDeviceSubClass: Common Class*/
+  0x01,                       /*bDeviceProtocol: Interface Association*/
+  USB_OTG_MAX_EP0_SIZE,      /*bMaxPacketSize*/
+  LOBYTE(USBD_HID_VID),           /*idVendor*/
+  HIBYTE(USBD_HID_VID),           /*idVendor*/
+  LOBYTE(USBD_COMP_PID),          /*idProduct*/
+  HIBYTE(USBD_COMP_PID),          /*idProduct*/
+  0x00,                       /*bcdDevice rel. 2.00*/
+  0x02,
+  USBD_IDX_MFC_STR,           /*Index of manufacturer  string*/
+  USBD_IDX_PRODUCT_STR,       /*Index of product string*/
+  USBD_IDX_SERIAL_STR,        /*Index of serial number string*/
+  USBD_CFG_MAX_NUM            /*bNumConfigurations*/
+}; /* USB_DeviceDescriptor */
+#endif
+
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
   #if defined ( __ICCARM__ ) /*!< IAR Compiler */
     #pragma data_alignment=4   
@@ -181,6 +230,21 @@ uint8_t *  USBD_HID_DeviceDescriptor( uint8_t speed , uint16_t *length)
   return (uint8_t*)USBD_HID_DeviceDesc;
 }
 
+#ifdef USBD_COMPOSITE
+/**
+* @brief  USBD_COMP_DeviceDescriptor 
+*         return the composite device descriptor
+* @param  speed : current device speed
+* @param  length : pointer to data length variable
+* @retval pointer to descriptor buffer
+*/
+uint8_t *  USBD_COMP_DeviceDescriptor( uint8_t speed , uint16_t *length)
+{
+  *length = sizeof(USBD_COMP_DeviceDesc);
+  return (uint8_t*)USBD_COMP_DeviceDesc;
+}
+#endif
+
 /**
 * @brief  USBD_HID_LangIDStrDescriptor 
 *         return the LangID string descriptor
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include "usbd_trace.h"
+#include "app_event.h"
+
+#define X(id, fmt)  fmt,
+static const char * const USBD_TRACE_Fmt[TRACE_ID_MAX] = {
+    USBD_TRACE_LIST
+};
+#undef X
+
+static USBD_TRACE_rec USBD_TRACE_Buf[USBD_TRACE_SIZE];
+static __IO u32 USBD_TRACE_Wr;
+static u32 USBD_TRACE_Rd;
+u32 USBD_TRACE_Lost;
+
+/* start the cycle counter used for the time stamps */
+void USBD_TRACE_Init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void USBD_TRACE_Put(u32 id, u32 a0, u32 a1, u32 a2, u32 a3)
+{
+    USBD_TRACE_rec *r;
+    u32 n;
+
+    do {
+        n = __LDREXW((uint32_t *)&USBD_TRACE_Wr);
+    } while (__STREXW(n + 1, (uint32_t *)&USBD_TRACE_Wr));
+
+    r = &USBD_TRACE_Buf[n & USBD_TRACE_MASK];
+    r->seq = 0;
+    r->ts = DWT->CYCCNT;
+    r->id = id;
+    r->arg[0] = a0;
+    r->arg[1] = a1;
+    r->arg[2] = a2;
+    r->arg[3] = a3;
+    __DMB();                        /* publish the record before its seq */
+    r->seq = n + 1;
+    APP_EventPost(APP_EVT_TRACE);
+}
+
+/* main loop only: format and print the records written so far */
+void USBD_TRACE_Drain(void)
+{
+    USBD_TRACE_rec rec, *r;
+    u32 wr;
+
+    for (;;) {
+        wr = USBD_TRACE_Wr;
+        if (wr - USBD_TRACE_Rd > USBD_TRACE_SIZE) {
+            /* overwritten before they were read */
+            USBD_TRACE_Lost += wr - USBD_TRACE_Rd - USBD_TRACE_SIZE;
+            USBD_TRACE_Rd = wr - USBD_TRACE_SIZE;
+        }
+        r = &USBD_TRACE_Buf[USBD_TRACE_Rd & USBD_TRACE_MASK];
+        if (r->seq != USBD_TRACE_Rd + 1)
+            break;                  /* empty, or still being written */
+        __DMB();
+        rec = *r;
+        __DMB();
+        /* reused by a writer before or while copied */
+        if (rec.seq != USBD_TRACE_Rd + 1 || r->seq != rec.seq) {
+            USBD_TRACE_Lost++;
+            USBD_TRACE_Rd++;
+            continue;
+        }
+        USBD_TRACE_Rd++;
+        if (rec.id < TRACE_ID_MAX) {
+            printf("[%10u] ", rec.ts);
+            printf(USBD_TRACE_Fmt[rec.id], rec.arg[0], rec.arg[1], rec.arg[2], rec.arg[3]);
+        }
+    }
+}
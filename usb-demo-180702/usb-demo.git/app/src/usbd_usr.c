@@ -31,6 +31,8 @@
 //#include "lcd_log.h"
 
 #include "usb_conf.h"
+#include "app_event.h"
+#include "usbd_trace.h"
 
 #include <stdio.h>
 
@@ -228,7 +230,8 @@ void USBD_USR_FS_DeviceConfigured (void)
 {
 //  LCD_UsrLog("> HID Interface started.\n");
     my_usb_status |= 1;
-    printf("> HID Interface started.\n");
+    APP_EventPost(APP_EVT_USB_STATE);
+    TRACE0(TRACE_HID_STARTED);
 }
 /**
 * @brief  USBD_USR_FS_ResetUSBDevice 
@@ -240,7 +243,8 @@ void USBD_USR_FS_DeviceSuspended(void)
 //  LCD_UsrLog("> HID Device in Suspend Mode.\n");
   /* Users can do their application actions here for the USB-Reset */
     my_usb_status &= ~1;
-    printf("> HID Device in Suspend Mode.\n");
+    APP_EventPost(APP_EVT_USB_STATE);
+    TRACE0(TRACE_HID_SUSPEND);
 }
 
 
@@ -323,7 +327,8 @@ void USBD_USR_HS_DeviceConfigured (void)
 {
 //  LCD_UsrLog("> MSC Interface started.\n");
     my_usb_status |= 0x10;
-    printf("> CDC Interface started.\n");
+    APP_EventPost(APP_EVT_USB_STATE);
+    TRACE0(TRACE_CDC_STARTED);
 }
 /**
 * @brief  USBD_USR_FS_ResetUSBDevice 
@@ -335,7 +340,8 @@ void USBD_USR_HS_DeviceSuspended(void)
 //  LCD_UsrLog("> MSC Device in Suspend Mode.\n");
   /* Users can do their application actions here for the USB-Reset */
     my_usb_status &= ~0x10;
-    printf("> CDC Device in Suspend Mode.\n");
+    APP_EventPost(APP_EVT_USB_STATE);
+    TRACE0(TRACE_CDC_SUSPEND);
 }
 
 
@@ -0,0 +1,39 @@
+/**
+  ******************************************************************************
+  * @file    diskio.h
+  * @brief   Host build stand-in for the FatFs disk interface that
+  *          usbh_msc_fatfs.c implements
+  ******************************************************************************
+  */
+
+#ifndef _DISKIO
+#define _DISKIO
+
+#define _READONLY       0
+#define _USE_IOCTL      1
+
+typedef unsigned char   BYTE;
+typedef unsigned short  WORD;
+typedef unsigned int    UINT;
+typedef unsigned long   DWORD;
+
+typedef BYTE DSTATUS;
+
+typedef enum {
+  RES_OK = 0,
+  RES_ERROR,
+  RES_WRPRT,
+  RES_NOTRDY,
+  RES_PARERR
+} DRESULT;
+
+#define STA_NOINIT      0x01
+#define STA_NODISK      0x02
+#define STA_PROTECT     0x04
+
+#define CTRL_SYNC           0
+#define GET_SECTOR_COUNT    1
+#define GET_SECTOR_SIZE     2
+#define GET_BLOCK_SIZE      3
+
+#endif /* _DISKIO */
@@ -0,0 +1,47 @@
+/**
+  ******************************************************************************
+  * @file    stm32f4xx.h
+  * @brief   Host build stand-in for the device header: the Cortex-M
+  *          intrinsics and the DWT cycle counter of app_event.c,
+  *          usbd_trace.c and usbd_stats.h. Each test supplies them, so it
+  *          can play the interrupts that land between two instructions and
+  *          set the time.
+  ******************************************************************************
+  */
+
+#ifndef __STM32F4xx_H
+#define __STM32F4xx_H
+
+#include <stdint.h>
+
+#ifndef __IO
+#define __IO            volatile
+#endif
+
+uint32_t __LDREXW(uint32_t *addr);
+uint32_t __STREXW(uint32_t value, uint32_t *addr);
+void __disable_irq(void);
+void __enable_irq(void);
+void __WFI(void);
+uint32_t __CLZ(uint32_t value);
+
+typedef struct
+{
+  volatile uint32_t CTRL;
+  volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+  volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern DWT_Type       DWT_Stub;
+extern CoreDebug_Type CoreDebug_Stub;
+
+#define DWT                         (&DWT_Stub)
+#define CoreDebug                   (&CoreDebug_Stub)
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+
+#endif /* __STM32F4xx_H */
@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    usb_conf.h
+  * @brief   Host build stand-in for app/inc/usb_conf.h: the types and
+  *          intrinsics the units under test take from the device headers
+  ******************************************************************************
+  */
+
+#ifndef __USB_CONF__H__
+#define __USB_CONF__H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#define __IO            volatile
+#define __DMB()         __sync_synchronize()
+#define __ALIGN_BEGIN
+#define __ALIGN_END     __attribute__ ((aligned (4)))
+/* host mode FIFO split, as a host application's usb_conf.h sets it; a
+   device test passes the Rx sizes of app/inc/usb_conf.h instead */
+#ifndef RX_FIFO_FS_SIZE
+#define RX_FIFO_FS_SIZE                 128
+#endif
+#define TXH_NP_FS_FIFOSIZ               96
+#define TXH_P_FS_FIFOSIZ                96
+#ifndef RX_FIFO_HS_SIZE
+#define RX_FIFO_HS_SIZE                 512
+#endif
+#define TXH_NP_HS_FIFOSIZ               256
+#define TXH_P_HS_FIFOSIZ                256
+
+/* ARMCC header-only inlines; the libc headers above must not see this */
+#define __inline        static inline
+
+#endif /* __USB_CONF__H__ */
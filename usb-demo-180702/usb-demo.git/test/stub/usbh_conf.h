@@ -0,0 +1,15 @@
+/**
+  ******************************************************************************
+  * @file    usbh_conf.h
+  * @brief   Host build stand-in for the application's usbh_conf.h: the
+  *          library template with its defaults, plus what an application
+  *          adds to it
+  ******************************************************************************
+  */
+
+#include "usbh_conf_template.h"
+
+#define USBH_MAX_DATA_BUFFER            0x400
+
+/* the class drivers report through the application's LCD log */
+#define LCD_ErrLog(...)                 printf(__VA_ARGS__)
@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file    usbh_msc.h
+  * @brief   Host build stand-in for the MSC class, BOT, SCSI and HCD headers:
+  *          just what usbh_msc_io.c and usbh_msc_cache.c use. The SCSI
+  *          commands, the BOT machine and the connection state are supplied
+  *          by each test.
+  ******************************************************************************
+  */
+
+#ifndef __USBH_MSC_STUB_H
+#define __USBH_MSC_STUB_H
+
+/* the headers this one replaces */
+#define __USBH_MSC_CORE_H
+#define __USBH_MSC_SCSI_H__
+#define __USBH_MSC_BOT_H__
+#define __USB_HCD_H__
+
+typedef struct { int dummy; } USB_OTG_CORE_HANDLE;
+typedef struct { int dummy; } USBH_HOST;
+
+typedef enum {
+  USBH_MSC_OK = 0,
+  USBH_MSC_FAIL = 1,
+  USBH_MSC_PHASE_ERROR = 2,
+  USBH_MSC_BUSY = 3
+}USBH_MSC_Status_TypeDef;
+
+typedef enum {
+  CMD_UNINITIALIZED_STATE =0,
+  CMD_SEND_STATE,
+  CMD_WAIT_STATUS
+} CMD_STATES_TypeDef;
+
+typedef struct
+{
+  uint32_t MSCapacity;          /* last LBA */
+} MassStorageParameter_TypeDef;
+
+typedef struct
+{
+  uint8_t CmdStateMachine;
+} USBH_BOTXfer_TypeDef;
+
+#define USBH_MSC_PAGE_LENGTH              512
+
+extern MassStorageParameter_TypeDef USBH_MSC_Param;
+extern USBH_BOTXfer_TypeDef USBH_MSC_BOTXferParam;
+
+uint8_t  USBH_MSC_Write10(USB_OTG_CORE_HANDLE *pdev, uint8_t *, uint32_t, uint32_t);
+uint8_t  USBH_MSC_Read10(USB_OTG_CORE_HANDLE *pdev, uint8_t *, uint32_t, uint32_t);
+void     USBH_MSC_HandleBOTXfer(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost);
+uint32_t HCD_IsDeviceConnected(USB_OTG_CORE_HANDLE *pdev);
+
+#endif /* __USBH_MSC_STUB_H */
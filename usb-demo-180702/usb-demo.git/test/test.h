@@ -0,0 +1,33 @@
+/**
+  ******************************************************************************
+  * @file    test.h
+  * @brief   Minimal check macros for the host unit tests
+  ******************************************************************************
+  */
+
+#ifndef __TEST_H
+#define __TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int test_failed = 0;
+
+#define CHECK(cond)                                                       \
+  do {                                                                    \
+    if (!(cond)) {                                                        \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);     \
+      test_failed++;                                                      \
+    }                                                                     \
+  } while (0)
+
+#define RUN(fn)                                                           \
+  do {                                                                    \
+    int before = test_failed;                                             \
+    fn();                                                                 \
+    printf("%-40s %s\n", #fn, (test_failed == before) ? "ok" : "FAIL");   \
+  } while (0)
+
+#define TEST_RESULT()   (test_failed ? EXIT_FAILURE : EXIT_SUCCESS)
+
+#endif /* __TEST_H */
@@ -0,0 +1,189 @@
+/**
+  ******************************************************************************
+  * @file    test_app_event.c
+  * @brief   Host tests of the main loop events: posts from interrupt
+  *          handlers are never lost, whether they land inside another post
+  *          or between the pending test and the WFI of APP_EventWait
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "app_event.h"
+
+/* ---- the Cortex-M core, one instruction at a time ----------------------- */
+
+static int      primask;        /* interrupts masked */
+static int      exclusive;      /* LDREX monitor armed */
+static uint32_t isr_evt;        /* what the pending interrupt posts */
+static int      isr_at_ldrex;   /* interrupt right after the next LDREX */
+static int      wfi_num;
+static int      wfi_masked;     /* WFI entered with PRIMASK set */
+static int      wfi_idle;       /* WFI with nothing pending: slept a tick */
+
+/* the pending interrupt runs, as soon as it is unmasked */
+static void isr(void)
+{
+  uint32_t evt = isr_evt;
+
+  isr_evt = 0;
+  /* exception entry clears the monitor of the code it interrupts */
+  exclusive = 0;
+  APP_EventPost(evt);
+  exclusive = 0;
+}
+
+uint32_t __LDREXW(uint32_t *addr)
+{
+  uint32_t v = *addr;
+
+  exclusive = 1;
+  if (isr_at_ldrex && isr_evt && !primask)
+  {
+    isr_at_ldrex = 0;
+    isr();
+  }
+  return v;
+}
+
+uint32_t __STREXW(uint32_t value, uint32_t *addr)
+{
+  if (!exclusive)
+    return 1;
+  exclusive = 0;
+  *addr = value;
+  return 0;
+}
+
+void __disable_irq(void) { primask = 1; }
+
+void __enable_irq(void)
+{
+  primask = 0;
+  if (isr_evt)
+    isr();
+}
+
+/* wakes on a pending interrupt even while masked, without running it */
+void __WFI(void)
+{
+  if (++wfi_num > 1000)
+  {
+    printf("APP_EventWait never returns\n");
+    exit(EXIT_FAILURE);
+  }
+  wfi_masked += primask;
+  if (!isr_evt)
+  {
+    /* nothing pending: sleep until the next SysTick */
+    wfi_idle++;
+    isr_evt = APP_EVT_TICK;
+  }
+}
+
+/* take whatever is left from the test before */
+static void drain(void)
+{
+  isr_evt = APP_EVT_TICK;
+  APP_EventWait();
+  primask = exclusive = isr_at_ldrex = 0;
+  wfi_num = wfi_masked = wfi_idle = 0;
+  isr_evt = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void test_post_wait(void)
+{
+  drain();
+  APP_EventPost(APP_EVT_HID_OUT);
+  APP_EventPost(APP_EVT_UART_RX);
+  APP_EventPost(APP_EVT_HID_OUT);
+  CHECK(APP_EventWait() == (APP_EVT_HID_OUT | APP_EVT_UART_RX));
+  CHECK(wfi_num == 0 && primask == 0);
+}
+
+static void test_wait_clears(void)
+{
+  drain();
+  APP_EventPost(APP_EVT_TRACE);
+  CHECK(APP_EventWait() == APP_EVT_TRACE);
+  /* nothing left: the next wait sleeps until the tick */
+  CHECK(APP_EventWait() == APP_EVT_TICK);
+  CHECK(wfi_num == 1);
+}
+
+static void test_wait_sleeps_masked(void)
+{
+  drain();
+  /* the test and the WFI run with interrupts masked, the interrupt is
+     taken once they are unmasked again and the loop sees its event */
+  CHECK(APP_EventWait() == APP_EVT_TICK);
+  CHECK(wfi_num == 1 && wfi_masked == 1 && wfi_idle == 1);
+  CHECK(primask == 0);
+}
+
+static void test_post_between_test_and_wfi(void)
+{
+  drain();
+  /* the USB interrupt fires once the loop found nothing pending: masked,
+     it stays pending and the WFI returns at once instead of sleeping a
+     tick on an event already posted */
+  isr_evt = APP_EVT_USB_STATE;
+  CHECK(APP_EventWait() == APP_EVT_USB_STATE);
+  CHECK(wfi_num == 1 && wfi_idle == 0);
+}
+
+static void test_post_preempted(void)
+{
+  drain();
+  /* an ISR posts between the LDREX and the STREX of a main loop post:
+     the STREX fails and the retry keeps both bits */
+  isr_evt = APP_EVT_CDC_OUT;
+  isr_at_ldrex = 1;
+  APP_EventPost(APP_EVT_HID_OUT);
+  CHECK(isr_at_ldrex == 0);
+  CHECK(APP_EventWait() == (APP_EVT_HID_OUT | APP_EVT_CDC_OUT));
+}
+
+static int      run_log[8];
+static int      run_num;
+
+static void task_a(void) { run_log[run_num++] = 'a'; }
+static void task_b(void) { run_log[run_num++] = 'b'; }
+static void task_c(void) { run_log[run_num++] = 'c'; }
+
+static const APP_Task_TypeDef tasks[] =
+{
+  { APP_EVT_USB_STATE,                  task_a },
+  { APP_EVT_HID_OUT | APP_EVT_UART_RX,  task_b },
+  { APP_EVT_TICK | APP_EVT_USB_STATE,   task_c },
+};
+
+static void test_run_table_order(void)
+{
+  run_num = 0;
+  APP_EventRun(tasks, 3, APP_EVT_USB_STATE | APP_EVT_UART_RX);
+  CHECK(run_num == 3 && run_log[0] == 'a' && run_log[1] == 'b' && run_log[2] == 'c');
+
+  /* a task runs once, however many of its events are pending */
+  run_num = 0;
+  APP_EventRun(tasks, 3, APP_EVT_HID_OUT | APP_EVT_UART_RX);
+  CHECK(run_num == 1 && run_log[0] == 'b');
+
+  run_num = 0;
+  APP_EventRun(tasks, 3, APP_EVT_TRACE);
+  CHECK(run_num == 0);
+  APP_EventRun(tasks, 3, 0);
+  CHECK(run_num == 0);
+}
+
+int main(void)
+{
+  RUN(test_post_wait);
+  RUN(test_wait_clears);
+  RUN(test_wait_sleeps_masked);
+  RUN(test_post_between_test_and_wfi);
+  RUN(test_post_preempted);
+  RUN(test_run_table_order);
+  return TEST_RESULT();
+}
@@ -0,0 +1,441 @@
+/**
+  ******************************************************************************
+  * @file    test_cdc.c
+  * @brief   Host tests of the data pipes of the host CDC class
+  *          (usbh_cdc_core.c), with the channel handlers run as the end of
+  *          each transfer: the receive ring re-armed from the handler and
+  *          read in place, the device NAKed while it is full, and the
+  *          transmit queue sent packet by packet, resent on a NAK and its
+  *          items handed back in order.
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usbh_cdc_core.c"
+
+#define HC_IN           1
+#define HC_OUT          2
+#define MPS             64
+
+static USB_OTG_CORE_HANDLE    core;
+static USBH_HOST              host;
+
+/* ---- the device: a transfer stays on the bus until the test ends it ------ */
+
+static struct
+{
+  void      (*handler[4])(void *pdev, uint8_t hc_num);
+  HC_NAK_POLICY nak[4];
+  URB_STATE urb[4];
+  uint32_t  xfer[4];
+  /* IN: the buffer the pipe is armed on */
+  uint8_t   *in_buff;
+  uint16_t  in_len;
+  int       in_arms;
+  /* OUT: the packet on the bus, and every byte acknowledged */
+  uint8_t   *out_buff;
+  uint16_t  out_len;
+  int       out_sends;
+  uint8_t   out[1024];
+  uint32_t  out_bytes;
+  int       clears;
+  int       halts;
+} modem;
+
+/* and what the application was told */
+static struct
+{
+  CDC_TxItem_TypeDef *sent[16];
+  int       sends;
+  int       receives;
+  int       full[4];
+  int       fulls;
+} app;
+
+static void app_send(CDC_TxItem_TypeDef *item)
+{
+  app.sent[app.sends++ & 15] = item;
+}
+
+static void app_receive(void)
+{
+  app.receives++;
+}
+
+static void app_rx_full(uint8_t full)
+{
+  app.full[app.fulls++ & 3] = full;
+}
+
+static CDC_Usercb_TypeDef app_cb = { app_send, app_receive, app_rx_full };
+
+/* ---- what usbh_cdc_core.c links against --------------------------------- */
+
+URB_STATE HCD_GetURB_State(USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num)
+{
+  return modem.urb[ch_num];
+}
+
+uint32_t HCD_GetXferCnt(USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num)
+{
+  return modem.xfer[ch_num];
+}
+
+void HCD_HC_SetHandler(USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num,
+                       void (*handler)(void *pdev, uint8_t hc_num))
+{
+  modem.handler[hc_num] = handler;
+}
+
+void HCD_HC_SetNakPolicy(USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num,
+                         HC_NAK_POLICY policy, uint8_t max_shift)
+{
+  modem.nak[hc_num] = policy;
+}
+
+uint32_t USB_OTG_HC_Halt(USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num)
+{
+  modem.halts++;
+  return 0;
+}
+
+USBH_Status USBH_BulkSendData(USB_OTG_CORE_HANDLE *pdev, uint8_t *buff,
+                              uint16_t length, uint8_t hc_num)
+{
+  modem.urb[hc_num] = URB_IDLE;
+  modem.out_buff = buff;
+  modem.out_len = length;
+  modem.out_sends++;
+  return USBH_OK;
+}
+
+USBH_Status USBH_BulkReceiveData(USB_OTG_CORE_HANDLE *pdev, uint8_t *buff,
+                                 uint16_t length, uint8_t hc_num)
+{
+  modem.urb[hc_num] = URB_IDLE;
+  modem.in_buff = buff;
+  modem.in_len = length;
+  modem.in_arms++;
+  return USBH_OK;
+}
+
+USBH_Status USBH_ClrFeature(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                            uint8_t ep_num, uint8_t hc_num)
+{
+  modem.clears++;
+  return USBH_OK;
+}
+
+/* the class set-up, not run here */
+uint8_t USBH_Open_Channel(USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num,
+                          uint8_t dev_address, uint8_t speed,
+                          uint8_t ep_type, uint16_t mps)
+{
+  return HC_OK;
+}
+
+uint8_t USBH_Alloc_Channel(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr)
+{
+  return 0;
+}
+
+uint8_t USBH_Free_Channel(USB_OTG_CORE_HANDLE *pdev, uint8_t idx)
+{
+  return USBH_OK;
+}
+
+USBH_Status CDC_GETLineCoding(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+{
+  return USBH_OK;
+}
+
+USBH_Status CDC_SETLineCoding(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+{
+  return USBH_OK;
+}
+
+USBH_Status CDC_SETControlLineState(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+{
+  return USBH_OK;
+}
+
+/* ---- the host ----------------------------------------------------------- */
+
+static void cdc_init(void)
+{
+  memset(&modem, 0, sizeof(modem));
+  memset(&app, 0, sizeof(app));
+  memset(&CDC_Rx, 0, sizeof(CDC_Rx));
+  memset(&CDC_Tx, 0, sizeof(CDC_Tx));
+  CDC_Machine.CDC_DataItf.hc_num_in = HC_IN;
+  CDC_Machine.CDC_DataItf.hc_num_out = HC_OUT;
+  CDC_Machine.CDC_DataItf.length = MPS;
+  RX_Enabled = 0;
+  CDC_InitTxRxParam(&core);
+  CDC_RegisterUserCb(&app_cb);
+}
+
+/* the IN transfer ends with len bytes of b, the handler runs */
+static void in_end(URB_STATE urb, uint8_t b, uint16_t len)
+{
+  CHECK(modem.in_buff != 0 && len <= modem.in_len);
+  memset(modem.in_buff, b, len);
+  modem.in_buff = 0;
+  modem.urb[HC_IN] = urb;
+  modem.xfer[HC_IN] = len;
+  modem.handler[HC_IN](&core, HC_IN);
+}
+
+/* the OUT transfer ends, the handler runs */
+static void out_end(URB_STATE urb)
+{
+  uint8_t *buff = modem.out_buff;
+
+  CHECK(buff != 0);
+  modem.out_buff = 0;
+  if (urb == URB_DONE)
+  {
+    memcpy(modem.out + modem.out_bytes, buff, modem.out_len);
+    modem.out_bytes += modem.out_len;
+  }
+  modem.urb[HC_OUT] = urb;
+  modem.handler[HC_OUT](&core, HC_OUT);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void test_rx_ring(void)
+{
+  uint8_t *data;
+  int i;
+
+  cdc_init();
+  CHECK(modem.handler[HC_IN] == CDC_RxHandler && modem.handler[HC_OUT] == CDC_TxHandler);
+  CHECK(modem.nak[HC_IN] == HC_NAK_NEXT_FRAME && modem.nak[HC_OUT] == HC_NAK_PING);
+  CDC_ProcessReception(&core, &host);
+  CHECK(modem.in_arms == 0);
+
+  /* the main loop arms the first slot, the handler the ones after */
+  CDC_StartReception(&core);
+  CDC_ProcessReception(&core, &host);
+  CHECK(modem.in_arms == 1 && modem.in_buff == CDC_Rx.data[0]);
+  CHECK(modem.in_len == CDC_RX_SLOT_SIZE);
+  in_end(URB_DONE, 0xA1, 100);
+  CHECK(modem.in_arms == 2 && modem.in_buff == CDC_Rx.data[1]);
+  /* a zero-length transfer keeps the slot */
+  in_end(URB_DONE, 0, 0);
+  CHECK(modem.in_arms == 3 && modem.in_buff == CDC_Rx.data[1]);
+  in_end(URB_DONE, 0xA2, CDC_RX_SLOT_SIZE);
+  CHECK(CDC_Rx.wr == 2 && CDC_Rx.Bytes == 100 + CDC_RX_SLOT_SIZE);
+
+  CDC_ProcessReception(&core, &host);
+  CHECK(app.receives == 1 && app.fulls == 0);
+  /* nothing for the main loop to arm */
+  CHECK(modem.in_arms == 4);
+
+  /* read in place, a slot in two goes */
+  CHECK(CDC_RxGet(&data) == 100 && data == CDC_Rx.data[0] && data[99] == 0xA1);
+  CDC_RxRelease(40);
+  CHECK(CDC_RxGet(&data) == 60 && data == &CDC_Rx.data[0][40]);
+  CDC_RxRelease(60);
+  CHECK(CDC_RxGet(&data) == CDC_RX_SLOT_SIZE && data[0] == 0xA2);
+  CDC_RxRelease(CDC_RX_SLOT_SIZE);
+  CHECK(CDC_RxGet(&data) == 0);
+  CDC_RxRelease(1);
+  CHECK(CDC_Rx.rd == 2 && CDC_Rx.offset == 0);
+
+  /* stopped: the transfer on the bus ends without a re-arm */
+  CDC_StopReception(&core);
+  CHECK(modem.halts == 1);
+  in_end(URB_DONE, 0xA3, 8);
+  CHECK(CDC_Rx.armed == 0 && modem.in_arms == 4 && CDC_Rx.wr == 3);
+  for (i = 0; i < 3; i++)
+  {
+    CDC_ProcessReception(&core, &host);
+  }
+  CHECK(modem.in_arms == 4);
+  CHECK(CDC_RxGet(&data) == 8 && data[0] == 0xA3);
+}
+
+/* a full ring leaves the device NAKed until a slot is read */
+static void test_rx_full(void)
+{
+  uint8_t *data;
+  int i;
+
+  cdc_init();
+  CDC_StartReception(&core);
+  CDC_ProcessReception(&core, &host);
+  for (i = 0; i < CDC_RX_SLOTS; i++)
+  {
+    in_end(URB_DONE, i, 10 + i);
+  }
+  CHECK(CDC_Rx.wr == CDC_RX_SLOTS && CDC_Rx.armed == 0 && CDC_Rx.Stalls == 1);
+  CHECK(modem.in_arms == CDC_RX_SLOTS && modem.in_buff == 0);
+
+  CDC_ProcessReception(&core, &host);
+  CHECK(app.fulls == 1 && app.full[0] == 1);
+  CHECK(modem.in_arms == CDC_RX_SLOTS);
+  /* told once */
+  CDC_ProcessReception(&core, &host);
+  CHECK(app.fulls == 1);
+
+  CHECK(CDC_RxGet(&data) == 10 && data[0] == 0);
+  CDC_RxRelease(10);
+  CDC_ProcessReception(&core, &host);
+  CHECK(app.fulls == 2 && app.full[1] == 0);
+  /* into the slot just read */
+  CHECK(modem.in_arms == CDC_RX_SLOTS + 1 && modem.in_buff == CDC_Rx.data[0]);
+  in_end(URB_DONE, 0x55, 4);
+  for (i = 1; i < CDC_RX_SLOTS; i++)
+  {
+    CHECK(CDC_RxGet(&data) == 10 + i && data[0] == i);
+    CDC_RxRelease(10 + i);
+  }
+  CHECK(CDC_RxGet(&data) == 4 && data[0] == 0x55);
+}
+
+/* a stall leaves the pipe to the main loop, which clears it and re-arms */
+static void test_rx_stall(void)
+{
+  cdc_init();
+  CDC_StartReception(&core);
+  CDC_ProcessReception(&core, &host);
+  in_end(URB_STALL, 0, 0);
+  CHECK(CDC_Rx.armed == 0 && CDC_Rx.wr == 0 && modem.in_arms == 1);
+  CDC_ProcessReception(&core, &host);
+  CHECK(modem.clears == 1 && modem.in_arms == 2 && modem.in_buff == CDC_Rx.data[0]);
+  in_end(URB_DONE, 1, 1);
+  CHECK(CDC_Rx.wr == 1 && modem.clears == 1);
+}
+
+static void test_tx_queue(void)
+{
+  static uint8_t a[100], b[MPS], c[10];
+  static CDC_TxItem_TypeDef it[4];
+  uint32_t i;
+
+  cdc_init();
+  memset(a, 'a', sizeof(a));
+  memset(b, 'b', sizeof(b));
+  memset(c, 'c', sizeof(c));
+  it[0].data = a; it[0].length = sizeof(a); it[0].next = &it[1];
+  it[1].data = b; it[1].length = sizeof(b); it[1].next = &it[2];
+  it[2].data = 0; it[2].length = 0;         it[2].next = &it[3];
+  it[3].data = c; it[3].length = sizeof(c); it[3].next = 0;
+  CHECK(CDC_Send(&it[0]) == 0);
+  CHECK(modem.out_sends == 0);
+
+  /* the main loop starts the queue, the handler sends it through */
+  CDC_ProcessTransmission(&core, &host);
+  CHECK(modem.out_sends == 1 && modem.out_buff == a && modem.out_len == MPS);
+  /* not again while it is on the bus */
+  CDC_ProcessTransmission(&core, &host);
+  CHECK(modem.out_sends == 1);
+  out_end(URB_DONE);
+  CHECK(modem.out_buff == a + MPS && modem.out_len == sizeof(a) - MPS);
+  /* a NAK resends the same packet */
+  out_end(URB_NOTREADY);
+  CHECK(modem.out_buff == a + MPS && modem.out_len == sizeof(a) - MPS);
+  CHECK(CDC_Tx.Naks == 1 && modem.out_sends == 3);
+  out_end(URB_DONE);
+  CHECK(modem.out_buff == b && modem.out_len == MPS);
+  out_end(URB_DONE);
+  /* the empty item goes without a transfer */
+  CHECK(modem.out_buff == c && modem.out_len == sizeof(c));
+  out_end(URB_DONE);
+  CHECK(CDC_Tx.busy == 0 && modem.out_buff == 0 && modem.out_sends == 5);
+  CHECK(modem.out_bytes == sizeof(a) + sizeof(b) + sizeof(c) && CDC_Tx.Bytes == modem.out_bytes);
+  for (i = 0; i < modem.out_bytes; i++)
+  {
+    if (modem.out[i] != ((i < sizeof(a)) ? 'a' : (i < sizeof(a) + sizeof(b)) ? 'b' : 'c'))
+      break;
+  }
+  CHECK(i == modem.out_bytes);
+
+  /* handed back by the main loop only, in order */
+  CHECK(app.sends == 0);
+  CDC_ProcessTransmission(&core, &host);
+  CHECK(app.sends == 4);
+  for (i = 0; i < 4; i++)
+  {
+    CHECK(app.sent[i] == &it[i]);
+  }
+  CHECK(modem.out_sends == 5);
+}
+
+/* the queue takes a whole list or none of it */
+static void test_tx_full(void)
+{
+  static uint8_t d[4];
+  static CDC_TxItem_TypeDef it[CDC_TX_QUEUE + 1];
+  int i;
+
+  cdc_init();
+  for (i = 0; i <= CDC_TX_QUEUE; i++)
+  {
+    it[i].data = d;
+    it[i].length = sizeof(d);
+    it[i].next = (i < CDC_TX_QUEUE) ? &it[i + 1] : 0;
+  }
+  CHECK(CDC_Send(&it[0]) == 1 && CDC_Tx.head == 0);
+  CHECK(CDC_Send(&it[1]) == 0 && CDC_Tx.head == CDC_TX_QUEUE);
+
+  /* sent but not handed back still takes its place */
+  CDC_ProcessTransmission(&core, &host);
+  out_end(URB_DONE);
+  it[0].next = 0;
+  CHECK(CDC_Send(&it[0]) == 1);
+  /* and CDC_SendData waits for all of it */
+  CDC_SendData(d, sizeof(d));
+  CHECK(CDC_Tx.head == CDC_TX_QUEUE);
+  CDC_ProcessTransmission(&core, &host);
+  CHECK(app.sends == 1 && CDC_Send(&it[0]) == 0);
+
+  for (i = 0; i < CDC_TX_QUEUE; i++)
+  {
+    out_end(URB_DONE);
+  }
+  CHECK(CDC_Tx.busy == 0);
+  CDC_ProcessTransmission(&core, &host);
+  CHECK(app.sends == CDC_TX_QUEUE + 1);
+  CDC_SendData(d, 3);
+  CDC_ProcessTransmission(&core, &host);
+  CHECK(modem.out_buff == d && modem.out_len == 3);
+  CDC_SendData(d, 2);
+  CHECK(CDC_Tx.head == CDC_TX_QUEUE + 2 && CDC_DataItem.length == 3);
+}
+
+/* a stall leaves the queue to the main loop, which clears it and resends */
+static void test_tx_stall(void)
+{
+  static uint8_t d[MPS + 8];
+  static CDC_TxItem_TypeDef it;
+
+  cdc_init();
+  it.data = d;
+  it.length = sizeof(d);
+  it.next = 0;
+  CDC_Send(&it);
+  CDC_ProcessTransmission(&core, &host);
+  out_end(URB_DONE);
+  out_end(URB_STALL);
+  CHECK(CDC_Tx.busy == 0 && modem.out_sends == 2);
+  CDC_ProcessTransmission(&core, &host);
+  CHECK(modem.clears == 1);
+  CHECK(modem.out_sends == 3 && modem.out_buff == d + MPS && modem.out_len == 8);
+  out_end(URB_DONE);
+  CDC_ProcessTransmission(&core, &host);
+  CHECK(app.sends == 1 && modem.out_bytes == sizeof(d));
+}
+
+int main(void)
+{
+  RUN(test_rx_ring);
+  RUN(test_rx_full);
+  RUN(test_rx_stall);
+  RUN(test_tx_queue);
+  RUN(test_tx_full);
+  RUN(test_tx_stall);
+  return TEST_RESULT();
+}
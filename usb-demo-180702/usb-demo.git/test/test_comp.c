@@ -0,0 +1,342 @@
+/**
+  ******************************************************************************
+  * @file    test_comp.c
+  * @brief   Host tests of the composite device layer: USBD_COMP_Add checks,
+  *          the configuration descriptor built from a HID-like and a CDC-like
+  *          class (interfaces renumbered, IAD, CDC functional descriptors),
+  *          and the routing of requests and transfers back to the classes
+  ******************************************************************************
+  */
+
+#include "test.h"
+
+/* the class table and the routes are private to the layer */
+#include "usbd_comp_core.c"
+
+/* ---- what usbd_comp_core.c links against ------------------------------- */
+
+static int stalls;
+
+void USBD_CtlError(USB_OTG_CORE_HANDLE *pdev, USB_SETUP_REQ *req) { stalls++; }
+
+/* ---- two fake classes, each numbering its interfaces from 0 ------------ */
+
+static const uint8_t hid_cfg[] =
+{
+  9, USB_CONFIGURATION_DESCRIPTOR_TYPE, 34, 0, 1, 1, 0, 0xE0, 50,
+  9, USB_INTERFACE_DESCRIPTOR_TYPE, 0, 0, 2, 0x03, 0, 0, 0,
+  9, 0x21, 0x11, 0x01, 0, 1, 0x22, 40, 0,
+  7, USB_ENDPOINT_DESCRIPTOR_TYPE, 0x81, 0x03, 64, 0, 1,
+  7, USB_ENDPOINT_DESCRIPTOR_TYPE, 0x01, 0x03, 64, 0, 1,
+};
+
+static const uint8_t cdc_cfg[] =
+{
+  9, USB_CONFIGURATION_DESCRIPTOR_TYPE, 67, 0, 2, 1, 0, 0xC0, 100,
+  9, USB_INTERFACE_DESCRIPTOR_TYPE, 0, 0, 1, 0x02, 0x02, 0x01, 0,
+  5, USB_DESC_TYPE_CS_INTERFACE, 0x00, 0x10, 0x01,          /* header */
+  5, USB_DESC_TYPE_CS_INTERFACE, 0x01, 0x00, 1,             /* call management */
+  4, USB_DESC_TYPE_CS_INTERFACE, 0x02, 0x02,                /* ACM */
+  5, USB_DESC_TYPE_CS_INTERFACE, 0x06, 0, 1,                /* union */
+  7, USB_ENDPOINT_DESCRIPTOR_TYPE, 0x83, 0x03, 8, 0, 0xFF,
+  9, USB_INTERFACE_DESCRIPTOR_TYPE, 1, 0, 2, 0x0A, 0, 0, 0,
+  7, USB_ENDPOINT_DESCRIPTOR_TYPE, 0x02, 0x02, 64, 0, 0,
+  7, USB_ENDPOINT_DESCRIPTOR_TYPE, 0x82, 0x02, 64, 0, 0,
+};
+
+/* what each class saw last */
+typedef struct
+{
+  int       setup, data_in, data_out, rx_ready, init, sof;
+  uint16_t  wIndex;
+  uint8_t   epnum;
+} seen_t;
+
+static seen_t hid_seen, cdc_seen;
+
+static uint8_t *hid_desc(uint8_t speed, uint16_t *length)
+{
+  *length = sizeof(hid_cfg);
+  return (uint8_t *)hid_cfg;
+}
+
+static uint8_t *cdc_desc(uint8_t speed, uint16_t *length)
+{
+  *length = sizeof(cdc_cfg);
+  return (uint8_t *)cdc_cfg;
+}
+
+static uint8_t hid_setup(void *pdev, USB_SETUP_REQ *req) { hid_seen.setup++; hid_seen.wIndex = req->wIndex; return USBD_OK; }
+static uint8_t cdc_setup(void *pdev, USB_SETUP_REQ *req) { cdc_seen.setup++; cdc_seen.wIndex = req->wIndex; return USBD_OK; }
+static uint8_t hid_in(void *pdev, uint8_t epnum) { hid_seen.data_in++; hid_seen.epnum = epnum; return USBD_OK; }
+static uint8_t cdc_in(void *pdev, uint8_t epnum) { cdc_seen.data_in++; cdc_seen.epnum = epnum; return USBD_OK; }
+static uint8_t hid_out(void *pdev, uint8_t epnum) { hid_seen.data_out++; hid_seen.epnum = epnum; return USBD_OK; }
+static uint8_t cdc_out(void *pdev, uint8_t epnum) { cdc_seen.data_out++; cdc_seen.epnum = epnum; return USBD_OK; }
+static uint8_t cdc_rx_ready(void *pdev) { cdc_seen.rx_ready++; return USBD_OK; }
+static uint8_t hid_init(void *pdev, uint8_t cfgidx) { hid_seen.init++; return USBD_OK; }
+static uint8_t cdc_init(void *pdev, uint8_t cfgidx) { cdc_seen.init++; return USBD_OK; }
+static uint8_t hid_sof(void *pdev) { hid_seen.sof++; return USBD_OK; }
+
+static uint8_t report[40];
+
+static uint8_t *hid_itf(void *pdev, uint8_t itf, uint8_t idx,
+                        uint16_t *wValue, uint16_t *length)
+{
+  if ((itf != 0) || (idx != 0))
+  {
+    return NULL;
+  }
+  *wValue = 0x2200;
+  *length = sizeof(report);
+  return report;
+}
+
+static USBD_Class_cb_TypeDef hid_class =
+{
+  .Init = hid_init, .Setup = hid_setup, .DataIn = hid_in, .DataOut = hid_out,
+  .SOF = hid_sof, .GetConfigDescriptor = hid_desc, .GetItfDescriptor = hid_itf,
+};
+
+static USBD_Class_cb_TypeDef cdc_class =
+{
+  .Init = cdc_init, .Setup = cdc_setup, .EP0_RxReady = cdc_rx_ready,
+  .DataIn = cdc_in, .DataOut = cdc_out, .GetConfigDescriptor = cdc_desc,
+};
+
+/* a HID-like class whose endpoints are patched per test */
+static uint8_t other_cfg[sizeof(hid_cfg)];
+
+static uint8_t *other_desc(uint8_t speed, uint16_t *length)
+{
+  *length = sizeof(other_cfg);
+  return other_cfg;
+}
+
+static USBD_Class_cb_TypeDef other_class =
+{
+  .Setup = hid_setup, .GetConfigDescriptor = other_desc,
+};
+
+static void other_eps(uint8_t in, uint8_t out)
+{
+  memcpy(other_cfg, hid_cfg, sizeof(hid_cfg));
+  other_cfg[9 + 9 + 9 + 2] = in;
+  other_cfg[9 + 9 + 9 + 7 + 2] = out;
+}
+
+static USB_OTG_CORE_HANDLE dev;
+
+/* ---------------------------------------------------------------------- */
+
+static void setup(void)
+{
+  USBD_COMP_ClassNum = 0;
+  memset(&hid_seen, 0, sizeof(hid_seen));
+  memset(&cdc_seen, 0, sizeof(cdc_seen));
+  stalls = 0;
+}
+
+static void setup_both(void)
+{
+  setup();
+  CHECK(USBD_COMP_Add(&hid_class, 0) == USBD_OK);
+  CHECK(USBD_COMP_Add(&cdc_class, USBD_COMP_IAD) == USBD_OK);
+}
+
+/* offset of the n-th descriptor of a type, -1 if none */
+static int find(const uint8_t *cfg, uint16_t len, uint8_t type, int n)
+{
+  uint16_t i;
+
+  for (i = 0; (i + 1 < len) && (cfg[i] >= 2); i += cfg[i])
+    if ((cfg[i + 1] == type) && (n-- == 0))
+      return i;
+  return -1;
+}
+
+static void request(uint8_t bmRequest, uint16_t wIndex)
+{
+  USB_SETUP_REQ req;
+
+  memset(&req, 0, sizeof(req));
+  req.bmRequest = bmRequest;
+  req.bRequest = USB_REQ_GET_STATUS;
+  req.wIndex = wIndex;
+  USBD_COMP_cb.Setup(&dev, &req);
+}
+
+static void test_build(void)
+{
+  uint8_t *cfg;
+  uint16_t len;
+  int at;
+
+  setup_both();
+  cfg = USBD_COMP_cb.GetConfigDescriptor(USB_OTG_SPEED_FULL, &len);
+  /* both bodies, one header, one IAD */
+  CHECK(len == 9 + (sizeof(hid_cfg) - 9) + 8 + (sizeof(cdc_cfg) - 9));
+  CHECK((cfg[2] | (cfg[3] << 8)) == len);
+  CHECK(cfg[1] == USB_CONFIGURATION_DESCRIPTOR_TYPE);
+  CHECK(cfg[4] == 3);                           /* bNumInterfaces */
+  CHECK(cfg[8] == 100);                         /* the larger bMaxPower */
+  CHECK(find(cfg, len, USB_CONFIGURATION_DESCRIPTOR_TYPE, 1) < 0);
+
+  /* interfaces numbered 0, 1, 2 */
+  CHECK(cfg[find(cfg, len, USB_INTERFACE_DESCRIPTOR_TYPE, 0) + 2] == 0);
+  CHECK(cfg[find(cfg, len, USB_INTERFACE_DESCRIPTOR_TYPE, 1) + 2] == 1);
+  CHECK(cfg[find(cfg, len, USB_INTERFACE_DESCRIPTOR_TYPE, 2) + 2] == 2);
+
+  /* the IAD right before the CDC control interface, with its class */
+  at = find(cfg, len, USB_DESC_TYPE_IAD, 0);
+  CHECK(at > 0 && find(cfg, len, USB_DESC_TYPE_IAD, 1) < 0);
+  CHECK(at + 8 == find(cfg, len, USB_INTERFACE_DESCRIPTOR_TYPE, 1));
+  CHECK(cfg[at] == 8 && cfg[at + 2] == 1 && cfg[at + 3] == 2);
+  CHECK(cfg[at + 4] == 0x02 && cfg[at + 5] == 0x02 && cfg[at + 6] == 0x01);
+
+  /* the CDC functional descriptors point at the renumbered interfaces */
+  at = find(cfg, len, USB_DESC_TYPE_CS_INTERFACE, 1);
+  CHECK(cfg[at + 2] == 0x01 && cfg[at + 4] == 2);     /* bDataInterface */
+  at = find(cfg, len, USB_DESC_TYPE_CS_INTERFACE, 3);
+  CHECK(cfg[at + 2] == 0x06 && cfg[at + 3] == 1 && cfg[at + 4] == 2);
+  /* the header is no interface reference */
+  at = find(cfg, len, USB_DESC_TYPE_CS_INTERFACE, 0);
+  CHECK(cfg[at + 3] == 0x10 && cfg[at + 4] == 0x01);
+  /* endpoints are not renumbered */
+  CHECK(cfg[find(cfg, len, USB_ENDPOINT_DESCRIPTOR_TYPE, 2) + 2] == 0x83);
+}
+
+static void test_build_no_iad(void)
+{
+  uint8_t *cfg;
+  uint16_t len;
+
+  setup();
+  CHECK(USBD_COMP_Add(&cdc_class, 0) == USBD_OK);
+  CHECK(USBD_COMP_Add(&hid_class, 0) == USBD_OK);
+  cfg = USBD_COMP_cb.GetConfigDescriptor(USB_OTG_SPEED_FULL, &len);
+  CHECK(len == sizeof(hid_cfg) + sizeof(cdc_cfg) - 9);
+  CHECK(find(cfg, len, USB_DESC_TYPE_IAD, 0) < 0);
+  /* CDC first keeps 0 and 1, HID moves to 2 */
+  CHECK(cfg[find(cfg, len, USB_DESC_TYPE_CS_INTERFACE, 3) + 3] == 0);
+  CHECK(cfg[find(cfg, len, USB_INTERFACE_DESCRIPTOR_TYPE, 2) + 2] == 2);
+  /* the header is the first class's one */
+  CHECK(cfg[7] == 0xC0 && cfg[8] == 100);
+}
+
+static void test_add_checks(void)
+{
+  uint8_t *cfg;
+  uint16_t len;
+
+  /* an endpoint taken already: refused, nothing committed */
+  setup();
+  CHECK(USBD_COMP_Add(&hid_class, 0) == USBD_OK);
+  other_eps(0x84, 0x01);
+  CHECK(USBD_COMP_Add(&other_class, 0) == USBD_FAIL);
+  cfg = USBD_COMP_cb.GetConfigDescriptor(USB_OTG_SPEED_FULL, &len);
+  CHECK(len == sizeof(hid_cfg) && cfg[4] == 1);
+  CHECK(USBD_COMP_ItfMap[1] == USBD_COMP_NONE);
+  CHECK(USBD_COMP_InEpMap[4] == USBD_COMP_NONE);
+  /* IN 1 and OUT 1 are two endpoints */
+  other_eps(0x84, 0x04);
+  CHECK(USBD_COMP_Add(&other_class, 0) == USBD_OK);
+  CHECK(USBD_COMP_InEpMap[4] == 1 && USBD_COMP_OutEpMap[4] == 1);
+
+  /* no more classes than USBD_COMP_MAX_CLASS */
+  other_eps(0x85, 0x05);
+  CHECK(USBD_COMP_Add(&other_class, 0) == USBD_FAIL);
+  CHECK(USBD_COMP_ItfTotal == 2);
+
+  /* EP0, or an endpoint the core has no FIFO for */
+  setup();
+  other_eps(0x80, 0x01);
+  CHECK(USBD_COMP_Add(&other_class, 0) == USBD_FAIL);
+  other_eps(0x81 + USB_OTG_MAX_TX_FIFOS, 0x01);
+  CHECK(USBD_COMP_Add(&other_class, 0) == USBD_FAIL);
+  other_eps(0x81, 0x01);
+  CHECK(USBD_COMP_Add(&other_class, 0) == USBD_OK);
+  CHECK(USBD_COMP_ClassNum == 1);
+}
+
+static void test_route_setup(void)
+{
+  setup_both();
+  /* interface 0 is HID's 0, interfaces 1 and 2 CDC's 0 and 1 */
+  request(0x81, 0);
+  CHECK(hid_seen.setup == 1 && hid_seen.wIndex == 0);
+  request(0x21, 2);
+  CHECK(cdc_seen.setup == 1 && cdc_seen.wIndex == 1);
+  request(0x21, 0x0301);
+  CHECK(cdc_seen.setup == 2 && cdc_seen.wIndex == 0x0300);
+  /* the class that took the setup stage gets its data stage */
+  USBD_COMP_cb.EP0_RxReady(&dev);
+  CHECK(cdc_seen.rx_ready == 1);
+  request(0x81, 0);
+  USBD_COMP_cb.EP0_RxReady(&dev);
+  CHECK(cdc_seen.rx_ready == 1);
+  /* no such interface */
+  request(0x81, 3);
+  CHECK(stalls == 1 && hid_seen.setup == 2 && cdc_seen.setup == 2);
+
+  /* endpoint requests by direction and number */
+  request(0x02, 0x82);
+  CHECK(cdc_seen.setup == 3 && cdc_seen.wIndex == 0x82);
+  request(0x02, 0x01);
+  CHECK(hid_seen.setup == 3);
+  request(0x02, 0x84);
+  CHECK(stalls == 2);
+  /* device requests go to every class */
+  request(0x00, 0);
+  CHECK(hid_seen.setup == 4 && cdc_seen.setup == 4);
+}
+
+static void test_route_data(void)
+{
+  setup_both();
+  USBD_COMP_cb.DataIn(&dev, 0x81);
+  CHECK(hid_seen.data_in == 1 && hid_seen.epnum == 1);
+  USBD_COMP_cb.DataIn(&dev, 0x83);
+  USBD_COMP_cb.DataIn(&dev, 0x82);
+  CHECK(cdc_seen.data_in == 2 && cdc_seen.epnum == 2);
+  USBD_COMP_cb.DataOut(&dev, 1);
+  USBD_COMP_cb.DataOut(&dev, 2);
+  CHECK(hid_seen.data_out == 1 && cdc_seen.data_out == 1);
+  /* nobody's endpoint */
+  USBD_COMP_cb.DataIn(&dev, 0x85);
+  USBD_COMP_cb.DataOut(&dev, 3);
+  CHECK(hid_seen.data_in == 1 && cdc_seen.data_in == 2);
+  CHECK(hid_seen.data_out == 1 && cdc_seen.data_out == 1);
+
+  USBD_COMP_cb.Init(&dev, 1);
+  CHECK(hid_seen.init == 1 && cdc_seen.init == 1);
+  /* a class without SOF is skipped */
+  USBD_COMP_cb.SOF(&dev);
+  CHECK(hid_seen.sof == 1);
+}
+
+static void test_itf_desc(void)
+{
+  uint16_t wValue, len;
+
+  setup();
+  CHECK(USBD_COMP_Add(&cdc_class, USBD_COMP_IAD) == USBD_OK);
+  CHECK(USBD_COMP_Add(&hid_class, 0) == USBD_OK);
+  /* HID is interface 2 here, its own 0 */
+  CHECK(USBD_COMP_cb.GetItfDescriptor(&dev, 2, 0, &wValue, &len) == report);
+  CHECK(wValue == 0x2200 && len == sizeof(report));
+  CHECK(USBD_COMP_cb.GetItfDescriptor(&dev, 2, 1, &wValue, &len) == NULL);
+  /* CDC has no class descriptors to hand out */
+  CHECK(USBD_COMP_cb.GetItfDescriptor(&dev, 0, 0, &wValue, &len) == NULL);
+  CHECK(USBD_COMP_cb.GetItfDescriptor(&dev, 7, 0, &wValue, &len) == NULL);
+}
+
+int main(void)
+{
+  RUN(test_build);
+  RUN(test_build_no_iad);
+  RUN(test_add_checks);
+  RUN(test_route_setup);
+  RUN(test_route_data);
+  RUN(test_itf_desc);
+  return TEST_RESULT();
+}
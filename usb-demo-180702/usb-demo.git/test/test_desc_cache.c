@@ -0,0 +1,511 @@
+/**
+  ******************************************************************************
+  * @file    test_desc_cache.c
+  * @brief   Host tests of the GET_DESCRIPTOR table in usbd_req.c, with the
+  *          OTG driver, the user descriptors and the class replaced by fakes
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usbd_req.h"
+#include "usbd_ioreq.h"
+#include "usbd_core.h"
+#include "usbd_hostos.h"
+#include "usb_dcd.h"
+
+#define LANGID          0x0409
+
+/* what the fake device below puts in the table on a flush:
+   device, configuration, LANGID, product and serial strings (+ qualifier and
+   other speed configuration at HS), the strings taking 4 + 16 + 16 bytes */
+#define FS_BUILT        5
+#define FS_POOL_USED    36
+
+/* ---- what usbd_req.c links against ----------------------------------- */
+
+__IO USB_OTG_DCTL_TypeDef SET_TEST_MODE;
+uint8_t USBD_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC];
+
+static uint8_t  *sent_buf;
+static uint16_t  sent_len;
+static int       sent_num;
+static int       stalls;
+static uint8_t   host_os;
+
+USBD_Status USBD_CtlSendData(USB_OTG_CORE_HANDLE *pdev, uint8_t *pbuf, uint16_t len)
+{
+  sent_buf = pbuf;
+  sent_len = len;
+  sent_num++;
+  return USBD_OK;
+}
+
+USBD_Status USBD_CtlSendStatus(USB_OTG_CORE_HANDLE *pdev) { return USBD_OK; }
+USBD_Status USBD_SetCfg(USB_OTG_CORE_HANDLE *pdev, uint8_t cfgidx) { return USBD_OK; }
+USBD_Status USBD_ClrCfg(USB_OTG_CORE_HANDLE *pdev, uint8_t cfgidx) { return USBD_OK; }
+uint32_t DCD_EP_Stall(USB_OTG_CORE_HANDLE *pdev, uint8_t epnum) { stalls++; return 0; }
+uint32_t DCD_EP_ClrStall(USB_OTG_CORE_HANDLE *pdev, uint8_t epnum) { return 0; }
+void DCD_EP_SetAddress(USB_OTG_CORE_HANDLE *pdev, uint8_t address) { }
+void USB_OTG_EP0_OutStart(USB_OTG_CORE_HANDLE *pdev) { }
+void USBD_HostOS_Setup(USB_OTG_CORE_HANDLE *pdev, USB_SETUP_REQ *req) { }
+uint8_t USBD_HostOS_Get(USB_OTG_CORE_HANDLE *pdev) { return host_os; }
+
+/* ---- fake device: counts how often each descriptor is built ---------- */
+
+static uint8_t dev_desc[18]  = { 18, USB_DESC_TYPE_DEVICE };
+/* two interfaces, no endpoints */
+static uint8_t cfg_desc[27]  = { 9, USB_DESC_TYPE_CONFIGURATION, 27, 0, 2, 1, 0, 0x80, 50,
+                                 9, USB_DESC_TYPE_INTERFACE, 0, 0, 0, 3, 0, 0, 0,
+                                 9, USB_DESC_TYPE_INTERFACE, 1, 0, 0, 3, 0, 0, 0 };
+static uint8_t langid_desc[4] = { 4, USB_DESC_TYPE_STRING, LOBYTE(LANGID), HIBYTE(LANGID) };
+static uint8_t str_buf[128];            /* shared by all strings, as usbd_desc.c */
+static uint16_t str_len = 0;            /* 0: built from the name */
+static int     n_dev, n_cfg, n_other, n_prod, n_serial;
+static int     str_bytes;               /* UTF-16 bytes built */
+
+uint8_t *USBD_GetCfgDesc(USB_OTG_CORE_HANDLE *pdev, uint16_t *length)
+{
+  n_cfg++;
+  *length = sizeof(cfg_desc);
+  return cfg_desc;
+}
+
+static uint8_t *fake_device(uint8_t speed, uint16_t *length)
+{
+  n_dev++;
+  *length = sizeof(dev_desc);
+  return dev_desc;
+}
+
+static uint8_t *fake_langid(uint8_t speed, uint16_t *length)
+{
+  *length = sizeof(langid_desc);
+  return langid_desc;
+}
+
+static uint8_t *fake_string(const char *s, uint16_t *length)
+{
+  USBD_GetString((uint8_t *)s, str_buf, length);
+  if (str_len != 0)
+  {
+    *length = str_len;
+  }
+  str_bytes += *length;
+  return str_buf;
+}
+
+static uint8_t *fake_product(uint8_t speed, uint16_t *length)
+{
+  n_prod++;
+  return fake_string("product", length);
+}
+
+static uint8_t *fake_serial(uint8_t speed, uint16_t *length)
+{
+  n_serial++;
+  return fake_string("serial", length);
+}
+
+static uint8_t *fake_none(uint8_t speed, uint16_t *length)
+{
+  *length = 0;
+  return str_buf;
+}
+
+static USBD_DEVICE fake_usr_device =
+{
+  fake_device,
+  fake_langid,
+  fake_none,
+  fake_product,
+  fake_serial,
+  fake_none,
+  fake_none,
+};
+
+/* ---- fake class: interface 0 has a HID and a report descriptor,
+   interface 1 a report descriptor only ----------------------------------- */
+
+static uint8_t hid_desc[9]   = { 9, 0x21 };
+static uint8_t report0[40]   = { 0x05, 0x01 };
+static uint8_t report1[20]   = { 0x06, 0x00, 0xFF };
+static int     n_setup, n_itf;
+
+static uint8_t fake_setup(void *pdev, USB_SETUP_REQ *req)
+{
+  n_setup++;
+  return USBD_OK;
+}
+
+static uint8_t *fake_other_cfg(uint8_t speed, uint16_t *length)
+{
+  n_other++;
+  *length = sizeof(cfg_desc);
+  return cfg_desc;
+}
+
+static uint8_t *fake_itf(void *pdev, uint8_t itf, uint8_t idx,
+                         uint16_t *wValue, uint16_t *length)
+{
+  n_itf++;
+  if ((itf == 0) && (idx == 0))
+  {
+    *wValue = 0x2100;
+    *length = sizeof(hid_desc);
+    return hid_desc;
+  }
+  if (((itf == 0) && (idx == 1)) || ((itf == 1) && (idx == 0)))
+  {
+    *wValue = 0x2200;
+    *length = itf ? sizeof(report1) : sizeof(report0);
+    return itf ? report1 : report0;
+  }
+  return NULL;
+}
+
+static USBD_Class_cb_TypeDef fake_class =
+{
+  .Setup = fake_setup,
+  .GetOtherConfigDescriptor = fake_other_cfg,
+  .GetItfDescriptor = fake_itf,
+};
+
+static USB_OTG_CORE_HANDLE fs, hs;
+
+/* ---------------------------------------------------------------------- */
+
+static void clear_counts(void)
+{
+  n_dev = n_cfg = n_other = n_prod = n_serial = n_setup = n_itf = 0;
+  str_bytes = 0;
+  sent_num = stalls = 0;
+  sent_buf = NULL;
+}
+
+static void setup(void)
+{
+  memset(&fs, 0, sizeof(fs));
+  memset(&hs, 0, sizeof(hs));
+  fs.cfg.coreID = USB_OTG_FS_CORE_ID;
+  fs.cfg.speed = USB_OTG_SPEED_FULL;
+  fs.dev.usr_device = &fake_usr_device;
+  fs.dev.class_cb = &fake_class;
+  hs.cfg.coreID = USB_OTG_HS_CORE_ID;
+  hs.cfg.speed = USB_OTG_SPEED_HIGH;
+  hs.dev.usr_device = &fake_usr_device;
+  hs.dev.class_cb = &fake_class;
+  host_os = 0;
+  str_len = 0;
+  USBD_DescCacheFlush(&fs);
+  USBD_DescCacheFlush(&hs);
+  clear_counts();
+}
+
+static void get(USB_OTG_CORE_HANDLE *pdev, uint8_t type, uint8_t idx,
+                uint16_t wIndex, uint16_t wLength)
+{
+  USB_SETUP_REQ req;
+
+  req.bmRequest = 0x80;
+  req.bRequest = USB_REQ_GET_DESCRIPTOR;
+  req.wValue = ((uint16_t)type << 8) | idx;
+  req.wIndex = wIndex;
+  req.wLength = wLength;
+  USBD_StdDevReq(pdev, &req);
+}
+
+static void get_itf(USB_OTG_CORE_HANDLE *pdev, uint8_t type, uint8_t itf,
+                    uint16_t wLength)
+{
+  USB_SETUP_REQ req;
+
+  req.bmRequest = 0x81;
+  req.bRequest = USB_REQ_GET_DESCRIPTOR;
+  req.wValue = (uint16_t)type << 8;
+  req.wIndex = itf;
+  req.wLength = wLength;
+  USBD_StdItfReq(pdev, &req);
+}
+
+static void set_config(USB_OTG_CORE_HANDLE *pdev, uint8_t cfgidx)
+{
+  USB_SETUP_REQ req;
+
+  req.bmRequest = 0x00;
+  req.bRequest = USB_REQ_SET_CONFIGURATION;
+  req.wValue = cfgidx;
+  req.wIndex = 0;
+  req.wLength = 0;
+  USBD_StdDevReq(pdev, &req);
+}
+
+static int is_string(const uint8_t *p, const char *s)
+{
+  uint8_t i;
+
+  if ((p == NULL) || (p[0] != strlen(s) * 2 + 2) || (p[1] != USB_DESC_TYPE_STRING))
+    return 0;
+  for (i = 0; s[i]; i++)
+    if ((p[2 + 2 * i] != (uint8_t)s[i]) || (p[3 + 2 * i] != 0))
+      return 0;
+  return 1;
+}
+
+static void test_prebuilt(void)
+{
+  setup();
+  /* the flush built everything: the first request is a lookup already */
+  get(&fs, USB_DESC_TYPE_DEVICE, 0, 0, 0xFF);
+  get(&fs, USB_DESC_TYPE_CONFIGURATION, 0, 0, 0xFF);
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_LANGID_STR, 0, 0xFF);
+  CHECK(sent_len == 4 && sent_buf[2] == LOBYTE(LANGID));
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, LANGID, 0xFF);
+  CHECK(is_string(sent_buf, "product"));
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_SERIAL_STR, LANGID, 0xFF);
+  CHECK(is_string(sent_buf, "serial"));
+  CHECK(sent_num == 5 && stalls == 0);
+  CHECK(n_dev == 0 && n_cfg == 0 && n_prod == 0 && n_serial == 0);
+  /* the FS core has no other speed: still stalled */
+  get(&fs, USB_DESC_TYPE_DEVICE_QUALIFIER, 0, 0, 0xFF);
+  CHECK(stalls == 2 && sent_num == 5);
+  /* the HS core has */
+  get(&hs, USB_DESC_TYPE_DEVICE_QUALIFIER, 0, 0, 0xFF);
+  CHECK(sent_buf == USBD_DeviceQualifierDesc);
+  get(&hs, USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION, 0, 0, 0xFF);
+  CHECK(sent_buf == cfg_desc && cfg_desc[1] == USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION);
+  CHECK(n_cfg == 0 && n_other == 0);
+}
+
+static void test_device_hit(void)
+{
+  setup();
+  get(&fs, USB_DESC_TYPE_DEVICE, 0, 0, 0xFF);
+  get(&fs, USB_DESC_TYPE_DEVICE, 0, 0, 0xFF);
+  CHECK(n_dev == 0);
+  CHECK(sent_num == 2);
+  CHECK(sent_buf == dev_desc && sent_len == sizeof(dev_desc));
+  /* a short read of the kept answer is cut to wLength */
+  get(&fs, USB_DESC_TYPE_DEVICE, 0, 0, 8);
+  CHECK(n_dev == 0 && sent_len == 8);
+}
+
+static void test_config_hit(void)
+{
+  setup();
+  get(&fs, USB_DESC_TYPE_CONFIGURATION, 0, 0, 0xFF);
+  CHECK(fs.dev.pConfig_descriptor == cfg_desc);
+  fs.dev.pConfig_descriptor = NULL;
+  cfg_desc[1] = USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION;
+  get(&fs, USB_DESC_TYPE_CONFIGURATION, 0, 0, 0xFF);
+  CHECK(n_cfg == 0);
+  /* the hit still types the shared buffer and records it */
+  CHECK(cfg_desc[1] == USB_DESC_TYPE_CONFIGURATION);
+  CHECK(fs.dev.pConfig_descriptor == cfg_desc);
+  CHECK(sent_buf == cfg_desc);
+}
+
+static void test_string_copied(void)
+{
+  setup();
+  /* the serial string was built last into the shared buffer */
+  CHECK(is_string(str_buf, "serial"));
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, LANGID, 0xFF);
+  CHECK(sent_buf != str_buf);
+  CHECK(is_string(sent_buf, "product"));
+  CHECK(((uintptr_t)sent_buf & 3) == 0);
+  CHECK(n_prod == 0);
+}
+
+static void test_string_langid(void)
+{
+  setup();
+  /* another language is built on its first request, then kept too */
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, 0x0407, 0xFF);
+  CHECK(n_prod == 1);
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, 0x0407, 0xFF);
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, LANGID, 0xFF);
+  CHECK(n_prod == 1);
+  CHECK(is_string(sent_buf, "product"));
+}
+
+static void test_speed_os_flush(void)
+{
+  setup();
+  get(&fs, USB_DESC_TYPE_CONFIGURATION, 0, 0, 0xFF);
+  CHECK(n_cfg == 0);
+  fs.cfg.speed = USB_OTG_SPEED_HIGH;
+  get(&fs, USB_DESC_TYPE_CONFIGURATION, 0, 0, 0xFF);
+  CHECK(n_cfg > 0 && n_prod == 1);
+  clear_counts();
+  get(&fs, USB_DESC_TYPE_CONFIGURATION, 0, 0, 0xFF);
+  CHECK(n_cfg == 0);
+  host_os = 1;
+  get(&fs, USB_DESC_TYPE_CONFIGURATION, 0, 0, 0xFF);
+  CHECK(n_cfg > 0);
+  /* and the application can rebuild it by hand */
+  clear_counts();
+  USBD_DescCacheFlush(&fs);
+  CHECK(n_dev == 1 && n_cfg > 0 && n_prod == 1);
+}
+
+static void test_per_core(void)
+{
+  setup();
+  /* a flush of one core leaves the other one alone */
+  USBD_DescCacheFlush(&hs);
+  CHECK(n_dev == 1);
+  get(&fs, USB_DESC_TYPE_DEVICE, 0, 0, 0xFF);
+  get(&hs, USB_DESC_TYPE_DEVICE, 0, 0, 0xFF);
+  CHECK(n_dev == 1 && sent_num == 2);
+  /* HS holds two more entries than FS: qualifier, other speed */
+  get(&fs, USB_DESC_TYPE_OTHER_SPEED_CONFIGURATION, 0, 0, 0xFF);
+  CHECK(stalls == 2);
+}
+
+static void test_itf_table(void)
+{
+  setup();
+  /* interface descriptors are only known once configured */
+  fs.dev.device_status = USB_OTG_ADDRESSED;
+  set_config(&fs, 1);
+  CHECK(fs.dev.device_status == USB_OTG_CONFIGURED);
+  CHECK(n_itf > 0);
+  clear_counts();
+
+  get_itf(&fs, 0x21, 0, 0xFF);
+  CHECK(sent_buf == hid_desc && sent_len == sizeof(hid_desc));
+  get_itf(&fs, 0x22, 0, 0xFF);
+  CHECK(sent_buf == report0 && sent_len == sizeof(report0));
+  /* Windows asks the report descriptor length + 0x40 */
+  get_itf(&fs, 0x22, 1, sizeof(report1) + 0x40);
+  CHECK(sent_buf == report1 && sent_len == sizeof(report1));
+  get_itf(&fs, 0x22, 1, 8);
+  CHECK(sent_len == 8);
+  CHECK(n_setup == 0 && n_itf == 0 && sent_num == 4);
+
+  /* no such descriptor in the table: the class answers */
+  get_itf(&fs, 0x21, 1, 0xFF);
+  CHECK(n_setup == 1 && sent_num == 4);
+  /* the interface is part of the key, the device recipient is not served */
+  get(&fs, 0x21, 0, 0, 0xFF);
+  CHECK(stalls == 2 && sent_num == 4);
+
+  /* unconfigured, the interface entries are gone */
+  set_config(&fs, 0);
+  fs.dev.device_status = USB_OTG_CONFIGURED;
+  get_itf(&fs, 0x22, 0, 0xFF);
+  CHECK(n_setup == 2 && sent_num == 4);
+  /* but not the device ones */
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, LANGID, 0xFF);
+  CHECK(n_prod == 0 && sent_num == 5);
+}
+
+static void test_itf_no_class_cb(void)
+{
+  USBD_Class_cb_TypeDef plain = { .Setup = fake_setup };
+
+  setup();
+  fs.dev.class_cb = &plain;
+  fs.dev.device_status = USB_OTG_ADDRESSED;
+  set_config(&fs, 1);
+  /* a class without GetItfDescriptor answers as before */
+  get_itf(&fs, 0x22, 0, 0xFF);
+  CHECK(n_setup == 1 && sent_num == 0);
+}
+
+/* One enumeration as Windows does it, after a bus reset */
+static void enumerate(USB_OTG_CORE_HANDLE *pdev)
+{
+  pdev->dev.device_status = USB_OTG_ADDRESSED;
+  get(pdev, USB_DESC_TYPE_DEVICE, 0, 0, 64);
+  get(pdev, USB_DESC_TYPE_DEVICE, 0, 0, 18);
+  get(pdev, USB_DESC_TYPE_CONFIGURATION, 0, 0, 9);
+  get(pdev, USB_DESC_TYPE_CONFIGURATION, 0, 0, 0xFF);
+  get(pdev, USB_DESC_TYPE_STRING, USBD_IDX_LANGID_STR, 0, 0xFF);
+  get(pdev, USB_DESC_TYPE_STRING, USBD_IDX_SERIAL_STR, LANGID, 0xFF);
+  get(pdev, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, LANGID, 0xFF);
+  get(pdev, USB_DESC_TYPE_DEVICE_QUALIFIER, 0, 0, 10);
+  set_config(pdev, 1);
+  get_itf(pdev, 0x22, 0, sizeof(report0) + 0x40);
+  get_itf(pdev, 0x22, 1, sizeof(report1) + 0x40);
+}
+
+static void test_enumeration_replay(void)
+{
+  int round;
+
+  setup();
+  for (round = 0; round < 3; round++)
+  {
+    clear_counts();
+    enumerate(&hs);
+    CHECK(sent_num == 10 && stalls == 0);
+    /* no descriptor built, no string converted or copied: only the
+       interface entries are swapped on SET_CONFIGURATION */
+    CHECK(n_dev == 0 && n_other == 0 && n_prod == 0 && n_serial == 0);
+    CHECK(str_bytes == 0);
+    CHECK(n_cfg == 1 && n_itf == 5);
+    CHECK(n_setup == 0);
+  }
+}
+
+static void test_pool_full(void)
+{
+  uint16_t id, n;
+
+  setup();
+  /* 64-byte strings: the rest of the pool holds only this many of them */
+  str_len = 64;
+  n = (USBD_DESC_CACHE_POOL - FS_POOL_USED) / 64;
+  for (id = 0; id <= n; id++)
+    get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, 0x0400 + id, 0xFF);
+  CHECK(n_prod == n + 1);
+  for (id = 0; id < n; id++)
+    get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, 0x0400 + id, 0xFF);
+  CHECK(n_prod == n + 1);
+  /* the one that did not fit is still answered, built each time */
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, 0x0400 + n, 0xFF);
+  CHECK(n_prod == n + 2);
+  CHECK(sent_buf == str_buf && sent_len == 64);
+}
+
+static void test_table_full(void)
+{
+  uint16_t id, n = USBD_DESC_CACHE_ENTRIES - FS_BUILT;
+
+  setup();
+  str_len = 4;
+  for (id = 0; id <= n; id++)
+    get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, 0x0400 + id, 0xFF);
+  CHECK(n_prod == n + 1);
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, 0x0400, 0xFF);
+  CHECK(n_prod == n + 1);
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_PRODUCT_STR, 0x0400 + n, 0xFF);
+  CHECK(n_prod == n + 2);
+}
+
+static void test_empty_not_kept(void)
+{
+  setup();
+  /* a zero length answer (no such string) is neither kept nor sent */
+  get(&fs, USB_DESC_TYPE_STRING, USBD_IDX_MFC_STR, LANGID, 0xFF);
+  CHECK(sent_num == 0 && stalls == 0);
+}
+
+int main(void)
+{
+  RUN(test_prebuilt);
+  RUN(test_device_hit);
+  RUN(test_config_hit);
+  RUN(test_string_copied);
+  RUN(test_string_langid);
+  RUN(test_speed_os_flush);
+  RUN(test_per_core);
+  RUN(test_itf_table);
+  RUN(test_itf_no_class_cb);
+  RUN(test_enumeration_replay);
+  RUN(test_pool_full);
+  RUN(test_table_full);
+  RUN(test_empty_not_kept);
+  return TEST_RESULT();
+}
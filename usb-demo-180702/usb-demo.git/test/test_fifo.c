@@ -0,0 +1,384 @@
+/**
+  ******************************************************************************
+  * @file    test_fifo.c
+  * @brief   Host tests of the SPSC report ring (usbd_fifo.h / usbd_fifo.c)
+  ******************************************************************************
+  */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include "test.h"
+#include "usbd_fifo.h"
+
+static USBD_FIFO_type fifo;
+
+static void fill(u8 *p, u8 seed, u16 len)
+{
+  u16 i;
+
+  for (i = 0; i < len; i++)
+    p[i] = (u8)(seed + i);
+}
+
+static void test_empty(void)
+{
+  u16 len = 0xFFFF;
+
+  memset(&fifo, 0, sizeof(fifo));
+  CHECK(USBD_FIFO_Front(&fifo, &len) == NULL);
+  CHECK(len == 0xFFFF);
+  CHECK(USBD_FIFO_Used(&fifo) == 0);
+  CHECK(USBD_FIFO_Unused(&fifo) == USBD_FIFO_SIZE);
+  CHECK(USBD_FIFO_At(&fifo, 0, &len) == NULL);
+}
+
+static void test_order(void)
+{
+  u8 in[USBD_FIFO_SLOT_SIZE], out[USBD_FIFO_SLOT_SIZE];
+  u16 len, i;
+
+  memset(&fifo, 0, sizeof(fifo));
+  for (i = 1; i <= 5; i++)
+  {
+    len = i * 3;
+    fill(in, (u8)i, len);
+    CHECK(USBD_FIFO_Push(&fifo, in, &len) == USBD_FIFO_OK);
+  }
+  CHECK(USBD_FIFO_Used(&fifo) == 5);
+  for (i = 1; i <= 5; i++)
+  {
+    len = 0;
+    USBD_FIFO_Pop(&fifo, out, &len);
+    fill(in, (u8)i, i * 3);
+    CHECK(len == i * 3);
+    CHECK(memcmp(in, out, len) == 0);
+  }
+  CHECK(USBD_FIFO_Used(&fifo) == 0);
+}
+
+static void test_full(void)
+{
+  u8 *p;
+  u16 i, len;
+
+  memset(&fifo, 0, sizeof(fifo));
+  for (i = 0; i < USBD_FIFO_SIZE; i++)
+  {
+    p = USBD_FIFO_Reserve(&fifo);
+    CHECK(p != NULL);
+    if (p == NULL)
+      return;
+    p[0] = (u8)i;
+    USBD_FIFO_Commit(&fifo, 1);
+  }
+  CHECK(USBD_FIFO_Reserve(&fifo) == NULL);
+  CHECK(USBD_FIFO_Unused(&fifo) == 0);
+
+  /* one slot freed, one slot back */
+  p = USBD_FIFO_Front(&fifo, &len);
+  CHECK(p != NULL && p[0] == 0 && len == 1);
+  USBD_FIFO_Release(&fifo);
+  CHECK(USBD_FIFO_Reserve(&fifo) != NULL);
+}
+
+static void test_push_status(void)
+{
+  u8 in[USBD_FIFO_SLOT_SIZE + 1];
+  u16 len, i;
+
+  memset(&fifo, 0, sizeof(fifo));
+  fill(in, 0x20, sizeof(in));
+  /* a whole slot fits, one byte more is refused and nothing queued */
+  len = USBD_FIFO_SLOT_SIZE;
+  CHECK(USBD_FIFO_Push(&fifo, in, &len) == USBD_FIFO_OK);
+  len = USBD_FIFO_SLOT_SIZE + 1;
+  CHECK(USBD_FIFO_Push(&fifo, in, &len) == USBD_FIFO_TOO_LONG);
+  len = 0xFFFF;
+  CHECK(USBD_FIFO_Push(&fifo, in, &len) == USBD_FIFO_TOO_LONG);
+  CHECK(USBD_FIFO_Used(&fifo) == 1);
+  CHECK(fifo.slot[1].dat[0] == 0);
+
+  for (i = 1; i < USBD_FIFO_SIZE; i++)
+  {
+    len = 1;
+    CHECK(USBD_FIFO_Push(&fifo, in, &len) == USBD_FIFO_OK);
+  }
+  len = 1;
+  CHECK(USBD_FIFO_Push(&fifo, in, &len) == USBD_FIFO_FULL);
+  CHECK(USBD_FIFO_Used(&fifo) == USBD_FIFO_SIZE);
+  /* the oversize check comes first, even when full */
+  len = USBD_FIFO_SLOT_SIZE + 1;
+  CHECK(USBD_FIFO_Push(&fifo, in, &len) == USBD_FIFO_TOO_LONG);
+}
+
+static void test_reserve_in_place(void)
+{
+  u8 *w, *r;
+  u16 len;
+
+  memset(&fifo, 0, sizeof(fifo));
+  w = USBD_FIFO_Reserve(&fifo);
+  /* reserved but not committed: invisible to the consumer */
+  CHECK(USBD_FIFO_Front(&fifo, &len) == NULL);
+  fill(w, 0x40, 8);
+  USBD_FIFO_Commit(&fifo, 8);
+  r = USBD_FIFO_Front(&fifo, &len);
+  CHECK(r == w);
+  CHECK(len == 8 && r[7] == 0x47);
+  /* the head stays until it is released */
+  CHECK(USBD_FIFO_Front(&fifo, &len) == r);
+  USBD_FIFO_Release(&fifo);
+  CHECK(USBD_FIFO_Front(&fifo, &len) == NULL);
+}
+
+static void test_index_wrap(void)
+{
+  u8 in[4], out[4];
+  u16 len;
+  u32 i;
+
+  /* free-running indices cross 2^32 */
+  memset(&fifo, 0, sizeof(fifo));
+  fifo.wr = fifo.rd = 0xFFFFFFF0u;
+  for (i = 0; i < 3 * USBD_FIFO_SIZE; i++)
+  {
+    len = 4;
+    memcpy(in, &i, 4);
+    USBD_FIFO_Push(&fifo, in, &len);
+    CHECK(USBD_FIFO_Used(&fifo) == 1);
+    len = 0;
+    USBD_FIFO_Pop(&fifo, out, &len);
+    CHECK(len == 4 && memcmp(in, out, 4) == 0);
+  }
+  CHECK(fifo.wr == fifo.rd);
+  CHECK(fifo.wr < 0xFFFFFFF0u);
+}
+
+static void test_at_release_n(void)
+{
+  u8 *p;
+  u16 len, i;
+
+  memset(&fifo, 0, sizeof(fifo));
+  for (i = 0; i < 4; i++)
+  {
+    p = USBD_FIFO_Reserve(&fifo);
+    p[0] = (u8)(0x10 + i);
+    USBD_FIFO_Commit(&fifo, i + 1);
+  }
+  for (i = 0; i < 4; i++)
+  {
+    p = USBD_FIFO_At(&fifo, i, &len);
+    CHECK(p != NULL && p[0] == 0x10 + i && len == i + 1);
+  }
+  CHECK(USBD_FIFO_At(&fifo, 4, &len) == NULL);
+  USBD_FIFO_ReleaseN(&fifo, 3);
+  p = USBD_FIFO_Front(&fifo, &len);
+  CHECK(p != NULL && p[0] == 0x13);
+}
+
+static void test_flush(void)
+{
+  u8 in[2] = { 1, 2 };
+  u16 len = 2;
+
+  memset(&fifo, 0, sizeof(fifo));
+  USBD_FIFO_Push(&fifo, in, &len);
+  USBD_FIFO_Push(&fifo, in, &len);
+  USBD_FIFO_Flush(&fifo);
+  CHECK(USBD_FIFO_Used(&fifo) == 0);
+  CHECK(USBD_FIFO_Front(&fifo, &len) == NULL);
+}
+
+/* producer and consumer on two threads, as main loop and USB ISR */
+#define STRESS_COUNT    200000u
+
+static void *stress_producer(void *arg)
+{
+  u32 n = 0;
+  u8 *p;
+
+  (void)arg;
+  while (n < STRESS_COUNT)
+  {
+    p = USBD_FIFO_Reserve(&fifo);
+    if (p == NULL)
+    {
+      sched_yield();                /* let the consumer run on one CPU */
+      continue;
+    }
+    memcpy(p, &n, 4);
+    p[4] = (u8)~n;
+    USBD_FIFO_Commit(&fifo, 5 + (n & 7));
+    n++;
+  }
+  return NULL;
+}
+
+static void test_spsc_stress(void)
+{
+  pthread_t t;
+  u32 n = 0, v;
+  u16 len;
+  u8 *p;
+  int bad = 0;
+
+  memset(&fifo, 0, sizeof(fifo));
+  pthread_create(&t, NULL, stress_producer, NULL);
+  while (n < STRESS_COUNT)
+  {
+    p = USBD_FIFO_Front(&fifo, &len);
+    if (p == NULL)
+    {
+      sched_yield();
+      continue;
+    }
+    memcpy(&v, p, 4);
+    if (v != n || p[4] != (u8)~n || len != 5 + (n & 7))
+      bad++;
+    USBD_FIFO_Release(&fifo);
+    n++;
+  }
+  pthread_join(t, NULL);
+  CHECK(bad == 0);
+  CHECK(USBD_FIFO_Used(&fifo) == 0);
+}
+
+/* ---- reports per second against the ring it replaced -------------------
+ * Printed only: __DMB() is a full fence on the host, far dearer than on
+ * the Cortex-M4, so the host figures undersell the new ring.
+ */
+
+/* the nr/wr/rd FIFO, as it was: length in the first byte of each entry */
+#define OLD_FIFO_SIZE   20
+
+typedef struct {
+    int nr;
+    int wr;
+    int rd;
+    u8 dat[OLD_FIFO_SIZE][65];
+} old_fifo_t;
+
+static void old_push(old_fifo_t *p, u8 *report, u16 *len)
+{
+    if (p->nr < OLD_FIFO_SIZE) {
+        p->dat[p->wr][0] = *len;
+        memcpy(p->dat[p->wr]+1, report, *len);
+        p->nr++, p->wr++;
+        if (p->wr > OLD_FIFO_SIZE-1)
+            p->wr = 0;
+    }
+}
+
+static void old_pop(old_fifo_t *p, u8 *report, u16 *len)
+{
+    if (p->nr > 0) {
+        *len = p->dat[p->rd][0];
+        memcpy(report, p->dat[p->rd]+1, *len);
+        p->nr--, p->rd++;
+        if (p->rd > OLD_FIFO_SIZE-1)
+            p->rd = 0;
+    }
+}
+
+static double now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define BENCH_REPORTS   1000000
+#define BENCH_BURST     8           /* reports queued before the ISR drains */
+#define BENCH_ROUNDS    3           /* best of, against preemption */
+
+enum { OLD_PUSH_POP, PUSH_POP, IN_PLACE };
+
+/* Mreports/s through one of the rings, len bytes each */
+static double bench(int how, u16 size)
+{
+  static old_fifo_t old;
+  u8 in[USBD_FIFO_SLOT_SIZE], out[USBD_FIFO_SLOT_SIZE];
+  volatile u8 sink = 0;
+  double t0, t, best = 1e9;
+  u32 n, i, r;
+  u16 len;
+  u8 *p;
+
+  fill(in, 1, sizeof(in));
+  for (r = 0; r < BENCH_ROUNDS; r++)
+  {
+    memset(&old, 0, sizeof(old));
+    memset(&fifo, 0, sizeof(fifo));
+    t0 = now_s();
+    for (n = 0; n < BENCH_REPORTS; n += BENCH_BURST)
+    {
+      for (i = 0; i < BENCH_BURST; i++)
+      {
+        len = size;
+        if (how == OLD_PUSH_POP)
+          old_push(&old, in, &len);
+        else if (how == PUSH_POP)
+          USBD_FIFO_Push(&fifo, in, &len);
+        else
+        {
+          /* as the HID class does: built in the slot, sent out of it */
+          p = USBD_FIFO_Reserve(&fifo);
+          p[0] = (u8)i;
+          USBD_FIFO_Commit(&fifo, size);
+        }
+      }
+      for (i = 0; i < BENCH_BURST; i++)
+      {
+        if (how == OLD_PUSH_POP)
+          old_pop(&old, out, &len);
+        else if (how == PUSH_POP)
+          USBD_FIFO_Pop(&fifo, out, &len);
+        else
+        {
+          p = USBD_FIFO_Front(&fifo, &len);
+          sink += p[0];
+          USBD_FIFO_Release(&fifo);
+        }
+      }
+    }
+    t = now_s() - t0;
+    best = (t < best) ? t : best;
+    CHECK(USBD_FIFO_Used(&fifo) == 0 && old.nr == 0);
+  }
+  return BENCH_REPORTS / best / 1e6;
+}
+
+static void test_throughput(void)
+{
+  static const u16 sizes[] = { 8, 64 };
+  double rate[3];
+  int s, how;
+
+  printf("  Mreports/s  old Push/Pop  Push/Pop  in place\n");
+  for (s = 0; s < 2; s++)
+  {
+    for (how = OLD_PUSH_POP; how <= IN_PLACE; how++)
+      rate[how] = bench(how, sizes[s]);
+    printf("  %2u bytes   %12.1f  %8.1f  %8.1f\n", sizes[s],
+           rate[OLD_PUSH_POP], rate[PUSH_POP], rate[IN_PLACE]);
+  }
+}
+
+int main(void)
+{
+  RUN(test_empty);
+  RUN(test_order);
+  RUN(test_full);
+  RUN(test_push_status);
+  RUN(test_reserve_in_place);
+  RUN(test_index_wrap);
+  RUN(test_at_release_n);
+  RUN(test_flush);
+  RUN(test_spsc_stress);
+  RUN(test_throughput);
+  return TEST_RESULT();
+}
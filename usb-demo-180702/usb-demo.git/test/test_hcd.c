@@ -0,0 +1,972 @@
+/**
+  ******************************************************************************
+  * @file    test_hcd.c
+  * @brief   Host tests of the host side of the OTG driver (usb_hcd.c,
+  *          usb_hcd_int.c) against a model of the core: the registers are
+  *          plain memory, a test plays the device by writing the channel
+  *          interrupts and received packets the core would raise, then
+  *          runs the interrupt handler on them.
+  *          - bulk IN: the data toggle follows the device's over transfers
+  *            of any number of packets, ending full, short or on a ZLP
+  *          - more pipes than host channels: binding, eviction of the idle
+  *            pipe of lowest priority, and the ageing of waiting transfers
+  *          - interrupt IN pipes polled from the SOF handler into a report
+  *            ring: one poll per interval, NAKs, a full ring, late frames
+  *          - bulk pipes parked on a NAK and retried from the SOF handler:
+  *            next frame, backoff, OUT handed back or PINGed
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usb_core.c"
+#include "usb_hcd.c"
+#include "usb_hcd_int.c"
+
+/* ---- what the driver links against ------------------------------------ */
+
+void USB_OTG_BSP_uDelay(const uint32_t usec) { }
+void USB_OTG_BSP_mDelay(const uint32_t msec) { }
+void USB_OTG_BSP_ConfigVBUS(USB_OTG_CORE_HANDLE *pdev) { }
+void USB_OTG_BSP_DriveVBUS(USB_OTG_CORE_HANDLE *pdev, uint8_t state) { }
+
+static int sofs;
+
+static uint8_t on_sof(USB_OTG_CORE_HANDLE *pdev) { sofs++; return 0; }
+static uint8_t on_event(USB_OTG_CORE_HANDLE *pdev) { return 0; }
+
+static USBH_HCD_INT_cb_TypeDef usbh_cb = {
+  on_sof, on_event, on_event, on_event, on_event
+};
+USBH_HCD_INT_cb_TypeDef *USBH_HCD_INT_fops = &usbh_cb;
+
+/* ---- the core ----------------------------------------------------------- */
+
+#define CHANNELS        8
+
+static USB_OTG_CORE_HANDLE dev;
+static USB_OTG_GREGS       gregs;
+static USB_OTG_HREGS       hregs;
+static USB_OTG_HC_REGS     hcregs[USB_OTG_MAX_TX_FIFOS];
+static uint32_t            hprt0, dfifo;
+
+static void core_init(void)
+{
+  int i;
+
+  memset(&dev, 0, sizeof(dev));
+  memset(&gregs, 0, sizeof(gregs));
+  memset(&hregs, 0, sizeof(hregs));
+  memset(hcregs, 0, sizeof(hcregs));
+  dev.regs.GREGS = &gregs;
+  dev.regs.HREGS = &hregs;
+  dev.regs.HPRT0 = &hprt0;
+  for (i = 0; i < USB_OTG_MAX_TX_FIFOS; i++)
+  {
+    dev.regs.HC_REGS[i] = &hcregs[i];
+    dev.regs.DFIFO[i] = &dfifo;
+  }
+  dev.cfg.host_channels = CHANNELS;
+  dev.cfg.mps = 64;
+  HCD_ResetState(&dev);
+}
+
+/* the speed of the device the pipes are opened to */
+static uint8_t port_speed = HPRT0_PRTSPD_FULL_SPEED;
+
+/* as USBH_Open_Channel */
+static void pipe_open(uint8_t pipe, uint8_t ep_type, uint8_t is_in, uint16_t mps)
+{
+  USB_OTG_HC *hc = &dev.host.hc[pipe];
+
+  hc->dev_addr = 1;
+  hc->ep_num = pipe + 1;
+  hc->ep_is_in = is_in;
+  hc->ep_type = ep_type;
+  hc->max_packet = mps;
+  hc->speed = port_speed;
+  hc->toggle_in = 0;
+  hc->toggle_out = 0;
+  if (port_speed == HPRT0_PRTSPD_HIGH_SPEED)
+  {
+    hc->do_ping = 1;
+  }
+  if (ep_type == EP_TYPE_INTR)
+  {
+    dev.host.Priority[pipe] = USB_OTG_HC_PRIO_INTR;
+  }
+  else if (ep_type == EP_TYPE_CTRL)
+  {
+    dev.host.Priority[pipe] = USB_OTG_HC_PRIO_CTRL;
+  }
+  else
+  {
+    dev.host.Priority[pipe] = USB_OTG_HC_PRIO_BULK;
+  }
+  HCD_HC_Init(&dev, pipe);
+}
+
+/* the channel raises bits: run the handler on them, as the core would */
+static void hc_event(uint8_t ch, uint32_t bits)
+{
+  hcregs[ch].HCINT = bits;
+  hregs.HAINT = 1 << ch;
+  USB_OTG_USBH_handle_hc_ISR(&dev);
+  hcregs[ch].HCINT = 0;
+  hregs.HAINT = 0;
+}
+
+static uint32_t hcint(int xfercompl, int chhltd, int nak, int stall, int frmovrun,
+                      int ack)
+{
+  USB_OTG_HCINTn_TypeDef i;
+
+  i.d32 = 0;
+  i.b.xfercompl = xfercompl;
+  i.b.chhltd = chhltd;
+  i.b.nak = nak;
+  i.b.stall = stall;
+  i.b.frmovrun = frmovrun;
+  i.b.ack = ack;
+  return i.d32;
+}
+
+#define XFERCOMPL       hcint(1, 0, 0, 0, 0, 0)
+#define CHHLTD          hcint(0, 1, 0, 0, 0, 0)
+#define NAK             hcint(0, 0, 1, 0, 0, 0)
+#define STALL           hcint(0, 0, 0, 1, 0, 0)
+#define FRMOVRUN        hcint(0, 0, 0, 0, 1, 0)
+#define ACK             hcint(0, 0, 0, 0, 0, 1)
+
+/* one IN data packet of len bytes into the Rx FIFO of channel ch */
+static void rx_packet(uint8_t ch, uint16_t len)
+{
+  USB_OTG_GRXFSTS_TypeDef grxsts;
+  USB_OTG_HCTSIZn_TypeDef hctsiz;
+
+  hctsiz.d32 = hcregs[ch].HCTSIZ;
+  hctsiz.b.pktcnt--;
+  hcregs[ch].HCTSIZ = hctsiz.d32;
+  grxsts.d32 = 0;
+  grxsts.b.chnum = ch;
+  grxsts.b.bcnt = len;
+  grxsts.b.pktsts = GRXSTS_PKTSTS_IN;
+  gregs.GRXSTSP = grxsts.d32;
+  USB_OTG_USBH_handle_rx_qlvl_ISR(&dev);
+}
+
+static uint8_t hc_pid(uint8_t ch)
+{
+  USB_OTG_HCTSIZn_TypeDef hctsiz;
+
+  hctsiz.d32 = hcregs[ch].HCTSIZ;
+  return hctsiz.b.pid;
+}
+
+/* as USBH_BulkReceiveData */
+static void bulk_receive(uint8_t pipe, uint8_t *buff, uint32_t len)
+{
+  dev.host.hc[pipe].ep_is_in = 1;
+  dev.host.hc[pipe].xfer_buff = buff;
+  dev.host.hc[pipe].xfer_len = len;
+  dev.host.hc[pipe].data_pid = dev.host.hc[pipe].toggle_in ? HC_PID_DATA1 : HC_PID_DATA0;
+  HCD_SubmitRequest(&dev, pipe);
+}
+
+/* ---- bulk IN data toggle ------------------------------------------------ */
+
+static uint8_t rx_buf[8 * 512];
+
+/* The device sends pkts, n of them, for a transfer of len; its toggle
+   flips on each. 0: the host asked with the PID the device expected, got
+   every byte and URB_DONE. */
+static int bulk_in(uint8_t pipe, uint32_t len, const uint16_t *pkts, int n,
+                   uint8_t *dev_toggle)
+{
+  uint8_t ch;
+  uint32_t total = 0;
+  int i, bad = 0;
+
+  bulk_receive(pipe, rx_buf, len);
+  ch = dev.host.ChNum[pipe];
+  if (hc_pid(ch) != (*dev_toggle ? HC_PID_DATA1 : HC_PID_DATA0))
+  {
+    bad |= 1;
+  }
+  for (i = 0; i < n; i++)
+  {
+    rx_packet(ch, pkts[i]);
+    total += pkts[i];
+    *dev_toggle ^= 1;
+  }
+  hc_event(ch, XFERCOMPL);
+  hc_event(ch, CHHLTD);
+  if (HCD_GetURB_State(&dev, pipe) != URB_DONE)
+  {
+    bad |= 2;
+  }
+  if (HCD_GetXferCnt(&dev, pipe) != total)
+  {
+    bad |= 4;
+  }
+  return bad;
+}
+
+static void test_bulk_in_toggle(void)
+{
+  static const uint16_t mps_of[2] = { 64, 512 };
+  uint16_t pkts[5], mps;
+  uint8_t toggle;
+  int m;
+
+  for (m = 0; m < 2; m++)
+  {
+    mps = mps_of[m];
+    core_init();
+    pipe_open(1, EP_TYPE_BULK, 1, mps);
+    toggle = 0;
+
+    /* full transfers, an even then an odd number of packets */
+    pkts[0] = pkts[1] = pkts[2] = pkts[3] = mps;
+    CHECK(bulk_in(1, 4 * mps, pkts, 4, &toggle) == 0);
+    CHECK(bulk_in(1, 3 * mps, pkts, 3, &toggle) == 0);
+    CHECK(bulk_in(1, mps, pkts, 1, &toggle) == 0);
+    /* ended on a short packet */
+    pkts[2] = 10;
+    CHECK(bulk_in(1, 4 * mps, pkts, 3, &toggle) == 0);
+    pkts[1] = 36;
+    CHECK(bulk_in(1, 2 * mps, pkts, 2, &toggle) == 0);
+    /* on a ZLP after full packets, or on a lone ZLP */
+    pkts[1] = mps;
+    pkts[2] = 0;
+    CHECK(bulk_in(1, 4 * mps, pkts, 3, &toggle) == 0);
+    pkts[0] = 0;
+    CHECK(bulk_in(1, mps, pkts, 1, &toggle) == 0);
+    /* a length the packets do not divide */
+    pkts[0] = mps;
+    pkts[1] = 36;
+    CHECK(bulk_in(1, mps + 36, pkts, 2, &toggle) == 0);
+    /* the last one asked with the right PID too */
+    CHECK(bulk_in(1, mps, pkts, 1, &toggle) == 0);
+  }
+}
+
+/* a ZLP moves no data: the count is not the one of the transfer before */
+static void test_zlp_count(void)
+{
+  uint16_t pkts[2] = { 64, 0 };
+  uint8_t toggle = 0;
+
+  core_init();
+  pipe_open(1, EP_TYPE_BULK, 1, 64);
+  CHECK(bulk_in(1, 64, pkts, 1, &toggle) == 0);
+  CHECK(HCD_GetXferCnt(&dev, 1) == 64);
+  CHECK(bulk_in(1, 64, pkts + 1, 1, &toggle) == 0);
+  CHECK(HCD_GetXferCnt(&dev, 1) == 0);
+}
+
+/* ---- pipes sharing the host channels ------------------------------------ */
+
+static void set_frame(uint16_t frame)
+{
+  hregs.HFNUM = frame;
+}
+
+static uint8_t ch_enabled(uint8_t ch)
+{
+  USB_OTG_HCCHAR_TypeDef hcchar;
+
+  if (ch == USB_OTG_HC_NONE)
+  {
+    return 0;
+  }
+  hcchar.d32 = hcregs[ch].HCCHAR;
+  return hcchar.b.chen;
+}
+
+/* the channel halts, as the core does: disabled, then chhltd */
+static void halted(uint8_t ch)
+{
+  USB_OTG_HCCHAR_TypeDef hcchar;
+
+  hcchar.d32 = hcregs[ch].HCCHAR;
+  hcchar.b.chen = 0;
+  hcchar.b.chdis = 0;
+  hcregs[ch].HCCHAR = hcchar.d32;
+  hc_event(ch, CHHLTD);
+}
+
+/* the transfer of a bound pipe ends: one packet, then the channel halts */
+static void finish(uint8_t pipe)
+{
+  uint8_t ch = dev.host.ChNum[pipe];
+
+  rx_packet(ch, 64);
+  hc_event(ch, XFERCOMPL);
+  halted(ch);
+}
+
+/* every channel bound to bulk pipes 0..CHANNELS-1, idle, 0 the least
+   recently used */
+static void fill_channels(void)
+{
+  uint8_t p;
+
+  core_init();
+  for (p = 0; p < CHANNELS; p++)
+  {
+    pipe_open(p, EP_TYPE_BULK, 1, 64);
+    bulk_receive(p, rx_buf, 64);
+    finish(p);
+  }
+}
+
+/* the binding of channels and pipes is one to one, both ways */
+static int bindings_agree(void)
+{
+  uint8_t ch, p;
+
+  for (ch = 0; ch < CHANNELS; ch++)
+  {
+    p = dev.host.ChPipe[ch];
+    if ((p != USB_OTG_HC_NONE) && (dev.host.ChNum[p] != ch))
+    {
+      return 0;
+    }
+  }
+  for (p = 0; p < USB_OTG_MAX_TX_FIFOS; p++)
+  {
+    ch = dev.host.ChNum[p];
+    if ((ch != USB_OTG_HC_NONE) && (dev.host.ChPipe[ch] != p))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static uint8_t ch_epnum(uint8_t ch)
+{
+  USB_OTG_HCCHAR_TypeDef hcchar;
+
+  if (ch == USB_OTG_HC_NONE)
+  {
+    return 0;
+  }
+  hcchar.d32 = hcregs[ch].HCCHAR;
+  return hcchar.b.epnum;
+}
+
+static void test_bind(void)
+{
+  uint8_t p, ch;
+
+  core_init();
+  pipe_open(3, EP_TYPE_BULK, 1, 64);
+  /* no channel until the first transfer */
+  CHECK(dev.host.ChNum[3] == USB_OTG_HC_NONE);
+  bulk_receive(3, rx_buf, 64);
+  ch = dev.host.ChNum[3];
+  CHECK(ch != USB_OTG_HC_NONE && ch_enabled(ch) && ch_epnum(ch) == 4);
+  finish(3);
+  /* and the pipe keeps it */
+  bulk_receive(3, rx_buf, 64);
+  CHECK(dev.host.ChNum[3] == ch);
+  finish(3);
+
+  fill_channels();
+  CHECK(bindings_agree());
+  for (p = 0; p < CHANNELS; p++)
+  {
+    CHECK(dev.host.ChNum[p] != USB_OTG_HC_NONE);
+  }
+  CHECK(dev.host.Evictions == 0 && dev.host.Deferrals == 0);
+
+  /* a freed channel goes to the next pipe */
+  ch = dev.host.ChNum[5];
+  HCD_HC_Free(&dev, 5);
+  CHECK(dev.host.ChPipe[ch] == USB_OTG_HC_NONE && dev.host.ChNum[5] == USB_OTG_HC_NONE);
+  pipe_open(9, EP_TYPE_BULK, 1, 64);
+  bulk_receive(9, rx_buf, 64);
+  CHECK(dev.host.ChNum[9] == ch && ch_epnum(ch) == 10);
+  CHECK(dev.host.Evictions == 0 && bindings_agree());
+}
+
+static void test_evict(void)
+{
+  uint8_t ch;
+
+  /* a control pipe takes the channel of the least recently used bulk pipe */
+  fill_channels();
+  bulk_receive(0, rx_buf, 64);
+  finish(0);
+  ch = dev.host.ChNum[1];
+  pipe_open(10, EP_TYPE_CTRL, 1, 64);
+  bulk_receive(10, rx_buf, 64);
+  CHECK(dev.host.ChNum[10] == ch && dev.host.ChNum[1] == USB_OTG_HC_NONE);
+  CHECK(dev.host.Evictions == 1 && bindings_agree());
+  /* the HCCHAR of the channel is the new pipe's */
+  CHECK(ch_epnum(ch) == 11);
+  finish(10);
+
+  /* the evicted pipe gets a channel back the same way, from bulk pipe 2 */
+  dev.host.Priority[1] = USB_OTG_HC_PRIO_CTRL;
+  ch = dev.host.ChNum[2];
+  bulk_receive(1, rx_buf, 64);
+  CHECK(dev.host.ChNum[1] == ch && ch_epnum(ch) == 2);
+  CHECK(dev.host.Evictions == 2 && bindings_agree());
+
+  /* no pipe below: the transfer waits */
+  fill_channels();
+  pipe_open(10, EP_TYPE_BULK, 1, 64);
+  bulk_receive(10, rx_buf, 64);
+  CHECK(dev.host.ChNum[10] == USB_OTG_HC_NONE && dev.host.Pending[10]);
+  CHECK(dev.host.Deferrals == 1 && dev.host.Evictions == 0);
+  CHECK(HCD_GetURB_State(&dev, 10) == URB_IDLE);
+}
+
+/* the pipes that are busy or re-submitted by the handler keep their channel */
+static void handler(void *pdev, uint8_t pipe) { }
+
+static void test_no_evict(void)
+{
+  static USB_OTG_HC_RING ring;
+  uint8_t p, ch;
+
+  fill_channels();
+  /* 0 on the bus, 1 with a handler, 2 polled into a ring, 3 parked on a
+     NAK, 4..7 higher than the intruder */
+  bulk_receive(0, rx_buf, 64);
+  HCD_HC_SetHandler(&dev, 1, handler);
+  dev.host.Ring[2] = &ring;
+  dev.host.Nak[3].state = NAK_PARKED;
+  for (p = 4; p < CHANNELS; p++)
+  {
+    dev.host.Priority[p] = USB_OTG_HC_PRIO_INTR;
+  }
+  pipe_open(10, EP_TYPE_CTRL, 1, 64);
+  bulk_receive(10, rx_buf, 64);
+  CHECK(dev.host.ChNum[10] == USB_OTG_HC_NONE && dev.host.Pending[10]);
+  CHECK(dev.host.Evictions == 0);
+
+  /* nor does a channel with an event the handler has not seen yet */
+  fill_channels();
+  for (p = 1; p < CHANNELS; p++)
+  {
+    dev.host.Priority[p] = USB_OTG_HC_PRIO_INTR;
+  }
+  ch = dev.host.ChNum[0];
+  hcregs[ch].HCINT = XFERCOMPL;
+  pipe_open(10, EP_TYPE_CTRL, 1, 64);
+  bulk_receive(10, rx_buf, 64);
+  CHECK(dev.host.ChNum[10] == USB_OTG_HC_NONE);
+  hcregs[ch].HCINT = 0;
+  HCD_ProcessPending(&dev);
+  CHECK(dev.host.ChNum[10] != USB_OTG_HC_NONE && dev.host.ChNum[0] == USB_OTG_HC_NONE);
+}
+
+/* a waiting transfer gains a level per USB_OTG_HC_AGE_FRAMES */
+static void test_ageing(void)
+{
+  uint16_t f0 = 0x3FFC;                 /* across the frame number wrap */
+  uint8_t p;
+
+  fill_channels();
+  set_frame(f0);
+  pipe_open(10, EP_TYPE_BULK, 1, 64);
+  bulk_receive(10, rx_buf, 64);
+  CHECK(dev.host.Pending[10]);
+
+  set_frame((f0 + USB_OTG_HC_AGE_FRAMES - 1) & 0x3FFF);
+  HCD_ProcessPending(&dev);
+  CHECK(dev.host.ChNum[10] == USB_OTG_HC_NONE);
+
+  /* now above the bulk pipes: it takes the least recently used one's */
+  set_frame((f0 + USB_OTG_HC_AGE_FRAMES) & 0x3FFF);
+  HCD_ProcessPending(&dev);
+  CHECK(dev.host.ChNum[10] != USB_OTG_HC_NONE && !dev.host.Pending[10]);
+  CHECK(dev.host.ChNum[0] == USB_OTG_HC_NONE);
+  CHECK(ch_enabled(dev.host.ChNum[10]));
+  CHECK(dev.host.Deferrals == 1 && dev.host.Evictions == 1 && bindings_agree());
+
+  /* a freed channel goes to the highest priority waiting, ageing counted */
+  fill_channels();
+  for (p = 0; p < CHANNELS; p++)
+  {
+    dev.host.Priority[p] = USB_OTG_HC_PRIO_INTR;
+  }
+  set_frame(100);
+  pipe_open(11, EP_TYPE_BULK, 1, 64);
+  bulk_receive(11, rx_buf, 64);
+  set_frame(100 + USB_OTG_HC_AGE_FRAMES / 2);
+  pipe_open(10, EP_TYPE_BULK, 1, 64);
+  bulk_receive(10, rx_buf, 64);
+  pipe_open(12, EP_TYPE_CTRL, 1, 64);
+  bulk_receive(12, rx_buf, 64);
+  HCD_HC_Free(&dev, 7);
+  HCD_ProcessPending(&dev);
+  CHECK(dev.host.ChNum[12] != USB_OTG_HC_NONE);
+  CHECK(dev.host.ChNum[10] == USB_OTG_HC_NONE && dev.host.ChNum[11] == USB_OTG_HC_NONE);
+  /* the older bulk transfer has aged past the other */
+  set_frame(100 + USB_OTG_HC_AGE_FRAMES);
+  HCD_HC_Free(&dev, 6);
+  HCD_ProcessPending(&dev);
+  CHECK(dev.host.ChNum[11] != USB_OTG_HC_NONE && dev.host.ChNum[10] == USB_OTG_HC_NONE);
+  CHECK(dev.host.Evictions == 0 && bindings_agree());
+}
+
+/* ---- interrupt IN report ring ------------------------------------------- */
+
+#define RING_PIPE       2
+
+static USB_OTG_HC_RING ring;
+
+static void sof(uint16_t frame)
+{
+  set_frame(frame);
+  USB_OTG_USBH_handle_sof_ISR(&dev);
+}
+
+static void ring_start(uint16_t frame, uint16_t interval)
+{
+  core_init();
+  memset(&ring, 0, sizeof(ring));
+  pipe_open(RING_PIPE, EP_TYPE_INTR, 1, 8);
+  set_frame(frame);
+  CHECK(HCD_StartRing(&dev, RING_PIPE, &ring, 8, interval) == USB_OTG_OK);
+}
+
+/* the poll on the bus gets a report of len bytes, first byte b */
+static void ring_data(uint8_t b, uint16_t len)
+{
+  uint8_t ch = dev.host.ChNum[RING_PIPE];
+
+  dfifo = 0x01010100u * b + b;
+  rx_packet(ch, len);
+  hc_event(ch, XFERCOMPL);
+}
+
+/* the poll on the bus ends without data */
+static void ring_nodata(uint32_t why)
+{
+  uint8_t ch = dev.host.ChNum[RING_PIPE];
+
+  hc_event(ch, why);
+  hc_event(ch, CHHLTD);
+}
+
+static void test_ring_poll(void)
+{
+  uint16_t len;
+  uint8_t *rep;
+  uint16_t f;
+
+  ring_start(10, 4);
+  CHECK(ring.state == RING_ARMED);
+  /* pinned to its channel */
+  CHECK(dev.host.ChNum[RING_PIPE] != USB_OTG_HC_NONE);
+
+  /* the next SOF starts it, DATA0 */
+  sof(11);
+  CHECK(ring.state == RING_BUSY && hc_pid(dev.host.ChNum[RING_PIPE]) == HC_PID_DATA0);
+  ring_data(0x11, 8);
+  CHECK(ring.state == RING_ARMED && ring.wr == 1 && ring.Reports == 1);
+  CHECK(ring.len[0] == 8 && ring.frame[0] == 11);
+  CHECK(HCD_GetURB_State(&dev, RING_PIPE) == URB_DONE);
+
+  /* the next poll interval frames after the due one, not before */
+  for (f = 12; f < 15; f++)
+  {
+    sof(f);
+    CHECK(ring.state == RING_ARMED);
+  }
+  sof(15);
+  CHECK(ring.state == RING_BUSY && hc_pid(dev.host.ChNum[RING_PIPE]) == HC_PID_DATA1);
+  ring_data(0x22, 5);
+  CHECK(ring.wr == 2 && ring.len[1] == 5 && ring.Late == 0);
+
+  /* the reports come out oldest first, in place */
+  rep = HCD_RingGet(&dev, RING_PIPE, &len);
+  CHECK(rep == ring.data[0] && len == 8 && rep[0] == 0x11);
+  HCD_RingRelease(&dev, RING_PIPE);
+  rep = HCD_RingGet(&dev, RING_PIPE, &len);
+  CHECK(rep == ring.data[1] && len == 5 && rep[0] == 0x22);
+  HCD_RingRelease(&dev, RING_PIPE);
+  CHECK(HCD_RingGet(&dev, RING_PIPE, &len) == 0);
+
+  /* across the wrap of the frame number */
+  ring_start(0x3FFC, 2);
+  sof(0x3FFD);
+  ring_data(1, 8);
+  sof(0x3FFE);
+  CHECK(ring.state == RING_ARMED);
+  sof(0x3FFF);
+  CHECK(ring.state == RING_BUSY);
+  ring_data(2, 8);
+  sof(0x0000);
+  CHECK(ring.state == RING_ARMED);
+  sof(0x0001);
+  CHECK(ring.state == RING_BUSY && ring.Late == 0);
+
+  /* stopped: no more polls */
+  ring_data(3, 8);
+  HCD_StopRing(&dev, RING_PIPE);
+  sof(0x0003);
+  CHECK(ring.state == RING_OFF && ring.wr == 3);
+}
+
+/* a NAK or a frame overrun moves on to the next interval, the toggle
+   not spent */
+static void test_ring_nak(void)
+{
+  ring_start(10, 2);
+  sof(11);
+  ring_nodata(NAK);
+  CHECK(ring.state == RING_ARMED && ring.wr == 0 && ring.due == 14);
+  sof(13);
+  CHECK(ring.state == RING_BUSY && hc_pid(dev.host.ChNum[RING_PIPE]) == HC_PID_DATA0);
+  ring_nodata(FRMOVRUN);
+  CHECK(ring.state == RING_ARMED && ring.wr == 0 && ring.due == 16);
+  sof(15);
+  CHECK(hc_pid(dev.host.ChNum[RING_PIPE]) == HC_PID_DATA0);
+  ring_data(1, 8);
+  sof(17);
+  CHECK(hc_pid(dev.host.ChNum[RING_PIPE]) == HC_PID_DATA1);
+  CHECK(ring.wr == 1 && ring.Reports == 1 && ring.Late == 0);
+}
+
+/* a full ring holds the polls until a report is read */
+static void test_ring_full(void)
+{
+  uint16_t f = 100, len;
+  int i;
+
+  ring_start(f, 1);
+  for (i = 0; i < USB_OTG_HC_RING_SIZE; i++)
+  {
+    sof(++f);
+    ring_data(i, 8);
+  }
+  CHECK(ring.wr == USB_OTG_HC_RING_SIZE);
+  sof(++f);
+  CHECK(ring.state == RING_FULL && ring.Pauses == 1);
+  sof(++f);
+  CHECK(ring.state == RING_FULL && ring.wr == USB_OTG_HC_RING_SIZE);
+
+  CHECK(HCD_RingGet(&dev, RING_PIPE, &len)[0] == 0);
+  HCD_RingRelease(&dev, RING_PIPE);
+  CHECK(ring.state == RING_ARMED);
+  sof(++f);
+  CHECK(ring.state == RING_BUSY);
+  ring_data(0x55, 8);
+  CHECK(ring.wr == USB_OTG_HC_RING_SIZE + 1);
+  /* into the slot just freed */
+  CHECK(ring.data[0][0] == 0x55);
+  /* neither the start nor the resume counts as late */
+  CHECK(ring.Late == 0);
+}
+
+/* a poll that could not start in its frame starts in the next one */
+static void test_ring_late(void)
+{
+  ring_start(10, 4);
+  sof(11);
+  ring_data(1, 8);
+  /* due 16, the SOF of 15 missed */
+  sof(17);
+  CHECK(ring.state == RING_BUSY && ring.Late == 1);
+  ring_data(2, 8);
+  CHECK(ring.due == 22);
+}
+
+/* a stall halts the ring with URB_STALL until it is started again */
+static void test_ring_stall(void)
+{
+  ring_start(10, 1);
+  sof(11);
+  ring_nodata(STALL);
+  CHECK(ring.state == RING_HALTED);
+  CHECK(HCD_GetURB_State(&dev, RING_PIPE) == URB_STALL);
+  sof(12);
+  sof(13);
+  CHECK(ring.state == RING_HALTED && ring.wr == 0);
+  CHECK(HCD_StartRing(&dev, RING_PIPE, &ring, 8, 1) == USB_OTG_OK);
+  sof(14);
+  CHECK(ring.state == RING_BUSY && ring.Late == 0);
+
+  /* longer than a slot is refused */
+  CHECK(HCD_StartRing(&dev, RING_PIPE, &ring, USB_OTG_HC_RING_SLOT + 1, 1) == USB_OTG_FAIL);
+}
+
+/* ---- NAK throttling of bulk pipes --------------------------------------- */
+
+#define NAK_PIPE        3
+
+static int       nak_calls;
+static URB_STATE nak_urb;
+
+static void nak_handler(void *pdev, uint8_t pipe)
+{
+  nak_calls++;
+  nak_urb = HCD_GetURB_State(&dev, pipe);
+}
+
+/* as USBH_BulkSendData */
+static void bulk_send(uint8_t pipe, uint8_t *buff, uint32_t len)
+{
+  dev.host.hc[pipe].ep_is_in = 0;
+  dev.host.hc[pipe].xfer_buff = buff;
+  dev.host.hc[pipe].xfer_len = len;
+  dev.host.hc[pipe].data_pid = dev.host.hc[pipe].toggle_out ? HC_PID_DATA1 : HC_PID_DATA0;
+  HCD_SubmitRequest(&dev, pipe);
+}
+
+/* a transfer of two packets on a bulk pipe of the policy, in frame */
+static uint8_t nak_start(uint16_t frame, uint8_t is_in, HC_NAK_POLICY policy,
+                         uint8_t max_shift)
+{
+  core_init();
+  nak_calls = 0;
+  nak_urb = URB_IDLE;
+  pipe_open(NAK_PIPE, EP_TYPE_BULK, is_in, 64);
+  HCD_HC_SetNakPolicy(&dev, NAK_PIPE, policy, max_shift);
+  HCD_HC_SetHandler(&dev, NAK_PIPE, nak_handler);
+  set_frame(frame);
+  if (is_in)
+  {
+    bulk_receive(NAK_PIPE, rx_buf, 128);
+  }
+  else
+  {
+    bulk_send(NAK_PIPE, rx_buf, 128);
+  }
+  return dev.host.ChNum[NAK_PIPE];
+}
+
+static uint8_t ch_halting(uint8_t ch)
+{
+  USB_OTG_HCCHAR_TypeDef hcchar;
+
+  hcchar.d32 = hcregs[ch].HCCHAR;
+  return hcchar.b.chdis;
+}
+
+/* the default, and DMA mode: retried by the NAK interrupt, as before */
+static void test_nak_immediate(void)
+{
+  USB_OTG_HC_NAK *nak = &dev.host.Nak[NAK_PIPE];
+  uint8_t ch;
+
+  ch = nak_start(100, 1, HC_NAK_IMMEDIATE, 0);
+  hc_event(ch, NAK);
+  CHECK(ch_enabled(ch) && !ch_halting(ch));
+  CHECK(nak->state == NAK_IDLE && nak->Naks == 1 && nak->Retries == 1);
+
+  /* OUT is handed back once halted */
+  ch = nak_start(100, 0, HC_NAK_IMMEDIATE, 0);
+  hc_event(ch, NAK);
+  CHECK(ch_halting(ch));
+  halted(ch);
+  CHECK(nak_calls == 1 && nak_urb == URB_NOTREADY);
+  CHECK(nak->state == NAK_IDLE && nak->Retries == 1);
+
+  ch = nak_start(100, 1, HC_NAK_NEXT_FRAME, 0);
+  dev.cfg.dma_enable = 1;
+  hc_event(ch, NAK);
+  CHECK(ch_enabled(ch) && !ch_halting(ch) && nak->state == NAK_IDLE);
+}
+
+/* IN goes on from where the NAK stopped it, in the next frame */
+static void test_nak_next_frame(void)
+{
+  USB_OTG_HC_NAK *nak = &dev.host.Nak[NAK_PIPE];
+  uint32_t hctsiz;
+  uint8_t ch;
+
+  ch = nak_start(100, 1, HC_NAK_NEXT_FRAME, 3);
+  rx_packet(ch, 64);
+  hctsiz = hcregs[ch].HCTSIZ;
+  hc_event(ch, NAK);
+  CHECK(ch_halting(ch));
+  CHECK(nak->state == NAK_PARKED && nak->due == 101 && nak->Retries == 0);
+  halted(ch);
+  /* nothing for the pipe handler yet */
+  CHECK(nak_calls == 0 && HCD_GetURB_State(&dev, NAK_PIPE) == URB_IDLE);
+  sof(100);
+  CHECK(nak->state == NAK_PARKED && !ch_enabled(ch));
+  sof(101);
+  CHECK(nak->state == NAK_IDLE && nak->Retries == 1);
+  CHECK(ch_enabled(ch) && !ch_halting(ch));
+  /* size, packet count and PID as the NAK left them */
+  CHECK(hcregs[ch].HCTSIZ == hctsiz);
+  /* no backoff, whatever max_shift says */
+  hc_event(ch, NAK);
+  halted(ch);
+  CHECK(nak->due == 102);
+  sof(102);
+  CHECK(ch_enabled(ch) && nak->Retries == 2);
+  rx_packet(ch, 64);
+  hc_event(ch, XFERCOMPL);
+  halted(ch);
+  CHECK(nak_calls == 1 && nak_urb == URB_DONE);
+  CHECK(HCD_GetXferCnt(&dev, NAK_PIPE) == 128);
+
+  /* across the wrap of the frame number */
+  ch = nak_start(0x3FFF, 1, HC_NAK_NEXT_FRAME, 0);
+  hc_event(ch, NAK);
+  halted(ch);
+  CHECK(nak->due == 0);
+  sof(0x3FFF);
+  CHECK(nak->state == NAK_PARKED);
+  sof(0x0000);
+  CHECK(nak->state == NAK_IDLE && ch_enabled(ch));
+}
+
+/* 1, 2, 4 .. 2^max_shift frames, 1 again once data came */
+static void test_nak_backoff(void)
+{
+  static const uint16_t wait[5] = { 1, 2, 4, 8, 8 };
+  USB_OTG_HC_NAK *nak = &dev.host.Nak[NAK_PIPE];
+  uint16_t f = 200;
+  uint8_t ch;
+  int i;
+
+  ch = nak_start(f, 1, HC_NAK_BACKOFF, 3);
+  for (i = 0; i < 5; i++)
+  {
+    hc_event(ch, NAK);
+    halted(ch);
+    CHECK(nak->due == f + wait[i]);
+    sof(f + wait[i] - 1);
+    CHECK(!ch_enabled(ch));
+    f += wait[i];
+    sof(f);
+    CHECK(ch_enabled(ch));
+  }
+  CHECK(nak->Naks == 5 && nak->Retries == 5);
+
+  rx_packet(ch, 64);
+  rx_packet(ch, 64);
+  hc_event(ch, XFERCOMPL);
+  halted(ch);
+  CHECK(HCD_GetURB_State(&dev, NAK_PIPE) == URB_DONE);
+  bulk_receive(NAK_PIPE, rx_buf, 128);
+  hc_event(ch, NAK);
+  halted(ch);
+  CHECK(nak->due == f + 1);
+
+  /* at most 2^10 frames */
+  HCD_HC_SetNakPolicy(&dev, NAK_PIPE, HC_NAK_BACKOFF, 15);
+  CHECK(nak->max_shift == 10 && nak->shift == 0);
+}
+
+/* OUT is handed back URB_NOTREADY in its frame, or PINGs first */
+static void test_nak_out(void)
+{
+  USB_OTG_HC_NAK *nak = &dev.host.Nak[NAK_PIPE];
+  USB_OTG_HCTSIZn_TypeDef hctsiz;
+  uint8_t ch;
+
+  ch = nak_start(300, 0, HC_NAK_NEXT_FRAME, 0);
+  hc_event(ch, NAK);
+  CHECK(ch_halting(ch));
+  halted(ch);
+  CHECK(nak->state == NAK_PARKED && nak_calls == 0);
+  CHECK(HCD_GetURB_State(&dev, NAK_PIPE) == URB_IDLE);
+  sof(301);
+  CHECK(nak->state == NAK_IDLE && nak->Retries == 1);
+  CHECK(nak_calls == 1 && nak_urb == URB_NOTREADY);
+
+  /* PING on a full speed pipe is the same */
+  ch = nak_start(300, 0, HC_NAK_PING, 0);
+  hc_event(ch, NAK);
+  halted(ch);
+  sof(301);
+  CHECK(nak->state == NAK_IDLE && nak_calls == 1 && nak_urb == URB_NOTREADY);
+
+  /* high speed: PINGed until the device has room */
+  port_speed = HPRT0_PRTSPD_HIGH_SPEED;
+  ch = nak_start(300, 0, HC_NAK_PING, 0);
+  port_speed = HPRT0_PRTSPD_FULL_SPEED;
+  hc_event(ch, NAK);
+  halted(ch);
+  sof(301);
+  hctsiz.d32 = hcregs[ch].HCTSIZ;
+  CHECK(nak->state == NAK_PING && hctsiz.b.dopng && ch_enabled(ch));
+  CHECK(nak_calls == 0);
+  hc_event(ch, NAK);
+  halted(ch);
+  CHECK(nak->state == NAK_PARKED && nak->due == 302 && nak_calls == 0);
+  sof(302);
+  CHECK(nak->state == NAK_PING && nak->Retries == 2);
+  hc_event(ch, ACK);
+  CHECK(ch_halting(ch));
+  halted(ch);
+  CHECK(nak->state == NAK_IDLE && nak_calls == 1 && nak_urb == URB_NOTREADY);
+
+  /* high speed, next frame: no PING, and the ACK of data answers none */
+  port_speed = HPRT0_PRTSPD_HIGH_SPEED;
+  ch = nak_start(300, 0, HC_NAK_NEXT_FRAME, 0);
+  port_speed = HPRT0_PRTSPD_FULL_SPEED;
+  hc_event(ch, NAK);
+  halted(ch);
+  sof(301);
+  CHECK(nak->state == NAK_IDLE && nak_calls == 1 && nak_urb == URB_NOTREADY);
+  bulk_send(NAK_PIPE, rx_buf, 64);
+  hc_event(ch, ACK);
+  CHECK(ch_enabled(ch) && !ch_halting(ch));
+  hc_event(ch, XFERCOMPL);
+  halted(ch);
+  CHECK(nak_calls == 2 && nak_urb == URB_DONE);
+}
+
+/* a halted or freed pipe is not retried */
+static void test_nak_halt(void)
+{
+  USB_OTG_HC_NAK *nak = &dev.host.Nak[NAK_PIPE];
+  uint8_t ch;
+
+  ch = nak_start(400, 1, HC_NAK_NEXT_FRAME, 0);
+  hc_event(ch, NAK);
+  halted(ch);
+  USB_OTG_HC_Halt(&dev, NAK_PIPE);
+  halted(ch);
+  sof(401);
+  CHECK(nak->state == NAK_IDLE && nak->Retries == 0 && !ch_enabled(ch));
+
+  ch = nak_start(400, 1, HC_NAK_NEXT_FRAME, 0);
+  hc_event(ch, NAK);
+  halted(ch);
+  HCD_HC_Free(&dev, NAK_PIPE);
+  CHECK(nak->state == NAK_IDLE && nak->policy == HC_NAK_IMMEDIATE);
+  sof(401);
+  CHECK(nak->Retries == 0 && !ch_enabled(ch));
+
+  /* nor is a pipe without a channel */
+  core_init();
+  pipe_open(NAK_PIPE, EP_TYPE_BULK, 1, 64);
+  nak->state = NAK_PARKED;
+  nak->due = 400;
+  sof(401);
+  CHECK(nak->state == NAK_PARKED && nak->Retries == 0);
+}
+
+int main(void)
+{
+  RUN(test_bulk_in_toggle);
+  RUN(test_zlp_count);
+  RUN(test_bind);
+  RUN(test_evict);
+  RUN(test_no_evict);
+  RUN(test_ageing);
+  RUN(test_ring_poll);
+  RUN(test_ring_nak);
+  RUN(test_ring_full);
+  RUN(test_ring_late);
+  RUN(test_ring_stall);
+  RUN(test_nak_immediate);
+  RUN(test_nak_next_frame);
+  RUN(test_nak_backoff);
+  RUN(test_nak_out);
+  RUN(test_nak_halt);
+  return TEST_RESULT();
+}
@@ -0,0 +1,789 @@
+/**
+  ******************************************************************************
+  * @file    test_hid_core.c
+  * @brief   Host tests of the HID class state: the FS and HS cores each run
+  *          their own report queues, IN completions and OUT report latch;
+  *          the touch scheduler merges contacts by ID and sends them from
+  *          SOF, replayed against queueing every touch report; at high
+  *          speed the queued reports of EP3 go out packed in one transfer
+  ******************************************************************************
+  */
+
+#include "test.h"
+
+void __WFI(void);
+
+/* the per-core state and the class callbacks are private to the class */
+#include "usbd_hid_core.c"
+
+/* ---- what usbd_hid_core.c links against -------------------------------- */
+
+#ifdef USBD_HID_HS_BATCH
+  #define TX_MAX        USBD_HID_HS_BATCH_SIZE
+#else
+  #define TX_MAX        USBD_FIFO_SLOT_SIZE
+#endif
+
+typedef struct
+{
+  USB_OTG_CORE_HANDLE *pdev;
+  uint8_t              ep;
+  uint8_t              dat[TX_MAX];
+  uint32_t             len;
+} tx_t;
+
+static tx_t tx_log[64];
+static int  tx_num;
+
+uint32_t DCD_EP_Tx(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint8_t *pbuf, uint32_t buf_len)
+{
+  tx_t *t = &tx_log[tx_num++ % 64];
+
+  t->pdev = pdev;
+  t->ep = ep_addr;
+  t->len = buf_len;
+  memcpy(t->dat, pbuf, buf_len < TX_MAX ? buf_len : TX_MAX);
+  return 0;
+}
+
+static uint16_t open_mps[2][16];    /* by core, IN EP number */
+
+uint32_t DCD_EP_Open(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type)
+{
+  if (ep_addr & 0x80)
+    open_mps[pdev->cfg.coreID][ep_addr & 0x0F] = ep_mps;
+  return 0;
+}
+
+static uint8_t out_seen[HID_OUT_PACKET];
+
+USBD_Status USBD_CtlSendData(USB_OTG_CORE_HANDLE *pdev, uint8_t *pbuf, uint16_t len) { return USBD_OK; }
+void USBD_CtlError(USB_OTG_CORE_HANDLE *pdev, USB_SETUP_REQ *req) { }
+USBD_Status USBD_CtlPrepareRx(USB_OTG_CORE_HANDLE *pdev, uint8_t *pbuf, uint16_t len) { return USBD_OK; }
+uint8_t USBD_HostOS_Get(USB_OTG_CORE_HANDLE *pdev) { return USBD_HOST_OS_UNKNOWN; }
+void USBD_HostOS_Hint(USB_OTG_CORE_HANDLE *pdev, uint8_t os) { }
+void USBD_HostOS_FirstReport(USB_OTG_CORE_HANDLE *pdev) { }
+uint32_t DCD_EP_Close(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr) { return 0; }
+void DCD_EP_SetHandler(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint8_t (*handler)(void *pdev, uint8_t epnum)) { }
+uint32_t DCD_EP_PrepareRx(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint8_t *pbuf, uint16_t buf_len) { return 0; }
+uint32_t DCD_EP_Flush(USB_OTG_CORE_HANDLE *pdev, uint8_t epnum) { return 0; }
+void USBD_TRACE_Put(u32 id, u32 a0, u32 a1, u32 a2, u32 a3) { }
+void EP1_OUT_Callback(u8 *buf) { memcpy(out_seen, buf, HID_OUT_PACKET); }
+void __WFI(void) { }
+
+/* ---- two cores, configured at their own speed --------------------------- */
+
+static USB_OTG_CORE_HANDLE fs, hs;
+
+static void setup(void)
+{
+  memset(&fs, 0, sizeof(fs));
+  memset(&hs, 0, sizeof(hs));
+  memset(USBD_HID_Core, 0, sizeof(USBD_HID_Core));
+  fs.cfg.coreID = USB_OTG_FS_CORE_ID;
+  fs.cfg.speed = USB_OTG_SPEED_FULL;
+  hs.cfg.coreID = USB_OTG_HS_CORE_ID;
+  hs.cfg.speed = USB_OTG_SPEED_HIGH;
+  fs.dev.device_status = USB_OTG_CONFIGURED;
+  hs.dev.device_status = USB_OTG_CONFIGURED;
+  USBD_HID_cb.Init(&fs, 1);
+  USBD_HID_cb.Init(&hs, 1);
+  tx_num = 0;
+}
+
+/* a vendor report, not the touch report ID the scheduler takes over */
+static uint8_t *report(uint8_t id, uint8_t seq)
+{
+  static uint8_t r[HID_IN_PACKET];
+
+  memset(r, seq, sizeof(r));
+  r[0] = id;
+  return r;
+}
+
+static uint16_t queued(USB_OTG_CORE_HANDLE *pdev, int idx)
+{
+  return USBD_FIFO_Used(&USBD_HID_CORE(pdev)->TxFIFO[idx]);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void test_core_index(void)
+{
+  setup();
+  CHECK(USBD_HID_CORE(&fs) != USBD_HID_CORE(&hs));
+  CHECK(USBD_HID_CORE(&fs) == &USBD_HID_Core[USB_OTG_FS_CORE_ID]);
+  CHECK(USBD_HID_CORE(&hs) == &USBD_HID_Core[USB_OTG_HS_CORE_ID]);
+}
+
+static void test_concurrent_streams(void)
+{
+  int i;
+
+  setup();
+  /* the first report of each core starts a transfer on that core */
+  USBD_HID_SendReport(&fs, report(0x05, 1), 8);
+  USBD_HID_SendReport(&hs, report(0x05, 2), 16);
+  CHECK(tx_num == 2);
+  CHECK(tx_log[0].pdev == &fs && tx_log[0].ep == HID_IN_EP && tx_log[0].len == 8);
+  CHECK(tx_log[0].dat[1] == 1);
+  CHECK(tx_log[1].pdev == &hs && tx_log[1].ep == HID_IN_EP && tx_log[1].len == 16);
+  CHECK(tx_log[1].dat[1] == 2);
+
+  /* the rest wait behind the transfer in flight of their own core */
+  for (i = 0; i < 3; i++)
+  {
+    USBD_HID_SendReport(&fs, report(0x05, 10 + i), 8);
+    USBD_HID_SendReport(&hs, report(0x05, 20 + i), 16);
+  }
+  CHECK(tx_num == 2);
+  CHECK(queued(&fs, 0) == 4 && queued(&hs, 0) == 4);
+
+  /* an FS completion sends the next FS report and leaves HS alone */
+  USBD_HID_DataIn(&fs, 1);
+  CHECK(tx_num == 3);
+  CHECK(tx_log[2].pdev == &fs && tx_log[2].dat[1] == 10);
+  CHECK(queued(&fs, 0) == 3 && queued(&hs, 0) == 4);
+
+  /* and the other way round */
+  USBD_HID_DataIn(&hs, 1);
+  USBD_HID_DataIn(&hs, 1);
+  CHECK(tx_num == 5);
+  CHECK(tx_log[3].pdev == &hs && tx_log[3].dat[1] == 20);
+  CHECK(tx_log[4].pdev == &hs && tx_log[4].dat[1] == 21);
+  CHECK(queued(&fs, 0) == 3 && queued(&hs, 0) == 2);
+
+  /* drain both; the last completion leaves each EP idle */
+  for (i = 0; i < 3; i++)
+    USBD_HID_DataIn(&fs, 1);
+  for (i = 0; i < 2; i++)
+    USBD_HID_DataIn(&hs, 1);
+  CHECK(queued(&fs, 0) == 0 && queued(&hs, 0) == 0);
+  CHECK(USBD_HID_CORE(&fs)->TxValid[0] && USBD_HID_CORE(&hs)->TxValid[0]);
+  CHECK(tx_num == 8);
+}
+
+static void test_endpoints_independent(void)
+{
+  setup();
+  USBD_HID_SendReport_EP2(&hs, report(0x07, 1), 8);
+  USBD_HID_SendReport_EP3(&hs, report(0x08, 2), 8);
+  CHECK(tx_num == 2 && tx_log[0].ep == HID_IN_EP2 && tx_log[1].ep == HID_IN_EP3);
+  CHECK(USBD_HID_CORE(&fs)->TxValid[1] && USBD_HID_CORE(&fs)->TxValid[2]);
+  /* a completion on an idle FS endpoint is ignored */
+  USBD_HID_DataIn(&fs, 2);
+  CHECK(tx_num == 2 && queued(&hs, 1) == 1);
+  USBD_HID_DataIn(&hs, 2);
+  CHECK(queued(&hs, 1) == 0 && queued(&hs, 2) == 1);
+}
+
+static void test_drop_per_core(void)
+{
+  int i;
+
+  setup();
+  for (i = 0; i < USBD_FIFO_SIZE + 3; i++)
+    USBD_HID_SendReport(&fs, report(0x05, i), 8);
+  USBD_HID_SendReport(&hs, report(0x05, 0), 8);
+  CHECK(queued(&fs, 0) == USBD_FIFO_SIZE);
+  CHECK(USBD_HID_CORE(&fs)->TxDrop[0] == 3);
+  CHECK(USBD_HID_CORE(&hs)->TxDrop[0] == 0 && queued(&hs, 0) == 1);
+}
+
+static void test_report_too_long(void)
+{
+  static uint8_t big[USBD_FIFO_SLOT_SIZE + 1];
+
+  setup();
+  big[0] = 0x05;
+  /* refused whole rather than copied past its slot */
+  CHECK(USBD_HID_SendReport(&fs, big, sizeof(big)) == USBD_FAIL);
+  CHECK(USBD_HID_SendReport_EP3(&fs, big, sizeof(big)) == USBD_FAIL);
+  CHECK(queued(&fs, 0) == 0 && queued(&fs, 2) == 0 && tx_num == 0);
+  CHECK(USBD_HID_CORE(&fs)->TxDrop[0] == 0 && !USBD_HID_CORE(&fs)->Busy);
+  CHECK(USBD_HID_SendReport(&fs, big, USBD_FIFO_SLOT_SIZE) == USBD_OK);
+  CHECK(tx_num == 1 && tx_log[0].len == USBD_FIFO_SLOT_SIZE);
+}
+
+static void test_unconfigured_core(void)
+{
+  setup();
+  /* the FS cable is out: its reports go nowhere, HS keeps streaming */
+  fs.dev.device_status = USB_OTG_DEFAULT;
+  USBD_HID_SendReport(&fs, report(0x05, 1), 8);
+  USBD_HID_SendReport(&hs, report(0x05, 2), 8);
+  CHECK(queued(&fs, 0) == 0 && USBD_HID_CORE(&fs)->TxDrop[0] == 0);
+  CHECK(tx_num == 1 && tx_log[0].pdev == &hs);
+}
+
+static void test_reinit_one_core(void)
+{
+  setup();
+  USBD_HID_SendReport(&fs, report(0x05, 1), 8);
+  USBD_HID_SendReport(&fs, report(0x05, 2), 8);
+  USBD_HID_SendReport(&hs, report(0x05, 3), 8);
+  USBD_HID_SendReport(&hs, report(0x05, 4), 8);
+  /* a bus reset and new SET_CONFIGURATION on HS only */
+  USBD_HID_cb.Init(&hs, 1);
+  CHECK(queued(&hs, 0) == 0 && USBD_HID_CORE(&hs)->TxValid[0]);
+  CHECK(queued(&fs, 0) == 2 && !USBD_HID_CORE(&fs)->TxValid[0]);
+}
+
+static void test_out_report_per_core(void)
+{
+  uint8_t buf[HID_OUT_PACKET];
+
+  setup();
+  memset(USBD_HID_CORE(&hs)->RcvBuf[0], 0x5A, HID_OUT_PACKET);
+  memset(USBD_HID_CORE(&fs)->RcvBuf[0], 0xA5, HID_OUT_PACKET);
+  USBD_HID_DataOut(&hs, 1);
+  CHECK(out_seen[0] == 0x5A);
+  CHECK(USBD_HID_ReadOutReport(&fs, buf) == 0);
+  memset(buf, 0, sizeof(buf));
+  CHECK(USBD_HID_ReadOutReport(&hs, buf) == 1);
+  CHECK(buf[0] == 0x5A && buf[HID_OUT_PACKET - 1] == 0x5A);
+  CHECK(USBD_HID_ReadOutReport(&hs, buf) == 0);
+
+  USBD_HID_DataOut(&fs, 1);
+  CHECK(USBD_HID_ReadOutReport(&hs, buf) == 0);
+  CHECK(USBD_HID_ReadOutReport(&fs, buf) == 1 && buf[0] == 0xA5);
+
+  /* only EP1 OUT is latched */
+  USBD_HID_DataOut(&fs, 2);
+  CHECK(USBD_HID_ReadOutReport(&fs, buf) == 0);
+}
+
+/* ---- touch scheduler ---------------------------------------------------- */
+
+static USBD_HID_TouchReport_TypeDef tr;
+
+static void touch_begin(uint8_t count)
+{
+  memset(&tr, 0, sizeof(tr));
+  tr.ReportID = USBD_HID_TOUCH_REPORT_ID;
+  tr.Count = count;
+}
+
+static void touch_contact(int i, uint8_t id, uint8_t flags, uint16_t x)
+{
+  tr.Contact[i].Flags = flags;
+  tr.Contact[i].ID = id;
+  tr.Contact[i].X = x;
+  tr.Contact[i].Y = id;
+}
+
+static void touch_post(USB_OTG_CORE_HANDLE *pdev)
+{
+  USBD_HID_SendReport_EP2(pdev, (uint8_t *)&tr, USBD_HID_TOUCH_REPORT_SIZE);
+}
+
+/* contact of a sent touch report by contact ID, NULL if not in it */
+static USBD_HID_TouchContact_TypeDef *sent_contact(tx_t *t, uint8_t id)
+{
+  USBD_HID_TouchReport_TypeDef *r = (USBD_HID_TouchReport_TypeDef *)t->dat;
+  int i;
+
+  for (i = 0; i < r->Count; i++)
+    if (r->Contact[i].ID == id)
+      return &r->Contact[i];
+  return NULL;
+}
+
+static void test_touch_layout(void)
+{
+  CHECK(sizeof(USBD_HID_TouchContact_TypeDef) == USBD_HID_TOUCH_CONTACT_SIZE);
+  CHECK(sizeof(USBD_HID_TouchReport_TypeDef) == USBD_HID_TOUCH_REPORT_SIZE);
+}
+
+static void test_touch_merge(void)
+{
+  USBD_HID_Touch_TypeDef *t;
+
+  setup();
+  t = &USBD_HID_CORE(&fs)->Touch;
+  touch_begin(2);
+  touch_contact(0, 7, USBD_HID_TOUCH_TIP, 100);
+  touch_contact(1, 9, USBD_HID_TOUCH_TIP, 200);
+  touch_post(&fs);
+  touch_begin(1);
+  touch_contact(0, 7, USBD_HID_TOUCH_TIP, 110);
+  touch_post(&fs);
+  /* nothing is sent before the frame, the older ID 7 is folded in */
+  CHECK(tx_num == 0 && queued(&fs, 1) == 0);
+  CHECK(t->Merged == 1 && t->Drop == 0);
+
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 1 && tx_log[0].ep == HID_IN_EP2);
+  CHECK(tx_log[0].len == USBD_HID_TOUCH_REPORT_SIZE);
+  CHECK(tx_log[0].dat[0] == USBD_HID_TOUCH_REPORT_ID);
+  CHECK(((USBD_HID_TouchReport_TypeDef *)tx_log[0].dat)->Count == 2);
+  CHECK(sent_contact(&tx_log[0], 7) && sent_contact(&tx_log[0], 7)->X == 110);
+  CHECK(sent_contact(&tx_log[0], 9) && sent_contact(&tx_log[0], 9)->X == 200);
+  CHECK(t->Dirty == 0);
+
+  /* a quiet frame sends nothing */
+  USBD_HID_DataIn(&fs, 2);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 1);
+
+  /* one finger moves: the report still holds every finger down */
+  touch_begin(1);
+  touch_contact(0, 9, USBD_HID_TOUCH_TIP, 210);
+  touch_post(&fs);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 2 && ((USBD_HID_TouchReport_TypeDef *)tx_log[1].dat)->Count == 2);
+  CHECK(sent_contact(&tx_log[1], 9)->X == 210 && sent_contact(&tx_log[1], 7)->X == 110);
+}
+
+static void test_touch_lift(void)
+{
+  USBD_HID_Touch_TypeDef *t;
+
+  setup();
+  t = &USBD_HID_CORE(&fs)->Touch;
+  touch_begin(2);
+  touch_contact(0, 1, USBD_HID_TOUCH_TIP, 10);
+  touch_contact(1, 2, USBD_HID_TOUCH_TIP, 20);
+  touch_post(&fs);
+  USBD_HID_SOF(&fs);
+  USBD_HID_DataIn(&fs, 2);
+
+  /* the lift is reported once, then the slot is free */
+  touch_begin(1);
+  touch_contact(0, 1, 0, 11);
+  touch_post(&fs);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 2);
+  CHECK(sent_contact(&tx_log[1], 1) && sent_contact(&tx_log[1], 1)->Flags == 0);
+  CHECK(t->Active == 0x02);
+  USBD_HID_DataIn(&fs, 2);
+
+  touch_begin(1);
+  touch_contact(0, 2, USBD_HID_TOUCH_TIP, 21);
+  touch_post(&fs);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 3 && ((USBD_HID_TouchReport_TypeDef *)tx_log[2].dat)->Count == 1);
+  CHECK(sent_contact(&tx_log[2], 1) == NULL);
+}
+
+static void test_touch_table_full(void)
+{
+  USBD_HID_Touch_TypeDef *t;
+  int i;
+
+  setup();
+  t = &USBD_HID_CORE(&fs)->Touch;
+  touch_begin(USBD_HID_TOUCH_MAX_CONTACT);
+  for (i = 0; i < USBD_HID_TOUCH_MAX_CONTACT; i++)
+    touch_contact(i, 20 + i, USBD_HID_TOUCH_TIP, i);
+  touch_post(&fs);
+  CHECK(t->Drop == 0 && t->Active == (1 << USBD_HID_TOUCH_MAX_CONTACT) - 1);
+
+  /* an 11th finger has no slot, the ten known ones still update */
+  touch_begin(2);
+  touch_contact(0, 99, USBD_HID_TOUCH_TIP, 0);
+  touch_contact(1, 20, USBD_HID_TOUCH_TIP, 500);
+  touch_post(&fs);
+  CHECK(t->Drop == 1 && t->Merged == 1);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 1 && sent_contact(&tx_log[0], 99) == NULL);
+  CHECK(sent_contact(&tx_log[0], 20)->X == 500);
+}
+
+static void test_touch_hybrid(void)
+{
+  USBD_HID_Touch_TypeDef *t;
+
+  setup();
+  t = &USBD_HID_CORE(&fs)->Touch;
+  /* a continuation report has a zero count: empty contacts are skipped */
+  touch_begin(0);
+  touch_contact(0, 3, USBD_HID_TOUCH_TIP, 30);
+  touch_contact(5, 4, USBD_HID_TOUCH_TIP, 40);
+  touch_post(&fs);
+  CHECK(t->Active == 0x03 && t->Drop == 0);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 1 && ((USBD_HID_TouchReport_TypeDef *)tx_log[0].dat)->Count == 2);
+}
+
+static void test_touch_busy_and_full(void)
+{
+  USBD_HID_Core_TypeDef *hid;
+  int i;
+
+  setup();
+  hid = USBD_HID_CORE(&fs);
+  touch_begin(1);
+  touch_contact(0, 5, USBD_HID_TOUCH_TIP, 1);
+  touch_post(&fs);
+  /* the main loop is producing: SOF leaves the contacts alone */
+  hid->Busy = 1;
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 0 && hid->Touch.Dirty);
+  hid->Busy = 0;
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 1);
+
+  /* the EP2 queue fills up behind the report in flight */
+  for (i = 1; i < USBD_FIFO_SIZE; i++)
+    USBD_HID_SendReport_EP2(&fs, report(0x07, i), 8);
+  CHECK(queued(&fs, 1) == USBD_FIFO_SIZE);
+  touch_begin(1);
+  touch_contact(0, 5, USBD_HID_TOUCH_TIP, 2);
+  touch_post(&fs);
+  USBD_HID_SOF(&fs);
+  /* the contacts wait and keep merging instead of being dropped */
+  touch_begin(1);
+  touch_contact(0, 5, USBD_HID_TOUCH_TIP, 3);
+  touch_post(&fs);
+  CHECK(hid->Touch.Dirty && hid->Touch.Drop == 0 && hid->Touch.Merged == 1);
+  CHECK(hid->TxDrop[1] == 0);
+
+  USBD_HID_DataIn(&fs, 2);
+  USBD_HID_SOF(&fs);
+  CHECK(!hid->Touch.Dirty && queued(&fs, 1) == USBD_FIFO_SIZE);
+  for (i = 0; i < USBD_FIFO_SIZE; i++)
+    USBD_HID_DataIn(&fs, 2);
+  CHECK(sent_contact(&tx_log[tx_num - 1], 5) && sent_contact(&tx_log[tx_num - 1], 5)->X == 3);
+}
+
+static void test_touch_down_up(void)
+{
+  setup();
+  touch_begin(1);
+  touch_contact(0, 6, USBD_HID_TOUCH_TIP, 1);
+  touch_post(&fs);
+  touch_begin(1);
+  touch_contact(0, 6, 0, 1);
+  touch_post(&fs);
+#if USBD_HID_SCHED_POLICY == USBD_HID_SCHED_COMPLETE
+  /* the pending down goes out before the up overwrites it */
+  CHECK(tx_num == 1 && sent_contact(&tx_log[0], 6)->Flags == USBD_HID_TOUCH_TIP);
+  USBD_HID_DataIn(&fs, 2);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 2 && sent_contact(&tx_log[1], 6)->Flags == 0);
+  CHECK(USBD_HID_CORE(&fs)->Touch.Merged == 0);
+#else
+  /* latency first: the tap collapses into the newest state */
+  CHECK(tx_num == 0);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 1 && sent_contact(&tx_log[0], 6)->Flags == 0);
+  CHECK(USBD_HID_CORE(&fs)->Touch.Merged == 1);
+#endif
+}
+
+static void test_touch_per_core(void)
+{
+  setup();
+  touch_begin(1);
+  touch_contact(0, 8, USBD_HID_TOUCH_TIP, 1);
+  touch_post(&hs);
+  USBD_HID_SOF(&fs);
+  CHECK(tx_num == 0 && USBD_HID_CORE(&fs)->Touch.Active == 0);
+  USBD_HID_SOF(&hs);
+  CHECK(tx_num == 1 && tx_log[0].pdev == &hs);
+}
+
+/* ---- replay: ten fingers scanned at 2 kHz, one IN transfer per frame ----- */
+
+#define SCAN_PER_FRAME  2
+#define REPLAY_FRAMES   400
+#define REPLAY_SCANS    (SCAN_PER_FRAME * REPLAY_FRAMES)
+
+typedef struct
+{
+  int scans;                    /* touch reports produced */
+  int delivered;                /* scans whose state reached the host */
+  int merged;                   /* scans superseded by a newer one */
+  int dropped;                  /* scans lost on a full queue */
+  int lat[REPLAY_SCANS];        /* frames from scan to host, per delivered scan */
+} replay_t;
+
+static int lat_cmp(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+static int lat_pct(replay_t *r, int pct)
+{
+  return r->delivered ? r->lat[(r->delivered - 1) * pct / 100] : 0;
+}
+
+static void replay_print(const char *name, replay_t *r)
+{
+  qsort(r->lat, r->delivered, sizeof(int), lat_cmp);
+  printf("  %-10s %4d scans %4d delivered %4d merged %4d dropped, "
+         "latency p50 %d p99 %d max %d frames\n", name, r->scans, r->delivered,
+         r->merged, r->dropped, lat_pct(r, 50), lat_pct(r, 99), lat_pct(r, 100));
+}
+
+/* scan s: fingers land one per scan, move, and all lift at the end */
+static void replay_scan(int s)
+{
+  int i, n = (s < USBD_HID_TOUCH_MAX_CONTACT) ? s + 1 : USBD_HID_TOUCH_MAX_CONTACT;
+  uint8_t flags = (s == REPLAY_SCANS - 1) ? 0 : USBD_HID_TOUCH_TIP;
+
+  touch_begin(n);
+  for (i = 0; i < n; i++)
+    touch_contact(i, i + 1, flags, s);
+}
+
+static void test_touch_replay(void)
+{
+  static replay_t co, fifo;
+  static USBD_FIFO_type ring;
+  static uint8_t seen[REPLAY_SCANS];
+  USBD_HID_TouchReport_TypeDef *r;
+  int f, k, s = 0, last = -1;
+  u8 *slot;
+  u16 len;
+
+  /* the scheduler: SOF sends the merged state, DataIn one frame later */
+  setup();
+  memset(&co, 0, sizeof(co));
+  memset(seen, 0, sizeof(seen));
+  for (f = 0; f <= REPLAY_FRAMES + 2; f++)
+  {
+    if (!USBD_HID_CORE(&fs)->TxValid[1])
+    {
+      r = (USBD_HID_TouchReport_TypeDef *)tx_log[(tx_num - 1) % 64].dat;
+      k = r->Contact[0].X;
+      if (r->Count && !seen[k])
+      {
+        seen[k] = 1;
+        co.lat[co.delivered++] = f - k / SCAN_PER_FRAME;
+        co.merged += k - last - 1;
+        last = k;
+      }
+      USBD_HID_DataIn(&fs, 2);
+    }
+    for (k = 0; k < SCAN_PER_FRAME && s < REPLAY_SCANS; k++, s++)
+    {
+      replay_scan(s);
+      touch_post(&fs);
+      co.scans++;
+    }
+    USBD_HID_SOF(&fs);
+  }
+  co.dropped = co.scans - co.delivered - co.merged;
+
+  /* every touch report queued as it comes, one sent per frame */
+  memset(&fifo, 0, sizeof(fifo));
+  USBD_FIFO_Flush(&ring);
+  for (s = 0, f = 0; f <= REPLAY_FRAMES + USBD_FIFO_SIZE; f++)
+  {
+    if ((slot = USBD_FIFO_Front(&ring, &len)) != NULL)
+    {
+      r = (USBD_HID_TouchReport_TypeDef *)slot;
+      fifo.lat[fifo.delivered++] = f - r->Contact[0].X / SCAN_PER_FRAME;
+      USBD_FIFO_Release(&ring);
+    }
+    for (k = 0; k < SCAN_PER_FRAME && s < REPLAY_SCANS; k++, s++)
+    {
+      replay_scan(s);
+      fifo.scans++;
+      if ((slot = USBD_FIFO_Reserve(&ring)) == NULL)
+      {
+        fifo.dropped++;
+        continue;
+      }
+      memcpy(slot, &tr, USBD_HID_TOUCH_REPORT_SIZE);
+      USBD_FIFO_Commit(&ring, USBD_HID_TOUCH_REPORT_SIZE);
+    }
+  }
+
+  replay_print("scheduler", &co);
+  replay_print("fifo", &fifo);
+  CHECK(co.scans == REPLAY_SCANS && co.dropped == 0);
+  CHECK(USBD_HID_CORE(&fs)->Touch.Drop == 0);
+  /* the last scan lifts every finger and must reach the host */
+  CHECK(seen[REPLAY_SCANS - 1]);
+  /* sent in the frame of the scan; a transition flushed early by the
+     complete policy queues the report after it one frame behind */
+  CHECK(lat_pct(&co, 100) <= 1 + (USBD_HID_SCHED_POLICY == USBD_HID_SCHED_COMPLETE));
+  CHECK(fifo.dropped > 0 && lat_pct(&fifo, 99) > lat_pct(&co, 99));
+}
+
+#ifdef USBD_HID_HS_BATCH
+/* ---- HS batching of EP3 ------------------------------------------------- */
+
+/* the packed transfer holds reports of len bytes, seq first..first+n-1 */
+static int batch_holds(tx_t *t, uint16_t len, uint8_t first, int n)
+{
+  int i;
+
+  if (t->len != len * n)
+    return 0;
+  for (i = 0; i < n; i++)
+    if (t->dat[i * len] != 0x08 || t->dat[i * len + 1] != (uint8_t)(first + i))
+      return 0;
+  return 1;
+}
+
+static void test_batch_endpoint(void)
+{
+  uint8_t *d;
+  uint16_t len, i;
+  int found = 0;
+
+  setup();
+  /* EP3 is high-bandwidth at HS only */
+  CHECK(open_mps[USB_OTG_HS_CORE_ID][3] == USBD_HID_HS_EP_MPS);
+  CHECK(open_mps[USB_OTG_HS_CORE_ID][1] == HID_IN_PACKET);
+  CHECK(open_mps[USB_OTG_FS_CORE_ID][3] == HID_IN_PACKET);
+
+  d = USBD_HID_CfgDescFor(USB_OTG_SPEED_HIGH, USBD_HOST_OS_UNKNOWN, &len);
+  for (i = 0; i + 6 < len && d[i]; i += d[i])
+  {
+    if (d[i + 1] != USB_ENDPOINT_DESCRIPTOR_TYPE || !(d[i + 2] & 0x80))
+      continue;
+    if (d[i + 2] == USBD_HID_HS_BATCH_EP)
+    {
+      CHECK((d[i + 4] | (d[i + 5] << 8)) == USBD_HID_HS_EP_MPS);
+      found++;
+    }
+    else
+    {
+      CHECK((d[i + 4] | (d[i + 5] << 8)) == HID_IN_PACKET);
+    }
+  }
+  CHECK(found == 1);
+  d = USBD_HID_CfgDescFor(USB_OTG_SPEED_FULL, USBD_HOST_OS_UNKNOWN, &len);
+  CHECK(d == USBD_HID_CfgDesc);
+}
+
+static void test_batch_fifo_fits(void)
+{
+  uint8_t *d;
+  uint16_t len, i, mps;
+  uint32_t words = 0;
+
+  /* every IN EP of the HS configuration, one packet each */
+  d = USBD_HID_CfgDescFor(USB_OTG_SPEED_HIGH, USBD_HOST_OS_UNKNOWN, &len);
+  for (i = 0; i + 6 < len && d[i]; i += d[i])
+  {
+    if (d[i + 1] != USB_ENDPOINT_DESCRIPTOR_TYPE || !(d[i + 2] & 0x80))
+      continue;
+    mps = d[i + 4] | (d[i + 5] << 8);
+    mps = (mps & 0x7FF) * (((mps >> 11) & 3) + 1);
+    words += (mps < 64) ? 16 : (mps + 3) / 4;
+  }
+  CHECK(words == USBD_HID_HS_BATCH_SIZE / 4 + (USBD_HID_NUM_EP - 1) * 16);
+  CHECK(RX_FIFO_HS_SIZE + TX0_FIFO_HS_SIZE + words <=
+        USB_OTG_HS_TOTAL_FIFO_SIZE - USB_OTG_DMA_FIFO_RESERVED);
+}
+
+static void test_batch_pack(void)
+{
+  USBD_HID_Core_TypeDef *hid;
+  int i, full = USBD_HID_HS_MPS / 64;
+
+  setup();
+  hid = USBD_HID_CORE(&hs);
+  /* an idle EP sends the first report alone, from its slot */
+  USBD_HID_SendReport_EP3(&hs, report(0x08, 0), 64);
+  CHECK(tx_num == 1 && batch_holds(&tx_log[0], 64, 0, 1));
+  CHECK(hid->TxCount[2] == 1);
+
+  /* the ones queued meanwhile are packed; a packet's worth of 64 byte
+     reports would end on a full packet, so the transfer stops one short */
+  for (i = 1; i <= full + 2; i++)
+    USBD_HID_SendReport_EP3(&hs, report(0x08, i), 64);
+  CHECK(queued(&hs, 2) == full + 3);
+  USBD_HID_DataIn(&hs, 3);
+  CHECK(tx_num == 2);
+  if (USBD_HID_HS_MULT == 1)
+  {
+    CHECK(hid->TxCount[2] == full - 1 && batch_holds(&tx_log[1], 64, 1, full - 1));
+    /* the slots are freed when the transfer completes */
+    USBD_HID_DataIn(&hs, 3);
+    CHECK(queued(&hs, 2) == 3 && hid->TxCount[2] == 3);
+    CHECK(batch_holds(&tx_log[2], 64, full, 3));
+  }
+  else
+  {
+    CHECK(hid->TxCount[2] == full + 2 && batch_holds(&tx_log[1], 64, 1, full + 2));
+    USBD_HID_DataIn(&hs, 3);
+    CHECK(queued(&hs, 2) == 0 && hid->TxValid[2] && tx_num == 2);
+
+    /* exactly one packet's worth in the queue */
+    USBD_HID_SendReport_EP3(&hs, report(0x08, 0), 64);
+    for (i = 1; i <= full; i++)
+      USBD_HID_SendReport_EP3(&hs, report(0x08, i), 64);
+    USBD_HID_DataIn(&hs, 3);
+    CHECK(hid->TxCount[2] == full - 1 && batch_holds(&tx_log[tx_num - 1], 64, 1, full - 1));
+    USBD_HID_DataIn(&hs, 3);
+    /* the last one alone goes out of its slot */
+    CHECK(hid->TxCount[2] == 1 && batch_holds(&tx_log[tx_num - 1], 64, full, 1));
+  }
+  USBD_HID_DataIn(&hs, 3);
+  CHECK(queued(&hs, 2) == 0 && hid->TxValid[2]);
+}
+
+static void test_batch_short_reports(void)
+{
+  USBD_HID_Core_TypeDef *hid;
+  int i, fit = USBD_HID_HS_BATCH_SIZE / 60;
+
+  /* a full ring behind the report in flight */
+  if (fit > USBD_FIFO_SIZE - 1)
+    fit = USBD_FIFO_SIZE - 1;
+  setup();
+  hid = USBD_HID_CORE(&hs);
+  for (i = 0; i < USBD_FIFO_SIZE; i++)
+    USBD_HID_SendReport_EP3(&hs, report(0x08, i), 60);
+  USBD_HID_DataIn(&hs, 3);
+  /* as many as fit, whole reports only */
+  CHECK(hid->TxCount[2] == fit);
+  CHECK(batch_holds(&tx_log[1], 60, 1, fit));
+  CHECK(tx_log[1].len <= USBD_HID_HS_BATCH_SIZE && tx_log[1].len % USBD_HID_HS_MPS != 0);
+}
+
+static void test_batch_only_ep3_at_hs(void)
+{
+  int i;
+
+  setup();
+  /* FS has no high-bandwidth EP: one report per transfer */
+  for (i = 0; i < 4; i++)
+    USBD_HID_SendReport_EP3(&fs, report(0x08, i), 16);
+  USBD_HID_DataIn(&fs, 3);
+  CHECK(tx_num == 2 && batch_holds(&tx_log[1], 16, 1, 1));
+  CHECK(USBD_HID_CORE(&fs)->TxCount[2] == 1);
+
+  /* nor are the HID interfaces of the HS core */
+  for (i = 0; i < 4; i++)
+    USBD_HID_SendReport(&hs, report(0x05, i), 16);
+  USBD_HID_DataIn(&hs, 1);
+  CHECK(tx_num == 4 && tx_log[3].len == 16 && USBD_HID_CORE(&hs)->TxCount[0] == 1);
+}
+#endif
+
+int main(void)
+{
+  RUN(test_core_index);
+  RUN(test_concurrent_streams);
+  RUN(test_endpoints_independent);
+  RUN(test_drop_per_core);
+  RUN(test_report_too_long);
+  RUN(test_unconfigured_core);
+  RUN(test_reinit_one_core);
+  RUN(test_out_report_per_core);
+  RUN(test_touch_layout);
+  RUN(test_touch_merge);
+  RUN(test_touch_lift);
+  RUN(test_touch_table_full);
+  RUN(test_touch_hybrid);
+  RUN(test_touch_busy_and_full);
+  RUN(test_touch_down_up);
+  RUN(test_touch_per_core);
+  RUN(test_touch_replay);
+#ifdef USBD_HID_HS_BATCH
+  RUN(test_batch_endpoint);
+  RUN(test_batch_fifo_fits);
+  RUN(test_batch_pack);
+  RUN(test_batch_short_reports);
+  RUN(test_batch_only_ep3_at_hs);
+#endif
+  return TEST_RESULT();
+}
@@ -0,0 +1,380 @@
+/**
+  ******************************************************************************
+  * @file    test_hid_desc.c
+  * @brief   Host tests of the HID report descriptors of one OEM variant, the
+  *          Makefile builds it once per variant: the bytes served for each
+  *          interface against the blocks the variant is made of, the lengths
+  *          in the configuration and HID descriptors, and the item structure
+  *          of every report descriptor
+  ******************************************************************************
+  */
+
+#include "test.h"
+
+void __WFI(void);
+
+/* the DESCRIPTOR_* blocks and the tables are private to the class */
+#include "usbd_hid_core.c"
+
+/* ---- what usbd_hid_core.c links against -------------------------------- */
+
+static uint8_t  *sent_buf;
+static uint16_t  sent_len;
+static int       stalls;
+static uint8_t   host_os;
+
+USBD_Status USBD_CtlSendData(USB_OTG_CORE_HANDLE *pdev, uint8_t *pbuf, uint16_t len)
+{
+  sent_buf = pbuf;
+  sent_len = len;
+  return USBD_OK;
+}
+
+void USBD_CtlError(USB_OTG_CORE_HANDLE *pdev, USB_SETUP_REQ *req) { stalls++; }
+USBD_Status USBD_CtlPrepareRx(USB_OTG_CORE_HANDLE *pdev, uint8_t *pbuf, uint16_t len) { return USBD_OK; }
+uint8_t USBD_HostOS_Get(USB_OTG_CORE_HANDLE *pdev) { return host_os; }
+void USBD_HostOS_Hint(USB_OTG_CORE_HANDLE *pdev, uint8_t os) { }
+void USBD_HostOS_FirstReport(USB_OTG_CORE_HANDLE *pdev) { }
+uint32_t DCD_EP_Open(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type) { return 0; }
+uint32_t DCD_EP_Close(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr) { return 0; }
+void DCD_EP_SetHandler(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint8_t (*handler)(void *pdev, uint8_t epnum)) { }
+uint32_t DCD_EP_PrepareRx(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint8_t *pbuf, uint16_t buf_len) { return 0; }
+uint32_t DCD_EP_Tx(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint8_t *pbuf, uint32_t buf_len) { return 0; }
+uint32_t DCD_EP_Flush(USB_OTG_CORE_HANDLE *pdev, uint8_t epnum) { return 0; }
+void USBD_FIFO_Flush(USBD_FIFO_type *p) { }
+void USBD_TRACE_Put(u32 id, u32 a0, u32 a1, u32 a2, u32 a3) { }
+void EP1_OUT_Callback(u8 *buf) { }
+void __WFI(void) { }
+
+/* ---- what each variant is made of -------------------------------------- */
+
+typedef struct
+{
+  const uint8_t *p;
+  uint16_t       len;
+} blob_t;
+
+#define BLOB(...)   { (const uint8_t[]){ __VA_ARGS__ }, sizeof ((const uint8_t[]){ __VA_ARGS__ }) }
+#define NO_DESC     { NULL, 0 }
+
+/* Interfaces 0, 1 and 2, block by block as the variants shipped before the
+   sizes were derived. TST declared more blocks on interface 1 than it had
+   and VESTEL fewer than the array it shared: both are what the bytes are. */
+static const blob_t expect[USBD_HID_NUM_EP] =
+#if defined(CHUANGWEI)
+{
+  BLOB(DESCRIPTOR_USER0506 DESCRIPTOR_MOUSE DESCRIPTOR_MULTITOUCH),
+  NO_DESC,
+  NO_DESC,
+};
+#elif defined(TST)
+{
+  BLOB(DESCRIPTOR_TOUCH_EREA_TST),
+  BLOB(DESCRIPTOR_USER0506 DESCRIPTOR_MOUSE_HH),
+  NO_DESC,
+};
+#elif defined(CK)
+{
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_MOUSE DESCRIPTOR_TOUCH_EREA_CK),
+  NO_DESC,
+  NO_DESC,
+};
+#elif defined(CHANGHONG)
+{
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERA1 DESCRIPTOR_USERA2 DESCRIPTOR_USERA3
+       DESCRIPTOR_USER_CH DESCRIPTOR_MOUSE DESCRIPTOR_KEY),
+  BLOB(DESCRIPTOR_MULTITOUCH),
+  NO_DESC,
+};
+#elif defined(PM)
+{
+  BLOB(DESCRIPTOR_USER_PM),
+  BLOB(DESCRIPTOR_USERA3 DESCRIPTOR_MULTITOUCH DESCRIPTOR_PEN_PM),
+  BLOB(DESCRIPTOR_MOUSE),
+};
+#elif defined(HONGHE)
+{
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERA1 DESCRIPTOR_USERA2 DESCRIPTOR_USERA3
+       DESCRIPTOR_KEY DESCRIPTOR_MOUSE_HH),
+#ifndef POINT_OS_EREA
+  BLOB(DESCRIPTOR_USER_HH DESCRIPTOR_TOUCH),
+#else
+  BLOB(DESCRIPTOR_USER_HH DESCRIPTOR_TOUCH_EREA_HH2 DESCRIPTOR_PEN_NEW),
+#endif
+  NO_DESC,
+};
+#elif defined(SEEWO)
+{
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERFB DESCRIPTOR_USERFC DESCRIPTOR_USERA3
+       DESCRIPTOR_USER_CH DESCRIPTOR_KEY DESCRIPTOR_MOUSE),
+  BLOB(DESCRIPTOR_MULTITOUCH DESCRIPTOR_PEN_NEW),
+  NO_DESC,
+};
+#elif defined(VESTEL)
+{
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERA1 DESCRIPTOR_USERA2 DESCRIPTOR_USERA3
+       DESCRIPTOR_USER_CH DESCRIPTOR_MOUSE),
+  BLOB(DESCRIPTOR_MULTITOUCH),
+  NO_DESC,
+};
+#elif defined(USB_ONE_INTERFACE)
+{
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERA1 DESCRIPTOR_USERA2 DESCRIPTOR_USERA3
+       DESCRIPTOR_USER_CH DESCRIPTOR_KEY DESCRIPTOR_MOUSE DESCRIPTOR_MULTITOUCH),
+  NO_DESC,
+  NO_DESC,
+};
+#elif defined(USB_TWO_INTERFACE)
+{
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERA1 DESCRIPTOR_USERA2 DESCRIPTOR_USERA3
+       DESCRIPTOR_USER_CH DESCRIPTOR_KEY DESCRIPTOR_MOUSE),
+  BLOB(DESCRIPTOR_MULTITOUCH DESCRIPTOR_PEN_NEW),
+  NO_DESC,
+};
+#else
+{
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERA1 DESCRIPTOR_USERA2 DESCRIPTOR_USERA3
+       DESCRIPTOR_USER_CH DESCRIPTOR_KEY),
+  BLOB(DESCRIPTOR_MULTITOUCH DESCRIPTOR_PEN_NEW),
+  BLOB(DESCRIPTOR_MOUSE),
+};
+#endif
+
+/* Interface 0 for a Mac: the keys and the mouse, where the variant has a
+   set of its own, else interface 0 as for any host */
+static const blob_t expect_mac =
+#if defined(CHUANGWEI)
+  BLOB(DESCRIPTOR_USER0506 DESCRIPTOR_MOUSE);
+#elif defined(CK)
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_MOUSE);
+#elif defined(SEEWO)
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERFB DESCRIPTOR_USERFC DESCRIPTOR_USERA3
+       DESCRIPTOR_USER_CH DESCRIPTOR_KEY DESCRIPTOR_MOUSE);
+#elif defined(HONGHE)
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERA1 DESCRIPTOR_USERA2 DESCRIPTOR_USERA3
+       DESCRIPTOR_KEY DESCRIPTOR_MOUSE_HH);
+#elif defined(TST) || defined(PM) || defined(VESTEL) || defined(CHANGHONG)
+  NO_DESC;
+#else
+  BLOB(DESCRIPTOR_USER050607 DESCRIPTOR_USERA1 DESCRIPTOR_USERA2 DESCRIPTOR_USERA3
+       DESCRIPTOR_USER_CH DESCRIPTOR_KEY DESCRIPTOR_MOUSE);
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+static USB_OTG_CORE_HANDLE dev;
+
+static void setup(uint8_t os)
+{
+  memset(&dev, 0, sizeof(dev));
+  dev.cfg.coreID = USB_OTG_FS_CORE_ID;
+  host_os = os;
+  USBD_HID_cb.Init(&dev, 1);
+}
+
+/* GET_DESCRIPTOR of a class descriptor of an interface, 0 on a stall */
+static uint16_t get_desc(uint8_t type, uint8_t itf)
+{
+  USB_SETUP_REQ req;
+  int before = stalls;
+
+  req.bmRequest = 0x81;
+  req.bRequest = USB_REQ_GET_DESCRIPTOR;
+  req.wValue = type << 8;
+  req.wIndex = itf;
+  req.wLength = 0xFFFF;
+  sent_buf = NULL;
+  sent_len = 0;
+  USBD_HID_cb.Setup(&dev, &req);
+  return (stalls == before) ? sent_len : 0;
+}
+
+/* wDescriptorLength of the HID descriptor of each interface in a
+   configuration descriptor, -1 where it has none */
+static void cfg_report_len(const uint8_t *cfg, uint16_t len, int *rlen)
+{
+  uint16_t i;
+  int itf = -1;
+
+  for (i = 0; i < USBD_HID_NUM_EP; i++)
+    rlen[i] = -1;
+  for (i = 0; (i + 1 < len) && cfg[i]; i += cfg[i])
+  {
+    if (cfg[i + 1] == USB_INTERFACE_DESCRIPTOR_TYPE)
+      itf = cfg[i + 2];
+    if ((cfg[i + 1] == HID_DESCRIPTOR_TYPE) && (itf >= 0) && (itf < USBD_HID_NUM_EP))
+      rlen[itf] = cfg[i + 7] | (cfg[i + 8] << 8);
+  }
+}
+
+/* the short and long items end exactly at len, collections are closed */
+static int items_ok(const uint8_t *p, uint16_t len)
+{
+  uint16_t i = 0;
+  int depth = 0;
+
+  while (i < len)
+  {
+    if (p[i] == 0xFE)
+    {
+      if (i + 1 >= len)
+        return 0;
+      i += 3 + p[i + 1];
+      continue;
+    }
+    if ((p[i] & 0xFC) == 0xA0)
+      depth++;
+    if (((p[i] & 0xFC) == 0xC0) && (--depth < 0))
+      return 0;
+    i += 1 + (((p[i] & 3) == 3) ? 4 : (p[i] & 3));
+  }
+  return (i == len) && (depth == 0);
+}
+
+static void test_block_sizes(void)
+{
+  /* the numbers usbd_hid_core.h carried by hand before */
+  CHECK(SIZE_DESC_USER_050607 == 35);
+  CHECK(SIZE_DESC_USER_0506 == 38);
+  CHECK(SIZE_DESC_USER_A1 == 29);
+  CHECK(SIZE_DESC_USER_A2 == 29);
+  CHECK(SIZE_DESC_USER_A3 == 29);
+  CHECK(SIZE_DESC_USER_FB == 29);
+  CHECK(SIZE_DESC_USER_FC == 29);
+  CHECK(SIZE_DESC_USER_CH == 38);
+  CHECK(SIZE_DESC_USER_HH == 35);
+  CHECK(SIZE_DESC_USER_PM == 53);
+  CHECK(SIZE_DESC_KEY == 65);
+  CHECK(SIZE_DESC_MOUSE == 60);
+  CHECK(SIZE_DESC_MOUSE_HH == 60);
+  CHECK(SIZE_DESC_TOUCH_TIME == 20);
+  CHECK(SIZE_DESC_TOUCH == 480);
+  CHECK(SIZE_DESC_TOUCH_EREA_IST1 == 442);
+  CHECK(SIZE_DESC_TOUCH_EREA_IST2 == 442 + 11 * 6);
+  CHECK(SIZE_DESC_TOUCH_EREA_HH2 == 442 + 11 * 6 + 20);
+  CHECK(SIZE_DESC_TOUCH_EREA_TST == 533);
+  CHECK(SIZE_DESC_TOUCH_EREA_CK == 690);
+  CHECK(SIZE_DESC_PEN == 86);
+  CHECK(SIZE_DESC_PEN_NEW == 133);
+  CHECK(SIZE_DESC_PEN_PM == 70);
+}
+
+static void test_report_bytes(void)
+{
+  uint16_t len;
+  int i;
+
+  setup(USBD_HOST_OS_WINDOWS);
+  for (i = 0; i < USBD_HID_NUM_EP; i++)
+  {
+    len = get_desc(HID_REPORT_DESC, i);
+    CHECK(len == expect[i].len);
+    if (len && (len == expect[i].len))
+      CHECK(memcmp(sent_buf, expect[i].p, len) == 0);
+  }
+  CHECK(sizeof (HID_Mouse_Touch_ReportDesc) ==
+        expect[0].len + expect[1].len + expect[2].len);
+}
+
+static void test_items(void)
+{
+  int i;
+
+  for (i = 0; i < USBD_HID_NUM_EP; i++)
+    if (expect[i].len)
+      CHECK(items_ok(expect[i].p, expect[i].len));
+  if (expect_mac.len)
+    CHECK(items_ok(expect_mac.p, expect_mac.len));
+}
+
+static void test_lengths(void)
+{
+  uint8_t *cfg;
+  uint16_t len;
+  int rlen[USBD_HID_NUM_EP];
+  int i;
+
+  setup(USBD_HOST_OS_WINDOWS);
+  cfg = USBD_HID_cb.GetConfigDescriptor(USB_OTG_SPEED_FULL, &len);
+  CHECK((cfg[2] | (cfg[3] << 8)) == len);
+  cfg_report_len(cfg, len, rlen);
+  for (i = 0; i < USBD_HID_NUM_EP; i++)
+  {
+    if (rlen[i] < 0)
+      continue;
+    CHECK(rlen[i] == expect[i].len);
+    /* and the HID descriptor answered on its own */
+    len = get_desc(HID_DESCRIPTOR_TYPE, i);
+    CHECK(len == USB_HID_DESC_SIZ);
+    if (len)
+      CHECK((sent_buf[7] | (sent_buf[8] << 8)) == expect[i].len);
+  }
+  /* an interface with a report descriptor is in the configuration */
+  for (i = 0; i < USBD_HID_NUM_EP; i++)
+    if (expect[i].len)
+      CHECK(rlen[i] >= 0);
+}
+
+static void test_mac(void)
+{
+  const blob_t *mac = expect_mac.len ? &expect_mac : &expect[0];
+  uint8_t *cfg;
+  uint16_t len;
+  int rlen[USBD_HID_NUM_EP];
+
+  setup(USBD_HOST_OS_MACOS);
+  len = get_desc(HID_REPORT_DESC, 0);
+  CHECK(len == mac->len);
+  if (len == mac->len)
+    CHECK(memcmp(sent_buf, mac->p, mac->len) == 0);
+  len = get_desc(HID_DESCRIPTOR_TYPE, 0);
+  CHECK(len == USB_HID_DESC_SIZ);
+  if (len)
+    CHECK((sent_buf[7] | (sent_buf[8] << 8)) == mac->len);
+
+  cfg = USBD_HID_GetCoreCfgDesc(&dev, USB_OTG_SPEED_FULL, &len);
+  CHECK((cfg[2] | (cfg[3] << 8)) == len);
+  cfg_report_len(cfg, len, rlen);
+  CHECK(rlen[0] == mac->len);
+  CHECK(rlen[1] < 0 && rlen[2] < 0);
+}
+
+/* the table the core builds from GetItfDescriptor answers as Setup does */
+static void test_itf_table(void)
+{
+  static const uint8_t os[] = { USBD_HOST_OS_UNKNOWN, USBD_HOST_OS_MACOS };
+  uint8_t *pdesc, i, idx, o;
+  uint16_t wValue, len, n;
+
+  for (o = 0; o < sizeof(os); o++)
+  {
+    setup(os[o]);
+    for (i = 0; i < USBD_HID_NUM_EP + 1; i++)
+    {
+      n = 0;
+      for (idx = 0; idx < 4; idx++)
+      {
+        pdesc = USBD_HID_cb.GetItfDescriptor(&dev, i, idx, &wValue, &len);
+        if (pdesc == NULL)
+          break;
+        n++;
+        CHECK(get_desc(wValue >> 8, i) == len);
+        CHECK(sent_buf == pdesc);
+      }
+      /* and nothing Setup answers is left out */
+      CHECK(n == (get_desc(HID_DESCRIPTOR_TYPE, i) != 0) +
+                 (get_desc(HID_REPORT_DESC, i) != 0));
+    }
+  }
+}
+
+int main(void)
+{
+  RUN(test_block_sizes);
+  RUN(test_report_bytes);
+  RUN(test_items);
+  RUN(test_lengths);
+  RUN(test_mac);
+  RUN(test_itf_table);
+  return TEST_RESULT();
+}
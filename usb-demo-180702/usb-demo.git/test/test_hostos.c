@@ -0,0 +1,310 @@
+/**
+  ******************************************************************************
+  * @file    test_hostos.c
+  * @brief   Host tests of the host OS fingerprint (usbd_hostos.c): replays
+  *          enumerations as Windows, macOS, Linux and Android hosts send
+  *          them, through the calls usbd_core.c / usbd_req.c / the HID
+  *          class make, and checks the guess the descriptors are chosen
+  *          with, the verdict, the counters and the enumeration timings.
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usbd_hostos.h"
+
+/* the time base, instead of jiff */
+static uint32_t now;                    /* ms */
+#undef USBD_HOSTOS_TICK
+#define USBD_HOSTOS_TICK()      now
+#include "usbd_hostos.c"
+
+/* ---- recorded enumerations ---------------------------------------------
+ * One step per request, at its time in ms from the first bus reset.
+ * Besides the standard requests: a bus reset, the Win7 touch feature
+ * SET_REPORT (a hint), and the first touch report sent.
+ */
+
+typedef struct
+{
+  uint16_t t;
+  uint8_t  bRequest;
+  uint16_t wValue;
+  uint16_t wLength;
+} step_t;
+
+#define BUS_RESET               0xF0
+#define WIN7_FEATURE            0xF1
+#define TOUCH_REPORT            0xF2
+
+#define RESET                   BUS_RESET, 0, 0
+#define DEV(len)                USB_REQ_GET_DESCRIPTOR, 0x0100, len
+#define CFG(len)                USB_REQ_GET_DESCRIPTOR, 0x0200, len
+#define STR(idx, len)           USB_REQ_GET_DESCRIPTOR, 0x0300 | (idx), len
+#define QUALIFIER               USB_REQ_GET_DESCRIPTOR, 0x0600, 10
+#define ADDRESS                 USB_REQ_SET_ADDRESS, 7, 0
+#define CONFIG                  USB_REQ_SET_CONFIGURATION, 1, 0
+#define HINT                    WIN7_FEATURE, 0, 0
+#define REPORT                  TOUCH_REPORT, 0, 0
+
+static const step_t win10[] = {
+  { 0, RESET }, { 58, DEV(64) }, { 60, RESET }, { 112, ADDRESS },
+  { 114, DEV(18) }, { 115, CFG(255) }, { 116, STR(0xEE, 18) },
+  { 117, STR(0, 255) }, { 118, STR(2, 255) }, { 119, QUALIFIER },
+  { 121, CONFIG }, { 176, REPORT },
+};
+
+static const step_t win7[] = {
+  { 0, RESET }, { 52, DEV(64) }, { 54, RESET }, { 104, ADDRESS },
+  { 106, DEV(18) }, { 107, CFG(255) }, { 108, STR(0xEE, 18) },
+  { 109, STR(0, 255) }, { 110, STR(2, 255) }, { 111, CFG(9) },
+  { 112, CFG(34) }, { 114, CONFIG }, { 131, HINT }, { 207, REPORT },
+};
+
+static const step_t linux_[] = {
+  { 0, RESET }, { 41, DEV(64) }, { 46, RESET }, { 96, ADDRESS },
+  { 98, DEV(18) }, { 99, CFG(9) }, { 100, CFG(34) }, { 101, STR(0, 255) },
+  { 102, STR(2, 255) }, { 103, STR(1, 255) }, { 104, STR(3, 255) },
+  { 105, CONFIG }, { 142, REPORT },
+};
+
+/* the Linux hub driver, then usbfs reading the strings again */
+static const step_t android[] = {
+  { 0, RESET }, { 31, DEV(64) }, { 36, RESET }, { 86, ADDRESS },
+  { 88, DEV(18) }, { 89, CFG(9) }, { 90, CFG(34) }, { 91, STR(0, 255) },
+  { 92, STR(2, 255) }, { 93, STR(1, 255) }, { 94, CONFIG },
+  { 97, STR(0, 255) }, { 98, STR(2, 255) }, { 153, REPORT },
+};
+
+static const step_t macos[] = {
+  { 0, RESET }, { 21, DEV(8) }, { 33, ADDRESS }, { 35, DEV(18) },
+  { 36, STR(0, 2) }, { 37, STR(0, 4) }, { 38, STR(2, 2) }, { 39, STR(2, 40) },
+  { 40, CFG(9) }, { 41, CFG(34) }, { 43, CONFIG }, { 92, REPORT },
+};
+
+typedef struct
+{
+  const char   *name;
+  uint8_t       os;
+  const step_t *step;
+  int           num;
+} host_t;
+
+#define HOST(name, os, s)       { name, os, s, sizeof(s) / sizeof(s[0]) }
+
+static const host_t hosts[] = {
+  HOST("Windows 10", USBD_HOST_OS_WINDOWS, win10),
+  HOST("Windows 7",  USBD_HOST_OS_WINDOWS, win7),
+  HOST("Linux",      USBD_HOST_OS_LINUX,   linux_),
+  HOST("Android",    USBD_HOST_OS_LINUX,   android),
+  HOST("macOS",      USBD_HOST_OS_MACOS,   macos),
+};
+#define HOSTS   (int)(sizeof(hosts) / sizeof(hosts[0]))
+
+/* ---------------------------------------------------------------------- */
+
+static USB_OTG_CORE_HANDLE fs, hs;
+
+static void setup(void)
+{
+  memset(USBD_HostOS_State, 0, sizeof(USBD_HostOS_State));
+  memset(&fs, 0, sizeof(fs));
+  memset(&hs, 0, sizeof(hs));
+  fs.cfg.coreID = USB_OTG_FS_CORE_ID;
+  hs.cfg.coreID = USB_OTG_HS_CORE_ID;
+  now = 1000;
+}
+
+/* play one step as the stack would; returns the guess a configuration
+   descriptor request is served with, unknown for other steps */
+static uint8_t play(USB_OTG_CORE_HANDLE *pdev, uint32_t start, const step_t *st)
+{
+  USB_SETUP_REQ req;
+
+  now = start + st->t;
+  switch (st->bRequest)
+  {
+  case BUS_RESET:
+    USBD_HostOS_BusReset(pdev);
+    break;
+  case WIN7_FEATURE:
+    USBD_HostOS_Hint(pdev, USBD_HOST_OS_WINDOWS);
+    break;
+  case TOUCH_REPORT:
+    USBD_HostOS_FirstReport(pdev);
+    break;
+  default:
+    req.bmRequest = (st->bRequest == USB_REQ_GET_DESCRIPTOR) ? 0x80 : 0x00;
+    req.bRequest = st->bRequest;
+    req.wValue = st->wValue;
+    req.wIndex = 0;
+    req.wLength = st->wLength;
+    USBD_HostOS_Setup(pdev, &req);
+    if ((st->bRequest == USB_REQ_GET_DESCRIPTOR) && ((st->wValue >> 8) == USB_DESC_TYPE_CONFIGURATION))
+      return USBD_HostOS_Get(pdev);
+  }
+  return USBD_HOST_OS_UNKNOWN;
+}
+
+/* replay a whole enumeration: the guess at the first configuration
+   descriptor request */
+static uint8_t replay(USB_OTG_CORE_HANDLE *pdev, const host_t *h)
+{
+  uint32_t start = now;
+  uint8_t guess = USBD_HOST_OS_UNKNOWN;
+  int i, cfg = 0;
+
+  for (i = 0; i < h->num; i++)
+  {
+    uint8_t g = play(pdev, start, &h->step[i]);
+
+    if (!cfg && (h->step[i].bRequest == USB_REQ_GET_DESCRIPTOR) && ((h->step[i].wValue >> 8) == USB_DESC_TYPE_CONFIGURATION))
+    {
+      cfg = 1;
+      guess = g;
+    }
+  }
+  now += 1000;
+  return guess;
+}
+
+/* when a host first sends a request */
+static uint32_t time_of(const host_t *h, uint8_t bRequest)
+{
+  int i;
+
+  for (i = 0; i < h->num; i++)
+    if (h->step[i].bRequest == bRequest)
+      return h->step[i].t;
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void test_replay(void)
+{
+  static const char *os_name[] = { "unknown", "Windows", "macOS", "Linux" };
+  USBD_HostOS_Stats_TypeDef st;
+  int h, right = 0;
+  uint8_t guess;
+
+  printf("  %-11s %-8s %-8s %6s %8s\n", "host", "guess", "verdict", "enum", "report");
+  for (h = 0; h < HOSTS; h++)
+  {
+    setup();
+    guess = replay(&fs, &hosts[h]);
+    USBD_HostOS_GetStats(&fs, &st);
+    printf("  %-11s %-8s %-8s %4ums %6ums\n", hosts[h].name, os_name[guess],
+           os_name[st.Verdict], st.EnumTime, st.ReportTime);
+    right += (guess == hosts[h].os);
+    CHECK(guess == hosts[h].os);
+    CHECK(st.Guess == hosts[h].os && st.Verdict == hosts[h].os);
+    /* from the first reset to SET_CONFIGURATION and to the first report */
+    CHECK(st.EnumTime == time_of(&hosts[h], USB_REQ_SET_CONFIGURATION));
+    CHECK(st.ReportTime == time_of(&hosts[h], TOUCH_REPORT));
+  }
+  printf("  %d of %d hosts told apart at the first configuration request\n", right, HOSTS);
+}
+
+static void test_unknown_before_cfg(void)
+{
+  uint32_t start;
+  int i;
+
+  setup();
+  start = now;
+  for (i = 0; hosts[0].step[i].bRequest != USB_REQ_GET_DESCRIPTOR ||
+              (hosts[0].step[i].wValue >> 8) != USB_DESC_TYPE_CONFIGURATION; i++)
+  {
+    play(&fs, start, &hosts[0].step[i]);
+    CHECK(USBD_HostOS_Get(&fs) == USBD_HOST_OS_UNKNOWN);
+  }
+  CHECK(play(&fs, start, &hosts[0].step[i]) == USBD_HOST_OS_WINDOWS);
+}
+
+static void test_counters(void)
+{
+  USBD_HostOS_Stats_TypeDef st;
+  int h, round;
+
+  /* every host twice on one core: each enumeration is counted when the
+     next one starts */
+  setup();
+  for (round = 0; round < 2; round++)
+    for (h = 0; h < HOSTS; h++)
+      replay(&fs, &hosts[h]);
+  USBD_HostOS_Reset(&fs);
+  USBD_HostOS_GetStats(&fs, &st);
+  CHECK(st.Enum == 2 * HOSTS && st.Mismatch == 0);
+  CHECK(st.Count[USBD_HOST_OS_WINDOWS] == 4);
+  CHECK(st.Count[USBD_HOST_OS_LINUX] == 4);
+  CHECK(st.Count[USBD_HOST_OS_MACOS] == 2);
+  /* nothing to tell once disconnected */
+  CHECK(st.Guess == USBD_HOST_OS_UNKNOWN && st.Verdict == USBD_HOST_OS_UNKNOWN);
+}
+
+static void test_late_evidence(void)
+{
+  /* a Windows host reading the configuration header first: taken for
+     Linux, then the MS OS string request proves otherwise */
+  static const step_t odd[] = {
+    { 0, RESET }, { 50, DEV(64) }, { 52, RESET }, { 100, ADDRESS },
+    { 102, DEV(18) }, { 103, CFG(9) }, { 104, CFG(34) }, { 105, STR(0xEE, 18) },
+    { 107, CONFIG },
+  };
+  static const host_t host = HOST("odd", USBD_HOST_OS_WINDOWS, odd);
+  USBD_HostOS_Stats_TypeDef st;
+
+  setup();
+  CHECK(replay(&fs, &host) == USBD_HOST_OS_LINUX);
+  USBD_HostOS_GetStats(&fs, &st);
+  CHECK(st.Guess == USBD_HOST_OS_LINUX && st.Verdict == USBD_HOST_OS_WINDOWS);
+  USBD_HostOS_Reset(&fs);
+  USBD_HostOS_GetStats(&fs, &st);
+  CHECK(st.Enum == 1 && st.Mismatch == 1 && st.Count[USBD_HOST_OS_WINDOWS] == 1);
+}
+
+static void test_no_evidence(void)
+{
+  /* a host with none of the habits (a BIOS, an embedded host) */
+  static const step_t plain[] = {
+    { 0, RESET }, { 20, ADDRESS }, { 22, DEV(18) }, { 23, CFG(34) }, { 25, CONFIG },
+  };
+  static const host_t host = HOST("plain", USBD_HOST_OS_UNKNOWN, plain);
+
+  setup();
+  CHECK(replay(&fs, &host) == USBD_HOST_OS_UNKNOWN);
+}
+
+static void test_cores_independent(void)
+{
+  USBD_HostOS_Stats_TypeDef st;
+  uint32_t start;
+  int i;
+
+  /* a Mac on the FS core and a Linux box on the HS core, step by step */
+  setup();
+  start = now;
+  for (i = 0; i < hosts[2].num || i < hosts[4].num; i++)
+  {
+    if (i < hosts[4].num)
+      play(&fs, start, &hosts[4].step[i]);
+    if (i < hosts[2].num)
+      play(&hs, start, &hosts[2].step[i]);
+  }
+  CHECK(USBD_HostOS_Get(&fs) == USBD_HOST_OS_MACOS);
+  CHECK(USBD_HostOS_Get(&hs) == USBD_HOST_OS_LINUX);
+  USBD_HostOS_GetStats(&hs, &st);
+  CHECK(st.EnumTime == time_of(&hosts[2], USB_REQ_SET_CONFIGURATION));
+  CHECK(st.ReportTime == time_of(&hosts[2], TOUCH_REPORT));
+}
+
+int main(void)
+{
+  RUN(test_replay);
+  RUN(test_unknown_before_cfg);
+  RUN(test_counters);
+  RUN(test_late_evidence);
+  RUN(test_no_evidence);
+  RUN(test_cores_independent);
+  return TEST_RESULT();
+}
@@ -0,0 +1,267 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_bot.c
+  * @brief   Host tests of the BOT command queue of the host MSC class
+  *          (usbh_msc_bot.c) against a device that answers every transfer
+  *          at once: one tag per CBW, the CSW checked against the tag of
+  *          its own command, a phase error failing what is queued, and the
+  *          REQUEST SENSE of a failed command in the same slot.
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usbh_msc_bot.c"
+
+#define HC_IN           1
+#define HC_OUT          2
+
+MSC_Machine_TypeDef           MSC_Machine;
+MassStorageParameter_TypeDef  USBH_MSC_Param;
+uint8_t                       MSCErrorCount;
+
+static USB_OTG_CORE_HANDLE    core;
+static USBH_HOST              host;
+
+/* ---- the device: the host channels end each transfer right away --------- */
+
+static struct
+{
+  URB_STATE  urb[4];
+  uint32_t   xfer[4];
+  HostCBWPkt_TypeDef cbw;       /* last CBW */
+  uint32_t   tags[16];          /* of every CBW */
+  int        cbws;
+  /* how the next CSW goes wrong, then the ones after */
+  int32_t    tag_delta;
+  uint32_t   signature;
+  uint32_t   csw_len;
+  uint8_t    status[16];        /* per CBW */
+} disk;
+
+static void disk_init(void)
+{
+  memset(&disk, 0, sizeof(disk));
+  disk.signature = USBH_MSC_BOT_CSW_SIGNATURE;
+  disk.csw_len = USBH_MSC_CSW_LENGTH;
+}
+
+uint32_t HCD_IsDeviceConnected(USB_OTG_CORE_HANDLE *pdev)
+{
+  return 1;
+}
+
+URB_STATE HCD_GetURB_State(USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num)
+{
+  return disk.urb[ch_num];
+}
+
+uint32_t HCD_GetXferCnt(USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num)
+{
+  return disk.xfer[ch_num];
+}
+
+USBH_Status USBH_BulkSendData(USB_OTG_CORE_HANDLE *pdev, uint8_t *buff,
+                              uint16_t length, uint8_t hc_num)
+{
+  if (length == USBH_MSC_BOT_CBW_PACKET_LENGTH)
+  {
+    memcpy(disk.cbw.CBWArray, buff, length);
+    disk.tags[disk.cbws++ & 15] = disk.cbw.field.CBWTag;
+  }
+  disk.urb[hc_num] = URB_DONE;
+  disk.xfer[hc_num] = length;
+  return USBH_OK;
+}
+
+USBH_Status USBH_BulkReceiveData(USB_OTG_CORE_HANDLE *pdev, uint8_t *buff,
+                                 uint16_t length, uint8_t hc_num)
+{
+  HostCSWPkt_TypeDef csw;
+
+  disk.urb[hc_num] = URB_DONE;
+  if (buff == USBH_MSC_BOTXferParam.pRxTxBuff)
+  {
+    /* the CSW */
+    memset(&csw, 0, sizeof(csw));
+    csw.field.CSWSignature = disk.signature;
+    csw.field.CSWTag = disk.cbw.field.CBWTag + disk.tag_delta;
+    csw.field.CSWStatus = disk.status[(disk.cbws - 1) & 15];
+    memcpy(buff, csw.CSWArray, USBH_MSC_CSW_LENGTH);
+    disk.xfer[hc_num] = disk.csw_len;
+  }
+  else
+  {
+    /* the data: sense UNIT ATTENTION, media changed, or a pattern */
+    memset(buff, 0x5A, length);
+    if (disk.cbw.field.CBWCB[0] == OPCODE_REQUEST_SENSE)
+    {
+      buff[0] = 0x70;
+      buff[2] = 0x06;
+      buff[12] = 0x28;
+      buff[13] = 0x00;
+    }
+    disk.xfer[hc_num] = length;
+  }
+  return USBH_OK;
+}
+
+USBH_Status USBH_ClrFeature(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                            uint8_t ep_num, uint8_t hc_num)
+{
+  return USBH_OK;
+}
+
+/* ---- the host ----------------------------------------------------------- */
+
+static void bot_init(void)
+{
+  disk_init();
+  memset(&MSC_Machine, 0, sizeof(MSC_Machine));
+  MSC_Machine.hc_num_in = HC_IN;
+  MSC_Machine.hc_num_out = HC_OUT;
+  MSC_Machine.MSBulkInEpSize = 64;
+  MSC_Machine.MSBulkOutEpSize = 64;
+  BOTSeq = 0;
+  USBH_MSC_Init(&core);
+}
+
+static USBH_MSC_Cmd_TypeDef *submit(uint8_t opcode, uint32_t length)
+{
+  static uint8_t data[USBH_MSC_CMD_QUEUE_DEPTH][512];
+  USBH_MSC_Cmd_TypeDef *cmd = USBH_MSC_CmdAlloc(0);
+
+  cmd->CBW.field.CBWCB[0] = opcode;
+  cmd->CBW.field.CBWTransferLength = length;
+  cmd->CBW.field.CBWFlags = USB_EP_DIR_IN;
+  cmd->pBuff = data[cmd - USBH_MSC_CmdQueue];
+  USBH_MSC_CmdSubmit(cmd);
+  return cmd;
+}
+
+/* run the state machine until the bus is idle and nothing is queued */
+static void run(void)
+{
+  int i;
+
+  for (i = 0; i < 100; i++)
+  {
+    USBH_MSC_HandleBOTXfer(&core, &host);
+    if ((USBH_MSC_BOTXferParam.BOTState == USBH_MSC_BOT_IDLE) &&
+        (USBH_MSC_CmdNext() == NULL))
+    {
+      return;
+    }
+  }
+  CHECK(!"BOT machine did not settle");
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void test_tag_per_cbw(void)
+{
+  USBH_MSC_Cmd_TypeDef *c[3];
+  int i;
+
+  bot_init();
+  c[0] = submit(OPCODE_TEST_UNIT_READY, 0);
+  c[1] = submit(OPCODE_READ10, 512);
+  c[2] = submit(OPCODE_TEST_UNIT_READY, 0);
+  run();
+  CHECK(disk.cbws == 3);
+  for (i = 0; i < 3; i++)
+  {
+    CHECK(disk.tags[i] == USBH_MSC_BOT_CBW_TAG + i);
+    CHECK(c[i]->State == USBH_MSC_CMD_DONE && c[i]->Status == USBH_MSC_OK);
+  }
+}
+
+/* the CSW of the command before: a phase error, and so is what is queued */
+static void test_stale_tag(void)
+{
+  USBH_MSC_Cmd_TypeDef *c[3];
+
+  bot_init();
+  c[0] = submit(OPCODE_TEST_UNIT_READY, 0);
+  run();
+  c[1] = submit(OPCODE_READ10, 512);
+  c[2] = submit(OPCODE_TEST_UNIT_READY, 0);
+  disk.tag_delta = -1;
+  run();
+  CHECK(c[0]->Status == USBH_MSC_OK);
+  CHECK(c[1]->State == USBH_MSC_CMD_DONE && c[1]->Status == USBH_MSC_PHASE_ERROR);
+  CHECK(c[2]->State == USBH_MSC_CMD_DONE && c[2]->Status == USBH_MSC_PHASE_ERROR);
+  /* the third never went out */
+  CHECK(disk.cbws == 2);
+  CHECK(USBH_MSC_BOTXferParam.BOTXferStatus == USBH_MSC_PHASE_ERROR);
+
+  /* and a tag ahead of the command is no better */
+  bot_init();
+  c[0] = submit(OPCODE_TEST_UNIT_READY, 0);
+  disk.tag_delta = 1;
+  run();
+  CHECK(c[0]->Status == USBH_MSC_PHASE_ERROR);
+}
+
+/* the other conditions of a valid CSW, BOT 6.3.1 */
+static void test_csw_invalid(void)
+{
+  USBH_MSC_Cmd_TypeDef *c;
+
+  bot_init();
+  disk.signature = USBH_MSC_BOT_CBW_SIGNATURE;
+  c = submit(OPCODE_TEST_UNIT_READY, 0);
+  run();
+  CHECK(c->Status == USBH_MSC_PHASE_ERROR);
+
+  bot_init();
+  disk.csw_len = USBH_MSC_CSW_LENGTH + 1;
+  c = submit(OPCODE_TEST_UNIT_READY, 0);
+  run();
+  CHECK(c->Status == USBH_MSC_PHASE_ERROR);
+
+  bot_init();
+  disk.status[0] = USBH_MSC_PHASE_ERROR;
+  c = submit(OPCODE_TEST_UNIT_READY, 0);
+  run();
+  CHECK(c->Status == USBH_MSC_PHASE_ERROR);
+}
+
+/* a failed command fetches its sense under a tag of its own */
+static void test_auto_sense(void)
+{
+  USBH_MSC_Cmd_TypeDef *c[2];
+
+  bot_init();
+  disk.status[0] = USBH_MSC_FAIL;
+  c[0] = submit(OPCODE_TEST_UNIT_READY, 0);
+  c[1] = submit(OPCODE_TEST_UNIT_READY, 0);
+  run();
+  CHECK(disk.cbws == 3);
+  CHECK(disk.tags[1] == USBH_MSC_BOT_CBW_TAG + 2);
+  CHECK(disk.tags[2] == USBH_MSC_BOT_CBW_TAG + 1);
+  CHECK(c[0]->Status == USBH_MSC_FAIL);
+  CHECK(c[0]->SenseKey == 0x06 && c[0]->ASC == 0x28 && c[0]->ASCQ == 0x00);
+  CHECK(c[1]->Status == USBH_MSC_OK);
+
+  /* the sense answered with a stale tag fails the command as a phase error */
+  bot_init();
+  disk.status[0] = USBH_MSC_FAIL;
+  c[0] = submit(OPCODE_TEST_UNIT_READY, 0);
+  USBH_MSC_HandleBOTXfer(&core, &host);         /* CBW */
+  USBH_MSC_HandleBOTXfer(&core, &host);         /* sent */
+  USBH_MSC_HandleBOTXfer(&core, &host);         /* CSW asked */
+  USBH_MSC_HandleBOTXfer(&core, &host);         /* FAIL: REQUEST SENSE out */
+  disk.tag_delta = -1;
+  run();
+  CHECK(disk.cbws == 2);
+  CHECK(c[0]->Status == USBH_MSC_PHASE_ERROR);
+}
+
+int main(void)
+{
+  RUN(test_tag_per_cbw);
+  RUN(test_stale_tag);
+  RUN(test_csw_invalid);
+  RUN(test_auto_sense);
+  return TEST_RESULT();
+}
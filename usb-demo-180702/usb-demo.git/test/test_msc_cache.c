@@ -0,0 +1,331 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_cache.c
+  * @brief   Host tests of the MSC sector cache (usbh_msc_cache.c) over a
+  *          RAM disk standing in for the queued I/O layer
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usbh_msc_cache.h"
+
+#define SECTOR          USBH_MSC_PAGE_LENGTH
+#define DISK_SECTORS    256
+#define SETS            USBH_MSC_CACHE_SETS
+#define WAYS            USBH_MSC_CACHE_WAYS
+
+static USB_OTG_CORE_HANDLE core;
+static USBH_HOST host;
+
+static uint8_t disk[DISK_SECTORS][SECTOR];
+static int     fail_writes = 0;
+
+/* every transfer that reached the disk */
+typedef struct
+{
+  uint8_t   op;
+  uint32_t  sector;
+  uint32_t  count;
+} xfer_log_t;
+
+static xfer_log_t xfer_log[64];
+static int        xfer_num;
+
+uint8_t USBH_MSC_IO_Wait(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost,
+                         USBH_MSC_IO_Req_TypeDef *req)
+{
+  if (xfer_num < (int)(sizeof(xfer_log) / sizeof(xfer_log[0])))
+  {
+    xfer_log[xfer_num].op = req->op;
+    xfer_log[xfer_num].sector = req->sector;
+    xfer_log[xfer_num].count = req->count;
+  }
+  xfer_num++;
+
+  switch (req->op)
+  {
+  case USBH_MSC_IO_READ:
+    memcpy(req->buff, disk[req->sector], req->count * SECTOR);
+    break;
+  case USBH_MSC_IO_WRITE:
+    if (fail_writes > 0)
+    {
+      fail_writes--;
+      req->status = USBH_MSC_FAIL;
+      return USBH_MSC_FAIL;
+    }
+    memcpy(disk[req->sector], req->buff, req->count * SECTOR);
+    break;
+  default:
+    break;
+  }
+  req->status = USBH_MSC_OK;
+  return USBH_MSC_OK;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static USBH_MSC_Cache_Stats_TypeDef stats;
+
+static void setup(void)
+{
+  uint32_t i;
+
+  for (i = 0; i < DISK_SECTORS; i++)
+    memset(disk[i], (int)i, SECTOR);
+  fail_writes = 0;
+  xfer_num = 0;
+  USBH_MSC_Cache_Reset();
+  USBH_MSC_Cache_ClearStats();
+}
+
+static int is_filled(const uint8_t *p, uint8_t v, uint32_t len)
+{
+  uint32_t i;
+
+  for (i = 0; i < len; i++)
+    if (p[i] != v)
+      return 0;
+  return 1;
+}
+
+static uint8_t rd(uint8_t *buf, uint32_t sector, uint32_t count)
+{
+  return USBH_MSC_Cache_Read(&core, &host, buf, sector, count);
+}
+
+static uint8_t wr(const uint8_t *buf, uint32_t sector, uint32_t count)
+{
+  return USBH_MSC_Cache_Write(&core, &host, buf, sector, count);
+}
+
+static int writes_logged(void)
+{
+  int i, n = 0;
+
+  for (i = 0; i < xfer_num; i++)
+    if (xfer_log[i].op == USBH_MSC_IO_WRITE)
+      n++;
+  return n;
+}
+
+static void test_read_hit(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  CHECK(rd(buf, 7, 1) == USBH_MSC_OK);
+  CHECK(is_filled(buf, 7, SECTOR));
+  memset(buf, 0, SECTOR);
+  CHECK(rd(buf, 7, 1) == USBH_MSC_OK);
+  CHECK(is_filled(buf, 7, SECTOR));
+  CHECK(xfer_num == 1);
+  USBH_MSC_Cache_GetStats(&stats);
+  CHECK(stats.ReadMiss == 1 && stats.ReadHit == 1);
+}
+
+static void test_write_back(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  memset(buf, 0xAB, SECTOR);
+  CHECK(wr(buf, 9, 1) == USBH_MSC_OK);
+  CHECK(xfer_num == 0);
+  CHECK(is_filled(disk[9], 9, SECTOR));
+  memset(buf, 0, SECTOR);
+  CHECK(rd(buf, 9, 1) == USBH_MSC_OK);
+  CHECK(is_filled(buf, 0xAB, SECTOR));
+  CHECK(xfer_num == 0);
+
+  CHECK(USBH_MSC_Cache_Flush(&core, &host) == USBH_MSC_OK);
+  CHECK(is_filled(disk[9], 0xAB, SECTOR));
+  /* the line is clean now: a second flush writes nothing */
+  xfer_num = 0;
+  CHECK(USBH_MSC_Cache_Flush(&core, &host) == USBH_MSC_OK);
+  CHECK(writes_logged() == 0);
+}
+
+static void test_flush_order(void)
+{
+  static const uint32_t order[] = { 30, 3, 17, 12 };
+  uint8_t buf[SECTOR];
+  uint32_t i;
+  int w = 0;
+
+  setup();
+  for (i = 0; i < 4; i++)
+  {
+    memset(buf, 0x80 + (int)i, SECTOR);
+    CHECK(wr(buf, order[i], 1) == USBH_MSC_OK);
+  }
+  CHECK(USBH_MSC_Cache_Flush(&core, &host) == USBH_MSC_OK);
+  /* lowest sector first, then the transport is synced */
+  CHECK(xfer_num == 5);
+  for (i = 0; i + 1 < (uint32_t)xfer_num; i++)
+  {
+    CHECK(xfer_log[i].op == USBH_MSC_IO_WRITE);
+    if (i > 0)
+      CHECK(xfer_log[i].sector > xfer_log[i - 1].sector);
+    w++;
+  }
+  CHECK(w == 4);
+  CHECK(xfer_log[xfer_num - 1].op == USBH_MSC_IO_SYNC);
+}
+
+static void test_lru_evict(void)
+{
+  uint8_t buf[SECTOR];
+  uint32_t w;
+
+  setup();
+  /* fill one set with data sectors, the first one dirty */
+  memset(buf, 0xC1, SECTOR);
+  CHECK(wr(buf, 2 * SETS + 1, 1) == USBH_MSC_OK);
+  for (w = 1; w < WAYS; w++)
+    CHECK(rd(buf, (2 + w) * SETS + 1, 1) == USBH_MSC_OK);
+  xfer_num = 0;
+  /* one more in the same set: the oldest (dirty) line goes, written back */
+  CHECK(rd(buf, (2 + WAYS) * SETS + 1, 1) == USBH_MSC_OK);
+  CHECK(xfer_num == 2);
+  CHECK(xfer_log[0].op == USBH_MSC_IO_WRITE && xfer_log[0].sector == 2 * SETS + 1);
+  CHECK(is_filled(disk[2 * SETS + 1], 0xC1, SECTOR));
+  USBH_MSC_Cache_GetStats(&stats);
+  CHECK(stats.Evict == 1 && stats.WriteBack == 1);
+
+  /* the other lines are still there */
+  xfer_num = 0;
+  for (w = 1; w < WAYS; w++)
+    CHECK(rd(buf, (2 + w) * SETS + 1, 1) == USBH_MSC_OK);
+  CHECK(xfer_num == 0);
+}
+
+static void test_bypass(void)
+{
+  uint8_t big[(USBH_MSC_CACHE_BYPASS + 1) * SECTOR];
+  uint8_t buf[SECTOR];
+  uint32_t n = USBH_MSC_CACHE_BYPASS + 1;
+
+  setup();
+  /* a dirty line inside a long read is merged over the disk data */
+  memset(buf, 0xD1, SECTOR);
+  CHECK(wr(buf, 41, 1) == USBH_MSC_OK);
+  xfer_num = 0;
+  CHECK(rd(big, 40, n) == USBH_MSC_OK);
+  CHECK(xfer_num == 1 && xfer_log[0].count == n);
+  CHECK(is_filled(big, 40, SECTOR));
+  CHECK(is_filled(big + SECTOR, 0xD1, SECTOR));
+
+  /* a long write goes straight out and replaces the cached copy */
+  memset(big, 0xD2, sizeof(big));
+  xfer_num = 0;
+  CHECK(wr(big, 40, n) == USBH_MSC_OK);
+  CHECK(xfer_num == 1 && xfer_log[0].op == USBH_MSC_IO_WRITE);
+  CHECK(is_filled(disk[41], 0xD2, SECTOR));
+  CHECK(rd(buf, 41, 1) == USBH_MSC_OK);
+  CHECK(is_filled(buf, 0xD2, SECTOR));
+  /* nothing dirty is left to overwrite it */
+  xfer_num = 0;
+  CHECK(USBH_MSC_Cache_Flush(&core, &host) == USBH_MSC_OK);
+  CHECK(writes_logged() == 0);
+  CHECK(is_filled(disk[41], 0xD2, SECTOR));
+  USBH_MSC_Cache_GetStats(&stats);
+  CHECK(stats.Bypass == 2);
+}
+
+/* FAT16 boot sector: 1 reserved sector, 2 FATs of 2 sectors, 16 root entries */
+static void make_boot(void)
+{
+  uint8_t *b = disk[0];
+
+  memset(b, 0, SECTOR);
+  b[0] = 0xEB;
+  b[11] = SECTOR & 0xFF;
+  b[12] = SECTOR >> 8;
+  b[14] = 1;                    /* reserved sectors */
+  b[16] = 2;                    /* FATs */
+  b[17] = 16;                   /* root entries: one sector */
+  b[22] = 2;                    /* sectors per FAT */
+  b[510] = 0x55;
+  b[511] = 0xAA;
+}
+
+static void test_fat_quota(void)
+{
+  uint8_t buf[SECTOR];
+  uint32_t fat = 1, i;
+
+  setup();
+  make_boot();
+  CHECK(rd(buf, 0, 1) == USBH_MSC_OK);          /* layout learnt here */
+  CHECK(rd(buf, fat, 1) == USBH_MSC_OK);
+  /* stream data through the FAT sector's set */
+  for (i = 1; i <= 3 * WAYS; i++)
+    CHECK(rd(buf, fat + (8 + i) * SETS, 1) == USBH_MSC_OK);
+  xfer_num = 0;
+  CHECK(rd(buf, fat, 1) == USBH_MSC_OK);
+  CHECK(xfer_num == 0);
+  CHECK(is_filled(buf, (uint8_t)fat, SECTOR));
+}
+
+static void test_no_boot_plain_lru(void)
+{
+  uint8_t buf[SECTOR];
+  uint32_t i;
+
+  setup();
+  /* sector 0 is no boot sector: sector 1 is plain data */
+  CHECK(rd(buf, 0, 1) == USBH_MSC_OK);
+  CHECK(rd(buf, 1, 1) == USBH_MSC_OK);
+  for (i = 1; i <= WAYS; i++)
+    CHECK(rd(buf, 1 + (8 + i) * SETS, 1) == USBH_MSC_OK);
+  xfer_num = 0;
+  CHECK(rd(buf, 1, 1) == USBH_MSC_OK);
+  CHECK(xfer_num == 1);
+}
+
+static void test_flush_error(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  memset(buf, 0xE1, SECTOR);
+  CHECK(wr(buf, 4, 1) == USBH_MSC_OK);
+  CHECK(wr(buf, 5, 1) == USBH_MSC_OK);
+  fail_writes = 1;
+  CHECK(USBH_MSC_Cache_Flush(&core, &host) == USBH_MSC_FAIL);
+  /* the failed line is given up, the other one made it */
+  CHECK(is_filled(disk[5], 0xE1, SECTOR));
+  xfer_num = 0;
+  CHECK(USBH_MSC_Cache_Flush(&core, &host) == USBH_MSC_OK);
+  CHECK(writes_logged() == 0);
+}
+
+static void test_reset(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  memset(buf, 0xF1, SECTOR);
+  CHECK(wr(buf, 6, 1) == USBH_MSC_OK);
+  USBH_MSC_Cache_Reset();
+  xfer_num = 0;
+  CHECK(USBH_MSC_Cache_Flush(&core, &host) == USBH_MSC_OK);
+  CHECK(writes_logged() == 0);
+  CHECK(rd(buf, 6, 1) == USBH_MSC_OK);
+  CHECK(is_filled(buf, 6, SECTOR));
+}
+
+int main(void)
+{
+  RUN(test_read_hit);
+  RUN(test_write_back);
+  RUN(test_flush_order);
+  RUN(test_lru_evict);
+  RUN(test_bypass);
+  RUN(test_fat_quota);
+  RUN(test_no_boot_plain_lru);
+  RUN(test_flush_error);
+  RUN(test_reset);
+  return TEST_RESULT();
+}
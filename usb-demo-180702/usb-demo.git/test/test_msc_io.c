@@ -0,0 +1,380 @@
+/**
+  ******************************************************************************
+  * @file    test_msc_io.c
+  * @brief   Host tests of the queued MSC sector I/O (usbh_msc_io.c) over a
+  *          RAM disk that answers READ(10)/WRITE(10) after a few calls
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usbh_msc_io.h"
+
+#define SECTOR          USBH_MSC_PAGE_LENGTH
+#define DISK_SECTORS    64
+
+MassStorageParameter_TypeDef USBH_MSC_Param;
+USBH_BOTXfer_TypeDef USBH_MSC_BOTXferParam;
+
+static USB_OTG_CORE_HANDLE core;
+static USBH_HOST host;
+
+static uint8_t  disk[DISK_SECTORS][SECTOR];
+static uint32_t connected = 1;
+static int      latency = 2;        /* BUSY answers before a command ends */
+static int      fail_next = 0;      /* commands to fail in their CSW */
+
+/* the command on the fake BOT machine */
+static struct
+{
+  int       busy;
+  int       left;
+} bot;
+
+/* every command sent, retries included */
+typedef struct
+{
+  uint8_t   write;
+  uint32_t  lba;
+  uint32_t  count;
+} cmd_log_t;
+
+static cmd_log_t cmd_log[64];
+static int       cmd_num;
+
+static uint8_t disk_cmd(uint8_t write, uint8_t *buf, uint32_t lba, uint32_t len)
+{
+  if (!bot.busy)
+  {
+    bot.busy = 1;
+    bot.left = latency;
+    if (cmd_num < (int)(sizeof(cmd_log) / sizeof(cmd_log[0])))
+    {
+      cmd_log[cmd_num].write = write;
+      cmd_log[cmd_num].lba = lba;
+      cmd_log[cmd_num].count = len / SECTOR;
+    }
+    cmd_num++;
+  }
+  if (bot.left-- > 0)
+    return USBH_MSC_BUSY;
+  bot.busy = 0;
+  if (fail_next > 0)
+  {
+    fail_next--;
+    return USBH_MSC_FAIL;
+  }
+  if (lba + len / SECTOR > DISK_SECTORS)
+    return USBH_MSC_FAIL;
+  if (write)
+    memcpy(disk[lba], buf, len);
+  else
+    memcpy(buf, disk[lba], len);
+  return USBH_MSC_OK;
+}
+
+uint8_t USBH_MSC_Read10(USB_OTG_CORE_HANDLE *pdev, uint8_t *buf, uint32_t lba, uint32_t len)
+{
+  return disk_cmd(0, buf, lba, len);
+}
+
+uint8_t USBH_MSC_Write10(USB_OTG_CORE_HANDLE *pdev, uint8_t *buf, uint32_t lba, uint32_t len)
+{
+  return disk_cmd(1, buf, lba, len);
+}
+
+void USBH_MSC_HandleBOTXfer(USB_OTG_CORE_HANDLE *pdev, USBH_HOST *phost)
+{
+}
+
+uint32_t HCD_IsDeviceConnected(USB_OTG_CORE_HANDLE *pdev)
+{
+  return connected;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void setup(void)
+{
+  uint32_t i;
+
+  for (i = 0; i < DISK_SECTORS; i++)
+    memset(disk[i], (int)i, SECTOR);
+  USBH_MSC_Param.MSCapacity = DISK_SECTORS - 1;
+  connected = 1;
+  latency = 2;
+  fail_next = 0;
+  memset(&bot, 0, sizeof(bot));
+  cmd_num = 0;
+  USBH_MSC_IO_Reset();
+}
+
+static uint8_t io(uint8_t op, uint8_t *buff, uint32_t sector, uint32_t count)
+{
+  USBH_MSC_IO_Req_TypeDef req;
+
+  memset(&req, 0, sizeof(req));
+  req.op = op;
+  req.buff = buff;
+  req.sector = sector;
+  req.count = count;
+  return USBH_MSC_IO_Wait(&core, &host, &req);
+}
+
+static int is_filled(const uint8_t *p, uint8_t v, uint32_t len)
+{
+  uint32_t i;
+
+  for (i = 0; i < len; i++)
+    if (p[i] != v)
+      return 0;
+  return 1;
+}
+
+static void test_read_direct(void)
+{
+  uint8_t buf[3 * SECTOR];
+
+  setup();
+  /* not where the last read ended: no read-ahead */
+  CHECK(io(USBH_MSC_IO_READ, buf, 10, 3) == USBH_MSC_OK);
+  CHECK(is_filled(buf, 10, SECTOR) && is_filled(buf + 2 * SECTOR, 12, SECTOR));
+  CHECK(cmd_num == 1 && cmd_log[0].lba == 10 && cmd_log[0].count == 3);
+}
+
+static void test_read_ahead(void)
+{
+  uint8_t buf[SECTOR];
+  uint32_t s;
+
+  setup();
+  for (s = 0; s < USBH_MSC_IO_RA_SECTORS; s++)
+  {
+    CHECK(io(USBH_MSC_IO_READ, buf, s, 1) == USBH_MSC_OK);
+    CHECK(is_filled(buf, (uint8_t)s, SECTOR));
+  }
+  /* one window fetched, the rest served from memory */
+  CHECK(cmd_num == 1);
+  CHECK(cmd_log[0].lba == 0 && cmd_log[0].count == USBH_MSC_IO_RA_SECTORS);
+}
+
+static void test_read_ahead_clipped(void)
+{
+  uint8_t buf[SECTOR];
+  uint32_t last = DISK_SECTORS - 1;
+
+  setup();
+  CHECK(io(USBH_MSC_IO_READ, buf, last - 3, 1) == USBH_MSC_OK);
+  cmd_num = 0;
+  /* sequential from here, the window may not run past the last LBA */
+  CHECK(io(USBH_MSC_IO_READ, buf, last - 2, 1) == USBH_MSC_OK);
+  CHECK(cmd_num == 1 && cmd_log[0].lba + cmd_log[0].count == DISK_SECTORS);
+  CHECK(io(USBH_MSC_IO_READ, buf, last, 1) == USBH_MSC_OK);
+  CHECK(is_filled(buf, (uint8_t)last, SECTOR));
+  CHECK(cmd_num == 1);
+}
+
+static void test_write_behind_merge(void)
+{
+  uint8_t buf[SECTOR];
+  uint32_t s;
+
+  setup();
+  for (s = 20; s < 20 + USBH_MSC_IO_WB_SECTORS; s++)
+  {
+    memset(buf, 0xA0 + (int)s, SECTOR);
+    CHECK(io(USBH_MSC_IO_WRITE, buf, s, 1) == USBH_MSC_OK);
+  }
+  /* all buffered, nothing on the bus yet */
+  CHECK(cmd_num == 0);
+  CHECK(is_filled(disk[20], 20, SECTOR));
+
+  CHECK(io(USBH_MSC_IO_SYNC, NULL, 0, 0) == USBH_MSC_OK);
+  CHECK(cmd_num == 1);
+  CHECK(cmd_log[0].write && cmd_log[0].lba == 20 &&
+        cmd_log[0].count == USBH_MSC_IO_WB_SECTORS);
+  for (s = 20; s < 20 + USBH_MSC_IO_WB_SECTORS; s++)
+    CHECK(is_filled(disk[s], (uint8_t)(0xA0 + s), SECTOR));
+}
+
+static void test_write_behind_overwrite(void)
+{
+  uint8_t buf[2 * SECTOR];
+
+  setup();
+  memset(buf, 0x11, sizeof(buf));
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 30, 2) == USBH_MSC_OK);
+  memset(buf, 0x22, SECTOR);
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 31, 1) == USBH_MSC_OK);
+  CHECK(io(USBH_MSC_IO_SYNC, NULL, 0, 0) == USBH_MSC_OK);
+  CHECK(cmd_num == 1 && cmd_log[0].count == 2);
+  CHECK(is_filled(disk[30], 0x11, SECTOR));
+  CHECK(is_filled(disk[31], 0x22, SECTOR));
+}
+
+static void test_write_gap_flushes(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  memset(buf, 0x33, SECTOR);
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 5, 1) == USBH_MSC_OK);
+  /* not adjacent: the buffer goes out first */
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 40, 1) == USBH_MSC_OK);
+  CHECK(cmd_num == 1 && cmd_log[0].lba == 5);
+  CHECK(is_filled(disk[5], 0x33, SECTOR));
+  CHECK(is_filled(disk[40], 40, SECTOR));
+}
+
+static void test_read_sees_pending_write(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  memset(buf, 0x44, SECTOR);
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 12, 1) == USBH_MSC_OK);
+  memset(buf, 0, SECTOR);
+  CHECK(io(USBH_MSC_IO_READ, buf, 12, 1) == USBH_MSC_OK);
+  CHECK(is_filled(buf, 0x44, SECTOR));
+  CHECK(cmd_num == 2 && cmd_log[0].write && !cmd_log[1].write);
+}
+
+static void test_write_drops_read_ahead(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  CHECK(io(USBH_MSC_IO_READ, buf, 0, 1) == USBH_MSC_OK);
+  memset(buf, 0x55, SECTOR);
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 1, 1) == USBH_MSC_OK);
+  memset(buf, 0, SECTOR);
+  /* sector 1 was in the window: it must come from the write */
+  CHECK(io(USBH_MSC_IO_READ, buf, 1, 1) == USBH_MSC_OK);
+  CHECK(is_filled(buf, 0x55, SECTOR));
+}
+
+static void test_retry(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  fail_next = USBH_MSC_IO_RETRY - 1;
+  CHECK(io(USBH_MSC_IO_READ, buf, 50, 1) == USBH_MSC_OK);
+  CHECK(cmd_num == USBH_MSC_IO_RETRY);
+  CHECK(is_filled(buf, 50, SECTOR));
+
+  setup();
+  fail_next = USBH_MSC_IO_RETRY;
+  CHECK(io(USBH_MSC_IO_READ, buf, 50, 1) == USBH_MSC_FAIL);
+  CHECK(cmd_num == USBH_MSC_IO_RETRY);
+}
+
+static void test_flush_error(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  memset(buf, 0x66, SECTOR);
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 8, 1) == USBH_MSC_OK);
+  fail_next = USBH_MSC_IO_RETRY;
+  /* the flush forced by a far write fails behind the caller's back */
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 60, 1) == USBH_MSC_OK);
+  CHECK(USBH_MSC_IO_Error() == 1);
+  /* reported once by SYNC, then cleared */
+  CHECK(io(USBH_MSC_IO_SYNC, NULL, 0, 0) == USBH_MSC_FAIL);
+  CHECK(USBH_MSC_IO_Error() == 0);
+  CHECK(io(USBH_MSC_IO_SYNC, NULL, 0, 0) == USBH_MSC_OK);
+  CHECK(is_filled(disk[60], 0x66, SECTOR));
+}
+
+static int cb_order[4];
+static int cb_num;
+
+static void on_done(USBH_MSC_IO_Req_TypeDef *req)
+{
+  cb_order[cb_num++] = (int)(size_t)req->ctx;
+}
+
+static void test_queue_order(void)
+{
+  static uint8_t buf[4][SECTOR];
+  USBH_MSC_IO_Req_TypeDef req[4];
+  int i, spins = 0;
+
+  setup();
+  cb_num = 0;
+  memset(req, 0, sizeof(req));
+  for (i = 0; i < 4; i++)
+  {
+    req[i].op = (i == 2) ? USBH_MSC_IO_WRITE : USBH_MSC_IO_READ;
+    req[i].buff = buf[i];
+    req[i].sector = 40 + 4 * i;
+    req[i].count = 1;
+    req[i].cb = on_done;
+    req[i].ctx = (void *)(size_t)i;
+    CHECK(USBH_MSC_IO_Submit(&req[i]) == USBH_MSC_BUSY);
+  }
+  CHECK(!USBH_MSC_IO_Idle());
+  while (!USBH_MSC_IO_Idle() && spins++ < 1000)
+    USBH_MSC_IO_Process(&core, &host);
+  CHECK(cb_num == 4);
+  for (i = 0; i < 4; i++)
+  {
+    CHECK(cb_order[i] == i);
+    CHECK(req[i].status == USBH_MSC_OK);
+  }
+  CHECK(is_filled(buf[3], 52, SECTOR));
+}
+
+static void test_bad_request(void)
+{
+  USBH_MSC_IO_Req_TypeDef req;
+  uint8_t buf[SECTOR];
+
+  setup();
+  memset(&req, 0, sizeof(req));
+  req.op = USBH_MSC_IO_READ;
+  req.buff = buf;
+  req.count = 0;
+  CHECK(USBH_MSC_IO_Submit(&req) == USBH_MSC_FAIL);
+  CHECK(req.status == USBH_MSC_FAIL);
+  req.count = 1;
+  req.buff = NULL;
+  CHECK(USBH_MSC_IO_Submit(&req) == USBH_MSC_FAIL);
+  CHECK(USBH_MSC_IO_Idle());
+}
+
+static void test_disconnect(void)
+{
+  uint8_t buf[SECTOR];
+
+  setup();
+  memset(buf, 0x77, SECTOR);
+  CHECK(io(USBH_MSC_IO_WRITE, buf, 3, 1) == USBH_MSC_OK);
+  connected = 0;
+  CHECK(io(USBH_MSC_IO_SYNC, NULL, 0, 0) == USBH_MSC_FAIL);
+  CHECK(USBH_MSC_IO_Idle());
+  /* the buffered write went with the device */
+  connected = 1;
+  memset(&bot, 0, sizeof(bot));
+  cmd_num = 0;
+  CHECK(io(USBH_MSC_IO_SYNC, NULL, 0, 0) == USBH_MSC_OK);
+  CHECK(cmd_num == 0);
+}
+
+int main(void)
+{
+  RUN(test_read_direct);
+  RUN(test_read_ahead);
+  RUN(test_read_ahead_clipped);
+  RUN(test_write_behind_merge);
+  RUN(test_write_behind_overwrite);
+  RUN(test_write_gap_flushes);
+  RUN(test_read_sees_pending_write);
+  RUN(test_write_drops_read_ahead);
+  RUN(test_retry);
+  RUN(test_flush_error);
+  RUN(test_queue_order);
+  RUN(test_bad_request);
+  RUN(test_disconnect);
+  return TEST_RESULT();
+}
@@ -0,0 +1,238 @@
+/**
+  ******************************************************************************
+  * @file    test_otg_fifo.c
+  * @brief   Host tests of USB_OTG_WritePacket / USB_OTG_ReadPacket against
+  *          a model of the DFIFO window, where any address of the 4 KB
+  *          window pushes or pops the same FIFO: every length and buffer
+  *          alignment gives the FIFO words of the one-word-per-loop
+  *          reference, and a read stops at len. Built once per copy path.
+  *          Also times both paths into a plain memory window per alignment
+  *          and packet size (x86-64 Linux: the model single-steps accesses).
+  ******************************************************************************
+  */
+
+#include <signal.h>
+#include <time.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "test.h"
+#include "usb_core.c"
+
+/* ---- what usb_core.c links against ------------------------------------ */
+
+void USB_OTG_BSP_uDelay(const uint32_t usec) { }
+void USB_OTG_BSP_mDelay(const uint32_t msec) { }
+
+/* ---- the DFIFO window ---------------------------------------------------
+ * The window page is kept inaccessible. An access faults, the handler
+ * opens the page (a read first finds the head of the FIFO there) and
+ * single-steps the instruction; the trap then takes a written word into
+ * the FIFO and closes the page again.
+ */
+
+#define WIN_WORDS       1024
+#define EFL_TF          0x100
+
+static uint32_t *win;
+static uint32_t  fifo_q[4096];
+static __IO int  q_in, q_out;      /* moved by the handlers */
+static uint32_t *hit;
+static int       hit_write;
+
+static void on_segv(int sig, siginfo_t *si, void *ctx)
+{
+  ucontext_t *uc = ctx;
+
+  if ((uint32_t *)si->si_addr < win || (uint32_t *)si->si_addr >= win + WIN_WORDS)
+    abort();
+  hit = (uint32_t *)((uintptr_t)si->si_addr & ~(uintptr_t)3);
+  hit_write = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+  mprotect(win, WIN_WORDS * 4, PROT_READ | PROT_WRITE);
+  if (!hit_write)
+    *hit = fifo_q[q_out++];
+  uc->uc_mcontext.gregs[REG_EFL] |= EFL_TF;
+}
+
+static void on_trap(int sig, siginfo_t *si, void *ctx)
+{
+  ucontext_t *uc = ctx;
+
+  if (hit_write)
+    fifo_q[q_in++] = *hit;
+  mprotect(win, WIN_WORDS * 4, PROT_NONE);
+  uc->uc_mcontext.gregs[REG_EFL] &= ~EFL_TF;
+}
+
+static void win_init(void)
+{
+  struct sigaction sa;
+
+  win = mmap(NULL, WIN_WORDS * 4, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_flags = SA_SIGINFO;
+  sa.sa_sigaction = on_segv;
+  sigaction(SIGSEGV, &sa, NULL);
+  sa.sa_sigaction = on_trap;
+  sigaction(SIGTRAP, &sa, NULL);
+}
+
+static USB_OTG_CORE_HANDLE dev;
+
+static void dev_init(uint32_t *dfifo)
+{
+  int i;
+
+  memset(&dev, 0, sizeof(dev));
+  for (i = 0; i < USB_OTG_MAX_TX_FIFOS; i++)
+    dev.regs.DFIFO[i] = dfifo;
+}
+
+/* the FIFO words of len bytes: little endian, the last one padded */
+static int words_match(const uint32_t *w, const uint8_t *bytes, int len)
+{
+  int i;
+
+  for (i = 0; i < len; i++)
+    if ((uint8_t)(w[i / 4] >> (8 * (i % 4))) != bytes[i])
+      return 0;
+  return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static uint8_t  buf[1100] __attribute__((aligned(4)));
+
+static void test_write_packet(void)
+{
+  int len, off, i, bad = 0;
+
+  dev_init(win);
+  for (off = 0; off < 4; off++)
+    for (len = 0; len <= 1024; len++)
+    {
+      for (i = 0; i < len; i++)
+        buf[off + i] = (uint8_t)(len * 7 + i);
+      q_in = q_out = 0;
+      USB_OTG_WritePacket(&dev, buf + off, 1, len);
+      if (q_in != (len + 3) / 4 || !words_match(fifo_q, buf + off, len))
+      {
+        if (bad++ < 5)
+          printf("  write off %d len %d: %d words\n", off, len, q_in);
+      }
+    }
+  CHECK(bad == 0);
+}
+
+static void test_read_packet(void)
+{
+  int len, off, i, bad = 0;
+  uint8_t *end;
+
+  dev_init(win);
+  for (off = 0; off < 4; off++)
+    for (len = 0; len <= 1024; len++)
+    {
+      for (i = 0; i < 256; i++)
+        fifo_q[i] = 0x01010101u * (uint8_t)(len + i) + 0x00020406u;
+      q_in = q_out = 0;
+      memset(buf, 0xA5, sizeof(buf));
+      end = USB_OTG_ReadPacket(&dev, buf + off, len);
+      if (q_out != (len + 3) / 4 || !words_match(fifo_q, buf + off, len) ||
+          buf[off + len + 3] != 0xA5 || (off && buf[off - 1] != 0xA5))
+      {
+        bad++;
+      }
+#ifndef USB_OTG_FIFO_COPY_REF
+      /* the fast path stops at len, the reference rounds up to a word */
+      if (end != buf + off + len || buf[off + len] != 0xA5)
+        bad++;
+#else
+      if (end != buf + off + (len + 3) / 4 * 4)
+        bad++;
+#endif
+    }
+  CHECK(bad == 0);
+}
+
+/* ---- cost per byte into a memory window, both paths --------------------- */
+
+static void ref_write(__IO uint32_t *fifo, uint8_t *src, uint32_t len)
+{
+  uint32_t i, count32b = (len + 3) / 4;
+
+  for (i = 0; i < count32b; i++)
+  {
+    USB_OTG_WRITE_REG32(fifo, *((__packed uint32_t *)src));
+    src += 4;
+  }
+}
+
+static void ref_read(__IO uint32_t *fifo, uint8_t *dest, uint32_t len)
+{
+  uint32_t i, count32b = (len + 3) / 4;
+
+  for (i = 0; i < count32b; i++)
+  {
+    *(__packed uint32_t *)dest = USB_OTG_READ_REG32(fifo);
+    dest += 4;
+  }
+}
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define REPS    20000
+
+static void test_cost(void)
+{
+  static uint32_t mem[WIN_WORDS];
+  static const int sizes[] = { 8, 64, 512 };
+  double t0, ns[4], big[4] = { 0, 0, 0, 0 };
+  int s, off, r, len, i;
+
+  dev_init(mem);
+  printf("  ns/byte     write  ref   read  ref\n");
+  for (s = 0; s < 3; s++)
+    for (off = 0; off < 4; off++)
+    {
+      len = sizes[s];
+      t0 = now_ns();
+      for (r = 0; r < REPS; r++)
+        USB_OTG_WritePacket(&dev, buf + off, 1, len);
+      ns[0] = (now_ns() - t0) / REPS / len;
+      t0 = now_ns();
+      for (r = 0; r < REPS; r++)
+        ref_write(mem, buf + off, len);
+      ns[1] = (now_ns() - t0) / REPS / len;
+      t0 = now_ns();
+      for (r = 0; r < REPS; r++)
+        USB_OTG_ReadPacket(&dev, buf + off, len);
+      ns[2] = (now_ns() - t0) / REPS / len;
+      t0 = now_ns();
+      for (r = 0; r < REPS; r++)
+        ref_read(mem, buf + off, len);
+      ns[3] = (now_ns() - t0) / REPS / len;
+      printf("  %3d +%d    %5.2f %5.2f  %5.2f %5.2f\n",
+             len, off, ns[0], ns[1], ns[2], ns[3]);
+      for (i = 0; s == 2 && i < 4; i++)
+        big[i] += ns[i];
+    }
+#ifndef USB_OTG_FIFO_COPY_REF
+  /* the bursts pay off on full HS packets, at any alignment */
+  CHECK(big[0] < big[1] && big[2] < big[3]);
+#endif
+}
+
+int main(void)
+{
+  win_init();
+  RUN(test_write_packet);
+  RUN(test_read_packet);
+  RUN(test_cost);
+  return TEST_RESULT();
+}
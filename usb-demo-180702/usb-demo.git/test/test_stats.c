@@ -0,0 +1,225 @@
+/**
+  ******************************************************************************
+  * @file    test_stats.c
+  * @brief   Host tests of the report ring statistics (usbd_stats.h): the
+  *          counters, the latency histogram buckets and the cycle counter
+  *          wrapping, on the real ring. Built with USBD_HID_STATS, where
+  *          the cost per report is checked against a cycle budget, and
+  *          without, where the hooks must compile to nothing.
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usbd_fifo.h"
+#include "usbd_stats.h"
+
+/* ---- what usbd_stats.h links against ----------------------------------- */
+
+DWT_Type       DWT_Stub;
+CoreDebug_Type CoreDebug_Stub;
+
+uint32_t __CLZ(uint32_t value)
+{
+  return value ? __builtin_clz(value) : 32;
+}
+
+static USBD_FIFO_type  fifo;
+static USBD_STATS_type stats;
+
+static void reset(void)
+{
+  memset(&fifo, 0, sizeof(fifo));
+  memset(&stats, 0, sizeof(stats));
+  DWT->CYCCNT = 0;
+}
+
+/* the producer side of USBD_HID_SendReport: commit or drop */
+static int queue(u16 len)
+{
+  u8 *dat = USBD_FIFO_Reserve(&fifo);
+
+  if (dat == NULL)
+  {
+    USBD_STATS_DROP(&stats);
+    return 0;
+  }
+  memset(dat, len, len);
+  USBD_STATS_COMMIT(&stats, &fifo);
+  USBD_FIFO_Commit(&fifo, len);
+  return 1;
+}
+
+/* the consumer side of USBD_HID_DataIn: n reports went out */
+static void sent(u32 n)
+{
+  USBD_STATS_RELEASE(&stats, &fifo, n);
+  USBD_FIFO_ReleaseN(&fifo, n);
+}
+
+#ifdef USBD_HID_STATS
+
+/* the bucket a report that waited lat cycles is filed in */
+static int bucket_of(u32 lat)
+{
+  int b;
+
+  reset();
+  DWT->CYCCNT = 5000;
+  queue(8);
+  DWT->CYCCNT = 5000 + lat;
+  sent(1);
+  for (b = 0; b < USBD_STATS_HIST; b++)
+    if (stats.ep.Hist[b])
+      return b;
+  return -1;
+}
+
+static void test_buckets(void)
+{
+  int b;
+
+  CHECK(bucket_of(0) == 0);
+  CHECK(bucket_of((1 << USBD_STATS_HIST_SHIFT) - 1) == 0);
+  /* bucket b holds [2^(b+SHIFT-1), 2^(b+SHIFT)) */
+  for (b = 1; b < USBD_STATS_HIST - 1; b++)
+  {
+    CHECK(bucket_of(1u << (b + USBD_STATS_HIST_SHIFT - 1)) == b);
+    CHECK(bucket_of((1u << (b + USBD_STATS_HIST_SHIFT)) - 1) == b);
+  }
+  /* the last bucket takes everything longer */
+  CHECK(bucket_of(1u << (USBD_STATS_HIST + USBD_STATS_HIST_SHIFT - 2)) == USBD_STATS_HIST - 1);
+  CHECK(bucket_of(0xFFFFFFFFu) == USBD_STATS_HIST - 1);
+}
+
+static void test_counters(void)
+{
+  static const u32 at[5] = { 0, 100, 2000, 2100, 2900 };
+  int i, total = 0;
+
+  reset();
+  for (i = 0; i < 5; i++)
+  {
+    DWT->CYCCNT = at[i];
+    queue(10 + i);
+  }
+  CHECK(stats.ep.Queued == 5 && stats.ep.MaxDepth == 5);
+  DWT->CYCCNT = 3000;
+  sent(2);
+  CHECK(stats.ep.Sent == 2 && stats.ep.Bytes == 10 + 11);
+  CHECK(stats.ep.MaxLatency == 3000);
+  CHECK(stats.ep.Hist[2] == 2);
+  DWT->CYCCNT = 3100;
+  sent(3);
+  CHECK(stats.ep.Sent == 5 && stats.ep.Bytes == 10 + 11 + 12 + 13 + 14);
+  CHECK(stats.ep.MaxLatency == 3000);
+  /* each report of a batch waited from its own commit */
+  CHECK(stats.ep.Hist[0] == 2 && stats.ep.Hist[1] == 1 && stats.ep.Hist[2] == 2);
+  for (i = 0; i < USBD_STATS_HIST; i++)
+    total += stats.ep.Hist[i];
+  CHECK(total == 5);
+
+  /* a full ring drops, the depth stays at its size */
+  for (i = 0; i < USBD_FIFO_SIZE + 3; i++)
+    queue(1);
+  CHECK(stats.ep.Dropped == 3);
+  CHECK(stats.ep.Queued == 5 + USBD_FIFO_SIZE);
+  CHECK(stats.ep.MaxDepth == USBD_FIFO_SIZE);
+}
+
+static void test_cyccnt_wraps(void)
+{
+  reset();
+  DWT->CYCCNT = 0xFFFFFF00u;
+  queue(4);
+  DWT->CYCCNT = 0x100;
+  sent(1);
+  CHECK(stats.ep.MaxLatency == 0x200);
+  CHECK(stats.ep.Hist[0] == 1);
+}
+
+/* ---- cost per report, in TSC cycles of the host ------------------------- */
+
+#define REPS            200000
+#define ROUNDS          10          /* best of, against preemption */
+#define BUDGET_CYCLES   40          /* commit + release, per report */
+
+static uint64_t rdtsc(void)
+{
+  uint32_t lo, hi;
+
+  __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static void test_cost(void)
+{
+  uint64_t t0, t, bare = ~0ull, with = ~0ull;
+  u8 *dat;
+  int i, r;
+
+  for (r = 0; r < ROUNDS; r++)
+  {
+    reset();
+    t0 = rdtsc();
+    for (i = 0; i < REPS; i++)
+    {
+      dat = USBD_FIFO_Reserve(&fifo);
+      dat[0] = (u8)i;
+      USBD_FIFO_Commit(&fifo, 8);
+      USBD_FIFO_ReleaseN(&fifo, 1);
+    }
+    t = rdtsc() - t0;
+    bare = (t < bare) ? t : bare;
+
+    reset();
+    t0 = rdtsc();
+    for (i = 0; i < REPS; i++)
+    {
+      dat = USBD_FIFO_Reserve(&fifo);
+      dat[0] = (u8)i;
+      DWT->CYCCNT = i;
+      USBD_STATS_COMMIT(&stats, &fifo);
+      USBD_FIFO_Commit(&fifo, 8);
+      USBD_STATS_RELEASE(&stats, &fifo, 1);
+      USBD_FIFO_ReleaseN(&fifo, 1);
+    }
+    t = rdtsc() - t0;
+    with = (t < with) ? t : with;
+  }
+
+  printf("  ring %.1f, with statistics %.1f cycles per report (budget +%d)\n",
+         (double)bare / REPS, (double)with / REPS, BUDGET_CYCLES);
+  CHECK(stats.ep.Sent == REPS);
+  CHECK(with < bare + (uint64_t)BUDGET_CYCLES * REPS);
+}
+
+#else
+
+static void test_compiled_out(void)
+{
+  int i;
+
+  reset();
+  for (i = 0; i < USBD_FIFO_SIZE + 3; i++)
+    queue(8);
+  sent(USBD_FIFO_SIZE);
+  CHECK(USBD_FIFO_Used(&fifo) == 0);
+  /* the statistics are never touched */
+  CHECK(stats.ep.Queued == 0 && stats.ep.Dropped == 0 && stats.ep.Sent == 0);
+  CHECK(stats.stamp[0] == 0);
+}
+
+#endif
+
+int main(void)
+{
+#ifdef USBD_HID_STATS
+  RUN(test_buckets);
+  RUN(test_counters);
+  RUN(test_cyccnt_wraps);
+  RUN(test_cost);
+#else
+  RUN(test_compiled_out);
+#endif
+  return TEST_RESULT();
+}
@@ -0,0 +1,407 @@
+/**
+  ******************************************************************************
+  * @file    test_trace.c
+  * @brief   Host tests of the binary trace: records come out of
+  *          USBD_TRACE_Drain() in order, overwritten or torn ones are
+  *          counted as lost, writers on several threads never corrupt a
+  *          record, and trace_decode prints a memory dump of the ring as
+  *          the drain does. Also times a trace point against printf.
+  ******************************************************************************
+  */
+
+#include <stdarg.h>
+#include <time.h>
+#include "test.h"
+#include "usbd_trace.h"
+
+/* what the drain prints, instead of the UART */
+static char   out[1 << 16];
+static size_t out_len;
+
+static int out_printf(const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(out + out_len, sizeof(out) - out_len, fmt, ap);
+  va_end(ap);
+  out_len += n;
+  if (out_len >= sizeof(out))
+    out_len = sizeof(out) - 1;
+  return n;
+}
+
+/* the barriers of the drain are where a writer's interrupt can land */
+static void (*preempt)(void);
+static int preempt_at;
+
+static void dmb(void)
+{
+  void (*isr)(void) = preempt;
+
+  __sync_synchronize();
+  if (isr && preempt_at-- == 0)
+  {
+    preempt = NULL;
+    isr();
+  }
+}
+
+#undef __DMB
+#define __DMB()   dmb()
+#define printf out_printf
+#include "usbd_trace.c"
+#undef printf
+
+#define TRACE_DECODE_NO_MAIN
+#include "trace_decode.c"
+
+/* ---- what usbd_trace.c links against ------------------------------------ */
+
+DWT_Type       DWT_Stub;
+CoreDebug_Type CoreDebug_Stub;
+
+static int posted;
+
+void APP_EventPost(uint32_t evt) { __sync_fetch_and_or(&posted, evt); }
+
+/* the exclusive monitor of each thread: STREX fails once the word moved */
+static __thread uint32_t ldrex_val;
+
+uint32_t __LDREXW(uint32_t *addr)
+{
+  ldrex_val = __atomic_load_n(addr, __ATOMIC_SEQ_CST);
+  return ldrex_val;
+}
+
+uint32_t __STREXW(uint32_t value, uint32_t *addr)
+{
+  return !__sync_bool_compare_and_swap(addr, ldrex_val, value);
+}
+
+static void reset(void)
+{
+  memset(USBD_TRACE_Buf, 0, sizeof(USBD_TRACE_Buf));
+  USBD_TRACE_Wr = USBD_TRACE_Rd = USBD_TRACE_Lost = 0;
+  out_len = 0;
+  out[0] = 0;
+  posted = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void test_init(void)
+{
+  DWT->CYCCNT = 1234;
+  USBD_TRACE_Init();
+  CHECK(DWT->CYCCNT == 0);
+  CHECK(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk);
+  CHECK(CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk);
+}
+
+static void test_put_drain(void)
+{
+  reset();
+  DWT->CYCCNT = 100;
+  TRACE2(TRACE_HID_OUT, 1, 3);
+  DWT->CYCCNT = 250;
+  TRACE4(TRACE_HID_OUT_DATA, 0xA, 0xB, 0xC, 0xD);
+  DWT->CYCCNT = 4000000000u;
+  TRACE1(TRACE_VCP_RX_OVERRUN, 7);
+  CHECK(posted == APP_EVT_TRACE);
+  CHECK(out_len == 0);
+
+  USBD_TRACE_Drain();
+  CHECK(strcmp(out,
+        "[       100] USBD_HID_DataOut core=1 epnum=3 \n"
+        "[       250] DataOUT  buf[0]=a,buf[1]=b,buf[2]=c,buf[3]=d \n"
+        "[4000000000] VCP RX overrun, 7 so far \n") == 0);
+  CHECK(USBD_TRACE_Lost == 0);
+
+  /* drained records are not printed twice */
+  out_len = 0;
+  USBD_TRACE_Drain();
+  CHECK(out_len == 0);
+}
+
+static void test_overwritten(void)
+{
+  char *p;
+  int i;
+
+  reset();
+  for (i = 0; i < USBD_TRACE_SIZE + 6; i++)
+    TRACE1(TRACE_COM4_RX, i);
+  USBD_TRACE_Drain();
+  /* the oldest six were gone before the drain */
+  CHECK(USBD_TRACE_Lost == 6);
+  p = strstr(out, "data=");
+  CHECK(p && strncmp(p, "data=6 ", 7) == 0);
+  for (i = 0, p = out; (p = strchr(p, '\n')) != NULL; p++)
+    i++;
+  CHECK(i == USBD_TRACE_SIZE);
+}
+
+static void test_record_in_progress(void)
+{
+  reset();
+  TRACE0(TRACE_HID_STARTED);
+  TRACE0(TRACE_HID_SUSPEND);
+  /* a writer was preempted inside the second record */
+  USBD_TRACE_Buf[1].seq = 0;
+  USBD_TRACE_Drain();
+  CHECK(strstr(out, "started") && !strstr(out, "Suspend"));
+  CHECK(USBD_TRACE_Rd == 1);
+  /* and finishes it */
+  USBD_TRACE_Buf[1].seq = 2;
+  USBD_TRACE_Drain();
+  CHECK(strstr(out, "Suspend") && USBD_TRACE_Lost == 0);
+}
+
+static void test_unknown_id(void)
+{
+  reset();
+  DWT->CYCCNT = 5;
+  USBD_TRACE_Put(TRACE_ID_MAX, 1, 2, 3, 4);
+  TRACE0(TRACE_CDC_STARTED);
+  USBD_TRACE_Drain();
+  CHECK(strcmp(out, "[         5] > CDC Interface started.\n") == 0);
+  CHECK(USBD_TRACE_Rd == 2 && USBD_TRACE_Lost == 0);
+}
+
+/* ---- a writer preempting the drain ------------------------------------- */
+
+static void isr_write(void)
+{
+  TRACE1(TRACE_COM4_RX, 0xEE);
+}
+
+static void fill_unread(void)
+{
+  int i;
+
+  reset();
+  for (i = 0; i < USBD_TRACE_SIZE; i++)
+    TRACE1(TRACE_COM4_RX, i);
+}
+
+static int lines(void)
+{
+  char *p;
+  int n = 0;
+
+  for (p = out; p < out + out_len; p++)
+    n += (*p == '\n');
+  return n;
+}
+
+static void test_preempt_before_copy(void)
+{
+  char *p;
+
+  /* record 0 checked, then overwritten whole by record 64 before the copy */
+  fill_unread();
+  preempt = isr_write;
+  preempt_at = 0;
+  USBD_TRACE_Drain();
+  CHECK(USBD_TRACE_Lost == 1 && USBD_TRACE_Rd == USBD_TRACE_SIZE + 1);
+  CHECK(lines() == USBD_TRACE_SIZE);
+  CHECK(strncmp(strstr(out, "data="), "data=1 ", 7) == 0);
+  /* record 64 comes last, once */
+  p = strstr(out, "data=ee ");
+  CHECK(p && strchr(p, '\n') == out + out_len - 1 && !strstr(p + 1, "data=ee "));
+}
+
+static void test_preempt_during_copy(void)
+{
+  /* the copy of record 0 may be torn: it is dropped, not printed */
+  fill_unread();
+  preempt = isr_write;
+  preempt_at = 1;
+  USBD_TRACE_Drain();
+  CHECK(USBD_TRACE_Lost == 1 && USBD_TRACE_Rd == USBD_TRACE_SIZE + 1);
+  CHECK(lines() == USBD_TRACE_SIZE);
+  CHECK(strncmp(strstr(out, "data="), "data=1 ", 7) == 0);
+}
+
+/* ---- writers on two threads, the main loop draining -------------------- */
+
+#define WRITES  200000
+
+static __IO int writers_done;
+
+static void *writer(void *arg)
+{
+  u32 t = (u32)(uintptr_t)arg, i;
+  volatile int spin;
+
+  for (i = 1; i <= WRITES; i++)
+  {
+    TRACE4(TRACE_HID_OUT_DATA, t, i, ~i, t ^ i);
+    /* about the drain's pace, so that it races the writers */
+    for (spin = 0; spin < 300; spin++)
+      ;
+  }
+  __sync_fetch_and_add(&writers_done, 1);
+  return NULL;
+}
+
+static void test_concurrent_writers(void)
+{
+  pthread_t th[2];
+  u32 last[2] = { 0, 0 }, t, a, b, c, printed = 0, bad = 0;
+  char *p, *nl;
+  int i, done;
+
+  reset();
+  writers_done = 0;
+  for (i = 0; i < 2; i++)
+    pthread_create(&th[i], NULL, writer, (void *)(uintptr_t)i);
+  do
+  {
+    done = writers_done;
+    out_len = 0;
+    USBD_TRACE_Drain();
+    /* every record printed is whole and each writer's are in order */
+    for (p = out; p < out + out_len; p = nl + 1)
+    {
+      nl = strchr(p, '\n');
+      if (sscanf(p, "[%*u] DataOUT  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x",
+                 &t, &a, &b, &c) != 4 || t > 1 || b != ~a || c != (t ^ a) ||
+          a <= last[t])
+      {
+        bad++;
+      }
+      else
+      {
+        last[t] = a;
+      }
+      printed++;
+    }
+  } while (done < 2);
+  for (i = 0; i < 2; i++)
+    pthread_join(th[i], NULL);
+  out_len = 0;
+  USBD_TRACE_Drain();
+  for (p = out; p < out + out_len; p++)
+    printed += (*p == '\n');
+
+  printf("  %u printed, %u lost of %u\n", printed, USBD_TRACE_Lost, 2 * WRITES);
+  CHECK(bad == 0);
+  CHECK(printed + USBD_TRACE_Lost == 2 * WRITES);
+  CHECK(USBD_TRACE_Wr == 2 * WRITES);
+}
+
+/* ---- trace_decode on a dump of the ring --------------------------------- */
+
+static int decode_ring(char *text, size_t size, u32 hz)
+{
+  FILE *in, *txt;
+  int n;
+
+  in = tmpfile();
+  txt = tmpfile();
+  fwrite(USBD_TRACE_Buf, 1, sizeof(USBD_TRACE_Buf), in);
+  rewind(in);
+  n = trace_decode(in, txt, hz);
+  rewind(txt);
+  memset(text, 0, size);
+  fread(text, 1, size - 1, txt);
+  fclose(in);
+  fclose(txt);
+  return n;
+}
+
+static void test_decode_dump(void)
+{
+  static char text[sizeof(out)];
+  int i;
+
+  CHECK(sizeof(USBD_TRACE_rec) == TRACE_REC_BYTES);
+
+  /* the ring has wrapped: the dump starts in the middle */
+  reset();
+  for (i = 0; i < USBD_TRACE_SIZE + 10; i++)
+  {
+    DWT->CYCCNT = 1000 * i;
+    TRACE2(TRACE_HID_OUT, i & 1, i);
+  }
+  CHECK(decode_ring(text, sizeof(text), 0) == USBD_TRACE_SIZE);
+  USBD_TRACE_Drain();
+  CHECK(strcmp(text, out) == 0);
+
+  /* a record being written is left out, and the gap is shown */
+  USBD_TRACE_Buf[20].seq = 0;
+  CHECK(decode_ring(text, sizeof(text), 0) == USBD_TRACE_SIZE - 1);
+  CHECK(strstr(text, "[     19000] USBD_HID_DataOut core=1 epnum=19 \n"
+                     "-- 1 records lost --\n"
+                     "[     21000] ") != NULL);
+
+  /* in microseconds at 168 MHz */
+  reset();
+  DWT->CYCCNT = 168;
+  TRACE0(TRACE_HID_STARTED);
+  CHECK(decode_ring(text, sizeof(text), 168000000) == 1);
+  CHECK(strcmp(text, "[       1.0] > HID Interface started.\n") == 0);
+
+  /* a short dump */
+  {
+    FILE *in = tmpfile(), *txt = tmpfile();
+
+    fwrite(USBD_TRACE_Buf, 1, 10, in);
+    rewind(in);
+    CHECK(trace_decode(in, txt, 0) == -1);
+    fclose(in);
+    fclose(txt);
+  }
+}
+
+/* ---- cost of a trace point against formatting in place ------------------ */
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void test_cost(void)
+{
+  static char line[128];
+  volatile int sink = 0;
+  double t0, put, fmt;
+  int i, n = 1000000;
+
+  reset();
+  t0 = now_ns();
+  for (i = 0; i < n; i++)
+    TRACE4(TRACE_HID_OUT_DATA, i, i + 1, i + 2, i + 3);
+  put = (now_ns() - t0) / n;
+
+  /* what the ISR did before, short of waiting for the UART */
+  t0 = now_ns();
+  for (i = 0; i < n; i++)
+    sink += snprintf(line, sizeof(line), "DataOUT  buf[0]=%x,buf[1]=%x,buf[2]=%x,buf[3]=%x \n",
+                     i, i + 1, i + 2, i + 3);
+  fmt = (now_ns() - t0) / n;
+
+  printf("  trace point %.1f ns, snprintf %.1f ns\n", put, fmt);
+  CHECK(put < fmt);
+}
+
+int main(void)
+{
+  RUN(test_init);
+  RUN(test_put_drain);
+  RUN(test_overwritten);
+  RUN(test_record_in_progress);
+  RUN(test_unknown_id);
+  RUN(test_preempt_before_copy);
+  RUN(test_preempt_during_copy);
+  RUN(test_concurrent_writers);
+  RUN(test_decode_dump);
+  RUN(test_cost);
+  return TEST_RESULT();
+}
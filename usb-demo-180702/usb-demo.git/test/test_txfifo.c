@@ -0,0 +1,267 @@
+/**
+  ******************************************************************************
+  * @file    test_txfifo.c
+  * @brief   Host tests of the Tx FIFO layout computed from a configuration
+  *          descriptor (USBD_CalcTxFifos) and of USBD_SetCfg refusing a
+  *          configuration that does not fit
+  ******************************************************************************
+  */
+
+#include "test.h"
+#include "usbd_core.h"
+#include "usbd_req.h"
+#include "usbd_ioreq.h"
+#include "usbd_hostos.h"
+#include "usb_dcd.h"
+#include "usb_bsp.h"
+
+#define FS_FIFOS        4
+#define HS_FIFOS        6
+
+/* ---- what usbd_core.c links against ----------------------------------- */
+
+static uint32_t fifo_space;
+static uint16_t fifo_set[USB_OTG_MAX_TX_FIFOS];
+static int      fifo_set_num;
+
+uint32_t USB_OTG_GetTxFifoSpace(USB_OTG_CORE_HANDLE *pdev) { return fifo_space; }
+
+USB_OTG_STS USB_OTG_SetTxFifos(USB_OTG_CORE_HANDLE *pdev, const uint16_t *depth)
+{
+  memcpy(fifo_set, depth, sizeof(fifo_set));
+  fifo_set_num++;
+  return USB_OTG_OK;
+}
+
+void DCD_Init(USB_OTG_CORE_HANDLE *pdev, USB_OTG_CORE_ID_TypeDef coreID) { }
+uint32_t DCD_EP_Open(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type) { return 0; }
+uint32_t DCD_EP_PrepareRx(USB_OTG_CORE_HANDLE *pdev, uint8_t ep_addr, uint8_t *pbuf, uint16_t buf_len) { return 0; }
+uint32_t DCD_EP_Stall(USB_OTG_CORE_HANDLE *pdev, uint8_t epnum) { return 0; }
+USBD_Status USBD_CtlContinueRx(USB_OTG_CORE_HANDLE *pdev, uint8_t *pbuf, uint16_t len) { return USBD_OK; }
+USBD_Status USBD_CtlContinueSendData(USB_OTG_CORE_HANDLE *pdev, uint8_t *pbuf, uint16_t len) { return USBD_OK; }
+USBD_Status USBD_CtlReceiveStatus(USB_OTG_CORE_HANDLE *pdev) { return USBD_OK; }
+USBD_Status USBD_CtlSendStatus(USB_OTG_CORE_HANDLE *pdev) { return USBD_OK; }
+void USBD_DescCacheFlush(USB_OTG_CORE_HANDLE *pdev) { }
+void USBD_HostOS_BusReset(USB_OTG_CORE_HANDLE *pdev) { }
+void USBD_HostOS_Reset(USB_OTG_CORE_HANDLE *pdev) { }
+void USBD_ParseSetupRequest(USB_OTG_CORE_HANDLE *pdev, USB_SETUP_REQ *req) { }
+USBD_Status USBD_StdDevReq(USB_OTG_CORE_HANDLE *pdev, USB_SETUP_REQ *req) { return USBD_OK; }
+USBD_Status USBD_StdEPReq(USB_OTG_CORE_HANDLE *pdev, USB_SETUP_REQ *req) { return USBD_OK; }
+USBD_Status USBD_StdItfReq(USB_OTG_CORE_HANDLE *pdev, USB_SETUP_REQ *req) { return USBD_OK; }
+void USB_OTG_BSP_EnableInterrupt(USB_OTG_CORE_HANDLE *pdev) { }
+void USB_OTG_BSP_Init(USB_OTG_CORE_HANDLE *pdev) { }
+
+/* ---- configuration descriptor builder --------------------------------- */
+
+static uint8_t  cfg[256];
+static uint16_t cfg_len;
+
+static void cfg_begin(void)
+{
+  static const uint8_t head[] = { 9, USB_DESC_TYPE_CONFIGURATION, 0, 0, 1, 1, 0, 0x80, 50,
+                                  9, USB_DESC_TYPE_INTERFACE, 0, 0, 2, 3, 0, 0, 0 };
+
+  memcpy(cfg, head, sizeof(head));
+  cfg_len = sizeof(head);
+}
+
+/* bmAttributes: 1 iso, 2 bulk, 3 interrupt */
+static void cfg_ep(uint8_t addr, uint8_t attr, uint16_t mps, uint8_t interval)
+{
+  uint8_t *p = &cfg[cfg_len];
+
+  p[0] = 7;
+  p[1] = USB_DESC_TYPE_ENDPOINT;
+  p[2] = addr;
+  p[3] = attr;
+  p[4] = mps & 0xFF;
+  p[5] = mps >> 8;
+  p[6] = interval;
+  cfg_len += 7;
+  cfg[2] = cfg_len & 0xFF;
+  cfg[3] = cfg_len >> 8;
+}
+
+static uint16_t depth[USB_OTG_MAX_TX_FIFOS];
+
+static USBD_Status calc(uint8_t speed, uint8_t fifos, uint32_t space)
+{
+  memset(depth, 0xA5, sizeof(depth));
+  return USBD_CalcTxFifos(cfg, cfg_len, speed, fifos, space, depth);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void test_fs_hid(void)
+{
+  /* one IN, one OUT interrupt endpoint polled every frame */
+  cfg_begin();
+  cfg_ep(0x81, 3, 64, 1);
+  cfg_ep(0x01, 3, 64, 1);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 192) == USBD_OK);
+  CHECK(depth[0] == 0);
+  CHECK(depth[1] == 32);                  /* 16 words, doubled */
+  CHECK(depth[2] == 0 && depth[3] == 0);
+}
+
+static void test_slow_interrupt_single(void)
+{
+  /* interrupt every 10 ms: one packet is enough */
+  cfg_begin();
+  cfg_ep(0x81, 3, 64, 10);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 192) == USBD_OK);
+  CHECK(depth[1] == 16);
+  /* at HS bInterval is 2^(n-1) microframes: 4 is every microframe x 8 */
+  cfg_begin();
+  cfg_ep(0x81, 3, 64, 4);
+  cfg_ep(0x82, 3, 64, 5);
+  CHECK(calc(USB_OTG_SPEED_HIGH, HS_FIFOS, 1000) == USBD_OK);
+  CHECK(depth[1] == 32 && depth[2] == 16);
+}
+
+static void test_minimum_and_gaps(void)
+{
+  /* a small packet still takes 16 words; FIFOs below a used one too */
+  cfg_begin();
+  cfg_ep(0x83, 3, 8, 10);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 192) == USBD_OK);
+  CHECK(depth[1] == 16 && depth[2] == 16 && depth[3] == 16);
+}
+
+static void test_hs_high_bandwidth(void)
+{
+  /* 1024 bytes x 3 transactions per microframe */
+  cfg_begin();
+  cfg_ep(0x81, 3, 1024 | (2 << 11), 1);
+  CHECK(calc(USB_OTG_SPEED_HIGH, HS_FIFOS, 1000) == USBD_OK);
+  CHECK(depth[1] == 768);                 /* no room to double */
+  /* the same field at FS is just the packet size */
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 1000) == USBD_OK);
+  CHECK(depth[1] == 512);
+  /* and it does not fit in less */
+  CHECK(calc(USB_OTG_SPEED_HIGH, HS_FIFOS, 767) == USBD_FAIL);
+}
+
+static void test_hs_device_split(void)
+{
+  /* what the HS Rx and EP0 FIFOs of app/inc/usb_conf.h leave */
+  uint32_t space = USB_OTG_HS_TOTAL_FIFO_SIZE - USB_OTG_DMA_FIFO_RESERVED -
+                   RX_FIFO_HS_SIZE - TX0_FIFO_HS_SIZE;
+
+  /* the HID interfaces, EP3 batched at 1024 x 3 */
+  cfg_begin();
+  cfg_ep(0x81, 3, 64, 1);
+  cfg_ep(0x82, 3, 64, 1);
+  cfg_ep(0x83, 3, 1024 | (2 << 11), 1);
+  CHECK(calc(USB_OTG_SPEED_HIGH, HS_FIFOS, space) == USBD_OK);
+  CHECK(depth[3] == 768);
+  /* and the CDC pipes of the composite device behind them */
+  cfg_ep(0x84, 2, 64, 0);
+  cfg_ep(0x85, 3, 8, 8);
+  CHECK(calc(USB_OTG_SPEED_HIGH, HS_FIFOS, space) == USBD_OK);
+  CHECK(depth[3] == 768 && depth[4] >= 16 && depth[5] == 16);
+}
+
+static void test_alternate_settings_max(void)
+{
+  cfg_begin();
+  cfg_ep(0x81, 1, 128, 1);
+  cfg_ep(0x81, 1, 512, 1);
+  cfg_ep(0x81, 1, 256, 1);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 1000) == USBD_OK);
+  CHECK(depth[1] == 256);
+}
+
+static void test_doubling_from_ep1(void)
+{
+  /* three bulk endpoints, room for one packet each and one spare */
+  cfg_begin();
+  cfg_ep(0x81, 2, 64, 0);
+  cfg_ep(0x82, 2, 64, 0);
+  cfg_ep(0x83, 2, 64, 0);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 64) == USBD_OK);
+  CHECK(depth[1] == 32 && depth[2] == 16 && depth[3] == 16);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 96) == USBD_OK);
+  CHECK(depth[1] == 32 && depth[2] == 32 && depth[3] == 32);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 47) == USBD_FAIL);
+}
+
+static void test_ep_beyond_core(void)
+{
+  /* the FS core has Tx FIFOs 0..3 only */
+  cfg_begin();
+  cfg_ep(0x84, 3, 64, 1);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 1000) == USBD_FAIL);
+  CHECK(calc(USB_OTG_SPEED_HIGH, HS_FIFOS, 1000) == USBD_OK);
+  cfg_begin();
+  cfg_ep(0x86, 3, 64, 1);
+  CHECK(calc(USB_OTG_SPEED_HIGH, HS_FIFOS, 1000) == USBD_FAIL);
+  /* an IN EP0 in a configuration is bogus */
+  cfg_begin();
+  cfg_ep(0x80, 3, 64, 1);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 1000) == USBD_FAIL);
+}
+
+static void test_truncated(void)
+{
+  /* an endpoint cut off by wTotalLength is not looked at */
+  cfg_begin();
+  cfg_ep(0x81, 3, 64, 10);
+  cfg_ep(0x82, 3, 64, 10);
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 192) == USBD_OK);
+  CHECK(depth[2] == 16);
+  cfg_len -= 3;
+  CHECK(calc(USB_OTG_SPEED_FULL, FS_FIFOS, 192) == USBD_OK);
+  CHECK(depth[1] == 16 && depth[2] == 0);
+}
+
+/* ---- USBD_SetCfg ------------------------------------------------------- */
+
+static int class_init;
+static int configured;
+
+static uint8_t fake_init(void *pdev, uint8_t cfgidx) { class_init++; return USBD_OK; }
+static uint8_t *fake_cfg(uint8_t speed, uint16_t *length) { *length = cfg_len; return cfg; }
+static void fake_configured(void) { configured++; }
+
+static USBD_Class_cb_TypeDef fake_class = { .Init = fake_init, .GetConfigDescriptor = fake_cfg };
+static USBD_Usr_cb_TypeDef fake_usr = { .DeviceConfigured = fake_configured };
+
+static void test_setcfg(void)
+{
+  USB_OTG_CORE_HANDLE dev;
+
+  memset(&dev, 0, sizeof(dev));
+  dev.cfg.speed = USB_OTG_SPEED_FULL;
+  dev.cfg.dev_endpoints = FS_FIFOS;
+  dev.dev.class_cb = &fake_class;
+  dev.dev.usr_cb = &fake_usr;
+  fifo_space = 192;
+  class_init = configured = fifo_set_num = 0;
+
+  cfg_begin();
+  cfg_ep(0x81, 3, 64, 1);
+  CHECK(USBD_SetCfg(&dev, 1) == USBD_OK);
+  CHECK(fifo_set_num == 1 && fifo_set[1] == 32);
+  CHECK(class_init == 1 && configured == 1);
+
+  /* EP4 has no FIFO on this core: nothing is programmed or started */
+  cfg_ep(0x84, 3, 64, 1);
+  CHECK(USBD_SetCfg(&dev, 1) == USBD_FAIL);
+  CHECK(fifo_set_num == 1 && class_init == 1 && configured == 1);
+}
+
+int main(void)
+{
+  RUN(test_fs_hid);
+  RUN(test_slow_interrupt_single);
+  RUN(test_minimum_and_gaps);
+  RUN(test_hs_high_bandwidth);
+  RUN(test_hs_device_split);
+  RUN(test_alternate_settings_max);
+  RUN(test_doubling_from_ep1);
+  RUN(test_ep_beyond_core);
+  RUN(test_truncated);
+  RUN(test_setcfg);
+  return TEST_RESULT();
+}
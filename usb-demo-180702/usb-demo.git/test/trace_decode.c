@@ -0,0 +1,129 @@
+/**
+  ******************************************************************************
+  * @file    trace_decode.c
+  * @brief   Host decoder of a USBD_TRACE_Buf memory dump, for a trace the
+  *          target could not drain (stopped in the debugger, hung main
+  *          loop). The records are printed oldest first, as
+  *          USBD_TRACE_Drain() prints them, from the same format table.
+  *
+  *          (gdb) dump binary memory trace.bin &USBD_TRACE_Buf[0] &USBD_TRACE_Buf[64]
+  *          $ test/build/trace_decode [-c cpu_hz] trace.bin
+  *
+  *          -c prints the time stamps in microseconds instead of cycles.
+  ******************************************************************************
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usbd_trace.h"
+
+#define X(id, fmt)  fmt,
+static const char * const trace_fmt[TRACE_ID_MAX] = {
+    USBD_TRACE_LIST
+};
+#undef X
+
+/* one record as the target stores it: seq, ts, id, arg[4], little endian */
+#define TRACE_REC_WORDS     7
+#define TRACE_REC_BYTES     (TRACE_REC_WORDS * 4)
+
+typedef struct
+{
+  u32  seq;
+  u32  ts;
+  u32  id;
+  u32  arg[4];
+} trace_rec_t;
+
+static u32 get32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static int seq_cmp(const void *a, const void *b)
+{
+  u32 x = ((const trace_rec_t *)a)->seq, y = ((const trace_rec_t *)b)->seq;
+
+  /* seq runs freely: order by distance, not value */
+  return ((int32_t)(x - y) > 0) - ((int32_t)(x - y) < 0);
+}
+
+/**
+  * @brief  Decode a dump of the record ring
+  * @param  in: USBD_TRACE_SIZE records
+  * @param  out: text, one line per record
+  * @param  hz: CPU clock for the time stamps, 0 to print cycles
+  * @retval records printed, -1 if the dump is short
+  */
+int trace_decode(FILE *in, FILE *out, u32 hz)
+{
+  unsigned char raw[USBD_TRACE_SIZE * TRACE_REC_BYTES];
+  trace_rec_t rec[USBD_TRACE_SIZE];
+  int i, j, n = 0;
+
+  if (fread(raw, 1, sizeof(raw), in) != sizeof(raw))
+    return -1;
+  for (i = 0; i < USBD_TRACE_SIZE; i++)
+  {
+    /* 0: never written, or a writer was interrupted in it */
+    if ((rec[n].seq = get32(&raw[i * TRACE_REC_BYTES])) == 0)
+      continue;
+    rec[n].ts = get32(&raw[i * TRACE_REC_BYTES + 4]);
+    rec[n].id = get32(&raw[i * TRACE_REC_BYTES + 8]);
+    for (j = 0; j < 4; j++)
+      rec[n].arg[j] = get32(&raw[i * TRACE_REC_BYTES + 12 + j * 4]);
+    n++;
+  }
+  qsort(rec, n, sizeof(rec[0]), seq_cmp);
+
+  for (i = 0; i < n; i++)
+  {
+    if (i && rec[i].seq != rec[i - 1].seq + 1)
+      fprintf(out, "-- %u records lost --\n", rec[i].seq - rec[i - 1].seq - 1);
+    if (hz)
+      fprintf(out, "[%10.1f] ", rec[i].ts * 1e6 / hz);
+    else
+      fprintf(out, "[%10u] ", rec[i].ts);
+    if (rec[i].id < TRACE_ID_MAX)
+      fprintf(out, trace_fmt[rec[i].id], rec[i].arg[0], rec[i].arg[1], rec[i].arg[2], rec[i].arg[3]);
+    else
+      fprintf(out, "unknown id %u: %x %x %x %x\n", rec[i].id,
+              rec[i].arg[0], rec[i].arg[1], rec[i].arg[2], rec[i].arg[3]);
+  }
+  return n;
+}
+
+#ifndef TRACE_DECODE_NO_MAIN
+int main(int argc, char **argv)
+{
+  FILE *in;
+  u32 hz = 0;
+  int n;
+
+  if (argc == 4 && strcmp(argv[1], "-c") == 0)
+  {
+    hz = strtoul(argv[2], NULL, 0);
+    argv += 2;
+    argc -= 2;
+  }
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s [-c cpu_hz] dump.bin\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if ((in = fopen(argv[1], "rb")) == NULL)
+  {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  n = trace_decode(in, stdout, hz);
+  fclose(in);
+  if (n < 0)
+  {
+    fprintf(stderr, "%s: not a dump of %d trace records\n", argv[1], USBD_TRACE_SIZE);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+#endif